@@ -0,0 +1,1140 @@
+/**
+ * @file tr31_bench.c
+ * @brief Benchmarks for TR-31 library
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+#include "tr31_crypto.h"
+#include "tr31_serialize.h"
+#include "tr31_strings.h"
+
+#include "crypto_aes.h"
+#include "crypto_tdes.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_MIN_TIME_DEFAULT (0.5) // seconds per benchmark
+#define BENCH_MIN_SAMPLE_NS (2000) // minimum duration of a timed batch
+#define BENCH_MAX_BATCH (1 << 20) // maximum operations per timed batch
+#define BENCH_MAX_SAMPLES (200000) // maximum timed batches per benchmark
+#define BENCH_MAX_OPT_BLOCKS (20)
+#define BENCH_MAX_MSG_LEN (128) // larger than typical key block header and payload
+#define BENCH_PERF_COUNTERS (4) // see bench_perf_events
+#define BENCH_TRACE_SUB_BUCKET_BITS (3) // histogram precision of 1/8th of each power of two
+#define BENCH_TRACE_BUCKETS (64 << BENCH_TRACE_SUB_BUCKET_BITS)
+
+#ifndef TR31_BENCH_CRYPTO_BACKEND
+#define TR31_BENCH_CRYPTO_BACKEND "unknown"
+#endif
+
+typedef int (*bench_func_t)(void* ctx);
+
+// benchmark state
+struct bench_t {
+	double min_time;
+	const char* filter;
+	FILE* json;
+	size_t count;
+	double* samples;
+	bool failed;
+	bool perf;
+	int perf_fd[BENCH_PERF_COUNTERS];
+	struct bench_trace_stage_t* trace;
+};
+
+// per-stage latency histogram populated by the trace hook
+struct bench_trace_stage_t {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t buckets[BENCH_TRACE_BUCKETS];
+};
+
+// key block import/export benchmark context
+struct bench_key_block_t {
+	const struct tr31_key_t* kbpk;
+	char key_block[2048];
+	size_t key_block_len;
+	struct tr31_ctx_t ctx;
+	char buf[2048];
+};
+
+// KBPK derivation benchmark context
+struct bench_kbpk_t {
+	const uint8_t* kbpk;
+	size_t kbpk_len;
+	uint8_t kbek[32];
+	uint8_t kbak[32];
+};
+
+// crypto primitive benchmark context
+struct bench_crypto_t {
+	const uint8_t* key;
+	size_t key_len;
+	enum tr31_aes_mode_t mode;
+	size_t msg_len;
+	uint8_t msg[BENCH_MAX_MSG_LEN];
+	uint8_t out[BENCH_MAX_MSG_LEN];
+	uint8_t iv[16];
+	uint8_t cmac[16];
+	uint8_t kbek[32];
+	uint8_t kbak[32];
+};
+
+// TR-31:2018, A.7.3.2 KBPK
+static const uint8_t bench_kbpk_tdes_data[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+// TR-31:2018, A.7.4 KBPK
+static const uint8_t bench_kbpk_aes_data[] = {
+	0x88, 0xE1, 0xAB, 0x2A, 0x2E, 0x3D, 0xD3, 0x8C, 0x1F, 0xA0, 0x39, 0xA5, 0x36, 0x50, 0x0C, 0xC8,
+	0xA8, 0x7A, 0xB9, 0xD6, 0x2D, 0xC9, 0x2C, 0x01, 0x05, 0x8F, 0xA7, 0x9F, 0x44, 0x65, 0x7D, 0xE6,
+};
+// arbitrary triple length TDES KBPK
+static const uint8_t bench_kbpk_tdes3_data[] = {
+	0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B,
+	0x89, 0xE8, 0x8C, 0xF7, 0x93, 0x14, 0x44, 0xF3,
+};
+static const uint8_t bench_key_data[] = { 0xBF, 0x82, 0xDA, 0xC6, 0xA3, 0x3D, 0xF9, 0x2C, 0xE6, 0x6E, 0x15, 0xB7, 0x0E, 0x5D, 0xCE, 0xB6 };
+static const uint8_t bench_iksn[] = { 0xFF, 0xFF, 0x00, 0xA0, 0x20, 0x00, 0x01, 0xE0, 0x00, 0x00 };
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+// hardware performance counters
+static const struct {
+	const char* name;
+	uint32_t type;
+	uint64_t config;
+} bench_perf_events[BENCH_PERF_COUNTERS] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{
+		"l1d_misses",
+		PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1D |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+	},
+};
+#endif
+
+// names of key block processing stages reported by the trace hook
+static const char* bench_trace_stage_names[TR31_TRACE_STAGE_COUNT] = {
+	"import",
+	"export",
+	"parse",
+	"encode",
+	"kbpk-derive",
+	"decrypt",
+	"encrypt",
+	"mac-verify",
+	"mac-generate",
+	"kcv",
+};
+
+// helper functions
+static bool bench_perf_open(struct bench_t* bench);
+static void bench_perf_close(struct bench_t* bench);
+static void bench_perf_start(struct bench_t* bench);
+static void bench_perf_stop(struct bench_t* bench, double* counts);
+static void bench_trace_hook(void* ctx, enum tr31_trace_stage_t stage, uint64_t start_ns, uint64_t end_ns);
+static size_t bench_trace_bucket(uint64_t ns);
+static double bench_trace_percentile(const struct bench_trace_stage_t* stage, double p);
+static void bench_trace_report(struct bench_t* bench);
+static uint64_t bench_now(void);
+static int bench_compare_double(const void* a, const void* b);
+static double bench_percentile(const double* sorted, size_t count, double p);
+static void bench_run(struct bench_t* bench, const char* name, bench_func_t func, void* ctx);
+static int bench_key_block_setup(
+	struct bench_key_block_t* kb,
+	const struct tr31_key_t* kbpk,
+	uint8_t version,
+	unsigned int opt_blocks_count
+);
+static int bench_crypto_setup(
+	struct bench_crypto_t* crypto,
+	const uint8_t* key,
+	size_t key_len,
+	size_t msg_len
+);
+static void bench_run_crypto(struct bench_t* bench);
+
+static bool bench_perf_open(struct bench_t* bench)
+{
+	bool available = false;
+
+	for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+		bench->perf_fd[i] = -1;
+	}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+		struct perf_event_attr attr;
+
+		// count user space events of the calling thread only; counters are
+		// opened individually such that unsupported counters do not prevent
+		// the others from being used
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = bench_perf_events[i].type;
+		attr.config = bench_perf_events[i].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		bench->perf_fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (bench->perf_fd[i] >= 0) {
+			available = true;
+		}
+	}
+#endif
+
+	return available;
+}
+
+static void bench_perf_close(struct bench_t* bench)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+		if (bench->perf_fd[i] >= 0) {
+			close(bench->perf_fd[i]);
+			bench->perf_fd[i] = -1;
+		}
+	}
+#else
+	(void)bench;
+#endif
+}
+
+static void bench_perf_start(struct bench_t* bench)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+		if (bench->perf_fd[i] >= 0) {
+			ioctl(bench->perf_fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(bench->perf_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#else
+	(void)bench;
+#endif
+}
+
+static void bench_perf_stop(struct bench_t* bench, double* counts)
+{
+	for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+		// negative for unavailable counters
+		counts[i] = -1;
+	}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+		if (bench->perf_fd[i] >= 0) {
+			ioctl(bench->perf_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+	for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+		uint64_t values[3]; // value, time enabled, time running
+
+		if (bench->perf_fd[i] < 0) {
+			continue;
+		}
+		if (read(bench->perf_fd[i], values, sizeof(values)) != sizeof(values) || !values[2]) {
+			continue;
+		}
+
+		// scale for counter multiplexing
+		counts[i] = (double)values[0] * values[1] / values[2];
+	}
+#else
+	(void)bench;
+#endif
+}
+
+static void bench_trace_hook(void* ctx, enum tr31_trace_stage_t stage, uint64_t start_ns, uint64_t end_ns)
+{
+	struct bench_trace_stage_t* trace = ctx;
+	uint64_t ns;
+
+	if (stage >= TR31_TRACE_STAGE_COUNT) {
+		return;
+	}
+
+	// benchmarks are single threaded and therefore no locking is required
+	ns = end_ns - start_ns;
+	trace[stage].count++;
+	trace[stage].total_ns += ns;
+	if (ns > trace[stage].max_ns) {
+		trace[stage].max_ns = ns;
+	}
+	trace[stage].buckets[bench_trace_bucket(ns)]++;
+}
+
+static size_t bench_trace_bucket(uint64_t ns)
+{
+	unsigned int msb;
+
+	// small values have their own bucket
+	if (ns < (1 << BENCH_TRACE_SUB_BUCKET_BITS)) {
+		return ns;
+	}
+
+	// log-linear buckets: each power of two is divided into equal sub-buckets
+	msb = 63 - __builtin_clzll(ns);
+	return ((size_t)(msb - BENCH_TRACE_SUB_BUCKET_BITS + 1) << BENCH_TRACE_SUB_BUCKET_BITS) +
+		((ns >> (msb - BENCH_TRACE_SUB_BUCKET_BITS)) & ((1 << BENCH_TRACE_SUB_BUCKET_BITS) - 1));
+}
+
+static double bench_trace_percentile(const struct bench_trace_stage_t* stage, double p)
+{
+	uint64_t rank;
+	uint64_t cumulative = 0;
+
+	// nearest-rank method
+	rank = (uint64_t)(p * stage->count + 0.999999);
+	if (rank < 1) {
+		rank = 1;
+	}
+
+	for (size_t i = 0; i < BENCH_TRACE_BUCKETS; ++i) {
+		unsigned int exponent;
+		uint64_t lower;
+		uint64_t width;
+
+		cumulative += stage->buckets[i];
+		if (cumulative < rank) {
+			continue;
+		}
+
+		// report the midpoint of the bucket
+		if (i < (2 << BENCH_TRACE_SUB_BUCKET_BITS)) {
+			return i;
+		}
+		exponent = (i >> BENCH_TRACE_SUB_BUCKET_BITS) - 1;
+		lower = ((uint64_t)(i & ((1 << BENCH_TRACE_SUB_BUCKET_BITS) - 1)) + (1 << BENCH_TRACE_SUB_BUCKET_BITS)) << exponent;
+		width = (uint64_t)1 << exponent;
+		return lower + (width - 1) / 2.0;
+	}
+
+	return stage->max_ns;
+}
+
+static void bench_trace_report(struct bench_t* bench)
+{
+	bool first = true;
+
+	for (size_t i = 0; i < TR31_TRACE_STAGE_COUNT; ++i) {
+		const struct bench_trace_stage_t* stage = &bench->trace[i];
+		double mean;
+		double p50;
+		double p99;
+
+		if (!stage->count) {
+			continue;
+		}
+		mean = (double)stage->total_ns / stage->count;
+		p50 = bench_trace_percentile(stage, 0.50);
+		p99 = bench_trace_percentile(stage, 0.99);
+
+		printf("  %-38s %14llu %12.1f %12.1f %12.1f %12llu\n",
+			bench_trace_stage_names[i],
+			(unsigned long long)stage->count,
+			mean,
+			p50,
+			p99,
+			(unsigned long long)stage->max_ns
+		);
+
+		if (bench->json) {
+			fprintf(bench->json,
+				"%s\"%s\": { \"count\": %llu, \"mean_ns\": %.2f, "
+				"\"p50_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %llu }",
+				first ? ", \"trace\": { " : ", ",
+				bench_trace_stage_names[i],
+				(unsigned long long)stage->count,
+				mean,
+				p50,
+				p99,
+				(unsigned long long)stage->max_ns
+			);
+			first = false;
+		}
+	}
+	if (bench->json && !first) {
+		fprintf(bench->json, " }");
+	}
+}
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_compare_double(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double bench_percentile(const double* sorted, size_t count, double p)
+{
+	size_t rank;
+
+	// nearest-rank method
+	rank = (size_t)(p * count + 0.999999);
+	if (rank < 1) {
+		rank = 1;
+	}
+	if (rank > count) {
+		rank = count;
+	}
+	return sorted[rank - 1];
+}
+
+static void bench_run(struct bench_t* bench, const char* name, bench_func_t func, void* ctx)
+{
+	size_t batch;
+	size_t sample_count = 0;
+	uint64_t iterations = 0;
+	uint64_t total_ns = 0;
+	uint64_t deadline;
+	double ns_per_op;
+	double ops_per_sec;
+	double p50;
+	double p99;
+	double p999;
+	double perf_counts[BENCH_PERF_COUNTERS];
+
+	if (bench->filter && !strstr(name, bench->filter)) {
+		return;
+	}
+
+	// calibrate batch size such that timer overhead is negligible, which
+	// also serves as warm-up
+	for (batch = 1; batch < BENCH_MAX_BATCH; batch *= 2) {
+		uint64_t start = bench_now();
+		for (size_t i = 0; i < batch; ++i) {
+			if (func(ctx)) {
+				fprintf(stderr, "Benchmark %s failed\n", name);
+				bench->failed = true;
+				return;
+			}
+		}
+		if (bench_now() - start >= BENCH_MIN_SAMPLE_NS) {
+			break;
+		}
+	}
+
+	// only trace the timed batches
+	if (bench->trace) {
+		memset(bench->trace, 0, sizeof(*bench->trace) * TR31_TRACE_STAGE_COUNT);
+	}
+
+	// each sample is the average duration of an operation within a batch
+	deadline = bench_now() + (uint64_t)(bench->min_time * 1e9);
+	if (bench->perf) {
+		bench_perf_start(bench);
+	}
+	while (sample_count < BENCH_MAX_SAMPLES) {
+		uint64_t start;
+		uint64_t elapsed;
+
+		start = bench_now();
+		for (size_t i = 0; i < batch; ++i) {
+			if (func(ctx)) {
+				fprintf(stderr, "Benchmark %s failed\n", name);
+				bench->failed = true;
+				return;
+			}
+		}
+		elapsed = bench_now() - start;
+
+		bench->samples[sample_count++] = (double)elapsed / batch;
+		iterations += batch;
+		total_ns += elapsed;
+		if (start + elapsed >= deadline) {
+			break;
+		}
+	}
+	if (bench->perf) {
+		bench_perf_stop(bench, perf_counts);
+	}
+
+	qsort(bench->samples, sample_count, sizeof(bench->samples[0]), &bench_compare_double);
+	ns_per_op = (double)total_ns / iterations;
+	ops_per_sec = 1e9 / ns_per_op;
+	p50 = bench_percentile(bench->samples, sample_count, 0.50);
+	p99 = bench_percentile(bench->samples, sample_count, 0.99);
+	p999 = bench_percentile(bench->samples, sample_count, 0.999);
+
+	printf("%-40s %14.0f %12.1f %12.1f %12.1f %12.1f",
+		name, ops_per_sec, ns_per_op, p50, p99, p999
+	);
+	if (bench->perf) {
+		// per operation hardware counters
+		for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+			if (perf_counts[i] < 0) {
+				printf(" %12s", "-");
+			} else {
+				printf(" %12.1f", perf_counts[i] / iterations);
+			}
+		}
+		if (perf_counts[0] > 0 && perf_counts[1] >= 0) {
+			printf(" %6.2f", perf_counts[1] / perf_counts[0]);
+		} else {
+			printf(" %6s", "-");
+		}
+	}
+	printf("\n");
+
+	if (bench->json) {
+		fprintf(bench->json,
+			"%s\n\t\t{ \"name\": \"%s\", \"iterations\": %llu, \"batch\": %zu, "
+			"\"ops_per_sec\": %.1f, \"ns_per_op\": %.2f, "
+			"\"p50_ns\": %.2f, \"p99_ns\": %.2f, \"p999_ns\": %.2f",
+			bench->count ? "," : "",
+			name,
+			(unsigned long long)iterations,
+			batch,
+			ops_per_sec,
+			ns_per_op,
+			p50,
+			p99,
+			p999
+		);
+#ifdef HAVE_LINUX_PERF_EVENT_H
+		if (bench->perf) {
+			for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+				if (perf_counts[i] < 0) {
+					fprintf(bench->json, ", \"%s_per_op\": null", bench_perf_events[i].name);
+				} else {
+					fprintf(bench->json, ", \"%s_per_op\": %.2f", bench_perf_events[i].name, perf_counts[i] / iterations);
+				}
+			}
+		}
+#endif
+	}
+	if (bench->trace) {
+		// per-stage latency histograms
+		bench_trace_report(bench);
+	}
+	if (bench->json) {
+		fprintf(bench->json, " }");
+	}
+	fflush(stdout);
+	++bench->count;
+}
+
+static int bench_key_block_setup(
+	struct bench_key_block_t* kb,
+	const struct tr31_key_t* kbpk,
+	uint8_t version,
+	unsigned int opt_blocks_count
+)
+{
+	int r;
+	struct tr31_key_t key;
+	struct tr31_ctx_t ctx;
+
+	memset(kb, 0, sizeof(*kb));
+	kb->kbpk = kbpk;
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_BDK,
+		kbpk->algorithm,
+		TR31_KEY_MODE_OF_USE_DERIVE,
+		"00",
+		TR31_KEY_EXPORT_TRUSTED,
+		TR31_KEY_CONTEXT_NONE,
+		bench_key_data,
+		sizeof(bench_key_data),
+		&key
+	);
+	if (r) {
+		return r;
+	}
+	r = tr31_init(version, &key, &ctx);
+	tr31_key_release(&key);
+	if (r) {
+		return r;
+	}
+
+	// typical optional blocks, followed by proprietary optional blocks
+	if (opt_blocks_count >= 4) {
+		r = tr31_opt_block_add_KS(&ctx, bench_iksn, sizeof(bench_iksn));
+		if (r) {
+			goto exit;
+		}
+		r = tr31_opt_block_add_KC(&ctx);
+		if (r) {
+			goto exit;
+		}
+		r = tr31_opt_block_add_LB(&ctx, "Benchmark");
+		if (r) {
+			goto exit;
+		}
+		r = tr31_opt_block_add_TS(&ctx, "20240101000000Z");
+		if (r) {
+			goto exit;
+		}
+	}
+	for (unsigned int i = 4; i < opt_blocks_count; ++i) {
+		static const char data[] = "0123456789ABCDEF";
+		unsigned int id = (('2' + i / 16) << 8) | data[i % 16];
+
+		r = tr31_opt_block_add(&ctx, id, data, sizeof(data) - 1);
+		if (r) {
+			goto exit;
+		}
+	}
+
+	r = tr31_export(&ctx, kbpk, 0, kb->key_block, sizeof(kb->key_block));
+	if (r) {
+		goto exit;
+	}
+	kb->key_block_len = strlen(kb->key_block);
+
+	// imported context object for export benchmarks
+	r = tr31_import(kb->key_block, kb->key_block_len, kbpk, 0, &kb->ctx);
+	if (r) {
+		goto exit;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_release(&ctx);
+	return r;
+}
+
+static int bench_import(void* ctx)
+{
+	struct bench_key_block_t* kb = ctx;
+	struct tr31_ctx_t tr31;
+	int r;
+
+	r = tr31_import(kb->key_block, kb->key_block_len, kb->kbpk, 0, &tr31);
+	tr31_release(&tr31);
+	return r;
+}
+
+static int bench_import_kcv(void* ctx)
+{
+	struct bench_key_block_t* kb = ctx;
+	struct tr31_ctx_t tr31;
+	int r;
+
+	r = tr31_import(kb->key_block, kb->key_block_len, kb->kbpk, TR31_IMPORT_COMPUTE_KCV, &tr31);
+	tr31_release(&tr31);
+	return r;
+}
+
+static int bench_import_no_kbpk(void* ctx)
+{
+	struct bench_key_block_t* kb = ctx;
+	struct tr31_ctx_t tr31;
+	int r;
+
+	r = tr31_import(kb->key_block, kb->key_block_len, NULL, 0, &tr31);
+	tr31_release(&tr31);
+	return r;
+}
+
+static int bench_export(void* ctx)
+{
+	struct bench_key_block_t* kb = ctx;
+
+	return tr31_export(&kb->ctx, kb->kbpk, 0, kb->buf, sizeof(kb->buf));
+}
+
+static int bench_tdes_kbpk_derive(void* ctx)
+{
+	struct bench_kbpk_t* kbpk = ctx;
+
+	return tr31_tdes_kbpk_derive(kbpk->kbpk, kbpk->kbpk_len, kbpk->kbek, kbpk->kbak);
+}
+
+static int bench_tdes_kbpk_variant(void* ctx)
+{
+	struct bench_kbpk_t* kbpk = ctx;
+
+	return tr31_tdes_kbpk_variant(kbpk->kbpk, kbpk->kbpk_len, kbpk->kbek, kbpk->kbak);
+}
+
+static int bench_aes_kbpk_derive(void* ctx)
+{
+	struct bench_kbpk_t* kbpk = ctx;
+
+	return tr31_aes_kbpk_derive(kbpk->kbpk, kbpk->kbpk_len, TR31_AES_MODE_CBC, kbpk->kbek, kbpk->kbak);
+}
+
+static int bench_hex_encode(void* ctx)
+{
+	struct tr31_ctx_t tr31;
+	int r;
+
+	// optional block KS is hex encoded by the library's internal helper;
+	// this includes the cost of initialising the context object
+	(void)ctx;
+	r = tr31_init(TR31_VERSION_B, NULL, &tr31);
+	if (r) {
+		return r;
+	}
+	r = tr31_opt_block_add_KS(&tr31, bench_iksn, sizeof(bench_iksn));
+	tr31_release(&tr31);
+	return r;
+}
+
+static int bench_hex_decode(void* ctx)
+{
+	struct tr31_ctx_t* tr31 = ctx;
+	uint8_t iksn[sizeof(bench_iksn)];
+
+	// optional block KS is hex decoded by the library's internal helper
+	return tr31_opt_block_decode_KS(tr31_opt_block_find(tr31, TR31_OPT_BLOCK_KS), iksn, sizeof(iksn));
+}
+
+static int bench_describe_header(void* ctx)
+{
+	const struct tr31_ctx_t* tr31 = ctx;
+	char ascii[3];
+	volatile size_t len = 0;
+
+	// accumulate lengths such that the calls are not optimised away
+	len += strlen(tr31_key_usage_get_ascii(tr31->key.usage, ascii, sizeof(ascii)));
+	len += strlen(tr31_key_usage_get_desc(tr31));
+	len += strlen(tr31_key_algorithm_get_desc(tr31));
+	len += strlen(tr31_key_mode_of_use_get_desc(tr31));
+	len += strlen(tr31_key_exportability_get_desc(tr31));
+	len += strlen(tr31_key_context_get_desc(tr31));
+	return len ? 0 : -1;
+}
+
+static int bench_describe_opt_blocks(void* ctx)
+{
+	const struct tr31_ctx_t* tr31 = ctx;
+	char ascii[3];
+	char desc[256];
+	int r;
+
+	for (size_t i = 0; i < tr31->opt_blocks_count; ++i) {
+		tr31_opt_block_id_get_ascii(tr31->opt_blocks[i].id, ascii, sizeof(ascii));
+		tr31_opt_block_id_get_desc(&tr31->opt_blocks[i]);
+		r = tr31_opt_block_data_get_desc(&tr31->opt_blocks[i], desc, sizeof(desc));
+		if (r < 0) {
+			return r;
+		}
+	}
+	return 0;
+}
+
+static int bench_serialize_json(void* ctx)
+{
+	const struct tr31_ctx_t* tr31 = ctx;
+	char json[4096];
+	size_t json_len;
+
+	return tr31_ctx_to_json(tr31, 0, json, sizeof(json), &json_len);
+}
+
+static int bench_serialize_cbor(void* ctx)
+{
+	const struct tr31_ctx_t* tr31 = ctx;
+	uint8_t cbor[4096];
+	size_t cbor_len;
+
+	return tr31_ctx_to_cbor(tr31, 0, cbor, sizeof(cbor), &cbor_len);
+}
+
+static int bench_crypto_setup(
+	struct bench_crypto_t* crypto,
+	const uint8_t* key,
+	size_t key_len,
+	size_t msg_len
+)
+{
+	int r;
+
+	memset(crypto, 0, sizeof(*crypto));
+	crypto->key = key;
+	crypto->key_len = key_len;
+	crypto->mode = TR31_AES_MODE_CBC;
+	crypto->msg_len = msg_len;
+	for (size_t i = 0; i < msg_len; ++i) {
+		crypto->msg[i] = i;
+	}
+
+	// precompute CMAC such that verification succeeds
+	if (!msg_len) {
+		return 0;
+	}
+	if (key == bench_kbpk_aes_data) {
+		r = crypto_aes_cmac(key, key_len, crypto->msg, msg_len, crypto->cmac);
+	} else {
+		r = crypto_tdes_cmac(key, key_len, crypto->msg, msg_len, crypto->cmac);
+	}
+	return r;
+}
+
+static int bench_crypto_tdes_kbpk_derive(void* ctx)
+{
+	struct bench_crypto_t* crypto = ctx;
+
+	return tr31_tdes_kbpk_derive(crypto->key, crypto->key_len, crypto->kbek, crypto->kbak);
+}
+
+static int bench_crypto_aes_kbpk_derive(void* ctx)
+{
+	struct bench_crypto_t* crypto = ctx;
+
+	return tr31_aes_kbpk_derive(crypto->key, crypto->key_len, crypto->mode, crypto->kbek, crypto->kbak);
+}
+
+static int bench_crypto_tdes_verify_cmac(void* ctx)
+{
+	struct bench_crypto_t* crypto = ctx;
+
+	return tr31_tdes_verify_cmac(crypto->key, crypto->key_len, crypto->msg, crypto->msg_len, crypto->cmac, DES_CMAC_SIZE);
+}
+
+static int bench_crypto_aes_verify_cmac(void* ctx)
+{
+	struct bench_crypto_t* crypto = ctx;
+
+	return tr31_aes_verify_cmac(crypto->key, crypto->key_len, crypto->msg, crypto->msg_len, crypto->cmac, AES_CMAC_SIZE);
+}
+
+static int bench_crypto_tdes_cbc(void* ctx)
+{
+	struct bench_crypto_t* crypto = ctx;
+
+	return crypto_tdes_encrypt(crypto->key, crypto->key_len, crypto->iv, crypto->msg, crypto->msg_len, crypto->out);
+}
+
+static int bench_crypto_aes_cbc(void* ctx)
+{
+	struct bench_crypto_t* crypto = ctx;
+
+	return crypto_aes_encrypt(crypto->key, crypto->key_len, crypto->iv, crypto->msg, crypto->msg_len, crypto->out);
+}
+
+static int bench_crypto_aes_ctr(void* ctx)
+{
+	struct bench_crypto_t* crypto = ctx;
+
+	return crypto_aes_encrypt_ctr(crypto->key, crypto->key_len, crypto->iv, crypto->msg, crypto->msg_len, crypto->out);
+}
+
+static void bench_run_crypto(struct bench_t* bench)
+{
+	int r;
+	struct bench_crypto_t crypto;
+	static const size_t aes_key_lens[] = { 16, 24, 32 };
+	// TR-31 messages are typically two to four blocks of header and payload
+	static const size_t msg_lens[] = { 16, 32, 48, 64, 128 };
+	char name[64];
+
+	// KBPK derivation per key length
+	for (size_t i = 2; i <= 3; ++i) {
+		bench_crypto_setup(&crypto, bench_kbpk_tdes3_data, i * DES_KEY_SIZE, 0);
+		snprintf(name, sizeof(name), "crypto/tdes-kbpk-derive/%zu", i * DES_KEY_SIZE * 8);
+		bench_run(bench, name, &bench_crypto_tdes_kbpk_derive, &crypto);
+	}
+	for (size_t i = 0; i < sizeof(aes_key_lens) / sizeof(aes_key_lens[0]); ++i) {
+		bench_crypto_setup(&crypto, bench_kbpk_aes_data, aes_key_lens[i], 0);
+		crypto.mode = TR31_AES_MODE_CBC;
+		snprintf(name, sizeof(name), "crypto/aes-kbpk-derive/cbc/%zu", aes_key_lens[i] * 8);
+		bench_run(bench, name, &bench_crypto_aes_kbpk_derive, &crypto);
+		crypto.mode = TR31_AES_MODE_CTR;
+		snprintf(name, sizeof(name), "crypto/aes-kbpk-derive/ctr/%zu", aes_key_lens[i] * 8);
+		bench_run(bench, name, &bench_crypto_aes_kbpk_derive, &crypto);
+	}
+
+	// CMAC verification and block modes per message size
+	for (size_t i = 0; i < sizeof(msg_lens) / sizeof(msg_lens[0]); ++i) {
+		r = bench_crypto_setup(&crypto, bench_kbpk_tdes_data, sizeof(bench_kbpk_tdes_data), msg_lens[i]);
+		if (r) {
+			fprintf(stderr, "TDES CMAC setup failed; error %d\n", r);
+			bench->failed = true;
+			return;
+		}
+		snprintf(name, sizeof(name), "crypto/tdes-verify-cmac/%zu", msg_lens[i]);
+		bench_run(bench, name, &bench_crypto_tdes_verify_cmac, &crypto);
+		snprintf(name, sizeof(name), "crypto/tdes-cbc/%zu", msg_lens[i]);
+		bench_run(bench, name, &bench_crypto_tdes_cbc, &crypto);
+
+		r = bench_crypto_setup(&crypto, bench_kbpk_aes_data, sizeof(bench_kbpk_aes_data), msg_lens[i]);
+		if (r) {
+			fprintf(stderr, "AES CMAC setup failed; error %d\n", r);
+			bench->failed = true;
+			return;
+		}
+		snprintf(name, sizeof(name), "crypto/aes-verify-cmac/%zu", msg_lens[i]);
+		bench_run(bench, name, &bench_crypto_aes_verify_cmac, &crypto);
+		snprintf(name, sizeof(name), "crypto/aes-cbc/%zu", msg_lens[i]);
+		bench_run(bench, name, &bench_crypto_aes_cbc, &crypto);
+		snprintf(name, sizeof(name), "crypto/aes-ctr/%zu", msg_lens[i]);
+		bench_run(bench, name, &bench_crypto_aes_ctr, &crypto);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int r;
+	struct bench_t bench;
+	const char* json_path = NULL;
+	bool trace = false;
+	struct tr31_key_t kbpk_tdes;
+	struct tr31_key_t kbpk_aes;
+	static const uint8_t versions[] = { TR31_VERSION_A, TR31_VERSION_B, TR31_VERSION_C, TR31_VERSION_D, TR31_VERSION_E };
+	static const unsigned int opt_blocks_counts[] = { 0, 4, BENCH_MAX_OPT_BLOCKS };
+	struct bench_key_block_t* kb = NULL;
+	struct bench_kbpk_t kbpk;
+	struct tr31_ctx_t* tr31_ks = NULL;
+	char name[64];
+
+	memset(&bench, 0, sizeof(bench));
+	bench.min_time = BENCH_MIN_TIME_DEFAULT;
+	for (size_t i = 0; i < BENCH_PERF_COUNTERS; ++i) {
+		bench.perf_fd[i] = -1;
+	}
+
+	// parse command line options
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			json_path = argv[++i];
+		} else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			bench.filter = argv[++i];
+		} else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+			bench.min_time = strtod(argv[++i], NULL);
+			if (bench.min_time <= 0) {
+				fprintf(stderr, "Invalid minimum time\n");
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--perf") == 0) {
+			bench.perf = true;
+		} else if (strcmp(argv[i], "--trace") == 0) {
+			trace = true;
+		} else {
+			fprintf(stderr, "Usage: %s [--json FILE] [--filter SUBSTRING] [--min-time SECONDS] [--perf] [--trace]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	bench.samples = malloc(sizeof(*bench.samples) * BENCH_MAX_SAMPLES);
+	kb = calloc(sizeof(versions) * sizeof(opt_blocks_counts) / sizeof(opt_blocks_counts[0]), sizeof(*kb));
+	tr31_ks = calloc(1, sizeof(*tr31_ks));
+	if (!bench.samples || !kb || !tr31_ks) {
+		fprintf(stderr, "Memory allocation failed\n");
+		free(bench.samples);
+		free(kb);
+		free(tr31_ks);
+		return 1;
+	}
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		bench_kbpk_tdes_data,
+		sizeof(bench_kbpk_tdes_data),
+		&kbpk_tdes
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_AES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		bench_kbpk_aes_data,
+		sizeof(bench_kbpk_aes_data),
+		&kbpk_aes
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		tr31_key_release(&kbpk_tdes);
+		return 1;
+	}
+
+	if (bench.perf && !bench_perf_open(&bench)) {
+		// typically due to containers or perf_event_paranoid
+		fprintf(stderr, "Hardware performance counters unavailable; continuing without them\n");
+		bench.perf = false;
+	}
+
+	if (trace) {
+		bench.trace = calloc(TR31_TRACE_STAGE_COUNT, sizeof(*bench.trace));
+		if (!bench.trace) {
+			fprintf(stderr, "Memory allocation failed\n");
+			r = 1;
+			goto exit;
+		}
+		if (tr31_set_trace_hook(&bench_trace_hook, bench.trace)) {
+			fprintf(stderr, "Trace hooks unavailable; build with TR31_ENABLE_TRACE to enable them\n");
+			free(bench.trace);
+			bench.trace = NULL;
+		}
+	}
+
+	if (json_path) {
+		bench.json = fopen(json_path, "w");
+		if (!bench.json) {
+			fprintf(stderr, "Failed to open \"%s\"\n", json_path);
+			r = 1;
+			goto exit;
+		}
+		fprintf(bench.json, "{\n\t\"library_version\": \"%s\",\n\t\"crypto_backend\": \"%s\",\n\t\"min_time\": %.3f,\n\t\"benchmarks\": [",
+			tr31_lib_version_string(),
+			TR31_BENCH_CRYPTO_BACKEND,
+			bench.min_time
+		);
+	}
+
+	printf("Crypto backend: %s\n", TR31_BENCH_CRYPTO_BACKEND);
+	printf("%-40s %14s %12s %12s %12s %12s", "benchmark", "ops/s", "ns/op", "p50 ns", "p99 ns", "p999 ns");
+	if (bench.perf) {
+		printf(" %12s %12s %12s %12s %6s", "cycles/op", "instr/op", "br-miss/op", "L1d-miss/op", "IPC");
+	}
+	printf("\n");
+	if (bench.trace) {
+		printf("  %-38s %14s %12s %12s %12s %12s\n", "trace stage", "count", "mean ns", "p50 ns", "p99 ns", "max ns");
+	}
+
+	// key block import and export for each format version and number of
+	// optional blocks
+	for (size_t i = 0; i < sizeof(versions); ++i) {
+		for (size_t j = 0; j < sizeof(opt_blocks_counts) / sizeof(opt_blocks_counts[0]); ++j) {
+			struct bench_key_block_t* ptr = &kb[i * (sizeof(opt_blocks_counts) / sizeof(opt_blocks_counts[0])) + j];
+			const struct tr31_key_t* kbpk_ptr;
+
+			kbpk_ptr = versions[i] >= TR31_VERSION_D ? &kbpk_aes : &kbpk_tdes;
+			r = bench_key_block_setup(ptr, kbpk_ptr, versions[i], opt_blocks_counts[j]);
+			if (r) {
+				fprintf(stderr, "Key block setup for version %c with %u optional blocks failed; error %d: %s\n",
+					versions[i],
+					opt_blocks_counts[j],
+					r,
+					tr31_get_error_string(r)
+				);
+				r = 1;
+				goto exit;
+			}
+
+			snprintf(name, sizeof(name), "import/%c/kbpk/opt%u", versions[i], opt_blocks_counts[j]);
+			bench_run(&bench, name, &bench_import, ptr);
+			snprintf(name, sizeof(name), "import/%c/kbpk-kcv/opt%u", versions[i], opt_blocks_counts[j]);
+			bench_run(&bench, name, &bench_import_kcv, ptr);
+			snprintf(name, sizeof(name), "import/%c/no-kbpk/opt%u", versions[i], opt_blocks_counts[j]);
+			bench_run(&bench, name, &bench_import_no_kbpk, ptr);
+			snprintf(name, sizeof(name), "export/%c/kbpk/opt%u", versions[i], opt_blocks_counts[j]);
+			bench_run(&bench, name, &bench_export, ptr);
+		}
+	}
+
+	// key block protection key derivation
+	kbpk.kbpk = bench_kbpk_tdes_data;
+	kbpk.kbpk_len = sizeof(bench_kbpk_tdes_data);
+	bench_run(&bench, "kbpk/tdes-variant", &bench_tdes_kbpk_variant, &kbpk);
+	bench_run(&bench, "kbpk/tdes-derive", &bench_tdes_kbpk_derive, &kbpk);
+	kbpk.kbpk = bench_kbpk_aes_data;
+	kbpk.kbpk_len = sizeof(bench_kbpk_aes_data);
+	bench_run(&bench, "kbpk/aes-derive", &bench_aes_kbpk_derive, &kbpk);
+
+	// hex conversion
+	r = tr31_init(TR31_VERSION_B, NULL, tr31_ks);
+	if (!r) {
+		r = tr31_opt_block_add_KS(tr31_ks, bench_iksn, sizeof(bench_iksn));
+	}
+	if (r) {
+		fprintf(stderr, "Optional block KS setup failed; error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	bench_run(&bench, "hex/encode-ks", &bench_hex_encode, tr31_ks);
+	bench_run(&bench, "hex/decode-ks", &bench_hex_decode, tr31_ks);
+
+	// string describers, using format version A key blocks with optional blocks
+	bench_run(&bench, "strings/header", &bench_describe_header, &kb[1].ctx);
+	bench_run(&bench, "strings/opt-blocks/opt4", &bench_describe_opt_blocks, &kb[1].ctx);
+	bench_run(&bench, "strings/opt-blocks/opt20", &bench_describe_opt_blocks, &kb[2].ctx);
+
+	// key block context serialization, using the same key blocks
+	bench_run(&bench, "serialize/json/opt4", &bench_serialize_json, &kb[1].ctx);
+	bench_run(&bench, "serialize/json/opt20", &bench_serialize_json, &kb[2].ctx);
+	bench_run(&bench, "serialize/cbor/opt4", &bench_serialize_cbor, &kb[1].ctx);
+	bench_run(&bench, "serialize/cbor/opt20", &bench_serialize_cbor, &kb[2].ctx);
+
+	// crypto primitives used by the library, per key length and message size
+	bench_run_crypto(&bench);
+
+	r = bench.failed ? 1 : 0;
+	goto exit;
+
+exit:
+	if (bench.json) {
+		fprintf(bench.json, "\n\t]\n}\n");
+		fclose(bench.json);
+	}
+	if (kb) {
+		for (size_t i = 0; i < sizeof(versions) * sizeof(opt_blocks_counts) / sizeof(opt_blocks_counts[0]); ++i) {
+			tr31_release(&kb[i].ctx);
+		}
+		free(kb);
+	}
+	if (tr31_ks) {
+		tr31_release(tr31_ks);
+		free(tr31_ks);
+	}
+	bench_perf_close(&bench);
+	if (bench.trace) {
+		tr31_set_trace_hook(NULL, NULL);
+		free(bench.trace);
+	}
+	free(bench.samples);
+	tr31_key_release(&kbpk_tdes);
+	tr31_key_release(&kbpk_aes);
+
+	return r;
+}
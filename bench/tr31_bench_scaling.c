@@ -0,0 +1,553 @@
+/**
+ * @file tr31_bench_scaling.c
+ * @brief Multi-threaded scaling benchmark for TR-31 library
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+#include "tr31_strings.h"
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define SCALING_MIN_TIME_DEFAULT (0.5) // seconds per measurement
+#define SCALING_EFFICIENCY_DEFAULT (0.8) // parallel efficiency below which scaling is non-linear
+#define SCALING_MAX_THREADS (1024)
+#define SCALING_CACHE_LINE_SIZE (64)
+
+typedef int (*scaling_func_t)(void* ctx);
+
+// workload description
+struct scaling_workload_t {
+	const char* name;
+	const char* desc;
+	scaling_func_t func;
+};
+
+// per thread state, on its own cache line to avoid false sharing
+struct scaling_thread_t {
+	pthread_t thread;
+	struct scaling_run_t* run;
+	unsigned int index;
+	int cpu;
+	uint64_t ops;
+	int result;
+	struct tr31_ctx_t ctx; // for export and describe workloads
+	char buf[1024];
+	char pad[SCALING_CACHE_LINE_SIZE];
+};
+
+// state of a single measurement
+struct scaling_run_t {
+	const struct scaling_workload_t* workload;
+	atomic_uint ready;
+	atomic_bool start;
+	atomic_bool stop;
+};
+
+// TR-31:2018, A.7.3.2 KBPK
+static const uint8_t scaling_kbpk_data[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+static const uint8_t scaling_key_data[] = { 0xBF, 0x82, 0xDA, 0xC6, 0xA3, 0x3D, 0xF9, 0x2C, 0xE6, 0x6E, 0x15, 0xB7, 0x0E, 0x5D, 0xCE, 0xB6 };
+static const uint8_t scaling_iksn[] = { 0xFF, 0xFF, 0x00, 0xA0, 0x20, 0x00, 0x01, 0xE0, 0x00, 0x00 };
+
+// shared inputs; read-only while threads are running
+static struct tr31_key_t scaling_kbpk;
+static char scaling_key_block[1024];
+static size_t scaling_key_block_len;
+
+// helper functions
+static uint64_t scaling_now(void);
+static int scaling_setup(void);
+static int scaling_import(void* ctx);
+static int scaling_export(void* ctx);
+static int scaling_describe(void* ctx);
+static void* scaling_thread(void* arg);
+static int scaling_measure(
+	const struct scaling_workload_t* workload,
+	unsigned int thread_count,
+	const int* cpus,
+	unsigned int cpu_count,
+	double min_time,
+	double* ops_per_sec
+);
+
+static const struct scaling_workload_t scaling_workloads[] = {
+	{ "import", "tr31_import() with KBPK; optional block parsing and memory allocation", &scaling_import },
+	{ "export", "tr31_export() with KBPK; random number generation", &scaling_export },
+	{ "describe", "tr31_opt_block_data_get_desc() for all optional blocks; time stamp formatting and locale", &scaling_describe },
+};
+
+static uint64_t scaling_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int scaling_setup(void)
+{
+	int r;
+	struct tr31_key_t key;
+	struct tr31_ctx_t ctx;
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		scaling_kbpk_data,
+		sizeof(scaling_kbpk_data),
+		&scaling_kbpk
+	);
+	if (r) {
+		return r;
+	}
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_DUKPT_IK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_DERIVE,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		scaling_key_data,
+		sizeof(scaling_key_data),
+		&key
+	);
+	if (r) {
+		return r;
+	}
+	r = tr31_init(TR31_VERSION_B, &key, &ctx);
+	tr31_key_release(&key);
+	if (r) {
+		return r;
+	}
+
+	// optional blocks that exercise parsing and string descriptions
+	r = tr31_opt_block_add_KS(&ctx, scaling_iksn, sizeof(scaling_iksn));
+	if (r) {
+		goto exit;
+	}
+	r = tr31_opt_block_add_KC(&ctx);
+	if (r) {
+		goto exit;
+	}
+	r = tr31_opt_block_add_LB(&ctx, "Scaling");
+	if (r) {
+		goto exit;
+	}
+	r = tr31_opt_block_add_TS(&ctx, "20240101000000Z");
+	if (r) {
+		goto exit;
+	}
+
+	r = tr31_export(&ctx, &scaling_kbpk, 0, scaling_key_block, sizeof(scaling_key_block));
+	if (r) {
+		goto exit;
+	}
+	scaling_key_block_len = strlen(scaling_key_block);
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_release(&ctx);
+	return r;
+}
+
+static int scaling_import(void* ctx)
+{
+	struct scaling_thread_t* thread = ctx;
+	struct tr31_ctx_t tr31;
+	int r;
+
+	(void)thread;
+	r = tr31_import(scaling_key_block, scaling_key_block_len, &scaling_kbpk, 0, &tr31);
+	tr31_release(&tr31);
+	return r;
+}
+
+static int scaling_export(void* ctx)
+{
+	struct scaling_thread_t* thread = ctx;
+
+	return tr31_export(&thread->ctx, &scaling_kbpk, 0, thread->buf, sizeof(thread->buf));
+}
+
+static int scaling_describe(void* ctx)
+{
+	struct scaling_thread_t* thread = ctx;
+	int r;
+
+	for (size_t i = 0; i < thread->ctx.opt_blocks_count; ++i) {
+		r = tr31_opt_block_data_get_desc(&thread->ctx.opt_blocks[i], thread->buf, sizeof(thread->buf));
+		if (r < 0) {
+			return r;
+		}
+	}
+	return 0;
+}
+
+static void* scaling_thread(void* arg)
+{
+	struct scaling_thread_t* thread = arg;
+	struct scaling_run_t* run = thread->run;
+	uint64_t ops = 0;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if (thread->cpu >= 0) {
+		cpu_set_t cpuset;
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(thread->cpu, &cpuset);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	}
+#endif
+
+	// start all threads at the same time
+	atomic_fetch_add(&run->ready, 1);
+	while (!atomic_load_explicit(&run->start, memory_order_acquire)) {
+		sched_yield();
+	}
+
+	while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+		thread->result = run->workload->func(thread);
+		if (thread->result) {
+			break;
+		}
+		++ops;
+	}
+	thread->ops = ops;
+
+	return NULL;
+}
+
+static int scaling_measure(
+	const struct scaling_workload_t* workload,
+	unsigned int thread_count,
+	const int* cpus,
+	unsigned int cpu_count,
+	double min_time,
+	double* ops_per_sec
+)
+{
+	int r;
+	struct scaling_run_t run;
+	struct scaling_thread_t* threads;
+	unsigned int started;
+	uint64_t start_time = 0;
+	uint64_t elapsed;
+	uint64_t ops = 0;
+	struct timespec delay;
+
+	threads = aligned_alloc(SCALING_CACHE_LINE_SIZE,
+		((sizeof(*threads) * thread_count + SCALING_CACHE_LINE_SIZE - 1) / SCALING_CACHE_LINE_SIZE) * SCALING_CACHE_LINE_SIZE
+	);
+	if (!threads) {
+		return -1;
+	}
+	memset(threads, 0, sizeof(*threads) * thread_count);
+	memset(&run, 0, sizeof(run));
+	run.workload = workload;
+	atomic_init(&run.ready, 0);
+	atomic_init(&run.start, false);
+	atomic_init(&run.stop, false);
+
+	for (started = 0; started < thread_count; ++started) {
+		struct scaling_thread_t* thread = &threads[started];
+
+		thread->run = &run;
+		thread->index = started;
+		thread->cpu = cpu_count ? cpus[started % cpu_count] : -1;
+		r = tr31_import(scaling_key_block, scaling_key_block_len, &scaling_kbpk, 0, &thread->ctx);
+		if (r) {
+			break;
+		}
+		r = pthread_create(&thread->thread, NULL, &scaling_thread, thread);
+		if (r) {
+			tr31_release(&thread->ctx);
+			break;
+		}
+	}
+	if (started < thread_count) {
+		r = -1;
+		atomic_store(&run.stop, true);
+		atomic_store(&run.start, true);
+		goto exit;
+	}
+
+	// wait for all threads to be ready, then measure for the minimum time
+	while (atomic_load(&run.ready) < thread_count) {
+		sched_yield();
+	}
+	start_time = scaling_now();
+	atomic_store_explicit(&run.start, true, memory_order_release);
+	delay.tv_sec = (time_t)min_time;
+	delay.tv_nsec = (long)((min_time - delay.tv_sec) * 1e9);
+	nanosleep(&delay, NULL);
+	atomic_store(&run.stop, true);
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	for (unsigned int i = 0; i < started; ++i) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].result && !r) {
+			r = threads[i].result;
+		}
+		ops += threads[i].ops;
+		tr31_release(&threads[i].ctx);
+	}
+	if (!r) {
+		// include the time taken by threads to observe the stop flag
+		elapsed = scaling_now() - start_time;
+		*ops_per_sec = ops * 1e9 / elapsed;
+	}
+	free(threads);
+	return r;
+}
+
+int main(int argc, char** argv)
+{
+	int r;
+	long cpu_count_online;
+	unsigned int max_threads = 0;
+	double min_time = SCALING_MIN_TIME_DEFAULT;
+	double min_efficiency = SCALING_EFFICIENCY_DEFAULT;
+	const char* workload_name = NULL;
+	const char* json_path = NULL;
+	bool pin = true;
+	bool fail_nonlinear = false;
+	bool nonlinear_found = false;
+	int cpus[SCALING_MAX_THREADS];
+	unsigned int cpu_count = 0;
+	unsigned int thread_counts[SCALING_MAX_THREADS];
+	unsigned int thread_counts_len = 0;
+	FILE* json = NULL;
+	size_t workload_count = 0;
+
+	// parse command line options
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			max_threads = strtoul(argv[++i], NULL, 10);
+			if (max_threads < 1 || max_threads > SCALING_MAX_THREADS) {
+				fprintf(stderr, "Number of threads must be from 1 to %u\n", SCALING_MAX_THREADS);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+			min_time = strtod(argv[++i], NULL);
+			if (min_time <= 0) {
+				fprintf(stderr, "Invalid minimum time\n");
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--min-efficiency") == 0 && i + 1 < argc) {
+			min_efficiency = strtod(argv[++i], NULL);
+			if (min_efficiency <= 0 || min_efficiency > 1) {
+				fprintf(stderr, "Minimum efficiency must be greater than 0 and at most 1\n");
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--workload") == 0 && i + 1 < argc) {
+			workload_name = argv[++i];
+		} else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			json_path = argv[++i];
+		} else if (strcmp(argv[i], "--no-pin") == 0) {
+			pin = false;
+		} else if (strcmp(argv[i], "--fail-nonlinear") == 0) {
+			fail_nonlinear = true;
+		} else {
+			fprintf(stderr,
+				"Usage: %s [--threads N] [--min-time SECONDS] [--min-efficiency RATIO] "
+				"[--workload import|export|describe] [--json FILE] [--no-pin] [--fail-nonlinear]\n",
+				argv[0]
+			);
+			return 1;
+		}
+	}
+
+	// determine the CPUs that this process may use
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if (pin) {
+		cpu_set_t cpuset;
+
+		if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+			for (int cpu = 0; cpu < CPU_SETSIZE && cpu_count < SCALING_MAX_THREADS; ++cpu) {
+				if (CPU_ISSET(cpu, &cpuset)) {
+					cpus[cpu_count++] = cpu;
+				}
+			}
+		}
+	}
+#else
+	(void)pin;
+#endif
+	if (!max_threads) {
+		cpu_count_online = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpu_count) {
+			max_threads = cpu_count;
+		} else {
+			max_threads = cpu_count_online > 0 ? cpu_count_online : 1;
+		}
+		if (max_threads > SCALING_MAX_THREADS) {
+			max_threads = SCALING_MAX_THREADS;
+		}
+	}
+
+	// every thread count up to 8, then powers of two, and finally the maximum
+	for (unsigned int t = 1; t <= max_threads; t = t < 8 ? t + 1 : t * 2) {
+		thread_counts[thread_counts_len++] = t;
+	}
+	if (thread_counts[thread_counts_len - 1] != max_threads) {
+		thread_counts[thread_counts_len++] = max_threads;
+	}
+
+	r = scaling_setup();
+	if (r) {
+		fprintf(stderr, "Setup failed; error %d: %s\n", r, tr31_get_error_string(r));
+		tr31_key_release(&scaling_kbpk);
+		return 1;
+	}
+
+	if (json_path) {
+		json = fopen(json_path, "w");
+		if (!json) {
+			fprintf(stderr, "Failed to open \"%s\"\n", json_path);
+			r = 1;
+			goto exit;
+		}
+		fprintf(json, "{\n\t\"library_version\": \"%s\",\n\t\"min_time\": %.3f,\n\t\"min_efficiency\": %.3f,\n\t\"pinned\": %s,\n\t\"workloads\": [",
+			tr31_lib_version_string(),
+			min_time,
+			min_efficiency,
+			cpu_count ? "true" : "false"
+		);
+	}
+
+	printf("Threads: up to %u; %s\n", max_threads, cpu_count ? "pinned to CPUs" : "not pinned");
+	for (size_t i = 0; i < sizeof(scaling_workloads) / sizeof(scaling_workloads[0]); ++i) {
+		const struct scaling_workload_t* workload = &scaling_workloads[i];
+		double ops_single = 0;
+		unsigned int first_nonlinear = 0;
+
+		if (workload_name && strcmp(workload_name, workload->name) != 0) {
+			continue;
+		}
+
+		printf("\nWorkload %s: %s\n", workload->name, workload->desc);
+		printf("%8s %14s %10s %10s\n", "threads", "ops/s", "speedup", "efficiency");
+		if (json) {
+			fprintf(json, "%s\n\t\t{\n\t\t\t\"name\": \"%s\",\n\t\t\t\"points\": [",
+				workload_count ? "," : "",
+				workload->name
+			);
+		}
+
+		for (size_t j = 0; j < thread_counts_len; ++j) {
+			unsigned int thread_count = thread_counts[j];
+			double ops_per_sec;
+			double speedup;
+			double efficiency;
+
+			r = scaling_measure(workload, thread_count, cpus, cpu_count, min_time, &ops_per_sec);
+			if (r) {
+				fprintf(stderr, "Workload %s failed with %u threads; error %d: %s\n",
+					workload->name,
+					thread_count,
+					r,
+					tr31_get_error_string(r)
+				);
+				r = 1;
+				goto exit;
+			}
+			if (thread_count == 1) {
+				ops_single = ops_per_sec;
+			}
+			speedup = ops_per_sec / ops_single;
+			efficiency = speedup / thread_count;
+			if (!first_nonlinear && efficiency < min_efficiency) {
+				first_nonlinear = thread_count;
+			}
+
+			printf("%8u %14.0f %10.2f %10.2f%s\n",
+				thread_count,
+				ops_per_sec,
+				speedup,
+				efficiency,
+				first_nonlinear == thread_count ? "  <- first non-linear point" : ""
+			);
+			fflush(stdout);
+			if (json) {
+				fprintf(json, "%s\n\t\t\t\t{ \"threads\": %u, \"ops_per_sec\": %.1f, \"speedup\": %.3f, \"efficiency\": %.3f }",
+					j ? "," : "",
+					thread_count,
+					ops_per_sec,
+					speedup,
+					efficiency
+				);
+			}
+		}
+
+		if (first_nonlinear) {
+			nonlinear_found = true;
+			printf("Scaling becomes non-linear at %u threads (efficiency below %.2f)\n", first_nonlinear, min_efficiency);
+		} else {
+			printf("Scaling is linear up to %u threads (efficiency at least %.2f)\n", max_threads, min_efficiency);
+		}
+		if (json) {
+			if (first_nonlinear) {
+				fprintf(json, "\n\t\t\t],\n\t\t\t\"first_nonlinear_threads\": %u\n\t\t}", first_nonlinear);
+			} else {
+				fprintf(json, "\n\t\t\t],\n\t\t\t\"first_nonlinear_threads\": null\n\t\t}");
+			}
+		}
+		++workload_count;
+	}
+
+	if (!workload_count) {
+		fprintf(stderr, "Unknown workload \"%s\"\n", workload_name);
+		r = 1;
+		goto exit;
+	}
+
+	r = fail_nonlinear && nonlinear_found ? 1 : 0;
+	goto exit;
+
+exit:
+	if (json) {
+		fprintf(json, "\n\t]\n}\n");
+		fclose(json);
+	}
+	tr31_key_release(&scaling_kbpk);
+
+	return r;
+}
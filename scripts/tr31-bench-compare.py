@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+##############################################################################
+# Copyright 2024 Leon Lynch
+#
+# This file is licensed under the terms of the LGPL v2.1 license.
+# See LICENSE file.
+##############################################################################
+
+"""Compare tr31_bench JSON output against a baseline.
+
+Usage: tr31-bench-compare.py [--threshold PERCENT] BASELINE CURRENT
+
+For each benchmark present in both files, the change in ns/op and p99 latency
+is reported. The exit status is non-zero if any benchmark's ns/op regressed by
+more than the threshold (default 10%).
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data, {b["name"]: b for b in data["benchmarks"]}
+
+
+def change(old, new):
+    if not old:
+        return 0.0
+    return (new - old) / old * 100.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare tr31_bench JSON output against a baseline")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="maximum allowed ns/op regression in percent (default: 10)")
+    parser.add_argument("baseline", help="baseline JSON file")
+    parser.add_argument("current", help="current JSON file")
+    args = parser.parse_args()
+
+    baseline_data, baseline = load(args.baseline)
+    current_data, current = load(args.current)
+
+    print("baseline: {} ({})".format(args.baseline, baseline_data.get("library_version", "unknown")))
+    print("current:  {} ({})".format(args.current, current_data.get("library_version", "unknown")))
+    print()
+    print("{:<40} {:>12} {:>12} {:>9} {:>12} {:>12} {:>9}".format(
+        "benchmark", "ns/op old", "ns/op new", "change", "p99 old", "p99 new", "change"))
+
+    regressions = []
+    for name, new in current.items():
+        old = baseline.get(name)
+        if old is None:
+            print("{:<40} {:>12} {:>12.1f}".format(name, "-", new["ns_per_op"]))
+            continue
+
+        ns_change = change(old["ns_per_op"], new["ns_per_op"])
+        p99_change = change(old["p99_ns"], new["p99_ns"])
+        marker = ""
+        if ns_change > args.threshold:
+            marker = "  REGRESSION"
+            regressions.append(name)
+        elif ns_change < -args.threshold:
+            marker = "  improvement"
+        print("{:<40} {:>12.1f} {:>12.1f} {:>+8.1f}% {:>12.1f} {:>12.1f} {:>+8.1f}%{}".format(
+            name,
+            old["ns_per_op"], new["ns_per_op"], ns_change,
+            old["p99_ns"], new["p99_ns"], p99_change,
+            marker))
+
+    for name in baseline:
+        if name not in current:
+            print("{:<40} missing from current results".format(name))
+
+    if regressions:
+        print()
+        print("{} benchmark(s) regressed by more than {:.1f}%".format(len(regressions), args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
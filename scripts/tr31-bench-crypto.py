@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+##############################################################################
+# Copyright 2024 Leon Lynch
+#
+# This file is licensed under the terms of the LGPL v2.1 license.
+# See LICENSE file.
+##############################################################################
+
+"""Compare crypto backends using tr31_bench and recommend the fastest.
+
+Usage: tr31-bench-crypto.py [--build-root DIR] [--backends LIST] [--min-time SECONDS] [SOURCE_DIR]
+       tr31-bench-crypto.py --report JSON [JSON ...]
+
+The crypto sub-project selects a single backend when the build system is
+generated, so each backend is built in its own build directory from the same
+source tree by disabling the discovery of the other backends. Backends that
+fail to build are reported as unavailable. The crypto benchmarks and the key
+block import/export benchmarks are then run for each backend and a report is
+generated that compares ns/op per benchmark and recommends a backend based on
+the geometric mean of the relative ns/op across all benchmarks.
+
+Alternatively, use --report to generate the report from existing tr31_bench
+JSON output files.
+"""
+
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+
+BACKENDS = ("MbedTLS", "OpenSSL")
+
+# benchmarks that depend on the crypto backend
+BENCH_FILTERS = ("crypto/", "import/", "export/")
+
+
+def build_and_run(source_dir, build_root, backend, min_time):
+    build_dir = os.path.join(build_root, backend.lower())
+    json_path = os.path.join(build_root, "{}.json".format(backend.lower()))
+
+    configure = [
+        "cmake",
+        "-S", source_dir,
+        "-B", build_dir,
+        "-DCMAKE_BUILD_TYPE=Release",
+        "-DBUILD_BENCHMARKS=YES",
+        "-DBUILD_TESTING=NO",
+        "-DBUILD_DOCS=NO",
+        "-DBUILD_TR31_TOOL=NO",
+    ]
+    for other in BACKENDS:
+        if other != backend:
+            configure.append("-DCMAKE_DISABLE_FIND_PACKAGE_{}=YES".format(other))
+    build = ["cmake", "--build", build_dir, "--target", "tr31_bench", "--parallel"]
+
+    for step, cmd in (("configure", configure), ("build", build)):
+        result = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+        if result.returncode:
+            print("{}: not available; {} failed".format(backend, step), file=sys.stderr)
+            return None
+
+    # run each filter separately and merge the results
+    results = None
+    for bench_filter in BENCH_FILTERS:
+        filter_json_path = "{}.{}".format(json_path, bench_filter.strip("/"))
+        cmd = [
+            os.path.join(build_dir, "bench", "tr31_bench"),
+            "--filter", bench_filter,
+            "--min-time", str(min_time),
+            "--json", filter_json_path,
+        ]
+        print("{}: running {} benchmarks".format(backend, bench_filter.strip("/")), file=sys.stderr)
+        result = subprocess.run(cmd, stdout=subprocess.DEVNULL)
+        if result.returncode:
+            print("{}: tr31_bench failed".format(backend), file=sys.stderr)
+            return None
+        with open(filter_json_path) as f:
+            data = json.load(f)
+        os.remove(filter_json_path)
+        if results is None:
+            results = data
+        else:
+            results["benchmarks"].extend(data["benchmarks"])
+
+    if results.get("crypto_backend", "unknown") == "unknown":
+        results["crypto_backend"] = backend
+    with open(json_path, "w") as f:
+        json.dump(results, f, indent="\t")
+    return json_path
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    backend = data.get("crypto_backend", "unknown")
+    if backend == "unknown":
+        backend = os.path.splitext(os.path.basename(path))[0]
+    return backend, {b["name"]: b for b in data["benchmarks"]}
+
+
+def report(paths):
+    results = [load(path) for path in paths]
+    backends = [backend for backend, _ in results]
+    if len(results) < 2:
+        print("At least two backends are required for a comparison")
+        if results:
+            print("Recommendation: {} (only available backend)".format(backends[0]))
+        return
+
+    # only compare benchmarks that are present for all backends
+    names = [name for name in results[0][1] if all(name in benchmarks for _, benchmarks in results)]
+
+    print("{:<36}".format("benchmark") + "".join("{:>14}".format(b + " ns") for b in backends) + "  fastest")
+    log_ratios = {backend: [] for backend in backends}
+    wins = {backend: 0 for backend in backends}
+    groups = {}
+    for name in names:
+        ns = [benchmarks[name]["ns_per_op"] for _, benchmarks in results]
+        best = min(ns)
+        fastest = backends[ns.index(best)]
+        wins[fastest] += 1
+        for backend, value in zip(backends, ns):
+            log_ratios[backend].append(math.log(value / best))
+            groups.setdefault(name.split("/")[0] + "/" + name.split("/")[1], {}).setdefault(backend, []).append(value / best)
+        print("{:<36}".format(name) + "".join("{:>14.1f}".format(v) for v in ns) + "  " + fastest)
+
+    print()
+    print("{:<36}".format("relative to fastest (geomean)") + "".join("{:>14}".format(b) for b in backends))
+    for group, values in groups.items():
+        print("{:<36}".format(group) + "".join(
+            "{:>13.2f}x".format(math.exp(sum(math.log(v) for v in values[b]) / len(values[b]))) for b in backends))
+
+    print()
+    geomean = {b: math.exp(sum(log_ratios[b]) / len(log_ratios[b])) for b in backends}
+    for backend in backends:
+        print("{}: fastest in {} of {} benchmarks; {:.2f}x slower than fastest on average".format(
+            backend, wins[backend], len(names), geomean[backend]))
+    recommended = min(backends, key=lambda b: geomean[b])
+    print()
+    print("Recommendation: {}".format(recommended))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare crypto backends using tr31_bench")
+    parser.add_argument("--build-root", default="build-bench-crypto",
+                        help="directory in which to build each backend (default: build-bench-crypto)")
+    parser.add_argument("--backends", default=",".join(BACKENDS),
+                        help="comma separated list of backends (default: {})".format(",".join(BACKENDS)))
+    parser.add_argument("--min-time", type=float, default=0.5,
+                        help="minimum time per benchmark in seconds (default: 0.5)")
+    parser.add_argument("--report", nargs="+", metavar="JSON",
+                        help="generate report from existing tr31_bench JSON files instead")
+    parser.add_argument("source_dir", nargs="?",
+                        default=os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir),
+                        help="source tree (default: parent directory of this script)")
+    args = parser.parse_args()
+
+    if args.report:
+        report(args.report)
+        return 0
+
+    backends = [b.strip() for b in args.backends.split(",") if b.strip()]
+    for backend in backends:
+        if backend not in BACKENDS:
+            parser.error("unknown backend \"{}\"".format(backend))
+
+    os.makedirs(args.build_root, exist_ok=True)
+    paths = []
+    for backend in backends:
+        path = build_and_run(os.path.abspath(args.source_dir), args.build_root, backend, args.min_time)
+        if path:
+            paths.append(path)
+    if not paths:
+        print("No crypto backends available", file=sys.stderr)
+        return 1
+
+    report(paths)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
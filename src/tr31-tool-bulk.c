@@ -0,0 +1,1038 @@
+/**
+ * @file tr31-tool-bulk.c
+ * @brief Bulk processing of newline separated records for tr31-tool
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31-tool-bulk.h"
+#include "tr31-tool-io.h"
+#include "tr31_config.h"
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#define TR31_TOOL_BULK_BATCH_RECORDS (4096) // maximum number of records per batch
+#define TR31_TOOL_BULK_READ_SIZE (1024 * 1024) // initial input buffer size
+#define TR31_TOOL_BULK_WRITE_SIZE (1024 * 1024) // output buffer size when writev() is not available
+#define TR31_TOOL_BULK_JOURNAL_MAGIC "tr31-tool-journal"
+#define TR31_TOOL_BULK_JOURNAL_VERSION (2)
+
+// Input reader state
+struct tr31_tool_bulk_reader_t {
+	FILE* file;
+	const struct tr31_tool_io_map_t* map;
+	bool eof;
+
+	// input data containing unprocessed data in [pos, data_len)
+	// either points to the input buffer or to the input file mapping
+	const char* data;
+	size_t data_len;
+	size_t pos;
+
+	// input buffer when the input file is not mapped
+	char* buf;
+	size_t buf_len;
+
+	// input offset of the start of the input data
+	uint64_t offset;
+
+	// line number of the last line that was read
+	size_t line_number;
+};
+
+// Worker pool state
+struct tr31_tool_bulk_pool_t {
+	const struct tr31_tool_bulk_config_t* config;
+
+	// current batch
+	struct tr31_tool_bulk_record_t* records;
+	size_t records_count;
+	atomic_size_t next_record;
+
+#ifdef HAVE_PTHREAD
+	bool initialised; // mutex and condition variables are initialised
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	unsigned int generation;
+	unsigned int busy_workers;
+	bool shutdown;
+
+	pthread_t* threads;
+	unsigned int threads_count;
+#endif
+};
+
+// Journal state
+struct tr31_tool_bulk_journal_t {
+	uint64_t input_offset;
+	uint64_t output_offset;
+	size_t line_number;
+	struct tr31_tool_bulk_stats_t stats;
+
+	// identity of input and processing parameters that must match to resume
+	uint64_t input_size;
+	long long input_mtime;
+	uint64_t input_ino;
+	char id[128];
+	char input_path[4096];
+};
+
+// helper functions
+static double tr31_tool_bulk_now(void);
+static void tr31_tool_bulk_cleanse(void* buf, size_t len);
+static int tr31_tool_bulk_output_grow(struct tr31_tool_bulk_record_t* record, size_t buf_len);
+static int tr31_tool_bulk_reader_init(struct tr31_tool_bulk_reader_t* reader, FILE* file, const struct tr31_tool_io_map_t* map, uint64_t offset, size_t line_number);
+static void tr31_tool_bulk_reader_release(struct tr31_tool_bulk_reader_t* reader);
+static int tr31_tool_bulk_read_batch(struct tr31_tool_bulk_reader_t* reader, struct tr31_tool_bulk_record_t* records, size_t* records_count);
+static void tr31_tool_bulk_process(struct tr31_tool_bulk_pool_t* pool);
+static int tr31_tool_bulk_pool_init(struct tr31_tool_bulk_pool_t* pool, const struct tr31_tool_bulk_config_t* config);
+static void tr31_tool_bulk_pool_run(struct tr31_tool_bulk_pool_t* pool, struct tr31_tool_bulk_record_t* records, size_t records_count);
+static void tr31_tool_bulk_pool_release(struct tr31_tool_bulk_pool_t* pool);
+static int tr31_tool_bulk_journal_read(const char* path, struct tr31_tool_bulk_journal_t* journal);
+static int tr31_tool_bulk_journal_read_line(FILE* file, char* buf, size_t buf_len);
+static int tr31_tool_bulk_journal_write(const char* path, const struct tr31_tool_bulk_journal_t* journal);
+static int tr31_tool_bulk_sync(FILE* file);
+static void tr31_tool_bulk_print_progress(const struct tr31_tool_bulk_stats_t* stats, uint64_t input_size, bool final);
+
+static double tr31_tool_bulk_now(void)
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	timespec_get(&ts, TIME_UTC);
+#endif
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void tr31_tool_bulk_cleanse(void* buf, size_t len)
+{
+	// volatile pointer prevents the compiler from removing the memset
+	volatile uint8_t* ptr = buf;
+	while (len--) {
+		*ptr++ = 0;
+	}
+}
+
+static int tr31_tool_bulk_output_grow(struct tr31_tool_bulk_record_t* record, size_t buf_len)
+{
+	char* buf;
+
+	// record output may contain cleartext keys and realloc() would leave
+	// the previous buffer uncleansed; copy and cleanse explicitly instead
+	buf = malloc(buf_len);
+	if (!buf) {
+		return -1;
+	}
+	if (record->output) {
+		memcpy(buf, record->output, record->output_len);
+		tr31_tool_bulk_cleanse(record->output, record->output_buf_len);
+		free(record->output);
+	}
+	record->output = buf;
+	record->output_buf_len = buf_len;
+
+	return 0;
+}
+
+int tr31_tool_bulk_output_append(struct tr31_tool_bulk_record_t* record, const void* data, size_t len)
+{
+	if (record->output_len + len > record->output_buf_len) {
+		// grow output buffer geometrically
+		size_t buf_len = record->output_buf_len ? record->output_buf_len : 256;
+
+		while (buf_len < record->output_len + len) {
+			buf_len *= 2;
+		}
+		if (tr31_tool_bulk_output_grow(record, buf_len)) {
+			return -1;
+		}
+	}
+
+	memcpy(record->output + record->output_len, data, len);
+	record->output_len += len;
+
+	return 0;
+}
+
+int tr31_tool_bulk_output_printf(struct tr31_tool_bulk_record_t* record, const char* format, ...)
+{
+	int r;
+	va_list ap;
+	int len;
+	char str[256];
+
+	va_start(ap, format);
+	len = vsnprintf(str, sizeof(str), format, ap);
+	va_end(ap);
+	if (len < 0) {
+		tr31_tool_bulk_cleanse(str, sizeof(str));
+		return -1;
+	}
+	if ((size_t)len < sizeof(str)) {
+		r = tr31_tool_bulk_output_append(record, str, len);
+		tr31_tool_bulk_cleanse(str, sizeof(str));
+		return r;
+	}
+	tr31_tool_bulk_cleanse(str, sizeof(str));
+
+	// formatted string is too long for temporary buffer; format directly
+	// into output buffer instead
+	if (record->output_len + len + 1 > record->output_buf_len) {
+		if (tr31_tool_bulk_output_grow(record, record->output_len + len + 1)) {
+			return -1;
+		}
+	}
+	va_start(ap, format);
+	vsnprintf(record->output + record->output_len, len + 1, format, ap);
+	va_end(ap);
+	record->output_len += len;
+
+	return 0;
+}
+
+static int tr31_tool_bulk_reader_init(struct tr31_tool_bulk_reader_t* reader, FILE* file, const struct tr31_tool_io_map_t* map, uint64_t offset, size_t line_number)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->file = file;
+	reader->line_number = line_number;
+
+	if (map) {
+		// the whole input is available and records refer to it directly
+		if (offset > map->len) {
+			return -2;
+		}
+		reader->map = map;
+		reader->eof = true;
+		reader->data = map->data;
+		reader->data_len = map->len;
+		reader->pos = offset;
+		return 0;
+	}
+
+	reader->offset = offset;
+	reader->buf_len = TR31_TOOL_BULK_READ_SIZE;
+	reader->buf = malloc(reader->buf_len);
+	if (!reader->buf) {
+		return -1;
+	}
+	reader->data = reader->buf;
+
+	return 0;
+}
+
+static void tr31_tool_bulk_reader_release(struct tr31_tool_bulk_reader_t* reader)
+{
+	free(reader->buf);
+	memset(reader, 0, sizeof(*reader));
+}
+
+static int tr31_tool_bulk_read_batch(struct tr31_tool_bulk_reader_t* reader, struct tr31_tool_bulk_record_t* records, size_t* records_count)
+{
+	size_t count = 0;
+
+	// discard data consumed by the previous batch, unless the input is mapped
+	if (reader->pos && !reader->map) {
+		memmove(reader->buf, reader->buf + reader->pos, reader->data_len - reader->pos);
+		reader->data_len -= reader->pos;
+		reader->offset += reader->pos;
+		reader->pos = 0;
+	}
+
+	while (count < TR31_TOOL_BULK_BATCH_RECORDS) {
+		const char* line = reader->data + reader->pos;
+		size_t remaining_len = reader->data_len - reader->pos;
+		const char* eol;
+		size_t line_len;
+
+		eol = memchr(line, '\n', remaining_len);
+		if (!eol) {
+			if (reader->eof) {
+				if (!remaining_len) {
+					// no more data
+					break;
+				}
+
+				// last line without line ending
+				eol = line + remaining_len;
+				reader->pos = reader->data_len;
+
+			} else if (count) {
+				// process current batch before reading more data
+				break;
+
+			} else {
+				size_t read_len;
+
+				// grow input buffer geometrically if current line does not fit
+				if (reader->data_len == reader->buf_len) {
+					char* buf = realloc(reader->buf, reader->buf_len * 2);
+					if (!buf) {
+						return -1;
+					}
+					reader->buf = buf;
+					reader->buf_len *= 2;
+					reader->data = reader->buf;
+				}
+
+				read_len = fread(reader->buf + reader->data_len, 1, reader->buf_len - reader->data_len, reader->file);
+				if (ferror(reader->file)) {
+					return -2;
+				}
+				if (!read_len) {
+					reader->eof = true;
+				}
+				reader->data_len += read_len;
+				continue;
+			}
+		} else {
+			reader->pos = eol - reader->data + 1;
+		}
+
+		// exclude line ending, including carriage return, if any
+		line_len = eol - line;
+		if (line_len && line[line_len - 1] == '\r') {
+			--line_len;
+		}
+
+		++reader->line_number;
+		records[count].line_number = reader->line_number;
+		records[count].line = line;
+		records[count].line_len = line_len;
+		records[count].result = 0;
+		tr31_tool_bulk_cleanse(records[count].output, records[count].output_buf_len);
+		records[count].output_len = 0;
+		++count;
+	}
+
+	*records_count = count;
+	return 0;
+}
+
+static void tr31_tool_bulk_process(struct tr31_tool_bulk_pool_t* pool)
+{
+	size_t i;
+
+	// claim records until none remain
+	while ((i = atomic_fetch_add(&pool->next_record, 1)) < pool->records_count) {
+		pool->config->func(pool->config->ctx, &pool->records[i]);
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void* tr31_tool_bulk_worker(void* arg)
+{
+	struct tr31_tool_bulk_pool_t* pool = arg;
+	unsigned int generation = 0;
+
+	while (true) {
+		// wait for next batch
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->generation == generation && !pool->shutdown) {
+			pthread_cond_wait(&pool->start_cond, &pool->mutex);
+		}
+		if (pool->shutdown) {
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		tr31_tool_bulk_process(pool);
+
+		// report completion of batch
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->busy_workers == 0) {
+			pthread_cond_signal(&pool->done_cond);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+#endif
+
+static int tr31_tool_bulk_pool_init(struct tr31_tool_bulk_pool_t* pool, const struct tr31_tool_bulk_config_t* config)
+{
+	memset(pool, 0, sizeof(*pool));
+	pool->config = config;
+	atomic_init(&pool->next_record, 0);
+
+#ifdef HAVE_PTHREAD
+	unsigned int jobs = config->jobs;
+
+	if (!jobs) {
+#ifdef _SC_NPROCESSORS_ONLN
+		long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = cpu_count > 0 ? cpu_count : 1;
+#else
+		jobs = 1;
+#endif
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	pool->initialised = true;
+
+	// calling thread also processes records
+	if (jobs > 1) {
+		pool->threads = calloc(jobs - 1, sizeof(*pool->threads));
+		if (!pool->threads) {
+			return -1;
+		}
+		for (unsigned int i = 0; i < jobs - 1; ++i) {
+			if (pthread_create(&pool->threads[i], NULL, tr31_tool_bulk_worker, pool)) {
+				// continue with the threads that were started
+				break;
+			}
+			++pool->threads_count;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+static void tr31_tool_bulk_pool_run(struct tr31_tool_bulk_pool_t* pool, struct tr31_tool_bulk_record_t* records, size_t records_count)
+{
+	pool->records = records;
+	pool->records_count = records_count;
+	atomic_store(&pool->next_record, 0);
+
+#ifdef HAVE_PTHREAD
+	if (pool->threads_count) {
+		// start workers
+		pthread_mutex_lock(&pool->mutex);
+		pool->busy_workers = pool->threads_count;
+		++pool->generation;
+		pthread_cond_broadcast(&pool->start_cond);
+		pthread_mutex_unlock(&pool->mutex);
+
+		tr31_tool_bulk_process(pool);
+
+		// wait for workers to complete batch
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->busy_workers) {
+			pthread_cond_wait(&pool->done_cond, &pool->mutex);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+#endif
+
+	tr31_tool_bulk_process(pool);
+}
+
+static void tr31_tool_bulk_pool_release(struct tr31_tool_bulk_pool_t* pool)
+{
+#ifdef HAVE_PTHREAD
+	if (!pool->initialised) {
+		// pool was never initialised; nothing to release
+		memset(pool, 0, sizeof(*pool));
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (unsigned int i = 0; i < pool->threads_count; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	free(pool->threads);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->start_cond);
+	pthread_mutex_destroy(&pool->mutex);
+#endif
+
+	memset(pool, 0, sizeof(*pool));
+}
+
+static int tr31_tool_bulk_journal_read(const char* path, struct tr31_tool_bulk_journal_t* journal)
+{
+	FILE* file;
+	char magic[32];
+	unsigned int version;
+	unsigned long long input_offset;
+	unsigned long long output_offset;
+	unsigned long long input_size;
+	unsigned long long input_ino;
+	size_t error_count_len;
+	int r;
+
+	memset(journal, 0, sizeof(*journal));
+
+	file = fopen(path, "r");
+	if (!file) {
+		// no journal
+		return 1;
+	}
+
+	r = fscanf(file, "%31s %u %llu %llu %zu %zu %zu %zu %zu",
+		magic,
+		&version,
+		&input_offset,
+		&output_offset,
+		&journal->line_number,
+		&journal->stats.records,
+		&journal->stats.errors,
+		&journal->stats.internal_errors,
+		&error_count_len
+	);
+	if (r != 9 ||
+		strcmp(magic, TR31_TOOL_BULK_JOURNAL_MAGIC) != 0 ||
+		version != TR31_TOOL_BULK_JOURNAL_VERSION ||
+		error_count_len != sizeof(journal->stats.error_counts) / sizeof(journal->stats.error_counts[0])
+	) {
+		fclose(file);
+		return -1;
+	}
+	for (size_t i = 0; i < error_count_len; ++i) {
+		if (fscanf(file, "%zu", &journal->stats.error_counts[i]) != 1) {
+			fclose(file);
+			return -1;
+		}
+	}
+	r = fscanf(file, "%llu %lld %llu", &input_size, &journal->input_mtime, &input_ino);
+	if (r != 3 ||
+		fgetc(file) != '\n' ||
+		tr31_tool_bulk_journal_read_line(file, journal->id, sizeof(journal->id)) ||
+		tr31_tool_bulk_journal_read_line(file, journal->input_path, sizeof(journal->input_path))
+	) {
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+
+	journal->input_offset = input_offset;
+	journal->output_offset = output_offset;
+	journal->input_size = input_size;
+	journal->input_ino = input_ino;
+
+	return 0;
+}
+
+static int tr31_tool_bulk_journal_read_line(FILE* file, char* buf, size_t buf_len)
+{
+	size_t len;
+
+	if (!fgets(buf, buf_len, file)) {
+		return -1;
+	}
+	len = strlen(buf);
+	if (!len || buf[len - 1] != '\n') {
+		// line is incomplete or too long
+		return -1;
+	}
+	buf[len - 1] = 0;
+
+	return 0;
+}
+
+static int tr31_tool_bulk_journal_write(const char* path, const struct tr31_tool_bulk_journal_t* journal)
+{
+	int r;
+	FILE* file;
+	size_t tmp_path_len;
+	char* tmp_path;
+	const size_t error_count_len = sizeof(journal->stats.error_counts) / sizeof(journal->stats.error_counts[0]);
+
+	// write journal to temporary file and then rename it such that the
+	// journal is always complete, even if interrupted
+	tmp_path_len = strlen(path) + 5;
+	tmp_path = malloc(tmp_path_len);
+	if (!tmp_path) {
+		return -1;
+	}
+	snprintf(tmp_path, tmp_path_len, "%s.tmp", path);
+
+	file = fopen(tmp_path, "w");
+	if (!file) {
+		r = -1;
+		goto exit;
+	}
+	fprintf(file, "%s %u %llu %llu %zu %zu %zu %zu %zu",
+		TR31_TOOL_BULK_JOURNAL_MAGIC,
+		TR31_TOOL_BULK_JOURNAL_VERSION,
+		(unsigned long long)journal->input_offset,
+		(unsigned long long)journal->output_offset,
+		journal->line_number,
+		journal->stats.records,
+		journal->stats.errors,
+		journal->stats.internal_errors,
+		error_count_len
+	);
+	for (size_t i = 0; i < error_count_len; ++i) {
+		fprintf(file, " %zu", journal->stats.error_counts[i]);
+	}
+	fprintf(file, " %llu %lld %llu\n%s\n%s\n",
+		(unsigned long long)journal->input_size,
+		journal->input_mtime,
+		(unsigned long long)journal->input_ino,
+		journal->id,
+		journal->input_path
+	);
+	r = tr31_tool_bulk_sync(file);
+	if (fclose(file) || r) {
+		r = -2;
+		goto exit;
+	}
+
+	r = rename(tmp_path, path);
+	if (r) {
+		r = -3;
+		goto exit;
+	}
+
+	r = 0;
+	goto exit;
+
+exit:
+	free(tmp_path);
+	return r;
+}
+
+static int tr31_tool_bulk_sync(FILE* file)
+{
+	if (fflush(file)) {
+		return -1;
+	}
+
+#ifdef HAVE_FSYNC
+	if (fsync(fileno(file))) {
+		return -2;
+	}
+#endif
+
+	return 0;
+}
+
+static void tr31_tool_bulk_print_progress(const struct tr31_tool_bulk_stats_t* stats, uint64_t input_size, bool final)
+{
+	double rate = 0;
+	size_t records = stats->records - stats->resumed_records;
+
+	if (stats->elapsed > 0) {
+		rate = records / stats->elapsed;
+	}
+
+	fprintf(stderr, "Processed %zu records (%.0f records/s), %zu errors",
+		stats->records,
+		rate,
+		stats->errors
+	);
+	if (!final && input_size && stats->input_bytes && stats->input_bytes < input_size) {
+		// estimate remaining time using input consumed during this run
+		double eta = stats->elapsed * (input_size - stats->input_bytes) / stats->input_bytes;
+		fprintf(stderr, ", ETA %02u:%02u:%02u",
+			(unsigned int)(eta / 3600),
+			(unsigned int)(eta / 60) % 60,
+			(unsigned int)eta % 60
+		);
+	}
+	if (final) {
+		fprintf(stderr, " in %.3f seconds", stats->elapsed);
+	}
+	fprintf(stderr, "\n");
+	fflush(stderr);
+}
+
+int tr31_tool_bulk_run(const struct tr31_tool_bulk_config_t* config, struct tr31_tool_bulk_stats_t* stats)
+{
+	int r;
+	bool input_is_stdin;
+	bool output_is_stdout;
+	FILE* input = NULL;
+	FILE* output = NULL;
+	uint64_t input_size = 0;
+	long long input_mtime = 0;
+	uint64_t input_ino = 0;
+	struct tr31_tool_bulk_journal_t journal;
+	bool journal_found = false;
+	struct tr31_tool_io_map_t map;
+	bool input_is_mapped = false;
+	struct tr31_tool_bulk_reader_t reader;
+	struct tr31_tool_bulk_pool_t pool;
+	struct tr31_tool_bulk_record_t* records = NULL;
+	struct tr31_tool_io_vec_t* vecs = NULL;
+	size_t records_count;
+	uint64_t resumed_input_bytes;
+	double start_time;
+	double last_progress_time;
+
+	if (!config || !config->input_path || !config->func || !stats) {
+		return -1;
+	}
+	memset(stats, 0, sizeof(*stats));
+	memset(&map, 0, sizeof(map));
+	memset(&reader, 0, sizeof(reader));
+	memset(&pool, 0, sizeof(pool));
+
+	input_is_stdin = strcmp(config->input_path, "-") == 0;
+	output_is_stdout = !config->output_path || strcmp(config->output_path, "-") == 0;
+	if (config->journal_path && (input_is_stdin || output_is_stdout)) {
+		fprintf(stderr, "Journal requires input and output files\n");
+		return 1;
+	}
+	if (config->journal_path && (
+		strlen(config->input_path) >= sizeof(journal.input_path) ||
+		strchr(config->input_path, '\n') ||
+		(config->journal_id && (strlen(config->journal_id) >= sizeof(journal.id) || strchr(config->journal_id, '\n')))
+	)) {
+		fprintf(stderr, "Input path or journal identifier is unsuitable for journal\n");
+		return 1;
+	}
+
+	// read journal, if available, to resume interrupted processing
+	memset(&journal, 0, sizeof(journal));
+	if (config->journal_path) {
+		r = tr31_tool_bulk_journal_read(config->journal_path, &journal);
+		if (r < 0) {
+			fprintf(stderr, "Invalid journal \"%s\"\n", config->journal_path);
+			return 1;
+		}
+		if (r == 0) {
+			journal_found = true;
+			*stats = journal.stats;
+			stats->resumed_records = journal.stats.records;
+			stats->input_bytes = 0;
+			stats->elapsed = 0;
+		}
+	}
+	resumed_input_bytes = journal.input_offset;
+
+	// open input
+	if (input_is_stdin) {
+		input = stdin;
+	} else {
+		input = fopen(config->input_path, "rb");
+		if (!input) {
+			fprintf(stderr, "Failed to open input \"%s\": %s\n", config->input_path, strerror(errno));
+			r = 1;
+			goto exit;
+		}
+#ifdef HAVE_UNISTD_H
+		struct stat st;
+		if (fstat(fileno(input), &st) == 0 && S_ISREG(st.st_mode)) {
+			input_size = st.st_size;
+			input_mtime = st.st_mtime;
+			input_ino = st.st_ino;
+		}
+#endif
+
+		// only resume using the input and processing parameters that
+		// produced the journal; anything else would splice the output
+		if (journal_found) {
+			if (strcmp(journal.input_path, config->input_path) != 0 ||
+				journal.input_size != input_size ||
+				journal.input_mtime != input_mtime ||
+				journal.input_ino != input_ino
+			) {
+				fprintf(stderr, "Journal \"%s\" does not match input \"%s\"; remove the journal to restart\n",
+					config->journal_path,
+					config->input_path
+				);
+				r = 1;
+				goto exit;
+			}
+			if (strcmp(journal.id, config->journal_id ? config->journal_id : "") != 0) {
+				fprintf(stderr, "Journal \"%s\" was created using different keys or parameters; remove the journal to restart\n",
+					config->journal_path
+				);
+				r = 1;
+				goto exit;
+			}
+			fprintf(stderr, "Resuming after line %zu using journal \"%s\"\n",
+				journal.line_number,
+				config->journal_path
+			);
+		}
+		journal.input_size = input_size;
+		journal.input_mtime = input_mtime;
+		journal.input_ino = input_ino;
+		snprintf(journal.id, sizeof(journal.id), "%s", config->journal_id ? config->journal_id : "");
+		snprintf(journal.input_path, sizeof(journal.input_path), "%s", config->input_path);
+
+		// map regular files to avoid copying the input
+		r = tr31_tool_io_map(input, &map);
+		if (r < 0) {
+			fprintf(stderr, "Failed to map input \"%s\"\n", config->input_path);
+			r = 1;
+			goto exit;
+		}
+		input_is_mapped = (r == 0);
+
+		if (journal.input_offset && !input_is_mapped) {
+#ifdef HAVE_FSEEKO
+			r = fseeko(input, journal.input_offset, SEEK_SET);
+#else
+			r = fseek(input, journal.input_offset, SEEK_SET);
+#endif
+			if (r) {
+				fprintf(stderr, "Failed to seek input \"%s\": %s\n", config->input_path, strerror(errno));
+				r = 1;
+				goto exit;
+			}
+		}
+	}
+
+	// open output
+	if (output_is_stdout) {
+		output = stdout;
+	} else if (journal.output_offset) {
+		// discard output that was written after the last journal entry
+		output = fopen(config->output_path, "r+b");
+		if (!output) {
+			fprintf(stderr, "Failed to open output \"%s\": %s\n", config->output_path, strerror(errno));
+			r = 1;
+			goto exit;
+		}
+#ifdef HAVE_UNISTD_H
+		if (ftruncate(fileno(output), journal.output_offset)) {
+			fprintf(stderr, "Failed to truncate output \"%s\": %s\n", config->output_path, strerror(errno));
+			r = 1;
+			goto exit;
+		}
+#endif
+#ifdef HAVE_FSEEKO
+		r = fseeko(output, journal.output_offset, SEEK_SET);
+#else
+		r = fseek(output, journal.output_offset, SEEK_SET);
+#endif
+		if (r) {
+			fprintf(stderr, "Failed to seek output \"%s\": %s\n", config->output_path, strerror(errno));
+			r = 1;
+			goto exit;
+		}
+	} else {
+		output = fopen(config->output_path, "wb");
+		if (!output) {
+			fprintf(stderr, "Failed to open output \"%s\": %s\n", config->output_path, strerror(errno));
+			r = 1;
+			goto exit;
+		}
+	}
+	stats->output_bytes = journal.output_offset;
+
+	// use large output buffer to reduce the number of writes
+	setvbuf(output, NULL, _IOFBF, TR31_TOOL_BULK_WRITE_SIZE);
+
+	// write output header for new output
+	if (config->output_header && !journal.output_offset) {
+		size_t header_len = strlen(config->output_header);
+		if (fwrite(config->output_header, 1, header_len, output) != header_len) {
+			fprintf(stderr, "Failed to write output: %s\n", strerror(errno));
+			r = 1;
+			goto exit;
+		}
+		stats->output_bytes += header_len;
+	}
+
+	r = tr31_tool_bulk_reader_init(
+		&reader,
+		input,
+		input_is_mapped ? &map : NULL,
+		journal.input_offset,
+		journal.line_number
+	);
+	if (r) {
+		fprintf(stderr, "Failed to prepare input \"%s\"\n", config->input_path);
+		r = 1;
+		goto exit;
+	}
+	records = calloc(TR31_TOOL_BULK_BATCH_RECORDS, sizeof(*records));
+	vecs = calloc(TR31_TOOL_BULK_BATCH_RECORDS, sizeof(*vecs));
+	if (!records || !vecs) {
+		fprintf(stderr, "Failed to allocate records\n");
+		r = 1;
+		goto exit;
+	}
+	r = tr31_tool_bulk_pool_init(&pool, config);
+	if (r) {
+		fprintf(stderr, "Failed to start worker threads\n");
+		r = 1;
+		goto exit;
+	}
+
+	start_time = tr31_tool_bulk_now();
+	last_progress_time = start_time;
+	while (true) {
+		// read next batch of records
+		r = tr31_tool_bulk_read_batch(&reader, records, &records_count);
+		if (r) {
+			fprintf(stderr, "Failed to read input: %s\n", strerror(errno));
+			r = 1;
+			goto exit;
+		}
+		if (!records_count) {
+			// done
+			break;
+		}
+
+		// process batch using worker pool
+		tr31_tool_bulk_pool_run(&pool, records, records_count);
+
+		// write output of whole batch in input order
+		for (size_t i = 0; i < records_count; ++i) {
+			vecs[i].data = records[i].output;
+			vecs[i].len = records[i].output_len;
+		}
+		r = tr31_tool_io_writev(output, vecs, records_count);
+		if (r) {
+			fprintf(stderr, "Failed to write output: %s\n", strerror(errno));
+			r = 1;
+			goto exit;
+		}
+
+		for (size_t i = 0; i < records_count; ++i) {
+			stats->output_bytes += records[i].output_len;
+
+			// update statistics
+			++stats->records;
+			if (records[i].result) {
+				if (config->report_errors) {
+					fprintf(stderr, "Line %zu: %s\n",
+						records[i].line_number,
+						tr31_get_error_string(records[i].result)
+					);
+				}
+				++stats->errors;
+				if (records[i].result > 0 &&
+					(size_t)records[i].result < sizeof(stats->error_counts) / sizeof(stats->error_counts[0])
+				) {
+					++stats->error_counts[records[i].result];
+				} else {
+					++stats->internal_errors;
+				}
+			}
+		}
+		stats->input_bytes = reader.offset + reader.pos - resumed_input_bytes;
+		stats->elapsed = tr31_tool_bulk_now() - start_time;
+
+		// commit batch to journal after output is synchronised
+		if (config->journal_path) {
+			r = tr31_tool_bulk_sync(output);
+			if (r) {
+				fprintf(stderr, "Failed to write output: %s\n", strerror(errno));
+				r = 1;
+				goto exit;
+			}
+
+			journal.input_offset = reader.offset + reader.pos;
+			journal.output_offset = stats->output_bytes;
+			journal.line_number = reader.line_number;
+			journal.stats = *stats;
+			r = tr31_tool_bulk_journal_write(config->journal_path, &journal);
+			if (r) {
+				fprintf(stderr, "Failed to write journal \"%s\"\n", config->journal_path);
+				r = 1;
+				goto exit;
+			}
+		}
+
+		// report progress at most once per second
+		if (config->progress && stats->elapsed + start_time - last_progress_time >= 1.0) {
+			last_progress_time = stats->elapsed + start_time;
+			tr31_tool_bulk_print_progress(stats, input_size ? input_size - resumed_input_bytes : 0, false);
+		}
+	}
+
+	if (fflush(output)) {
+		fprintf(stderr, "Failed to write output: %s\n", strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	stats->elapsed = tr31_tool_bulk_now() - start_time;
+	if (config->progress) {
+		tr31_tool_bulk_print_progress(stats, 0, true);
+	}
+
+	// processing is complete and journal is no longer needed
+	if (config->journal_path) {
+		remove(config->journal_path);
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_tool_bulk_pool_release(&pool);
+	if (records) {
+		for (size_t i = 0; i < TR31_TOOL_BULK_BATCH_RECORDS; ++i) {
+			tr31_tool_bulk_cleanse(records[i].output, records[i].output_buf_len);
+			free(records[i].output);
+		}
+		free(records);
+	}
+	free(vecs);
+	tr31_tool_bulk_reader_release(&reader);
+	tr31_tool_io_unmap(&map);
+	if (input && input != stdin) {
+		fclose(input);
+	}
+	if (output && output != stdout) {
+		if (fclose(output) && !r) {
+			fprintf(stderr, "Failed to write output: %s\n", strerror(errno));
+			r = 1;
+		}
+	}
+
+	return r;
+}
+
+void tr31_tool_bulk_print_stats(const struct tr31_tool_bulk_stats_t* stats)
+{
+	fprintf(stderr, "Records: %zu\n", stats->records);
+	if (stats->resumed_records) {
+		fprintf(stderr, "Records from previous run: %zu\n", stats->resumed_records);
+	}
+	fprintf(stderr, "Errors: %zu\n", stats->errors);
+	for (size_t i = 0; i < sizeof(stats->error_counts) / sizeof(stats->error_counts[0]); ++i) {
+		if (stats->error_counts[i]) {
+			fprintf(stderr, "\t[%zu] %s: %zu\n", i, tr31_get_error_string(i), stats->error_counts[i]);
+		}
+	}
+	if (stats->internal_errors) {
+		fprintf(stderr, "\t%s: %zu\n", tr31_get_error_string(-1), stats->internal_errors);
+	}
+	if (stats->elapsed > 0) {
+		fprintf(stderr, "Throughput: %.0f records/s (%.1f MiB/s)\n",
+			(stats->records - stats->resumed_records) / stats->elapsed,
+			stats->input_bytes / stats->elapsed / (1024 * 1024)
+		);
+	}
+}
@@ -0,0 +1,117 @@
+/**
+ * @file tr31-tool-bulk.h
+ * @brief Bulk processing of newline separated records for tr31-tool
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TR31_TOOL_BULK_H
+#define TR31_TOOL_BULK_H
+
+#include "tr31.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Bulk processing record
+struct tr31_tool_bulk_record_t {
+	size_t line_number; ///< Line number of record in input, starting at 1
+	const char* line; ///< Record input line, without line ending. Not null-terminated.
+	size_t line_len; ///< Length of record input line in bytes
+
+	int result; ///< Result of record processing. See @ref tr31_error_t
+
+	char* output; ///< Record output. Written verbatim and in input order.
+	size_t output_len; ///< Length of record output in bytes
+	size_t output_buf_len; ///< Length of record output buffer in bytes
+};
+
+/**
+ * Bulk processing function. Called concurrently by multiple threads, but
+ * only once for each record.
+ * @param ctx Context provided by @ref tr31_tool_bulk_config_t.ctx
+ * @param record Record to process. Populate @ref tr31_tool_bulk_record_t.result
+ *               and use @ref tr31_tool_bulk_output_append() or
+ *               @ref tr31_tool_bulk_output_printf() for output.
+ */
+typedef void (*tr31_tool_bulk_func_t)(void* ctx, struct tr31_tool_bulk_record_t* record);
+
+/// Bulk processing configuration
+struct tr31_tool_bulk_config_t {
+	const char* input_path; ///< Input file path. Use - for stdin.
+	const char* output_path; ///< Output file path. Use - or NULL for stdout.
+	const char* journal_path; ///< Journal file path used to resume interrupted processing. NULL to disable.
+	const char* journal_id; ///< Identifier of processing parameters, such as key check values, recorded in journal. Resuming requires the same identifier. NULL for none.
+	const char* output_header; ///< Header written to new output. NULL to disable.
+	unsigned int jobs; ///< Number of worker threads. Zero for number of online processors.
+	bool progress; ///< Report progress to stderr
+	bool report_errors; ///< Report record errors, in input order, to stderr
+
+	tr31_tool_bulk_func_t func; ///< Bulk processing function
+	void* ctx; ///< Context for bulk processing function
+};
+
+/// Bulk processing statistics
+struct tr31_tool_bulk_stats_t {
+	size_t records; ///< Number of processed records
+	size_t errors; ///< Number of records with errors
+	size_t internal_errors; ///< Number of records with internal errors
+	size_t error_counts[TR31_ERROR_KCV_NOT_AVAILABLE + 1]; ///< Number of records per @ref tr31_error_t
+	uint64_t input_bytes; ///< Number of input bytes consumed
+	uint64_t output_bytes; ///< Number of output bytes written
+	double elapsed; ///< Elapsed time in seconds
+	size_t resumed_records; ///< Number of records processed by a previous run that was resumed
+};
+
+/**
+ * Append data to record output
+ * @param record Bulk processing record
+ * @param data Data to append
+ * @param len Length of data in bytes
+ * @return Zero for success. Non-zero for error.
+ */
+int tr31_tool_bulk_output_append(struct tr31_tool_bulk_record_t* record, const void* data, size_t len);
+
+/**
+ * Append formatted string to record output
+ * @param record Bulk processing record
+ * @param format printf() format string
+ * @return Zero for success. Non-zero for error.
+ */
+int tr31_tool_bulk_output_printf(struct tr31_tool_bulk_record_t* record, const char* format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/**
+ * Process all records in input and write the output of each record in input
+ * order. Records are separated by line feed (LF) and a trailing carriage
+ * return (CR) is removed.
+ * @param config Bulk processing configuration
+ * @param stats Bulk processing statistics output
+ * @return Zero for success. Non-zero for I/O or internal error.
+ *         Record errors are only reported by @p stats.
+ */
+int tr31_tool_bulk_run(const struct tr31_tool_bulk_config_t* config, struct tr31_tool_bulk_stats_t* stats);
+
+/**
+ * Print bulk processing statistics, including error counts by
+ * @ref tr31_error_t, to stderr
+ * @param stats Bulk processing statistics
+ */
+void tr31_tool_bulk_print_stats(const struct tr31_tool_bulk_stats_t* stats);
+
+#endif
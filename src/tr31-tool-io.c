@@ -0,0 +1,216 @@
+/**
+ * @file tr31-tool-io.c
+ * @brief File input/output helpers for tr31-tool
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31-tool-io.h"
+#include "tr31_config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_WRITEV
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+
+#define TR31_TOOL_IO_READ_SIZE (64 * 1024) // initial read buffer size
+#define TR31_TOOL_IO_WRITEV_COUNT (1024) // maximum number of buffers per writev()
+
+void* tr31_tool_io_read_file(FILE* file, size_t* len)
+{
+	char* buf = NULL;
+	size_t buf_len = 0;
+	size_t total_len = 0;
+
+	if (!file || !len) {
+		return NULL;
+	}
+	*len = 0;
+
+	do {
+		// grow buffer geometrically
+		if (total_len == buf_len) {
+			char* new_buf;
+			size_t new_buf_len = buf_len ? buf_len * 2 : TR31_TOOL_IO_READ_SIZE;
+
+			new_buf = realloc(buf, new_buf_len);
+			if (!new_buf) {
+				free(buf);
+				return NULL;
+			}
+			buf = new_buf;
+			buf_len = new_buf_len;
+		}
+
+		// read as much as the buffer allows
+		total_len += fread(buf + total_len, 1, buf_len - total_len, file);
+		if (ferror(file)) {
+			free(buf);
+			return NULL;
+		}
+	} while (!feof(file));
+
+	*len = total_len;
+	return buf;
+}
+
+int tr31_tool_io_map(FILE* file, struct tr31_tool_io_map_t* map)
+{
+	if (!file || !map) {
+		return -1;
+	}
+	memset(map, 0, sizeof(*map));
+
+#if defined(HAVE_UNISTD_H) && defined(HAVE_MMAP)
+	struct stat st;
+	void* data;
+
+	if (fstat(fileno(file), &st) || !S_ISREG(st.st_mode)) {
+		// not a regular file
+		return 1;
+	}
+	if (!st.st_size) {
+		// empty files cannot be mapped but require no data either
+		return 0;
+	}
+	if ((uintmax_t)st.st_size > SIZE_MAX) {
+		// too large for address space
+		return 1;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (data == MAP_FAILED) {
+		// fall back to stdio
+		return 1;
+	}
+#ifdef HAVE_POSIX_MADVISE
+	// advise the kernel to read ahead aggressively; failure is harmless
+	posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+
+	map->data = data;
+	map->len = st.st_size;
+	return 0;
+#else
+	// memory mapping not available on this platform
+	return 1;
+#endif
+}
+
+void tr31_tool_io_unmap(struct tr31_tool_io_map_t* map)
+{
+	if (!map) {
+		return;
+	}
+
+#ifdef HAVE_MMAP
+	if (map->data) {
+		munmap((void*)map->data, map->len);
+	}
+#endif
+
+	memset(map, 0, sizeof(*map));
+}
+
+int tr31_tool_io_writev(FILE* file, const struct tr31_tool_io_vec_t* vecs, size_t count)
+{
+	if (!file || (!vecs && count)) {
+		return -1;
+	}
+
+#ifdef HAVE_WRITEV
+	struct iovec iov[TR31_TOOL_IO_WRITEV_COUNT];
+	size_t iov_max = TR31_TOOL_IO_WRITEV_COUNT;
+	int fd = fileno(file);
+
+#ifdef IOV_MAX
+	if (iov_max > IOV_MAX) {
+		iov_max = IOV_MAX;
+	}
+#endif
+
+	// data buffered by stdio must precede data written directly
+	if (fflush(file)) {
+		return -2;
+	}
+
+	while (count) {
+		size_t iov_count = 0;
+		ssize_t written;
+
+		// populate as many buffers as allowed, skipping empty ones
+		while (count && iov_count < iov_max) {
+			if (vecs->len) {
+				iov[iov_count].iov_base = (void*)vecs->data;
+				iov[iov_count].iov_len = vecs->len;
+				++iov_count;
+			}
+			++vecs;
+			--count;
+		}
+		if (!iov_count) {
+			break;
+		}
+
+		// write until all buffers are complete, allowing for partial writes
+		for (struct iovec* ptr = iov; iov_count; ) {
+			written = writev(fd, ptr, iov_count);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -3;
+			}
+			if (!written) {
+				// no progress
+				return -3;
+			}
+			while (iov_count && (size_t)written >= ptr->iov_len) {
+				written -= ptr->iov_len;
+				++ptr;
+				--iov_count;
+			}
+			if (iov_count) {
+				ptr->iov_base = (char*)ptr->iov_base + written;
+				ptr->iov_len -= written;
+			}
+		}
+	}
+#else
+	for (size_t i = 0; i < count; ++i) {
+		if (vecs[i].len && fwrite(vecs[i].data, 1, vecs[i].len, file) != vecs[i].len) {
+			return -3;
+		}
+	}
+#endif
+
+	return 0;
+}
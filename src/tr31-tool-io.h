@@ -0,0 +1,76 @@
+/**
+ * @file tr31-tool-io.h
+ * @brief File input/output helpers for tr31-tool
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TR31_TOOL_IO_H
+#define TR31_TOOL_IO_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/// Read-only memory mapping of an input file
+struct tr31_tool_io_map_t {
+	const char* data; ///< Mapped file content
+	size_t len; ///< Length of mapped file content in bytes
+};
+
+/// Output buffer for use with @ref tr31_tool_io_writev()
+struct tr31_tool_io_vec_t {
+	const void* data; ///< Output data
+	size_t len; ///< Length of output data in bytes
+};
+
+/**
+ * Read entire file into memory. The buffer grows geometrically such that
+ * large inputs from pipes do not require a reallocation for every block.
+ * @param file File to read until end-of-file
+ * @param len Length of data read, in bytes
+ * @return Buffer containing data read. Use free() to release. NULL for error.
+ */
+void* tr31_tool_io_read_file(FILE* file, size_t* len);
+
+/**
+ * Map regular file into memory for sequential reading, from the start of the
+ * file and regardless of the current file position.
+ * @param file Input file
+ * @param map Memory mapping output. Use @ref tr31_tool_io_unmap() to release.
+ * @return Zero for success. Less than zero for error. Greater than zero if
+ *         @p file is not a regular file or cannot be mapped on this
+ *         platform, in which case the caller should use stdio instead.
+ */
+int tr31_tool_io_map(FILE* file, struct tr31_tool_io_map_t* map);
+
+/**
+ * Release memory mapping of input file
+ * @param map Memory mapping
+ */
+void tr31_tool_io_unmap(struct tr31_tool_io_map_t* map);
+
+/**
+ * Write multiple buffers to file, in order, using as few system calls as
+ * possible. Data buffered by stdio for @p file is flushed first.
+ * @param file Output file
+ * @param vecs Output buffers
+ * @param count Number of output buffers
+ * @return Zero for success. Non-zero for error.
+ */
+int tr31_tool_io_writev(FILE* file, const struct tr31_tool_io_vec_t* vecs, size_t count);
+
+#endif
@@ -20,6 +20,9 @@
 
 #include "tr31.h"
 #include "tr31_strings.h"
+#include "tr31-tool-bulk.h"
+#include "tr31-tool-io.h"
+#include "tr31_config.h"
 
 #include <stddef.h>
 #include <stdbool.h>
@@ -33,6 +36,10 @@
 #include <ctype.h> // for isalnum and friends
 #include <time.h> // for time, gmtime and strftime
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 // optional block CT parameters
 struct tr31_opt_block_CT {
 	uint8_t cert_format;
@@ -44,17 +51,29 @@ struct tr31_opt_block_CT {
 struct tr31_tool_options_t {
 	bool found_stdin_arg;
 	bool import;
+	bool import_file;
+	bool verify_file;
 	bool export;
+	bool export_file;
+	bool migrate;
 	bool kbpk;
 
 	// import parameters
-	// valid if import is true
+	// valid if import or import_file is true
 	size_t key_block_len;
 	char* key_block;
+	const char* import_file_path;
+	bool import_format_found;
+	unsigned int import_format;
 	uint32_t import_flags;
 
+	// verify parameters
+	// valid if verify_file is true
+	const char* verify_file_path;
+
 	// export parameters
-	// valid if export is true
+	// valid if export or export_file is true
+	const char* export_file_path;
 	size_t export_key_buf_len;
 	uint8_t* export_key_buf;
 	const char* export_key_algorithm;
@@ -85,25 +104,99 @@ struct tr31_tool_options_t {
 	uint8_t export_opt_block_WP_value;
 	uint32_t export_flags;
 
+	// migrate parameters
+	// valid if migrate is true
+	const char* migrate_input_path;
+	const char* migrate_output_path;
+	unsigned int migrate_format_version;
+	bool kbpk_old;
+	size_t kbpk_old_buf_len;
+	uint8_t kbpk_old_buf[32]; // max 256-bit KBPK
+	bool kbpk_new;
+	size_t kbpk_new_buf_len;
+	uint8_t kbpk_new_buf[32]; // max 256-bit KBPK
+
 	// kbpk parameters
 	// valid if kbpk is true
 	size_t kbpk_buf_len;
 	uint8_t kbpk_buf[32]; // max 256-bit KBPK
+
+	// bulk processing parameters
+	unsigned int jobs;
+
+	// library-wide counters output
+	const char* stats_path;
+};
+
+// bulk import output formats
+enum tr31_tool_import_format_t {
+	TR31_TOOL_IMPORT_FORMAT_NDJSON = 0,
+	TR31_TOOL_IMPORT_FORMAT_CSV,
+};
+
+// bulk key block import context
+struct tr31_tool_import_ctx_t {
+	bool decrypt;
+	struct tr31_key_t kbpk_tdes;
+	struct tr31_key_t kbpk_aes;
+	unsigned int format;
+	uint32_t import_flags;
+};
+
+// export manifest template or header cache entry
+struct tr31_tool_export_template_t {
+	struct tr31_tool_export_template_t* next;
+	char* name; // template name or export header
+	int result;
+	struct tr31_ctx_t tr31_ctx;
+	const struct tr31_key_t* kbpk;
+};
+
+// bulk key block export context
+struct tr31_tool_export_ctx_t {
+	const struct tr31_tool_options_t* options;
+	struct tr31_key_t kbpk_tdes;
+	struct tr31_key_t kbpk_aes;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;
+#endif
+	struct tr31_tool_export_template_t* templates;
+};
+
+// key block migration context
+struct tr31_tool_migrate_ctx_t {
+	struct tr31_key_t kbpk_old_tdes;
+	struct tr31_key_t kbpk_old_aes;
+	struct tr31_key_t kbpk_new_tdes;
+	struct tr31_key_t kbpk_new_aes;
+	unsigned int format_version;
+	uint32_t import_flags;
+	uint32_t export_flags;
 };
 
 // helper functions
 static error_t argp_parser_helper(int key, char* arg, struct argp_state* state);
-static void* read_file(FILE* file, size_t* len);
 static int parse_hex(const char* hex, void* bin, size_t bin_len);
+static void cleanse(void* buf, size_t length);
 static void print_hex(const void* buf, size_t length);
 static void print_str(const void* buf, size_t length);
 static void print_str_with_quotes(const void* buf, size_t length);
+static void output_hex(struct tr31_tool_bulk_record_t* record, const void* buf, size_t length);
+static void output_json_str(struct tr31_tool_bulk_record_t* record, const void* buf, size_t length);
+static void output_csv_str(struct tr31_tool_bulk_record_t* record, const void* buf, size_t length);
+static int parse_csv_line(char* line, char** fields, size_t fields_len, size_t* field_count);
+static int write_stats(const char* path);
 
 // argp option keys
 enum tr31_tool_option_keys_t {
 	TR31_TOOL_OPTION_IMPORT = -255, // negative value to avoid short options
 	TR31_TOOL_OPTION_IMPORT_NO_STRICT_VALIDATION,
+	TR31_TOOL_OPTION_IMPORT_FILE,
+	TR31_TOOL_OPTION_IMPORT_FORMAT,
+	TR31_TOOL_OPTION_VERIFY_FILE,
 	TR31_TOOL_OPTION_EXPORT,
+	TR31_TOOL_OPTION_EXPORT_FILE,
 	TR31_TOOL_OPTION_EXPORT_KEY_ALGORITHM,
 	TR31_TOOL_OPTION_EXPORT_FORMAT_VERSION,
 	TR31_TOOL_OPTION_EXPORT_TEMPLATE,
@@ -126,6 +219,12 @@ enum tr31_tool_option_keys_t {
 	TR31_TOOL_OPTION_EXPORT_OPT_BLOCK_WP,
 	TR31_TOOL_OPTION_EXPORT_NO_KEY_LENGTH_OBFUSCATION,
 	TR31_TOOL_OPTION_EXPORT_ZERO_OPT_BLOCK_PB,
+	TR31_TOOL_OPTION_MIGRATE,
+	TR31_TOOL_OPTION_MIGRATE_FORMAT_VERSION,
+	TR31_TOOL_OPTION_KBPK_OLD,
+	TR31_TOOL_OPTION_KBPK_NEW,
+	TR31_TOOL_OPTION_JOBS,
+	TR31_TOOL_OPTION_STATS,
 	TR31_TOOL_OPTION_KBPK,
 	TR31_TOOL_OPTION_VERSION,
 };
@@ -135,9 +234,13 @@ static struct argp_option argp_options[] = {
 	{ NULL, 0, NULL, 0, "Options for decoding/decrypting key blocks:", 1 },
 	{ "import", TR31_TOOL_OPTION_IMPORT, "KEYBLOCK", 0, "Import key block to decode/decrypt. Use - to read raw bytes from stdin. Optionally specify KBPK (--kbpk) to decrypt." },
 	{ "import-no-strict-validation", TR31_TOOL_OPTION_IMPORT_NO_STRICT_VALIDATION, NULL, 0, "Disable strict validation during key block import" },
+	{ "import-file", TR31_TOOL_OPTION_IMPORT_FILE, "FILE", 0, "Import key blocks in FILE, one per line, to decode/decrypt. Use - to read from stdin. Optionally specify KBPK (--kbpk) to decrypt. Outputs one record per key block to stdout, in input order." },
+	{ "import-format", TR31_TOOL_OPTION_IMPORT_FORMAT, "ndjson|csv", 0, "Output format for --import-file. Default is ndjson." },
+	{ "verify-file", TR31_TOOL_OPTION_VERIFY_FILE, "FILE", 0, "Verify key blocks in FILE, one per line, without extracting the keys. Use - to read from stdin. Requires KBPK (--kbpk). Outputs only the key blocks that failed verification, in input order." },
 
 	{ NULL, 0, NULL, 0, "Options for encoding/encrypting key blocks:", 2 },
 	{ "export", TR31_TOOL_OPTION_EXPORT, "KEY", 0, "Export key block containing KEY. Use - to read raw bytes from stdin. Requires KBPK (--kbpk). Requires either --export-key-algorithm, --export-format-version and --export-template, or only --export-header" },
+	{ "export-file", TR31_TOOL_OPTION_EXPORT_FILE, "MANIFEST", 0, "Export key blocks for all rows in the CSV MANIFEST file to stdout, one per line and in manifest order. Use - to read from stdin. Each row consists of the KEY (hex), either a template or an export header, and optional blocks formatted as ID=data and separated by semicolons. Requires KBPK (--kbpk). Template rows require --export-key-algorithm and --export-format-version. Failed rows result in empty lines." },
 	{ "export-key-algorithm", TR31_TOOL_OPTION_EXPORT_KEY_ALGORITHM, "TDES|AES", 0, "Algorithm of key to be exported." },
 	{ "export-format-version", TR31_TOOL_OPTION_EXPORT_FORMAT_VERSION, "A|B|C|D|E", 0, "Key block format version to use for export." },
 	{ "export-template", TR31_TOOL_OPTION_EXPORT_TEMPLATE, "KEK|BDK|IK", 0, "Key block template to use for export." },
@@ -161,7 +264,17 @@ static struct argp_option argp_options[] = {
 	{ "export-no-key-length-obfuscation", TR31_TOOL_OPTION_EXPORT_NO_KEY_LENGTH_OBFUSCATION, NULL, 0, "Disable ANSI X9.143 key length obfuscation during key block export." },
 	{ "export-zero-opt-block-PB", TR31_TOOL_OPTION_EXPORT_ZERO_OPT_BLOCK_PB, NULL, 0, "Fill optional block PB (Padding Block) using zeros instead of random characters during key block export." },
 
-	{ NULL, 0, NULL, 0, "Options for decrypting/encrypting key blocks:", 3 },
+	{ NULL, 0, NULL, 0, "Options for migrating key blocks to a new key block protection key:", 3 },
+	{ "migrate", TR31_TOOL_OPTION_MIGRATE, "INPUT", 0, "Migrate key blocks in INPUT file, one per line, to the OUTPUT file specified as the next argument. Use - for stdin or stdout. Requires --kbpk-old and --kbpk-new. Failed key blocks result in empty lines in OUTPUT. An interrupted migration resumes using the OUTPUT.journal file, provided that INPUT, the KBPKs and the format version are unchanged." },
+	{ "migrate-format-version", TR31_TOOL_OPTION_MIGRATE_FORMAT_VERSION, "A|B|C|D|E", 0, "Key block format version to use for migrated key blocks. Default is to retain the format version of each key block." },
+	{ "kbpk-old", TR31_TOOL_OPTION_KBPK_OLD, "KEY", 0, "Key block protection key used to decrypt key blocks being migrated. Use - to read raw bytes from stdin." },
+	{ "kbpk-new", TR31_TOOL_OPTION_KBPK_NEW, "KEY", 0, "Key block protection key used to encrypt migrated key blocks. Use - to read raw bytes from stdin." },
+
+	{ NULL, 0, NULL, 0, "Options for bulk processing of key blocks:", 4 },
+	{ "jobs", TR31_TOOL_OPTION_JOBS, "N", 0, "Number of threads to use for bulk processing. Default is the number of online processors." },
+	{ "stats", TR31_TOOL_OPTION_STATS, "FILE", 0, "Write library-wide operation and error counters in Prometheus text format to FILE after processing. Use - for stdout." },
+
+	{ NULL, 0, NULL, 0, "Options for decrypting/encrypting key blocks:", 5 },
 	{ "kbpk", TR31_TOOL_OPTION_KBPK, "KEY", 0, "Key block protection key. Use - to read raw bytes from stdin." },
 
 	{ "version", TR31_TOOL_OPTION_VERSION, NULL, 0, "Display TR-31 library version" },
@@ -175,7 +288,7 @@ static struct argp argp_config = {
 	argp_parser_helper,
 	NULL,
 	" \v" // force the text to be after the options in the help message
-	"The import (decoding/decrypting) and export (encoding/encrypting) options cannot be specified simultaneously.\n\n"
+	"The import (decoding/decrypting), import-file, verify-file, export (encoding/encrypting), export-file and migrate options cannot be specified simultaneously.\n\n"
 	"NOTE:\nAll KEY values are strings of hex digits representing binary data, or - to read raw bytes from stdin. "
 	"All ISO8601 values are in UTC and must end with 'Z'.",
 };
@@ -204,7 +317,7 @@ static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
 					}
 					options->found_stdin_arg = true;
 
-					buf = read_file(stdin, &buf_len);
+					buf = tr31_tool_io_read_file(stdin, &buf_len);
 					if (!buf) {
 						argp_error(state, "Failed to read data from stdin");
 					}
@@ -229,6 +342,8 @@ static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
 			}
 
 			case TR31_TOOL_OPTION_EXPORT:
+			case TR31_TOOL_OPTION_KBPK_OLD:
+			case TR31_TOOL_OPTION_KBPK_NEW:
 			case TR31_TOOL_OPTION_KBPK: {
 				// If argument is "-", read from stdin
 				if (strcmp(arg, "-") == 0) {
@@ -237,7 +352,7 @@ static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
 					}
 					options->found_stdin_arg = true;
 
-					buf = read_file(stdin, &buf_len);
+					buf = tr31_tool_io_read_file(stdin, &buf_len);
 					if (!buf) {
 						argp_error(state, "Failed to read data from stdin");
 					}
@@ -273,12 +388,56 @@ static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
 			options->import_flags |= TR31_IMPORT_NO_STRICT_VALIDATION;
 			return 0;
 
+		case TR31_TOOL_OPTION_IMPORT_FILE:
+			if (strcmp(arg, "-") == 0) {
+				if (options->found_stdin_arg) {
+					argp_error(state, "Only one option may be read from stdin");
+				}
+				options->found_stdin_arg = true;
+			}
+			options->import_file_path = arg;
+			options->import_file = true;
+			return 0;
+
+		case TR31_TOOL_OPTION_VERIFY_FILE:
+			if (strcmp(arg, "-") == 0) {
+				if (options->found_stdin_arg) {
+					argp_error(state, "Only one option may be read from stdin");
+				}
+				options->found_stdin_arg = true;
+			}
+			options->verify_file_path = arg;
+			options->verify_file = true;
+			return 0;
+
+		case TR31_TOOL_OPTION_IMPORT_FORMAT:
+			if (strcmp(arg, "ndjson") == 0) {
+				options->import_format = TR31_TOOL_IMPORT_FORMAT_NDJSON;
+			} else if (strcmp(arg, "csv") == 0) {
+				options->import_format = TR31_TOOL_IMPORT_FORMAT_CSV;
+			} else {
+				argp_error(state, "Import format must be either ndjson or csv");
+			}
+			options->import_format_found = true;
+			return 0;
+
 		case TR31_TOOL_OPTION_EXPORT:
 			options->export_key_buf = buf;
 			options->export_key_buf_len = buf_len;
 			options->export = true;
 			return 0;
 
+		case TR31_TOOL_OPTION_EXPORT_FILE:
+			if (strcmp(arg, "-") == 0) {
+				if (options->found_stdin_arg) {
+					argp_error(state, "Only one option may be read from stdin");
+				}
+				options->found_stdin_arg = true;
+			}
+			options->export_file_path = arg;
+			options->export_file = true;
+			return 0;
+
 		case TR31_TOOL_OPTION_EXPORT_KEY_ALGORITHM:
 			options->export_key_algorithm = arg;
 			return 0;
@@ -552,6 +711,56 @@ static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
 			options->export_flags |= TR31_EXPORT_ZERO_OPT_BLOCK_PB;
 			return 0;
 
+		case TR31_TOOL_OPTION_MIGRATE:
+			if (strcmp(arg, "-") == 0) {
+				if (options->found_stdin_arg) {
+					argp_error(state, "Only one option may be read from stdin");
+				}
+				options->found_stdin_arg = true;
+			}
+			options->migrate_input_path = arg;
+			options->migrate = true;
+			return 0;
+
+		case TR31_TOOL_OPTION_MIGRATE_FORMAT_VERSION:
+			if (strlen(arg) != 1 || !strchr("ABCDE", *arg)) {
+				argp_error(state, "Migrate format version must be A, B, C, D or E");
+			}
+			options->migrate_format_version = *arg;
+			return 0;
+
+		case TR31_TOOL_OPTION_KBPK_OLD:
+			if (buf_len > sizeof(options->kbpk_old_buf)) {
+				argp_error(state, "KEY string may not have more than %zu digits (thus %zu bytes)",
+					sizeof(options->kbpk_old_buf) * 2,
+					sizeof(options->kbpk_old_buf)
+				);
+			}
+			memcpy(options->kbpk_old_buf, buf, buf_len);
+			options->kbpk_old_buf_len = buf_len;
+			options->kbpk_old = true;
+
+			free(buf);
+			buf = NULL;
+
+			return 0;
+
+		case TR31_TOOL_OPTION_KBPK_NEW:
+			if (buf_len > sizeof(options->kbpk_new_buf)) {
+				argp_error(state, "KEY string may not have more than %zu digits (thus %zu bytes)",
+					sizeof(options->kbpk_new_buf) * 2,
+					sizeof(options->kbpk_new_buf)
+				);
+			}
+			memcpy(options->kbpk_new_buf, buf, buf_len);
+			options->kbpk_new_buf_len = buf_len;
+			options->kbpk_new = true;
+
+			free(buf);
+			buf = NULL;
+
+			return 0;
+
 		case TR31_TOOL_OPTION_KBPK:
 			if (buf_len > sizeof(options->kbpk_buf)) {
 				argp_error(state, "KEY string may not have more than %zu digits (thus %zu bytes)",
@@ -568,6 +777,30 @@ static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
 
 			return 0;
 
+		case TR31_TOOL_OPTION_JOBS: {
+			char* endptr = NULL;
+			unsigned long jobs;
+
+			jobs = strtoul(arg, &endptr, 10);
+			if (!arg[0] || *endptr || jobs < 1 || jobs > 1024) {
+				argp_error(state, "Number of jobs must be a value from 1 to 1024");
+			}
+			options->jobs = jobs;
+			return 0;
+		}
+
+		case TR31_TOOL_OPTION_STATS:
+			options->stats_path = arg;
+			return 0;
+
+		case ARGP_KEY_ARG:
+			// only the migrate OUTPUT argument is allowed
+			if (options->migrate_output_path) {
+				argp_error(state, "Unexpected argument \"%s\"", arg);
+			}
+			options->migrate_output_path = arg;
+			return 0;
+
 		case TR31_TOOL_OPTION_VERSION: {
 			const char* version;
 
@@ -583,13 +816,41 @@ static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
 
 		case ARGP_KEY_END: {
 			// check for required options
-			if (!options->import && !options->export) {
-				argp_error(state, "Either --import option or --export option is required");
+			if (!options->import &&
+				!options->import_file &&
+				!options->verify_file &&
+				!options->export &&
+				!options->export_file &&
+				!options->migrate
+			) {
+				argp_error(state, "Either --import option, --import-file option, --verify-file option, --export option, --export-file option or --migrate option is required");
 			}
 
 			// check for conflicting options
-			if (options->import && options->export) {
-				argp_error(state, "The --import option and --export option cannot be specified simultaneously");
+			if (options->import + options->import_file + options->verify_file + options->export + options->export_file + options->migrate > 1) {
+				argp_error(state, "The --import option, --import-file option, --verify-file option, --export option, --export-file option and --migrate option cannot be specified simultaneously");
+			}
+			if (!options->import_file && options->import_format_found) {
+				argp_error(state, "The --import-format option requires --import-file");
+			}
+
+			// check for required --verify-file options
+			if (options->verify_file && !options->kbpk) {
+				argp_error(state, "The --verify-file option requires --kbpk");
+			}
+
+			// check for required --migrate options
+			if (options->migrate && !options->migrate_output_path) {
+				argp_error(state, "The --migrate option requires INPUT and OUTPUT arguments");
+			}
+			if (options->migrate && (!options->kbpk_old || !options->kbpk_new)) {
+				argp_error(state, "The --migrate option requires --kbpk-old and --kbpk-new");
+			}
+			if (!options->migrate && options->migrate_output_path) {
+				argp_error(state, "Unexpected argument \"%s\"", options->migrate_output_path);
+			}
+			if (!options->migrate && (options->kbpk_old || options->kbpk_new || options->migrate_format_version)) {
+				argp_error(state, "The --kbpk-old, --kbpk-new and --migrate-format-version options require --migrate");
 			}
 
 			// check for required --export options
@@ -616,6 +877,14 @@ static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
 				argp_error(state, "The --export-template option and --export-header option cannot be specified simultaneously");
 			}
 
+			// check for required and conflicting --export-file options
+			if (options->export_file && !options->kbpk) {
+				argp_error(state, "The --export-file option requires --kbpk");
+			}
+			if (options->export_file && (options->export_template || options->export_header)) {
+				argp_error(state, "The --export-file option obtains the template or export header from MANIFEST and cannot be used with --export-template or --export-header");
+			}
+
 			return 0;
 		}
 
@@ -624,37 +893,6 @@ static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
 	}
 }
 
-// File/stdin read helper function
-static void* read_file(FILE* file, size_t* len)
-{
-	const size_t block_size = 4096; // Use common page size
-	void* buf = NULL;
-	size_t buf_len = 0;
-	size_t total_len = 0;
-
-	if (!file) {
-		*len = 0;
-		return NULL;
-	}
-
-	do {
-		// Grow buffer
-		buf_len += block_size;
-		buf = realloc(buf, buf_len);
-
-		// Read next block
-		total_len += fread(buf + total_len, 1, block_size, file);
-		if (ferror(file)) {
-			free(buf);
-			*len = 0;
-			return NULL;
-		}
-	} while (!feof(file));
-
-	*len = total_len;
-	return buf;
-}
-
 // hex parser helper function
 static int parse_hex(const char* hex, void* bin, size_t bin_len)
 {
@@ -682,6 +920,16 @@ static int parse_hex(const char* hex, void* bin, size_t bin_len)
 	return 0;
 }
 
+// sensitive buffer cleansing helper function
+static void cleanse(void* buf, size_t length)
+{
+	// volatile pointer prevents the compiler from removing the memset
+	volatile uint8_t* ptr = buf;
+	while (length--) {
+		*ptr++ = 0;
+	}
+}
+
 // hex output helper function
 static void print_hex(const void* buf, size_t length)
 {
@@ -713,8 +961,146 @@ static void print_str_with_quotes(const void* buf, size_t length)
 	printf("\"");
 }
 
-// KBPK populating helper function
-static int populate_kbpk(const struct tr31_tool_options_t* options, unsigned int format_version, struct tr31_key_t* kbpk)
+// hex output helper function for bulk processing records
+static void output_hex(struct tr31_tool_bulk_record_t* record, const void* buf, size_t length)
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+	const uint8_t* ptr = buf;
+	char hex[2];
+
+	for (size_t i = 0; i < length; ++i) {
+		hex[0] = hex_digits[ptr[i] >> 4];
+		hex[1] = hex_digits[ptr[i] & 0xF];
+		tr31_tool_bulk_output_append(record, hex, sizeof(hex));
+	}
+}
+
+static void output_json_str(struct tr31_tool_bulk_record_t* record, const void* buf, size_t length)
+{
+	const char* str = buf;
+
+	tr31_tool_bulk_output_append(record, "\"", 1);
+	for (size_t i = 0; i < length; ++i) {
+		if (str[i] == '"' || str[i] == '\\') {
+			tr31_tool_bulk_output_printf(record, "\\%c", str[i]);
+		} else if ((uint8_t)str[i] < 0x20 || (uint8_t)str[i] > 0x7E) {
+			// escape control characters and non-ASCII bytes
+			tr31_tool_bulk_output_printf(record, "\\u%04X", (uint8_t)str[i]);
+		} else {
+			tr31_tool_bulk_output_append(record, &str[i], 1);
+		}
+	}
+	tr31_tool_bulk_output_append(record, "\"", 1);
+}
+
+static void output_csv_str(struct tr31_tool_bulk_record_t* record, const void* buf, size_t length)
+{
+	const char* str = buf;
+
+	// always quote strings and double any quotes
+	tr31_tool_bulk_output_append(record, "\"", 1);
+	for (size_t i = 0; i < length; ++i) {
+		if (str[i] == '"') {
+			tr31_tool_bulk_output_append(record, "\"\"", 2);
+		} else {
+			tr31_tool_bulk_output_append(record, &str[i], 1);
+		}
+	}
+	tr31_tool_bulk_output_append(record, "\"", 1);
+}
+
+static int parse_csv_line(char* line, char** fields, size_t fields_len, size_t* field_count)
+{
+	char* src = line;
+	char* dst = line;
+	size_t count = 0;
+
+	// split line in place and remove quotes
+	while (true) {
+		if (count >= fields_len) {
+			// too many fields
+			return 1;
+		}
+		fields[count++] = dst;
+
+		if (*src == '"') {
+			// quoted field where double quotes represent a single quote
+			++src;
+			while (true) {
+				if (!*src) {
+					// unterminated quoted field
+					return 1;
+				}
+				if (*src == '"') {
+					if (src[1] != '"') {
+						++src;
+						break;
+					}
+					++src;
+				}
+				*dst++ = *src++;
+			}
+			if (*src && *src != ',') {
+				// unexpected character after quoted field
+				return 1;
+			}
+		} else {
+			while (*src && *src != ',') {
+				*dst++ = *src++;
+			}
+		}
+
+		if (!*src) {
+			*dst = 0;
+			break;
+		}
+
+		// skip separator
+		++src;
+		*dst++ = 0;
+	}
+
+	*field_count = count;
+	return 0;
+}
+
+static int write_stats(const char* path)
+{
+	int r;
+	struct tr31_stats_t stats;
+	char buf[4096];
+	FILE* file;
+
+	r = tr31_stats_snapshot(&stats);
+	if (r) {
+		fprintf(stderr, "tr31_stats_snapshot() failed; r=%d\n", r);
+		return 1;
+	}
+	r = tr31_stats_get_prometheus_string(&stats, buf, sizeof(buf));
+	if (r) {
+		fprintf(stderr, "tr31_stats_get_prometheus_string() failed; r=%d\n", r);
+		return 1;
+	}
+
+	if (strcmp(path, "-") == 0) {
+		printf("%s", buf);
+		return 0;
+	}
+	file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "Failed to open stats file \"%s\"\n", path);
+		return 1;
+	}
+	fputs(buf, file);
+	if (fclose(file)) {
+		fprintf(stderr, "Failed to write stats file \"%s\"\n", path);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int populate_kbpk(const void* kbpk_buf, size_t kbpk_buf_len, unsigned int format_version, struct tr31_key_t* kbpk)
 {
 	int r;
 	unsigned int algorithm;
@@ -745,8 +1131,8 @@ static int populate_kbpk(const struct tr31_tool_options_t* options, unsigned int
 		"00",
 		TR31_KEY_EXPORT_NONE,
 		TR31_KEY_CONTEXT_STORAGE,
-		options->kbpk_buf,
-		options->kbpk_buf_len,
+		kbpk_buf,
+		kbpk_buf_len,
 		kbpk
 	);
 	if (r) {
@@ -754,9 +1140,71 @@ static int populate_kbpk(const struct tr31_tool_options_t* options, unsigned int
 		return 1;
 	}
 
+	// cache KCV for optional block KP such that bulk processing threads
+	// need not compute it for every key block
+	tr31_key_get_kcv(kbpk);
+
+	return 0;
+}
+
+// KBPK populating helper function for bulk processing where key blocks may
+// use any format version; populates the KBPK for each algorithm that is
+// valid for the KBPK length
+static int populate_kbpk_by_algorithm(
+	const void* kbpk_buf,
+	size_t kbpk_buf_len,
+	struct tr31_key_t* kbpk_tdes,
+	struct tr31_key_t* kbpk_aes
+)
+{
+	int r;
+
+	memset(kbpk_tdes, 0, sizeof(*kbpk_tdes));
+	memset(kbpk_aes, 0, sizeof(*kbpk_aes));
+
+	if (kbpk_buf_len == 16 || kbpk_buf_len == 24) {
+		r = populate_kbpk(kbpk_buf, kbpk_buf_len, TR31_VERSION_B, kbpk_tdes);
+		if (r) {
+			return r;
+		}
+	}
+	if (kbpk_buf_len == 16 || kbpk_buf_len == 24 || kbpk_buf_len == 32) {
+		r = populate_kbpk(kbpk_buf, kbpk_buf_len, TR31_VERSION_D, kbpk_aes);
+		if (r) {
+			tr31_key_release(kbpk_tdes);
+			return r;
+		}
+	}
+	if (!kbpk_tdes->length && !kbpk_aes->length) {
+		fprintf(stderr, "KBPK error: %s\n", tr31_get_error_string(TR31_ERROR_UNSUPPORTED_KBPK_LENGTH));
+		return 1;
+	}
+
 	return 0;
 }
 
+// KBPK selection helper function for bulk processing
+static const struct tr31_key_t* select_kbpk_by_version(
+	unsigned int format_version,
+	const struct tr31_key_t* kbpk_tdes,
+	const struct tr31_key_t* kbpk_aes
+)
+{
+	switch (format_version) {
+		case TR31_VERSION_A:
+		case TR31_VERSION_B:
+		case TR31_VERSION_C:
+			return kbpk_tdes;
+
+		case TR31_VERSION_D:
+		case TR31_VERSION_E:
+			return kbpk_aes;
+
+		default:
+			return NULL;
+	}
+}
+
 // key block import helper function
 static int do_tr31_import(const struct tr31_tool_options_t* options)
 {
@@ -764,9 +1212,10 @@ static int do_tr31_import(const struct tr31_tool_options_t* options)
 	int r;
 	struct tr31_key_t kbpk;
 	struct tr31_ctx_t tr31_ctx;
+	struct tr31_opt_blocks_decoded_t opt_blocks_decoded;
 
 	// populate key block protection key
-	r = populate_kbpk(options, options->key_block[0], &kbpk);
+	r = populate_kbpk(options->kbpk_buf, options->kbpk_buf_len, options->key_block[0], &kbpk);
 	if (r) {
 		return r;
 	}
@@ -819,6 +1268,9 @@ static int do_tr31_import(const struct tr31_tool_options_t* options)
 	if (tr31_ctx.opt_blocks_count) {
 		printf("Optional blocks [%zu]:\n", tr31_ctx.opt_blocks_count);
 	}
+	// decode all optional blocks at once; invalid optional blocks are not
+	// present and will be printed as strings
+	tr31_opt_blocks_decode_all(&tr31_ctx, &opt_blocks_decoded);
 	if (tr31_ctx.opt_blocks) { // might be NULL when tr31_import() fails
 		for (size_t i = 0; i < tr31_ctx.opt_blocks_count; ++i) {
 			char opt_block_data_str[128];
@@ -829,125 +1281,129 @@ static int do_tr31_import(const struct tr31_tool_options_t* options)
 			);
 
 			switch (tr31_ctx.opt_blocks[i].id) {
-				case TR31_OPT_BLOCK_AL: {
-					struct tr31_opt_blk_akl_data_t akl_data;
-					r = tr31_opt_block_decode_AL(&tr31_ctx.opt_blocks[i], &akl_data);
-					if (r || akl_data.version != TR31_OPT_BLOCK_AL_VERSION_1) {
+				case TR31_OPT_BLOCK_AL:
+					if (!(opt_blocks_decoded.present & TR31_OPT_BLOCKS_DECODED_AL) ||
+						opt_blocks_decoded.akl.version != TR31_OPT_BLOCK_AL_VERSION_1
+					) {
 						// invalid; print as string
 						print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
 						break;
 					}
 					// valid; assume version 1 and print AKL as hex
 					printf("v1, ");
-					print_hex(&akl_data.v1.akl, sizeof(akl_data.v1.akl));
+					print_hex(&opt_blocks_decoded.akl.v1.akl, sizeof(opt_blocks_decoded.akl.v1.akl));
 					break;
-				}
 
-				case TR31_OPT_BLOCK_BI: {
-					struct tr31_opt_blk_bdkid_data_t bdkid_data;
-					r = tr31_opt_block_decode_BI(&tr31_ctx.opt_blocks[i], &bdkid_data);
-					if (r) {
+				case TR31_OPT_BLOCK_BI:
+					if (!(opt_blocks_decoded.present & TR31_OPT_BLOCKS_DECODED_BI)) {
 						// invalid; print as string
 						print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
 						break;
 					}
 					// valid; print as hex
-					print_hex(bdkid_data.bdkid, bdkid_data.bdkid_len);
+					print_hex(opt_blocks_decoded.bdkid.bdkid, opt_blocks_decoded.bdkid.bdkid_len);
 					break;
-				}
 
 				case TR31_OPT_BLOCK_DA: {
-					size_t da_attr_count;
+					const struct tr31_opt_blk_da_attr_t* da_attrs = opt_blocks_decoded.da;
 					size_t da_data_len;
-					struct tr31_opt_blk_da_data_t* da_data;
-					if (tr31_ctx.opt_blocks[i].data_length < 2) {
+					struct tr31_opt_blk_da_data_t* da_data = NULL;
+
+					if (!(opt_blocks_decoded.present & TR31_OPT_BLOCKS_DECODED_DA)) {
 						// invalid; print as string
 						print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
 						break;
 					}
-					da_attr_count = (tr31_ctx.opt_blocks[i].data_length - 2) / 5;
-					da_data_len = sizeof(struct tr31_opt_blk_da_attr_t)
-						* da_attr_count
-						+ sizeof(struct tr31_opt_blk_da_data_t);
-					da_data = malloc(da_data_len);
-					r = tr31_opt_block_decode_DA(&tr31_ctx.opt_blocks[i], da_data, da_data_len);
-					if (r) {
-						// invalid; print as string
-						print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
-						free(da_data);
-						break;
+					if (opt_blocks_decoded.da_count > TR31_OPT_BLOCKS_DECODED_DA_MAX) {
+						// too many attributes for decoded optional blocks;
+						// decode this optional block separately
+						da_data_len = sizeof(struct tr31_opt_blk_da_attr_t)
+							* opt_blocks_decoded.da_count
+							+ sizeof(struct tr31_opt_blk_da_data_t);
+						da_data = malloc(da_data_len);
+						if (!da_data ||
+							tr31_opt_block_decode_DA(&tr31_ctx.opt_blocks[i], da_data, da_data_len)
+						) {
+							// invalid; print as string
+							print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
+							free(da_data);
+							break;
+						}
+						da_attrs = da_data->attr;
 					}
-					for (size_t i = 0; i < da_attr_count; ++i) {
+					for (size_t j = 0; j < opt_blocks_decoded.da_count; ++j) {
+						const struct tr31_opt_blk_da_attr_t* da_attr = &da_attrs[j];
 						printf("%s%s%c%c%c",
-							i == 0 ? "" : ",",
-							tr31_key_usage_get_ascii(da_data->attr[i].key_usage, ascii_buf, sizeof(ascii_buf)),
-							da_data->attr[i].algorithm,
-							da_data->attr[i].mode_of_use,
-							da_data->attr[i].exportability
+							j == 0 ? "" : ",",
+							tr31_key_usage_get_ascii(da_attr->key_usage, ascii_buf, sizeof(ascii_buf)),
+							da_attr->algorithm,
+							da_attr->mode_of_use,
+							da_attr->exportability
 						);
 					}
 					free(da_data);
 					break;
 				}
 
-				case TR31_OPT_BLOCK_HM: {
-					uint8_t hash_algorithm;
-					r = tr31_opt_block_decode_HM(&tr31_ctx.opt_blocks[i], &hash_algorithm);
-					if (r) {
+				case TR31_OPT_BLOCK_HM:
+					if (!(opt_blocks_decoded.present & TR31_OPT_BLOCKS_DECODED_HM)) {
 						// invalid; print as string
 						print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
 						break;
 					}
 					// valid; print as hex
-					print_hex(&hash_algorithm, sizeof(hash_algorithm));
+					print_hex(&opt_blocks_decoded.hash_algorithm, sizeof(opt_blocks_decoded.hash_algorithm));
 					break;
-				}
 
-				case TR31_OPT_BLOCK_IK: {
-					uint8_t ikid[8];
-					r = tr31_opt_block_decode_IK(&tr31_ctx.opt_blocks[i], ikid, sizeof(ikid));
-					if (r) {
+				case TR31_OPT_BLOCK_IK:
+					if (!(opt_blocks_decoded.present & TR31_OPT_BLOCKS_DECODED_IK)) {
 						// invalid; print as string
 						print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
 						break;
 					}
 					// valid; print as hex
-					print_hex(ikid, sizeof(ikid));
+					print_hex(opt_blocks_decoded.ikid, sizeof(opt_blocks_decoded.ikid));
 					break;
-				}
 
-				case TR31_OPT_BLOCK_KS: {
-					uint8_t iksn[10];
-					r = tr31_opt_block_decode_KS(&tr31_ctx.opt_blocks[i], iksn, sizeof(iksn));
-					if (r) {
+				case TR31_OPT_BLOCK_KS:
+					if (!(opt_blocks_decoded.present & TR31_OPT_BLOCKS_DECODED_KS)) {
 						// invalid; print as string
 						print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
 						break;
 					}
 					// valid; print as hex
-					print_hex(iksn, sizeof(iksn));
+					print_hex(opt_blocks_decoded.iksn, sizeof(opt_blocks_decoded.iksn));
 					break;
-				}
 
 				case TR31_OPT_BLOCK_KC:
 				case TR31_OPT_BLOCK_KP:
 				case TR31_OPT_BLOCK_PK: {
-					struct tr31_opt_blk_kcv_data_t kcv_data;
-					r = tr31_opt_block_decode_kcv(&tr31_ctx.opt_blocks[i], &kcv_data);
-					if (r) {
+					const struct tr31_opt_blk_kcv_data_t* kcv_data;
+					uint32_t bit;
+					if (tr31_ctx.opt_blocks[i].id == TR31_OPT_BLOCK_KC) {
+						kcv_data = &opt_blocks_decoded.kc;
+						bit = TR31_OPT_BLOCKS_DECODED_KC;
+					} else if (tr31_ctx.opt_blocks[i].id == TR31_OPT_BLOCK_KP) {
+						kcv_data = &opt_blocks_decoded.kp;
+						bit = TR31_OPT_BLOCKS_DECODED_KP;
+					} else {
+						kcv_data = &opt_blocks_decoded.pk;
+						bit = TR31_OPT_BLOCKS_DECODED_PK;
+					}
+					if (!(opt_blocks_decoded.present & bit)) {
 						// invalid; print as string
 						print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
 						break;
 					}
 					// valid; print as hex
-					print_hex(kcv_data.kcv, kcv_data.kcv_len);
+					print_hex(kcv_data->kcv, kcv_data->kcv_len);
 					break;
 				}
 
-				case TR31_OPT_BLOCK_WP: {
-					struct tr31_opt_blk_wp_data_t wp_data;
-					r = tr31_opt_block_decode_WP(&tr31_ctx.opt_blocks[i], &wp_data);
-					if (r || wp_data.version != TR31_OPT_BLOCK_WP_VERSION_0) {
+				case TR31_OPT_BLOCK_WP:
+					if (!(opt_blocks_decoded.present & TR31_OPT_BLOCKS_DECODED_WP) ||
+						opt_blocks_decoded.wp.version != TR31_OPT_BLOCK_WP_VERSION_0
+					) {
 						// invalid; print as string
 						print_str(tr31_ctx.opt_blocks[i].data, tr31_ctx.opt_blocks[i].data_length);
 						break;
@@ -955,7 +1411,6 @@ static int do_tr31_import(const struct tr31_tool_options_t* options)
 					// valid; assume version 00 and print wrapping pedigree digit
 					print_str(tr31_ctx.opt_blocks[i].data + 2, 1);
 					break;
-				}
 
 				case TR31_OPT_BLOCK_CT:
 					// for certificates and certificate chains, skip the first two bytes and use quotes
@@ -990,6 +1445,9 @@ static int do_tr31_import(const struct tr31_tool_options_t* options)
 	// if available, print decrypted key
 	if (tr31_ctx.key.length) {
 		if (tr31_ctx.key.data) {
+			// KCV is not available if it cannot be computed for the key algorithm
+			tr31_key_get_kcv(&tr31_ctx.key);
+
 			printf("Key length: %zu\n", tr31_ctx.key.length);
 			printf("Key value: ");
 			print_hex(tr31_ctx.key.data, tr31_ctx.key.length);
@@ -1454,7 +1912,7 @@ static int do_tr31_export(const struct tr31_tool_options_t* options)
 	}
 
 	// populate key block protection key
-	r = populate_kbpk(options, export_format_version, &kbpk);
+	r = populate_kbpk(options->kbpk_buf, options->kbpk_buf_len, export_format_version, &kbpk);
 	if (r) {
 		return r;
 	}
@@ -1477,6 +1935,807 @@ static int do_tr31_export(const struct tr31_tool_options_t* options)
 	return 0;
 }
 
+// key block import NDJSON output helper function
+static void output_import_record_ndjson(struct tr31_tool_bulk_record_t* record, const struct tr31_ctx_t* tr31_ctx)
+{
+	char ascii_buf[3]; // temporary ascii buffer
+	char c;
+
+	tr31_tool_bulk_output_printf(record, "{\"line\":%zu,\"result\":%d,\"error\":", record->line_number, record->result);
+	if (record->result) {
+		const char* error_str = tr31_get_error_string(record->result);
+		output_json_str(record, error_str, strlen(error_str));
+	} else {
+		tr31_tool_bulk_output_printf(record, "null");
+	}
+
+	// key block header fields are only available if the header was parsed
+	if (tr31_ctx->version) {
+		c = tr31_ctx->version;
+		tr31_tool_bulk_output_printf(record, ",\"version\":");
+		output_json_str(record, &c, 1);
+		tr31_tool_bulk_output_printf(record, ",\"length\":%zu,\"key_usage\":", tr31_ctx->length);
+		tr31_key_usage_get_ascii(tr31_ctx->key.usage, ascii_buf, sizeof(ascii_buf));
+		output_json_str(record, ascii_buf, strlen(ascii_buf));
+		c = tr31_ctx->key.algorithm;
+		tr31_tool_bulk_output_printf(record, ",\"algorithm\":");
+		output_json_str(record, &c, 1);
+		c = tr31_ctx->key.mode_of_use;
+		tr31_tool_bulk_output_printf(record, ",\"mode_of_use\":");
+		output_json_str(record, &c, 1);
+		tr31_tool_bulk_output_printf(record, ",\"key_version\":");
+		if (tr31_ctx->key.key_version == TR31_KEY_VERSION_IS_UNUSED) {
+			tr31_tool_bulk_output_printf(record, "null");
+		} else {
+			output_json_str(record, tr31_ctx->key.key_version_str, strlen(tr31_ctx->key.key_version_str));
+		}
+		c = tr31_ctx->key.exportability;
+		tr31_tool_bulk_output_printf(record, ",\"exportability\":");
+		output_json_str(record, &c, 1);
+		c = tr31_ctx->key.key_context;
+		tr31_tool_bulk_output_printf(record, ",\"key_context\":");
+		output_json_str(record, &c, 1);
+
+		tr31_tool_bulk_output_printf(record, ",\"opt_blocks\":[");
+		if (tr31_ctx->opt_blocks) { // might be NULL when tr31_import() fails
+			for (size_t i = 0; i < tr31_ctx->opt_blocks_count; ++i) {
+				if (i) {
+					tr31_tool_bulk_output_append(record, ",", 1);
+				}
+				tr31_opt_block_id_get_ascii(tr31_ctx->opt_blocks[i].id, ascii_buf, sizeof(ascii_buf));
+				tr31_tool_bulk_output_printf(record, "{\"id\":");
+				output_json_str(record, ascii_buf, strlen(ascii_buf));
+				tr31_tool_bulk_output_printf(record, ",\"data\":");
+				output_json_str(record, tr31_ctx->opt_blocks[i].data, tr31_ctx->opt_blocks[i].data_length);
+				tr31_tool_bulk_output_append(record, "}", 1);
+			}
+		}
+		tr31_tool_bulk_output_append(record, "]", 1);
+
+		// if available, output decrypted key
+		if (tr31_ctx->key.length && tr31_ctx->key.data) {
+			tr31_tool_bulk_output_printf(record, ",\"key_length\":%zu,\"key\":\"", tr31_ctx->key.length);
+			output_hex(record, tr31_ctx->key.data, tr31_ctx->key.length);
+			tr31_tool_bulk_output_append(record, "\"", 1);
+			if (tr31_ctx->key.kcv_len) {
+				tr31_tool_bulk_output_printf(record, ",\"kcv\":\"");
+				output_hex(record, tr31_ctx->key.kcv, tr31_ctx->key.kcv_len);
+				tr31_tool_bulk_output_append(record, "\"", 1);
+			}
+		}
+	}
+
+	tr31_tool_bulk_output_append(record, "}\n", 2);
+}
+
+// key block import CSV output helper function
+static void output_import_record_csv(struct tr31_tool_bulk_record_t* record, const struct tr31_ctx_t* tr31_ctx)
+{
+	char ascii_buf[3]; // temporary ascii buffer
+	char c;
+
+	tr31_tool_bulk_output_printf(record, "%zu,%d,", record->line_number, record->result);
+	if (record->result) {
+		const char* error_str = tr31_get_error_string(record->result);
+		output_csv_str(record, error_str, strlen(error_str));
+	}
+
+	// key block header fields are only available if the header was parsed
+	if (!tr31_ctx->version) {
+		tr31_tool_bulk_output_printf(record, ",,,,,,,,,,,,\n");
+		return;
+	}
+
+	c = tr31_ctx->version;
+	tr31_tool_bulk_output_append(record, ",", 1);
+	output_csv_str(record, &c, 1);
+	tr31_tool_bulk_output_printf(record, ",%zu,", tr31_ctx->length);
+	tr31_key_usage_get_ascii(tr31_ctx->key.usage, ascii_buf, sizeof(ascii_buf));
+	output_csv_str(record, ascii_buf, strlen(ascii_buf));
+	c = tr31_ctx->key.algorithm;
+	tr31_tool_bulk_output_append(record, ",", 1);
+	output_csv_str(record, &c, 1);
+	c = tr31_ctx->key.mode_of_use;
+	tr31_tool_bulk_output_append(record, ",", 1);
+	output_csv_str(record, &c, 1);
+	tr31_tool_bulk_output_append(record, ",", 1);
+	if (tr31_ctx->key.key_version != TR31_KEY_VERSION_IS_UNUSED) {
+		output_csv_str(record, tr31_ctx->key.key_version_str, strlen(tr31_ctx->key.key_version_str));
+	}
+	c = tr31_ctx->key.exportability;
+	tr31_tool_bulk_output_append(record, ",", 1);
+	output_csv_str(record, &c, 1);
+	c = tr31_ctx->key.key_context;
+	tr31_tool_bulk_output_append(record, ",", 1);
+	output_csv_str(record, &c, 1);
+
+	// optional blocks are encoded as a single field, formatted as ID=data
+	// and separated by semicolons
+	tr31_tool_bulk_output_append(record, ",\"", 2);
+	if (tr31_ctx->opt_blocks) { // might be NULL when tr31_import() fails
+		for (size_t i = 0; i < tr31_ctx->opt_blocks_count; ++i) {
+			const char* data = tr31_ctx->opt_blocks[i].data;
+			if (i) {
+				tr31_tool_bulk_output_append(record, ";", 1);
+			}
+			tr31_opt_block_id_get_ascii(tr31_ctx->opt_blocks[i].id, ascii_buf, sizeof(ascii_buf));
+			tr31_tool_bulk_output_printf(record, "%s=", ascii_buf);
+			for (size_t j = 0; j < tr31_ctx->opt_blocks[i].data_length; ++j) {
+				if (data[j] == '"') {
+					tr31_tool_bulk_output_append(record, "\"\"", 2);
+				} else {
+					tr31_tool_bulk_output_append(record, &data[j], 1);
+				}
+			}
+		}
+	}
+	tr31_tool_bulk_output_append(record, "\",", 2);
+
+	// if available, output decrypted key
+	if (tr31_ctx->key.length && tr31_ctx->key.data) {
+		tr31_tool_bulk_output_printf(record, "%zu,", tr31_ctx->key.length);
+		output_hex(record, tr31_ctx->key.data, tr31_ctx->key.length);
+		tr31_tool_bulk_output_append(record, ",", 1);
+		output_hex(record, tr31_ctx->key.kcv, tr31_ctx->key.kcv_len);
+	} else {
+		tr31_tool_bulk_output_append(record, ",,", 2);
+	}
+
+	tr31_tool_bulk_output_append(record, "\n", 1);
+}
+
+// key block import record helper function
+static void do_tr31_import_record(void* ctx, struct tr31_tool_bulk_record_t* record)
+{
+	const struct tr31_tool_import_ctx_t* import_ctx = ctx;
+	const struct tr31_key_t* kbpk = NULL;
+	int kbpk_result = 0;
+	struct tr31_ctx_t tr31_ctx;
+
+	// skip empty lines
+	if (!record->line_len) {
+		record->result = 0;
+		return;
+	}
+
+	if (import_ctx->decrypt) {
+		// determine key block protection key from format version
+		kbpk = select_kbpk_by_version((uint8_t)record->line[0], &import_ctx->kbpk_tdes, &import_ctx->kbpk_aes);
+		if (kbpk && !kbpk->length) {
+			// parse key block without decryption, but report KBPK error
+			kbpk = NULL;
+			kbpk_result = TR31_ERROR_UNSUPPORTED_KBPK_LENGTH;
+		}
+	}
+
+	memset(&tr31_ctx, 0, sizeof(tr31_ctx));
+	record->result = tr31_import(record->line, record->line_len, kbpk, import_ctx->import_flags | TR31_IMPORT_COMPUTE_KCV, &tr31_ctx);
+	if (!record->result) {
+		record->result = kbpk_result;
+	}
+
+	switch (import_ctx->format) {
+		case TR31_TOOL_IMPORT_FORMAT_NDJSON:
+			output_import_record_ndjson(record, &tr31_ctx);
+			break;
+
+		case TR31_TOOL_IMPORT_FORMAT_CSV:
+			output_import_record_csv(record, &tr31_ctx);
+			break;
+	}
+
+	tr31_release(&tr31_ctx);
+}
+
+// bulk key block import helper function
+static int do_tr31_import_file(const struct tr31_tool_options_t* options)
+{
+	int r;
+	struct tr31_tool_import_ctx_t import_ctx;
+	struct tr31_tool_bulk_config_t config;
+	struct tr31_tool_bulk_stats_t stats;
+
+	memset(&import_ctx, 0, sizeof(import_ctx));
+	import_ctx.decrypt = options->kbpk;
+	import_ctx.format = options->import_format;
+	import_ctx.import_flags = options->import_flags;
+
+	// populate key block protection keys
+	if (options->kbpk) {
+		r = populate_kbpk_by_algorithm(
+			options->kbpk_buf,
+			options->kbpk_buf_len,
+			&import_ctx.kbpk_tdes,
+			&import_ctx.kbpk_aes
+		);
+		if (r) {
+			goto exit;
+		}
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.input_path = options->import_file_path;
+	config.output_path = NULL; // stdout
+	if (import_ctx.format == TR31_TOOL_IMPORT_FORMAT_CSV) {
+		config.output_header = "line,result,error,version,length,key_usage,algorithm,mode_of_use,key_version,exportability,key_context,opt_blocks,key_length,key,kcv\n";
+	}
+	config.jobs = options->jobs;
+	config.progress = true;
+	config.report_errors = false; // errors are reported by output records
+	config.func = &do_tr31_import_record;
+	config.ctx = &import_ctx;
+
+	r = tr31_tool_bulk_run(&config, &stats);
+	if (r) {
+		goto exit;
+	}
+	tr31_tool_bulk_print_stats(&stats);
+	if (stats.errors) {
+		r = 1;
+		goto exit;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_key_release(&import_ctx.kbpk_tdes);
+	tr31_key_release(&import_ctx.kbpk_aes);
+
+	return r;
+}
+
+// key block verification record helper function
+static void do_tr31_verify_record(void* ctx, struct tr31_tool_bulk_record_t* record)
+{
+	const struct tr31_tool_import_ctx_t* import_ctx = ctx;
+	const struct tr31_key_t* kbpk;
+
+	// skip empty lines
+	if (!record->line_len) {
+		record->result = 0;
+		return;
+	}
+
+	// determine key block protection key from format version
+	kbpk = select_kbpk_by_version((uint8_t)record->line[0], &import_ctx->kbpk_tdes, &import_ctx->kbpk_aes);
+	if (!kbpk) {
+		record->result = TR31_ERROR_UNSUPPORTED_VERSION;
+	} else if (!kbpk->length) {
+		record->result = TR31_ERROR_UNSUPPORTED_KBPK_LENGTH;
+	} else {
+		record->result = tr31_verify(record->line, record->line_len, kbpk, import_ctx->import_flags);
+	}
+
+	// only output failures
+	if (record->result) {
+		tr31_tool_bulk_output_printf(record, "Line %zu: %s\n",
+			record->line_number,
+			tr31_get_error_string(record->result)
+		);
+	}
+}
+
+// bulk key block verification helper function
+static int do_tr31_verify_file(const struct tr31_tool_options_t* options)
+{
+	int r;
+	struct tr31_tool_import_ctx_t import_ctx;
+	struct tr31_tool_bulk_config_t config;
+	struct tr31_tool_bulk_stats_t stats;
+
+	memset(&import_ctx, 0, sizeof(import_ctx));
+	import_ctx.import_flags = options->import_flags;
+
+	// populate key block protection keys
+	r = populate_kbpk_by_algorithm(
+		options->kbpk_buf,
+		options->kbpk_buf_len,
+		&import_ctx.kbpk_tdes,
+		&import_ctx.kbpk_aes
+	);
+	if (r) {
+		goto exit;
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.input_path = options->verify_file_path;
+	config.output_path = NULL; // stdout
+	config.jobs = options->jobs;
+	config.progress = true;
+	config.report_errors = false; // errors are reported by output records
+	config.func = &do_tr31_verify_record;
+	config.ctx = &import_ctx;
+
+	r = tr31_tool_bulk_run(&config, &stats);
+	if (r) {
+		goto exit;
+	}
+	tr31_tool_bulk_print_stats(&stats);
+	if (stats.errors) {
+		r = 1;
+		goto exit;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_key_release(&import_ctx.kbpk_tdes);
+	tr31_key_release(&import_ctx.kbpk_aes);
+
+	return r;
+}
+
+// export manifest template or header cache helper function
+static const struct tr31_tool_export_template_t* get_export_template(
+	struct tr31_tool_export_ctx_t* export_ctx,
+	const char* name,
+	const void* key_buf,
+	size_t key_buf_len
+)
+{
+	int r;
+	struct tr31_tool_export_template_t* entry;
+	struct tr31_tool_options_t options;
+	unsigned int format_version;
+	size_t name_len;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&export_ctx->mutex);
+#endif
+
+	// manifests typically contain few distinct templates or headers
+	for (entry = export_ctx->templates; entry; entry = entry->next) {
+		if (strcmp(entry->name, name) == 0) {
+			goto exit;
+		}
+	}
+
+	// prepare the key block context object once for each distinct template
+	// or header, including the optional blocks specified on the command line
+	name_len = strlen(name);
+	entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		goto exit;
+	}
+	entry->name = malloc(name_len + 1);
+	if (!entry->name) {
+		free(entry);
+		entry = NULL;
+		goto exit;
+	}
+	memcpy(entry->name, name, name_len + 1);
+
+	options = *export_ctx->options;
+	options.export_key_buf = (uint8_t*)key_buf;
+	options.export_key_buf_len = key_buf_len;
+	if (name_len >= 16) {
+		// header determines the key block format version to use
+		format_version = name[0];
+		options.export_header = entry->name;
+		r = populate_tr31_from_header(&options, &entry->tr31_ctx);
+
+	} else if (options.export_key_algorithm && options.export_format_version) {
+		// options determine the key block format version to use
+		format_version = options.export_format_version;
+		options.export_template = entry->name;
+		r = populate_tr31_from_template(&options, &entry->tr31_ctx);
+
+	} else {
+		fprintf(stderr, "Export template \"%s\" requires --export-key-algorithm and --export-format-version\n", name);
+		r = 1;
+	}
+	if (!r) {
+		r = populate_opt_blocks(&options, &entry->tr31_ctx);
+	}
+	if (r) {
+		// populate helper functions report the reason to stderr
+		entry->result = -1;
+	} else {
+		// determine key block protection key from format version
+		entry->kbpk = select_kbpk_by_version(format_version, &export_ctx->kbpk_tdes, &export_ctx->kbpk_aes);
+		if (!entry->kbpk) {
+			entry->result = TR31_ERROR_UNSUPPORTED_VERSION;
+		} else if (!entry->kbpk->length) {
+			entry->result = TR31_ERROR_UNSUPPORTED_KBPK_LENGTH;
+		}
+	}
+
+	// the key of the first row is only needed to populate the template and
+	// must not be retained; rows only use the key attributes
+	tr31_key_release(&entry->tr31_ctx.key);
+	entry->tr31_ctx.key.length = 0;
+
+	entry->next = export_ctx->templates;
+	export_ctx->templates = entry;
+
+exit:
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&export_ctx->mutex);
+#endif
+
+	return entry;
+}
+
+// key block export manifest record helper function
+static void do_tr31_export_record(void* ctx, struct tr31_tool_bulk_record_t* record)
+{
+	int r;
+	struct tr31_tool_export_ctx_t* export_ctx = ctx;
+	char* line = NULL;
+	char* fields[3]; // key, template or header, optional blocks
+	size_t field_count;
+	size_t key_buf_len;
+	uint8_t* key_buf = NULL;
+	const struct tr31_tool_export_template_t* entry;
+	struct tr31_key_t key;
+	struct tr31_ctx_t tr31_ctx;
+	char key_block[10000]; // max key block length is 9999 + null-termination
+
+	memset(&tr31_ctx, 0, sizeof(tr31_ctx));
+
+	// retain empty lines
+	if (!record->line_len) {
+		r = 0;
+		goto error;
+	}
+
+	// split manifest row into fields
+	line = malloc(record->line_len + 1);
+	if (!line) {
+		r = -1;
+		goto error;
+	}
+	memcpy(line, record->line, record->line_len);
+	line[record->line_len] = 0;
+	r = parse_csv_line(line, fields, sizeof(fields) / sizeof(fields[0]), &field_count);
+	if (r || field_count < 2) {
+		r = TR31_ERROR_INVALID_CHARACTER;
+		goto error;
+	}
+
+	// skip optional manifest header
+	if (record->line_number == 1 && strcmp(fields[0], "key") == 0) {
+		r = 0;
+		goto exit;
+	}
+
+	// parse key
+	key_buf_len = strlen(fields[0]) / 2;
+	if (!key_buf_len || strlen(fields[0]) % 2 != 0) {
+		r = TR31_ERROR_INVALID_KEY_LENGTH;
+		goto error;
+	}
+	key_buf = malloc(key_buf_len);
+	if (!key_buf) {
+		r = -1;
+		goto error;
+	}
+	r = parse_hex(fields[0], key_buf, key_buf_len);
+	if (r) {
+		r = TR31_ERROR_INVALID_KEY_LENGTH;
+		goto error;
+	}
+
+	entry = get_export_template(export_ctx, fields[1], key_buf, key_buf_len);
+	if (!entry) {
+		r = -1;
+		goto error;
+	}
+	if (entry->result) {
+		r = entry->result;
+		goto error;
+	}
+
+	// populate key block context object from template or header
+	// avoid tr31_key_set_data() here to avoid tr31_key_release() later
+	key = entry->tr31_ctx.key;
+	key.length = key_buf_len;
+	key.data = key_buf;
+	r = tr31_init(entry->tr31_ctx.version, &key, &tr31_ctx);
+	if (r) {
+		goto error;
+	}
+	for (size_t i = 0; i < entry->tr31_ctx.opt_blocks_count; ++i) {
+		r = tr31_opt_block_add(
+			&tr31_ctx,
+			entry->tr31_ctx.opt_blocks[i].id,
+			entry->tr31_ctx.opt_blocks[i].data,
+			entry->tr31_ctx.opt_blocks[i].data_length
+		);
+		if (r) {
+			goto error;
+		}
+	}
+
+	// populate optional blocks from manifest row
+	if (field_count > 2 && fields[2][0]) {
+		char* opt_block_str = fields[2];
+
+		while (opt_block_str) {
+			char* next = strchr(opt_block_str, ';');
+			if (next) {
+				*next++ = 0;
+			}
+			if (strlen(opt_block_str) < 3 || opt_block_str[2] != '=') {
+				r = TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+				goto error;
+			}
+
+			r = tr31_opt_block_add(
+				&tr31_ctx,
+				((unsigned int)(uint8_t)opt_block_str[0] << 8) | (uint8_t)opt_block_str[1],
+				opt_block_str + 3,
+				strlen(opt_block_str + 3)
+			);
+			if (r) {
+				goto error;
+			}
+			opt_block_str = next;
+		}
+	}
+
+	r = tr31_export(&tr31_ctx, entry->kbpk, export_ctx->options->export_flags, key_block, sizeof(key_block));
+	if (r) {
+		goto error;
+	}
+	tr31_tool_bulk_output_append(record, key_block, strlen(key_block));
+	tr31_tool_bulk_output_append(record, "\n", 1);
+
+	// success
+	r = 0;
+	goto exit;
+
+error:
+	// failed rows result in empty lines
+	tr31_tool_bulk_output_append(record, "\n", 1);
+exit:
+	record->result = r;
+	tr31_release(&tr31_ctx);
+	if (key_buf) {
+		cleanse(key_buf, key_buf_len);
+		free(key_buf);
+	}
+	if (line) {
+		cleanse(line, record->line_len + 1);
+		free(line);
+	}
+}
+
+// bulk key block export helper function
+static int do_tr31_export_file(const struct tr31_tool_options_t* options)
+{
+	int r;
+	struct tr31_tool_export_ctx_t export_ctx;
+	struct tr31_tool_bulk_config_t config;
+	struct tr31_tool_bulk_stats_t stats;
+
+	memset(&export_ctx, 0, sizeof(export_ctx));
+	export_ctx.options = options;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&export_ctx.mutex, NULL);
+#endif
+
+	// populate key block protection keys once for all rows
+	r = populate_kbpk_by_algorithm(
+		options->kbpk_buf,
+		options->kbpk_buf_len,
+		&export_ctx.kbpk_tdes,
+		&export_ctx.kbpk_aes
+	);
+	if (r) {
+		goto exit;
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.input_path = options->export_file_path;
+	config.output_path = NULL; // stdout
+	config.jobs = options->jobs;
+	config.progress = true;
+	config.report_errors = true;
+	config.func = &do_tr31_export_record;
+	config.ctx = &export_ctx;
+
+	r = tr31_tool_bulk_run(&config, &stats);
+	if (r) {
+		goto exit;
+	}
+	tr31_tool_bulk_print_stats(&stats);
+	if (stats.errors) {
+		r = 1;
+		goto exit;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	while (export_ctx.templates) {
+		struct tr31_tool_export_template_t* entry = export_ctx.templates;
+		export_ctx.templates = entry->next;
+		tr31_release(&entry->tr31_ctx);
+		free(entry->name);
+		free(entry);
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&export_ctx.mutex);
+#endif
+	tr31_key_release(&export_ctx.kbpk_tdes);
+	tr31_key_release(&export_ctx.kbpk_aes);
+
+	return r;
+}
+
+// key block migration record helper function
+static void do_tr31_migrate_record(void* ctx, struct tr31_tool_bulk_record_t* record)
+{
+	const struct tr31_tool_migrate_ctx_t* migrate_ctx = ctx;
+	const struct tr31_key_t* kbpk_old;
+	const struct tr31_key_t* kbpk_new;
+	unsigned int format_version;
+	char key_block[10000]; // max key block length is 9999 + null-termination
+
+	// retain empty lines
+	if (!record->line_len) {
+		record->result = 0;
+		tr31_tool_bulk_output_append(record, "\n", 1);
+		return;
+	}
+
+	// determine key block protection keys from format versions
+	format_version = migrate_ctx->format_version ? migrate_ctx->format_version : (uint8_t)record->line[0];
+	kbpk_old = select_kbpk_by_version((uint8_t)record->line[0], &migrate_ctx->kbpk_old_tdes, &migrate_ctx->kbpk_old_aes);
+	kbpk_new = select_kbpk_by_version(format_version, &migrate_ctx->kbpk_new_tdes, &migrate_ctx->kbpk_new_aes);
+	if (!kbpk_old || !kbpk_new) {
+		record->result = TR31_ERROR_UNSUPPORTED_VERSION;
+	} else if (!kbpk_old->length || !kbpk_new->length) {
+		record->result = TR31_ERROR_UNSUPPORTED_KBPK_LENGTH;
+	} else {
+		record->result = tr31_rewrap(
+			record->line,
+			record->line_len,
+			kbpk_old,
+			kbpk_new,
+			format_version,
+			migrate_ctx->import_flags,
+			migrate_ctx->export_flags,
+			key_block,
+			sizeof(key_block)
+		);
+	}
+	if (record->result) {
+		// failed key blocks result in empty lines
+		tr31_tool_bulk_output_append(record, "\n", 1);
+		return;
+	}
+
+	tr31_tool_bulk_output_append(record, key_block, strlen(key_block));
+	tr31_tool_bulk_output_append(record, "\n", 1);
+}
+
+// key block migration helper function
+static int do_tr31_migrate(const struct tr31_tool_options_t* options)
+{
+	int r;
+	struct tr31_tool_migrate_ctx_t migrate_ctx;
+	struct tr31_tool_bulk_config_t config;
+	struct tr31_tool_bulk_stats_t stats;
+	char* journal_path = NULL;
+	char journal_id[64];
+	size_t journal_id_len = 0;
+
+	memset(&migrate_ctx, 0, sizeof(migrate_ctx));
+	migrate_ctx.format_version = options->migrate_format_version;
+	migrate_ctx.import_flags = options->import_flags;
+	migrate_ctx.export_flags = options->export_flags;
+
+	// validate format version
+	switch (migrate_ctx.format_version) {
+		case 0: // retain format version
+		case TR31_VERSION_A:
+		case TR31_VERSION_B:
+		case TR31_VERSION_C:
+		case TR31_VERSION_D:
+		case TR31_VERSION_E:
+			break;
+
+		default:
+			fprintf(stderr, "%s\n", tr31_get_error_string(TR31_ERROR_UNSUPPORTED_VERSION));
+			return 1;
+	}
+
+	// populate key block protection keys
+	r = populate_kbpk_by_algorithm(
+		options->kbpk_old_buf,
+		options->kbpk_old_buf_len,
+		&migrate_ctx.kbpk_old_tdes,
+		&migrate_ctx.kbpk_old_aes
+	);
+	if (r) {
+		goto exit;
+	}
+	r = populate_kbpk_by_algorithm(
+		options->kbpk_new_buf,
+		options->kbpk_new_buf_len,
+		&migrate_ctx.kbpk_new_tdes,
+		&migrate_ctx.kbpk_new_aes
+	);
+	if (r) {
+		goto exit;
+	}
+
+	// use journal to allow interrupted migration to be resumed, but only if
+	// both input and output are files
+	if (strcmp(options->migrate_input_path, "-") != 0 &&
+		strcmp(options->migrate_output_path, "-") != 0
+	) {
+		size_t journal_path_len = strlen(options->migrate_output_path) + 9;
+		journal_path = malloc(journal_path_len);
+		if (!journal_path) {
+			fprintf(stderr, "Memory allocation failed\n");
+			r = 1;
+			goto exit;
+		}
+		snprintf(journal_path, journal_path_len, "%s.journal", options->migrate_output_path);
+
+		// identify KBPKs by their KCVs, as well as the format version, such
+		// that a migration is only resumed using the same parameters
+		const struct tr31_key_t* kbpks[] = {
+			&migrate_ctx.kbpk_old_tdes,
+			&migrate_ctx.kbpk_old_aes,
+			&migrate_ctx.kbpk_new_tdes,
+			&migrate_ctx.kbpk_new_aes,
+		};
+		for (size_t i = 0; i < sizeof(kbpks) / sizeof(kbpks[0]); ++i) {
+			for (size_t j = 0; j < kbpks[i]->kcv_len; ++j) {
+				journal_id_len += snprintf(journal_id + journal_id_len, sizeof(journal_id) - journal_id_len, "%02X", kbpks[i]->kcv[j]);
+			}
+			journal_id_len += snprintf(journal_id + journal_id_len, sizeof(journal_id) - journal_id_len, ":");
+		}
+		snprintf(journal_id + journal_id_len, sizeof(journal_id) - journal_id_len, "%c",
+			migrate_ctx.format_version ? (char)migrate_ctx.format_version : '-'
+		);
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.input_path = options->migrate_input_path;
+	config.output_path = options->migrate_output_path;
+	config.journal_path = journal_path;
+	config.journal_id = journal_path ? journal_id : NULL;
+	config.jobs = options->jobs;
+	config.progress = true;
+	config.report_errors = true;
+	config.func = &do_tr31_migrate_record;
+	config.ctx = &migrate_ctx;
+
+	r = tr31_tool_bulk_run(&config, &stats);
+	if (r) {
+		goto exit;
+	}
+	tr31_tool_bulk_print_stats(&stats);
+	if (stats.errors) {
+		r = 1;
+		goto exit;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	free(journal_path);
+	tr31_key_release(&migrate_ctx.kbpk_old_tdes);
+	tr31_key_release(&migrate_ctx.kbpk_old_aes);
+	tr31_key_release(&migrate_ctx.kbpk_new_tdes);
+	tr31_key_release(&migrate_ctx.kbpk_new_aes);
+
+	return r;
+}
+
 int main(int argc, char** argv)
 {
 	int r;
@@ -1502,16 +2761,43 @@ int main(int argc, char** argv)
 		goto exit;
 	}
 
+	if (options.import_file) {
+		r = do_tr31_import_file(&options);
+		goto exit;
+	}
+
+	if (options.verify_file) {
+		r = do_tr31_verify_file(&options);
+		goto exit;
+	}
+
 	if (options.export) {
 		r = do_tr31_export(&options);
 		goto exit;
 	}
 
+	if (options.export_file) {
+		r = do_tr31_export_file(&options);
+		goto exit;
+	}
+
+	if (options.migrate) {
+		r = do_tr31_migrate(&options);
+		goto exit;
+	}
+
 	// Unknown error
 	r = -1;
 	goto exit;
 
 exit:
+	if (options.stats_path) {
+		// report counters regardless of whether processing succeeded
+		if (write_stats(options.stats_path) && !r) {
+			r = 1;
+		}
+	}
+
 	// Cleanup
 	if (options.key_block) {
 		free(options.key_block);
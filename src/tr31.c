@@ -22,16 +22,29 @@
 #include "tr31.h"
 #include "tr31_config.h"
 #include "tr31_crypto.h"
+#include "tr31_stats.h"
 
 #include "crypto_tdes.h"
 #include "crypto_aes.h"
 #include "crypto_mem.h"
-#include "crypto_rand.h"
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef TR31_ENABLE_TRACE
+#include <time.h>
+#endif
+
+#ifdef TR31_ENABLE_USDT
+#include <sys/sdt.h>
+#endif
 
 #if defined(HAVE_ARPA_INET_H)
 #include <arpa/inet.h> // for ntohs and friends
@@ -91,11 +104,46 @@ struct tr31_payload_t {
 #define TR31_MIN_PAYLOAD_LENGTH (DES_BLOCK_SIZE)
 #define TR31_MIN_KEY_BLOCK_LENGTH (sizeof(struct tr31_header_t) + TR31_MIN_PAYLOAD_LENGTH + 8) // Minimum key block length: header + minimum payload + authenticator
 
+// per-stage timing instrumentation
+// when TR31_ENABLE_TRACE is not defined, these macros produce no code at all
+// and when it is defined but no trace hook is set, they only test the hook
+#ifdef TR31_ENABLE_TRACE
+#define TR31_TRACE_BEGIN(name) uint64_t name = tr31_trace_begin()
+#define TR31_TRACE_END(stage, name) tr31_trace_end(stage, name)
+#else
+#define TR31_TRACE_BEGIN(name) do {} while (0)
+#define TR31_TRACE_END(stage, name) do {} while (0)
+#endif
+
+// USDT probes for dynamic tracing tools like bpftrace, using provider libtr31
+// when TR31_ENABLE_USDT is not defined, these macros produce no code at all
+// and when it is defined, each probe is a single nop instruction until a
+// tracer attaches to it
+#ifdef TR31_ENABLE_USDT
+#define TR31_PROBE2(name, arg1, arg2) STAP_PROBE2(libtr31, name, arg1, arg2)
+#define TR31_PROBE3(name, arg1, arg2, arg3) STAP_PROBE3(libtr31, name, arg1, arg2, arg3)
+#define TR31_PROBE4(name, arg1, arg2, arg3, arg4) STAP_PROBE4(libtr31, name, arg1, arg2, arg3, arg4)
+#else
+#define TR31_PROBE2(name, arg1, arg2) do {} while (0)
+#define TR31_PROBE3(name, arg1, arg2, arg3) do {} while (0)
+#define TR31_PROBE4(name, arg1, arg2, arg3, arg4) do {} while (0)
+#endif
+
 // Internal processing state
+// Key block encryption key (KBEK) and key block authentication key (KBAK)
+// derived from key block protection key (KBPK) for a specific format version
+struct tr31_kbpk_derived_t {
+	uint8_t kbek[AES256_KEY_SIZE];
+	uint8_t kbak[AES256_KEY_SIZE];
+};
+
 struct tr31_state_t {
 	// flags used during processing
 	uint32_t flags;
 
+	// key block format version
+	uint8_t version_id;
+
 	// encryption block size used for header length validation
 	unsigned int enc_block_size;
 
@@ -112,9 +160,109 @@ struct tr31_state_t {
 	void* payload;
 	size_t authenticator_length;
 	void* authenticator;
+
+	// previously derived keys for key block protection key, if available
+	const struct tr31_kbpk_derived_t* kbpk_derived;
+};
+
+// Internal state for batch re-wrap processing
+struct tr31_rewrap_batch_t {
+	struct tr31_rewrap_item_t* items;
+	size_t items_count;
+	atomic_size_t next_item;
+
+	const struct tr31_key_t* kbpk_old;
+	const struct tr31_key_t* kbpk_new;
+	uint8_t version_id;
+	uint32_t import_flags;
+	uint32_t export_flags;
+};
+
+// Internal keyring entry
+// Entries are immutable once published and may be shared by snapshots
+// Derived keys are indexed by tr31_keyring_derived_index()
+struct tr31_keyring_entry_t {
+	size_t id;
+	struct tr31_key_t kbpk;
+	uint32_t hash;
+	struct tr31_kbpk_derived_t derived[2];
+};
+
+// Internal keyring snapshot
+// Snapshots are immutable once published and keyring updates replace the
+// current snapshot instead of modifying it
+struct tr31_keyring_snapshot_t {
+	uint64_t version;
+	size_t entries_count;
+	struct tr31_keyring_entry_t** entries;
+	size_t* next; // index + 1 of next entry in same hash bucket; zero for none
+
+	// hash buckets containing index + 1 of first entry; zero for none
+	// number of buckets is always a power of two
+	size_t buckets_count;
+	size_t* buckets;
+
+	// populated when snapshot is replaced:
+	// - entry removed by the update, if any, to be released with snapshot
+	// - epoch during which the snapshot was replaced
+	// - next replaced snapshot awaiting reclamation
+	struct tr31_keyring_entry_t* removed;
+	uint64_t retired_epoch;
+	struct tr31_keyring_snapshot_t* retired_next;
+};
+
+// Internal keyring state
+struct tr31_keyring_t {
+	// current snapshot; readers only perform an atomic load
+	_Atomic(struct tr31_keyring_snapshot_t*) snapshot;
+
+	// epoch based reclamation of replaced snapshots
+	// readers register in the counter for the parity of the current epoch
+	atomic_uint_fast64_t epoch;
+	atomic_size_t readers[2];
+
+	// writer state; protected by writer mutex, if available
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;
+#endif
+	size_t next_id;
+	struct tr31_keyring_snapshot_t* retired;
+};
+
+// Internal state for parallel keyring trial import
+struct tr31_keyring_trial_t {
+	const struct tr31_keyring_snapshot_t* snapshot;
+	const char* key_block;
+	size_t key_block_len;
+	uint32_t flags;
+	unsigned int kbpk_algorithm;
+	unsigned int derived_index;
+	atomic_size_t next_entry;
+	atomic_size_t found; // index + 1 of entry that completed the trial; zero for none
+	int result; // result of entry that completed the trial; only written by its thread
+	struct tr31_ctx_t* ctx; // populated by entry that completed the trial
 };
 
+// memory allocator provided by tr31_set_allocator()
+static struct tr31_allocator_t tr31_allocator = { NULL, NULL, NULL, NULL };
+
+#ifdef TR31_ENABLE_TRACE
+// trace hook provided by tr31_set_trace_hook()
+static tr31_trace_func_t tr31_trace_func = NULL;
+static void* tr31_trace_ctx = NULL;
+#endif
+
 // helper functions
+static void* tr31_malloc(size_t size);
+static void* tr31_calloc(size_t nmemb, size_t size);
+static void* tr31_realloc(void* ptr, size_t size);
+static void tr31_free(void* ptr);
+static inline void tr31_stats_alloc(size_t size, const void* ptr);
+#ifdef TR31_ENABLE_TRACE
+static uint64_t tr31_trace_now(void);
+static inline uint64_t tr31_trace_begin(void);
+static inline void tr31_trace_end(enum tr31_trace_stage_t stage, uint64_t start_ns);
+#endif
 static int dec_to_int(const char* str, size_t str_len);
 static void int_to_dec(unsigned int value, char* str, size_t str_len);
 static int hex_to_int(const char* str, size_t str_len);
@@ -125,17 +273,40 @@ static int tr31_validate_format_an(const char* buf, size_t buf_len);
 static int tr31_validate_format_h(const char* buf, size_t buf_len);
 static int tr31_validate_format_pa(const char* buf, size_t buf_len);
 static struct tr31_opt_ctx_t* tr31_opt_block_alloc(struct tr31_ctx_t* ctx, unsigned int id, size_t length);
+static void tr31_opt_block_remove(struct tr31_ctx_t* ctx, unsigned int id);
 static inline size_t tr31_opt_block_kcv_data_length(size_t kcv_len);
+static int tr31_key_compute_kcv(const struct tr31_key_t* key, uint8_t* kcv_algorithm, uint8_t* kcv, size_t* kcv_len);
 static int tr31_opt_block_encode_kcv(uint8_t kcv_algorithm, const void* kcv, size_t kcv_len, char* encoded_data, size_t encoded_data_len);
+static int tr31_opt_block_decode_DA_internal(const struct tr31_opt_ctx_t* opt_ctx, unsigned int* version, size_t* count, struct tr31_opt_blk_da_attr_t* attr, size_t attr_max);
 static int tr31_opt_block_validate_hash_algorithm(uint8_t hash_algorithm);
 static int tr31_opt_block_parse(const struct tr31_state_t* state, const void* ptr, size_t remaining_len, size_t* opt_block_len, struct tr31_opt_ctx_t* opt_ctx);
+static int tr31_opt_block_parse_internal(const struct tr31_state_t* state, const void* ptr, size_t remaining_len, size_t* opt_block_len, struct tr31_opt_ctx_t* opt_ctx);
 static int tr31_opt_block_validate_iso8601(const char* ts_str, size_t ts_str_len);
+static int tr31_opt_block_decode_iso8601(const struct tr31_opt_ctx_t* opt_ctx, struct tr31_opt_blk_time_data_t* time_data);
 static int tr31_opt_block_export(const struct tr31_opt_ctx_t* opt_ctx, size_t remaining_len, size_t* opt_blk_len, void* ptr);
 static int tr31_opt_block_export_PB(const struct tr31_state_t* state, size_t pb_len, struct tr31_opt_blk_t* opt_blk);
 static int tr31_state_init(uint32_t flags, uint8_t version_id, struct tr31_state_t* state);
 static int tr31_state_prepare_import(struct tr31_state_t* state, const void* key_block, size_t key_block_len, size_t header_len);
 static int tr31_state_prepare_export(struct tr31_state_t* state, struct tr31_header_t* header, size_t header_len, size_t key_block_buf_len, const struct tr31_key_t* key);
 static void tr31_state_release(struct tr31_state_t* state);
+static int tr31_import_internal(const char* key_block, size_t key_block_len, const struct tr31_key_t* kbpk, const struct tr31_kbpk_derived_t* kbpk_derived, uint32_t flags, bool verify_only, struct tr31_ctx_t* ctx);
+static int tr31_export_internal(const struct tr31_ctx_t* ctx, const struct tr31_key_t* kbpk, uint32_t flags, char* key_block, size_t key_block_buf_len);
+static void tr31_rewrap_batch_process(struct tr31_rewrap_batch_t* batch);
+static uint32_t tr31_keyring_hash(unsigned int kbpk_algorithm, uint8_t kcv_algorithm, const uint8_t* kcv);
+static int tr31_keyring_derived_index(uint8_t version_id, unsigned int* kbpk_algorithm, unsigned int* derived_index);
+static int tr31_keyring_entry_create(const struct tr31_key_t* kbpk, struct tr31_keyring_entry_t** entry);
+static void tr31_keyring_entry_destroy(struct tr31_keyring_entry_t* entry);
+static struct tr31_keyring_snapshot_t* tr31_keyring_snapshot_create(const struct tr31_keyring_snapshot_t* snapshot, struct tr31_keyring_entry_t* add_entry, const struct tr31_keyring_entry_t* remove_entry);
+static void tr31_keyring_snapshot_destroy(struct tr31_keyring_snapshot_t* snapshot);
+static int tr31_keyring_update(struct tr31_keyring_t* keyring, struct tr31_keyring_entry_t* add_entry, const size_t* remove_id, size_t* kbpk_id);
+static size_t tr31_keyring_reclaim_internal(struct tr31_keyring_t* keyring);
+static const struct tr31_keyring_snapshot_t* tr31_keyring_read_begin(struct tr31_keyring_t* keyring, unsigned int* reader);
+static void tr31_keyring_read_end(struct tr31_keyring_t* keyring, unsigned int reader);
+static void tr31_keyring_trial_process(struct tr31_keyring_trial_t* trial);
+static int tr31_keyring_trial(const struct tr31_keyring_snapshot_t* snapshot, const char* key_block, size_t key_block_len, uint32_t flags, unsigned int kbpk_algorithm, unsigned int derived_index, unsigned int thread_count, struct tr31_ctx_t* ctx, size_t* found);
+static int tr31_keyring_import_internal(const struct tr31_keyring_snapshot_t* snapshot, const char* key_block, size_t key_block_len, uint32_t flags, unsigned int thread_count, struct tr31_ctx_t* ctx, size_t* kbpk_id);
+static int tr31_kbpk_derive_internal(uint8_t version_id, const struct tr31_key_t* kbpk, uint8_t* kbek, uint8_t* kbak);
+static int tr31_kbpk_derive(const struct tr31_state_t* state, const struct tr31_key_t* kbpk, uint8_t* kbek, uint8_t* kbak);
 static int tr31_tdes_decrypt_verify_variant_binding(const struct tr31_state_t* state, const struct tr31_key_t* kbpk, struct tr31_key_t* key);
 static int tr31_tdes_encrypt_sign_variant_binding(struct tr31_state_t* state, const struct tr31_key_t* kbpk);
 static int tr31_tdes_decrypt_verify_derivation_binding(struct tr31_state_t* state, const struct tr31_key_t* kbpk, struct tr31_key_t* key);
@@ -143,6 +314,139 @@ static int tr31_tdes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 static int tr31_aes_decrypt_verify_derivation_binding(struct tr31_state_t* state, const struct tr31_key_t* kbpk, struct tr31_key_t* key);
 static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state, const struct tr31_key_t* kbpk);
 
+static void* tr31_malloc(size_t size)
+{
+	void* ptr;
+
+	if (tr31_allocator.malloc_func) {
+		ptr = tr31_allocator.malloc_func(tr31_allocator.ctx, size);
+	} else {
+		ptr = malloc(size);
+	}
+
+	tr31_stats_alloc(size, ptr);
+	return ptr;
+}
+
+static void* tr31_calloc(size_t nmemb, size_t size)
+{
+	void* ptr;
+
+	if (!tr31_allocator.malloc_func) {
+		ptr = calloc(nmemb, size);
+		tr31_stats_alloc(nmemb * size, ptr);
+		return ptr;
+	}
+
+	if (size && nmemb > SIZE_MAX / size) {
+		tr31_stats_alloc(0, NULL);
+		return NULL;
+	}
+	ptr = tr31_allocator.malloc_func(tr31_allocator.ctx, nmemb * size);
+	if (ptr) {
+		memset(ptr, 0, nmemb * size);
+	}
+	tr31_stats_alloc(nmemb * size, ptr);
+	return ptr;
+}
+
+static void* tr31_realloc(void* ptr, size_t size)
+{
+	void* new_ptr;
+
+	if (tr31_allocator.realloc_func) {
+		new_ptr = tr31_allocator.realloc_func(tr31_allocator.ctx, ptr, size);
+	} else {
+		new_ptr = realloc(ptr, size);
+	}
+
+	tr31_stats_alloc(size, new_ptr);
+	return new_ptr;
+}
+
+static void tr31_free(void* ptr)
+{
+	if (tr31_allocator.free_func) {
+		tr31_allocator.free_func(tr31_allocator.ctx, ptr);
+		return;
+	}
+	free(ptr);
+}
+
+static inline void tr31_stats_alloc(size_t size, const void* ptr)
+{
+	if (!ptr) {
+		tr31_stats_add(TR31_STATS_INDEX(alloc_failed_count), 1);
+		return;
+	}
+	tr31_stats_add(TR31_STATS_INDEX(alloc_count), 1);
+	tr31_stats_add(TR31_STATS_INDEX(alloc_bytes), size);
+}
+
+void tr31_set_allocator(const struct tr31_allocator_t* allocator)
+{
+	if (allocator &&
+		allocator->malloc_func &&
+		allocator->realloc_func &&
+		allocator->free_func
+	) {
+		tr31_allocator = *allocator;
+	} else {
+		memset(&tr31_allocator, 0, sizeof(tr31_allocator));
+	}
+}
+
+#ifdef TR31_ENABLE_TRACE
+static uint64_t tr31_trace_now(void)
+{
+	struct timespec ts;
+
+#ifdef HAVE_CLOCK_GETTIME
+	if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		return 0;
+	}
+#else
+	// fallback to C11 wall clock time if a monotonic clock is not available
+	if (!timespec_get(&ts, TIME_UTC)) {
+		return 0;
+	}
+#endif
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t tr31_trace_begin(void)
+{
+	if (!tr31_trace_func) {
+		return 0;
+	}
+	return tr31_trace_now();
+}
+
+static inline void tr31_trace_end(enum tr31_trace_stage_t stage, uint64_t start_ns)
+{
+	// skip stages that started before the trace hook was set
+	if (!tr31_trace_func || !start_ns) {
+		return;
+	}
+	tr31_trace_func(tr31_trace_ctx, stage, start_ns, tr31_trace_now());
+}
+#endif
+
+int tr31_set_trace_hook(tr31_trace_func_t func, void* ctx)
+{
+#ifdef TR31_ENABLE_TRACE
+	tr31_trace_func = func;
+	tr31_trace_ctx = func ? ctx : NULL;
+	return 0;
+#else
+	// tracing not available
+	(void)func;
+	(void)ctx;
+	return -1;
+#endif
+}
+
 static int dec_to_int(const char* str, size_t str_len)
 {
 	int value;
@@ -549,7 +853,7 @@ void tr31_key_release(struct tr31_key_t* key)
 {
 	if (key->data) {
 		crypto_cleanse(key->data, key->length);
-		free(key->data);
+		tr31_free(key->data);
 		key->data = NULL;
 		key->kcv_len = 0;
 	}
@@ -588,8 +892,6 @@ int tr31_key_copy(
 
 int tr31_key_set_data(struct tr31_key_t* key, const void* data, size_t length)
 {
-	int r;
-
 	if (!key || !data || !length) {
 		return -1;
 	}
@@ -597,43 +899,85 @@ int tr31_key_set_data(struct tr31_key_t* key, const void* data, size_t length)
 	// release existing key data
 	tr31_key_release(key);
 
-	// update KCV
+	// KCV is computed when first requested
+	// see tr31_key_get_kcv()
+	key->kcv_algorithm = 0;
 	key->kcv_len = 0;
 	memset(&key->kcv, 0, sizeof(key->kcv));
+
+	// copy key data
+	key->length = length;
+	key->data = tr31_malloc(key->length);
+	memcpy(key->data, data, key->length);
+
+	return 0;
+}
+
+static int tr31_key_compute_kcv(
+	const struct tr31_key_t* key,
+	uint8_t* kcv_algorithm,
+	uint8_t* kcv,
+	size_t* kcv_len
+)
+{
+	int r;
+
+	if (key->kcv_len) {
+		// use cached KCV
+		*kcv_algorithm = key->kcv_algorithm;
+		memcpy(kcv, key->kcv, key->kcv_len);
+		*kcv_len = key->kcv_len;
+		return 0;
+	}
+
+	if (!key->data || !key->length) {
+		return TR31_ERROR_KCV_NOT_AVAILABLE;
+	}
+
 	if (key->algorithm == TR31_KEY_ALGORITHM_TDES) {
 		// use legacy KCV for TDES key
 		// see ANSI X9.24-1:2017, 7.7.2
-		key->kcv_algorithm = TR31_OPT_BLOCK_KCV_LEGACY;
-		r = crypto_tdes_kcv_legacy(data, length, key->kcv);
+		TR31_TRACE_BEGIN(trace_kcv);
+		r = crypto_tdes_kcv_legacy(key->data, key->length, kcv);
+		TR31_TRACE_END(TR31_TRACE_STAGE_KCV, trace_kcv);
 		if (r) {
 			// failed to compute KCV
 			return TR31_ERROR_KCV_NOT_AVAILABLE;
 		}
-		key->kcv_len = DES_KCV_SIZE_LEGACY;
+		*kcv_algorithm = TR31_OPT_BLOCK_KCV_LEGACY;
+		*kcv_len = DES_KCV_SIZE_LEGACY;
 
 	} else if (key->algorithm == TR31_KEY_ALGORITHM_AES) {
 		// use CMAC-based KCV for AES key
 		// see ANSI X9.24-1:2017, 7.7.2
-		key->kcv_algorithm = TR31_OPT_BLOCK_KCV_CMAC;
-		r = crypto_aes_kcv(data, length, key->kcv);
+		TR31_TRACE_BEGIN(trace_kcv);
+		r = crypto_aes_kcv(key->data, key->length, kcv);
+		TR31_TRACE_END(TR31_TRACE_STAGE_KCV, trace_kcv);
 		if (r) {
 			// failed to compute KCV
 			return TR31_ERROR_KCV_NOT_AVAILABLE;
 		}
-		key->kcv_len = AES_KCV_SIZE;
+		*kcv_algorithm = TR31_OPT_BLOCK_KCV_CMAC;
+		*kcv_len = AES_KCV_SIZE;
 
 	} else {
-		// key algorithm not suitable for KCV computation; continue
+		// key algorithm not suitable for KCV computation
+		return TR31_ERROR_KCV_NOT_AVAILABLE;
 	}
 
-	// copy key data
-	key->length = length;
-	key->data = malloc(key->length);
-	memcpy(key->data, data, key->length);
-
 	return 0;
 }
 
+int tr31_key_get_kcv(struct tr31_key_t* key)
+{
+	if (!key) {
+		return -1;
+	}
+
+	// compute KCV when first requested and cache it in the key object
+	return tr31_key_compute_kcv(key, &key->kcv_algorithm, key->kcv, &key->kcv_len);
+}
+
 int tr31_key_set_key_version(struct tr31_key_t* key, const char* key_version)
 {
 	int r;
@@ -818,7 +1162,7 @@ int tr31_init_from_header(
 	// see ANSI X9.143:2021, 6.3.6
 	ptr = header + 1; // optional blocks, if any, are after the header
 	if (ctx->opt_blocks_count) {
-		ctx->opt_blocks = calloc(ctx->opt_blocks_count, sizeof(ctx->opt_blocks[0]));
+		ctx->opt_blocks = tr31_calloc(ctx->opt_blocks_count, sizeof(ctx->opt_blocks[0]));
 	}
 	for (int i = 0; i < opt_blocks_count; ++i) {
 		// ensure that current pointer is valid for minimal optional block
@@ -886,35 +1230,23 @@ static struct tr31_opt_ctx_t* tr31_opt_block_alloc(
 		}
 	}
 
-	// if optional block PB already exists, remove all instances
+	// if optional block PB already exists, remove it
 	// NOTE: it will be recreated by tr31_export()
 	// NOTE: if no new optional blocks are added, PB is intentionally preserved
 	if (opt_blk_pb_found) {
-		for (size_t i = 0; i < ctx->opt_blocks_count; ++i) {
-			if (ctx->opt_blocks[i].id == TR31_OPT_BLOCK_PB) {
-				free(ctx->opt_blocks[i].data);
-				ctx->opt_blocks[i].data = NULL;
-
-				ctx->opt_blocks_count -= 1;
-				if (i < ctx->opt_blocks_count) {
-					size_t remaining_count = ctx->opt_blocks_count - i;
-					size_t remaining_bytes = sizeof(*ctx->opt_blocks) * remaining_count;
-					memmove(&ctx->opt_blocks[i], &ctx->opt_blocks[i + 1], remaining_bytes);
-				}
-			}
-		}
+		tr31_opt_block_remove(ctx, TR31_OPT_BLOCK_PB);
 	}
 
 	// grow optional block array
 	ctx->opt_blocks_count++;
-	ctx->opt_blocks = realloc(ctx->opt_blocks, ctx->opt_blocks_count * sizeof(struct tr31_opt_ctx_t));
+	ctx->opt_blocks = tr31_realloc(ctx->opt_blocks, ctx->opt_blocks_count * sizeof(struct tr31_opt_ctx_t));
 
 	// copy optional block fields and allocate optional block data
 	opt_ctx = &ctx->opt_blocks[ctx->opt_blocks_count - 1];
 	opt_ctx->id = id;
 	opt_ctx->data_length = length;
 	if (length) {
-		opt_ctx->data = malloc(opt_ctx->data_length);
+		opt_ctx->data = tr31_malloc(opt_ctx->data_length);
 	} else {
 		opt_ctx->data = NULL;
 	}
@@ -922,6 +1254,27 @@ static struct tr31_opt_ctx_t* tr31_opt_block_alloc(
 	return opt_ctx;
 }
 
+static void tr31_opt_block_remove(struct tr31_ctx_t* ctx, unsigned int id)
+{
+	for (size_t i = 0; i < ctx->opt_blocks_count; ++i) {
+		if (ctx->opt_blocks[i].id == id) {
+			if (ctx->opt_blocks[i].data) {
+				tr31_free(ctx->opt_blocks[i].data);
+			}
+
+			ctx->opt_blocks_count -= 1;
+			if (i < ctx->opt_blocks_count) {
+				size_t remaining_count = ctx->opt_blocks_count - i;
+				size_t remaining_bytes = sizeof(*ctx->opt_blocks) * remaining_count;
+				memmove(&ctx->opt_blocks[i], &ctx->opt_blocks[i + 1], remaining_bytes);
+			}
+
+			// optional block IDs are unique
+			return;
+		}
+	}
+}
+
 int tr31_opt_block_add(
 	struct tr31_ctx_t* ctx,
 	unsigned int id,
@@ -1364,7 +1717,7 @@ int tr31_opt_block_add_CT(
 			opt_block_ct->data_length = 2 + 4 + old.data_length + 2 + 4 + cert_base64_len;
 
 			// convert to cert chain
-			opt_block_ct->data = malloc(opt_block_ct->data_length);
+			opt_block_ct->data = tr31_malloc(opt_block_ct->data_length);
 			data = opt_block_ct->data;
 			int_to_hex(TR31_OPT_BLOCK_CT_CERT_CHAIN, data, 2);
 			memcpy(data + 2, old.data, 2); // copy first certificate format
@@ -1378,7 +1731,7 @@ int tr31_opt_block_add_CT(
 			memcpy(data + 6, cert_base64, cert_base64_len);
 
 			// cleanup optional block CT data
-			free(old.data);
+			tr31_free(old.data);
 			old.data = NULL;
 			old.data_length = 0;
 
@@ -1392,7 +1745,7 @@ int tr31_opt_block_add_CT(
 			// - 4 bytes for next certificate length
 			// - next certificate data
 			opt_block_ct->data_length += 2 + 4 + cert_base64_len;
-			opt_block_ct->data = realloc(opt_block_ct->data, opt_block_ct->data_length);
+			opt_block_ct->data = tr31_realloc(opt_block_ct->data, opt_block_ct->data_length);
 			data = opt_block_ct->data + opt_block_ct->data_length - 2 - 4 - cert_base64_len;
 
 			// add new cert to chain
@@ -1455,30 +1808,23 @@ int tr31_opt_block_add_DA(
 	return r;
 }
 
-int tr31_opt_block_decode_DA(
+static int tr31_opt_block_decode_DA_internal(
 	const struct tr31_opt_ctx_t* opt_ctx,
-	struct tr31_opt_blk_da_data_t* da_data,
-	size_t da_data_len
+	unsigned int* version,
+	size_t* count,
+	struct tr31_opt_blk_da_attr_t* attr,
+	size_t attr_max
 )
 {
-	size_t count;
 	const uint8_t* da_attr;
 
-	if (!opt_ctx || !da_data || !da_data_len) {
-		return -1;
-	}
-
-	if (opt_ctx->id != TR31_OPT_BLOCK_DA) {
-		return -2;
-	}
-
 	// decode optional block DA version
 	// see ANSI X9.143:2021, 6.3.6.1, table 8
 	if (opt_ctx->data_length < 2) {
 		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
 	}
-	da_data->version = hex_to_int(opt_ctx->data, 2);
-	if (da_data->version != TR31_OPT_BLOCK_DA_VERSION_1) {
+	*version = hex_to_int(opt_ctx->data, 2);
+	if (*version != TR31_OPT_BLOCK_DA_VERSION_1) {
 		// unsupported DA version
 		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
 	}
@@ -1489,29 +1835,59 @@ int tr31_opt_block_decode_DA(
 	) {
 		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
 	}
-	count = (opt_ctx->data_length - 2) / 5;
-
-	// validate output data length
-	if (da_data_len != sizeof(struct tr31_opt_blk_da_attr_t) * count + sizeof(struct tr31_opt_blk_da_data_t)) {
-		return -3;
-	}
+	*count = (opt_ctx->data_length - 2) / 5;
 
-	// decode optional block DA version 1
+	// decode optional block DA version 1, up to the available output
 	// see ANSI X9.143:2021, 6.3.6.1, table 8
 	da_attr = opt_ctx->data + 2;
-	for (size_t i = 0; i < count; ++i) {
+	for (size_t i = 0; i < *count && i < attr_max; ++i) {
 		uint16_t key_usage_raw = da_attr[0];
 		key_usage_raw += da_attr[1] << 8;
-		da_data->attr[i].key_usage = ntohs(key_usage_raw);
-		da_data->attr[i].algorithm = da_attr[2];
-		da_data->attr[i].mode_of_use = da_attr[3];
-		da_data->attr[i].exportability = da_attr[4];
+		attr[i].key_usage = ntohs(key_usage_raw);
+		attr[i].algorithm = da_attr[2];
+		attr[i].mode_of_use = da_attr[3];
+		attr[i].exportability = da_attr[4];
 		da_attr += 5;
 	}
 
 	return 0;
 }
 
+int tr31_opt_block_decode_DA(
+	const struct tr31_opt_ctx_t* opt_ctx,
+	struct tr31_opt_blk_da_data_t* da_data,
+	size_t da_data_len
+)
+{
+	int r;
+	size_t attr_max = 0;
+	size_t count;
+
+	if (!opt_ctx || !da_data || !da_data_len) {
+		return -1;
+	}
+
+	if (opt_ctx->id != TR31_OPT_BLOCK_DA) {
+		return -2;
+	}
+
+	// only decode attributes that fit in the output data
+	if (da_data_len > sizeof(struct tr31_opt_blk_da_data_t)) {
+		attr_max = (da_data_len - sizeof(struct tr31_opt_blk_da_data_t)) / sizeof(struct tr31_opt_blk_da_attr_t);
+	}
+	r = tr31_opt_block_decode_DA_internal(opt_ctx, &da_data->version, &count, da_data->attr, attr_max);
+	if (r) {
+		return r;
+	}
+
+	// validate output data length
+	if (da_data_len != sizeof(struct tr31_opt_blk_da_attr_t) * count + sizeof(struct tr31_opt_blk_da_data_t)) {
+		return -3;
+	}
+
+	return 0;
+}
+
 static int tr31_opt_block_validate_hash_algorithm(uint8_t hash_algorithm)
 {
 	// validate hash algorithm
@@ -1903,6 +2279,22 @@ int tr31_opt_block_add_TC(
 	return tr31_opt_block_add(ctx, TR31_OPT_BLOCK_TC, tc_str, strlen(tc_str));
 }
 
+int tr31_opt_block_decode_TC(
+	const struct tr31_opt_ctx_t* opt_ctx,
+	struct tr31_opt_blk_time_data_t* time_data
+)
+{
+	if (!opt_ctx || !time_data) {
+		return -1;
+	}
+
+	if (opt_ctx->id != TR31_OPT_BLOCK_TC) {
+		return -2;
+	}
+
+	return tr31_opt_block_decode_iso8601(opt_ctx, time_data);
+}
+
 int tr31_opt_block_add_TS(
 	struct tr31_ctx_t* ctx,
 	const char* ts_str
@@ -1924,6 +2316,22 @@ int tr31_opt_block_add_TS(
 	return tr31_opt_block_add(ctx, TR31_OPT_BLOCK_TS, ts_str, strlen(ts_str));
 }
 
+int tr31_opt_block_decode_TS(
+	const struct tr31_opt_ctx_t* opt_ctx,
+	struct tr31_opt_blk_time_data_t* time_data
+)
+{
+	if (!opt_ctx || !time_data) {
+		return -1;
+	}
+
+	if (opt_ctx->id != TR31_OPT_BLOCK_TS) {
+		return -2;
+	}
+
+	return tr31_opt_block_decode_iso8601(opt_ctx, time_data);
+}
+
 int tr31_opt_block_add_WP(
 	struct tr31_ctx_t* ctx,
 	uint8_t wrapping_pedigree
@@ -1987,48 +2395,212 @@ int tr31_opt_block_decode_WP(
 	return 0;
 }
 
-int tr31_import(
-	const char* key_block,
-	size_t key_block_len,
-	const struct tr31_key_t* kbpk,
-	uint32_t flags,
-	struct tr31_ctx_t* ctx
+int tr31_opt_blocks_decode_all(
+	const struct tr31_ctx_t* ctx,
+	struct tr31_opt_blocks_decoded_t* decoded
 )
 {
-	int r;
-	const struct tr31_header_t* header;
-	struct tr31_state_t state;
-	size_t opt_blk_len_total = 0;
-	const void* ptr;
+	int ret = 0;
 
-	if (!key_block || !ctx) {
+	if (!ctx || !decoded) {
 		return -1;
 	}
+	memset(decoded, 0, sizeof(*decoded));
 
-	// validate minimum length
-	if (key_block_len < TR31_MIN_KEY_BLOCK_LENGTH) {
-		return TR31_ERROR_INVALID_LENGTH;
+	if (!ctx->opt_blocks) { // might be NULL when tr31_import() fails
+		return 0;
 	}
 
-	// validate key block as printable ASCII (format PA)
-	r = tr31_validate_format_pa(key_block, key_block_len);
-	if (r) {
-		return TR31_ERROR_INVALID_CHARACTER;
-	}
+	for (size_t i = 0; i < ctx->opt_blocks_count; ++i) {
+		const struct tr31_opt_ctx_t* opt_ctx = &ctx->opt_blocks[i];
+		int r;
+		uint32_t bit;
+
+		// optional block IDs are unique and therefore each decoded output
+		// is populated at most once
+		switch (opt_ctx->id) {
+			case TR31_OPT_BLOCK_AL:
+				bit = TR31_OPT_BLOCKS_DECODED_AL;
+				r = tr31_opt_block_decode_AL(opt_ctx, &decoded->akl);
+				break;
 
-	// initialise processing state object
-	// this will populate:
-	// - state.flags
-	// - state.enc_block_size
-	// - state.authenticator_length
-	header = (const struct tr31_header_t*)key_block;
-	r = tr31_state_init(flags, header->version_id, &state);
-	if (r) {
-		// return error value as-is
-		return r;
-	}
+			case TR31_OPT_BLOCK_BI:
+				bit = TR31_OPT_BLOCKS_DECODED_BI;
+				r = tr31_opt_block_decode_BI(opt_ctx, &decoded->bdkid);
+				break;
 
-	// initialise key block context object
+			case TR31_OPT_BLOCK_DA:
+				bit = TR31_OPT_BLOCKS_DECODED_DA;
+				r = tr31_opt_block_decode_DA_internal(
+					opt_ctx,
+					&decoded->da_version,
+					&decoded->da_count,
+					decoded->da,
+					TR31_OPT_BLOCKS_DECODED_DA_MAX
+				);
+				break;
+
+			case TR31_OPT_BLOCK_HM:
+				bit = TR31_OPT_BLOCKS_DECODED_HM;
+				r = tr31_opt_block_decode_HM(opt_ctx, &decoded->hash_algorithm);
+				break;
+
+			case TR31_OPT_BLOCK_IK:
+				bit = TR31_OPT_BLOCKS_DECODED_IK;
+				r = tr31_opt_block_decode_IK(opt_ctx, decoded->ikid, sizeof(decoded->ikid));
+				break;
+
+			case TR31_OPT_BLOCK_KC:
+				bit = TR31_OPT_BLOCKS_DECODED_KC;
+				r = tr31_opt_block_decode_kcv(opt_ctx, &decoded->kc);
+				break;
+
+			case TR31_OPT_BLOCK_KP:
+				bit = TR31_OPT_BLOCKS_DECODED_KP;
+				r = tr31_opt_block_decode_kcv(opt_ctx, &decoded->kp);
+				break;
+
+			case TR31_OPT_BLOCK_KS:
+				bit = TR31_OPT_BLOCKS_DECODED_KS;
+				r = tr31_opt_block_decode_KS(opt_ctx, decoded->iksn, sizeof(decoded->iksn));
+				// legacy encodings only provide 8 bytes
+				decoded->iksn_len = opt_ctx->data_length == 16 ? 8 : sizeof(decoded->iksn);
+				break;
+
+			case TR31_OPT_BLOCK_PK:
+				bit = TR31_OPT_BLOCKS_DECODED_PK;
+				r = tr31_opt_block_decode_kcv(opt_ctx, &decoded->pk);
+				break;
+
+			case TR31_OPT_BLOCK_TC:
+				bit = TR31_OPT_BLOCKS_DECODED_TC;
+				r = tr31_opt_block_decode_TC(opt_ctx, &decoded->tc);
+				break;
+
+			case TR31_OPT_BLOCK_TS:
+				bit = TR31_OPT_BLOCKS_DECODED_TS;
+				r = tr31_opt_block_decode_TS(opt_ctx, &decoded->ts);
+				break;
+
+			case TR31_OPT_BLOCK_WP:
+				bit = TR31_OPT_BLOCKS_DECODED_WP;
+				r = tr31_opt_block_decode_WP(opt_ctx, &decoded->wp);
+				break;
+
+			default:
+				// no decoder available
+				continue;
+		}
+		if (r < 0) {
+			// internal error
+			return r;
+		}
+		if (r) {
+			// invalid; retain first error and continue with other optional blocks
+			decoded->invalid |= bit;
+			if (!ret) {
+				ret = r;
+			}
+			continue;
+		}
+		decoded->present |= bit;
+	}
+
+	return ret;
+}
+
+int tr31_import(
+	const char* key_block,
+	size_t key_block_len,
+	const struct tr31_key_t* kbpk,
+	uint32_t flags,
+	struct tr31_ctx_t* ctx
+)
+{
+	int r;
+	uint8_t version_id = key_block && key_block_len ? key_block[0] : 0;
+
+	TR31_PROBE3(import__entry, version_id, key_block_len, flags);
+	TR31_TRACE_BEGIN(trace_import);
+	r = tr31_import_internal(key_block, key_block_len, kbpk, NULL, flags, false, ctx);
+	TR31_TRACE_END(TR31_TRACE_STAGE_IMPORT, trace_import);
+	TR31_PROBE3(import__return, version_id, key_block_len, r);
+	tr31_stats_update(TR31_STATS_INDEX(import_count), version_id, key_block_len, r);
+
+	return r;
+}
+
+int tr31_verify(
+	const char* key_block,
+	size_t key_block_len,
+	const struct tr31_key_t* kbpk,
+	uint32_t flags
+)
+{
+	int r;
+	struct tr31_ctx_t ctx;
+
+	if (!kbpk) {
+		return -1;
+	}
+
+	// key block parsing may fail before the context object is initialised
+	memset(&ctx, 0, sizeof(ctx));
+	r = tr31_import_internal(key_block, key_block_len, kbpk, NULL, flags, true, &ctx);
+	tr31_release(&ctx);
+
+	return r;
+}
+
+static int tr31_import_internal(
+	const char* key_block,
+	size_t key_block_len,
+	const struct tr31_key_t* kbpk,
+	const struct tr31_kbpk_derived_t* kbpk_derived,
+	uint32_t flags,
+	bool verify_only,
+	struct tr31_ctx_t* ctx
+)
+{
+	int r;
+	const struct tr31_header_t* header;
+	struct tr31_state_t state;
+	size_t opt_blk_len_total = 0;
+	const void* ptr;
+	struct tr31_key_t* key;
+
+	if (!key_block || !ctx) {
+		return -1;
+	}
+
+	// parsing ends when the state object is ready for the binding functions
+	TR31_TRACE_BEGIN(trace_parse);
+
+	// validate minimum length
+	if (key_block_len < TR31_MIN_KEY_BLOCK_LENGTH) {
+		return TR31_ERROR_INVALID_LENGTH;
+	}
+
+	// validate key block as printable ASCII (format PA)
+	r = tr31_validate_format_pa(key_block, key_block_len);
+	if (r) {
+		return TR31_ERROR_INVALID_CHARACTER;
+	}
+
+	// initialise processing state object
+	// this will populate:
+	// - state.flags
+	// - state.enc_block_size
+	// - state.authenticator_length
+	header = (const struct tr31_header_t*)key_block;
+	r = tr31_state_init(flags, header->version_id, &state);
+	if (r) {
+		// return error value as-is
+		return r;
+	}
+	state.kbpk_derived = kbpk_derived;
+
+	// initialise key block context object
 	r = tr31_init(header->version_id, NULL, ctx);
 	if (r) {
 		// return error value as-is
@@ -2079,7 +2651,7 @@ int tr31_import(
 	// see ANSI X9.143:2021, 6.3.6
 	ptr = header + 1; // optional blocks, if any, are after the header
 	if (ctx->opt_blocks_count) {
-		ctx->opt_blocks = calloc(ctx->opt_blocks_count, sizeof(ctx->opt_blocks[0]));
+		ctx->opt_blocks = tr31_calloc(ctx->opt_blocks_count, sizeof(ctx->opt_blocks[0]));
 	}
 	for (int i = 0; i < opt_blocks_count; ++i) {
 		// ensure that current pointer is valid for minimal optional block
@@ -2138,6 +2710,7 @@ int tr31_import(
 		// return error value as-is
 		goto error;
 	}
+	TR31_TRACE_END(TR31_TRACE_STAGE_PARSE, trace_parse);
 
 	// if no key block protection key was provided, we are done
 	if (!kbpk) {
@@ -2145,6 +2718,9 @@ int tr31_import(
 		goto exit;
 	}
 
+	// binding functions only verify the key block if no key is provided
+	key = verify_only ? NULL : &ctx->key;
+
 	switch (ctx->version) {
 		case TR31_VERSION_A:
 		case TR31_VERSION_B:
@@ -2170,10 +2746,10 @@ int tr31_import(
 
 			if (ctx->version == TR31_VERSION_A || ctx->version == TR31_VERSION_C) {
 				// verify and decrypt payload
-				r = tr31_tdes_decrypt_verify_variant_binding(&state, kbpk, &ctx->key);
+				r = tr31_tdes_decrypt_verify_variant_binding(&state, kbpk, key);
 			} else if (ctx->version == TR31_VERSION_B) {
 				// decrypt and verify payload
-				r = tr31_tdes_decrypt_verify_derivation_binding(&state, kbpk, &ctx->key);
+				r = tr31_tdes_decrypt_verify_derivation_binding(&state, kbpk, key);
 			} else {
 				// invalid format version
 				return -1;
@@ -2182,6 +2758,10 @@ int tr31_import(
 				// return error value as-is
 				goto error;
 			}
+			if (!key) {
+				// key data not available for validation
+				break;
+			}
 
 			// validate payload length field
 			switch (ctx->key.algorithm) {
@@ -2223,11 +2803,15 @@ int tr31_import(
 			}
 
 			// decrypt and verify payload
-			r = tr31_aes_decrypt_verify_derivation_binding(&state, kbpk, &ctx->key);
+			r = tr31_aes_decrypt_verify_derivation_binding(&state, kbpk, key);
 			if (r) {
 				// return error value as-is
 				goto error;
 			}
+			if (!key) {
+				// key data not available for validation
+				break;
+			}
 
 			// validate payload length field
 			switch (ctx->key.algorithm) {
@@ -2266,11 +2850,15 @@ int tr31_import(
 			}
 
 			// decrypt and verify payload
-			r = tr31_aes_decrypt_verify_derivation_binding(&state, kbpk, &ctx->key);
+			r = tr31_aes_decrypt_verify_derivation_binding(&state, kbpk, key);
 			if (r) {
 				// return error value as-is
 				goto error;
 			}
+			if (!key) {
+				// key data not available for validation
+				break;
+			}
 
 			// validate payload length field
 			switch (ctx->key.algorithm) {
@@ -2306,6 +2894,16 @@ int tr31_import(
 			return -1;
 	}
 
+	if (key && (flags & TR31_IMPORT_COMPUTE_KCV)) {
+		// compute KCV now instead of when first requested
+		r = tr31_key_get_kcv(key);
+		if (r < 0) {
+			// internal error
+			goto error;
+		}
+		// KCV not available for key algorithm; continue
+	}
+
 	// success
 	r = 0;
 	goto exit;
@@ -2324,16 +2922,45 @@ int tr31_export(
 	char* key_block,
 	size_t key_block_buf_len
 )
+{
+	int r;
+	uint8_t version_id = ctx ? ctx->version : 0;
+	size_t key_block_len;
+
+	TR31_PROBE3(export__entry, version_id, key_block_buf_len, flags);
+	TR31_TRACE_BEGIN(trace_export);
+	r = tr31_export_internal(ctx, kbpk, flags, key_block, key_block_buf_len);
+	TR31_TRACE_END(TR31_TRACE_STAGE_EXPORT, trace_export);
+	key_block_len = r ? 0 : strlen(key_block);
+	TR31_PROBE3(export__return, version_id, key_block_len, r);
+	tr31_stats_update(TR31_STATS_INDEX(export_count), version_id, key_block_len, r);
+
+	return r;
+}
+
+static int tr31_export_internal(
+	const struct tr31_ctx_t* ctx,
+	const struct tr31_key_t* kbpk,
+	uint32_t flags,
+	char* key_block,
+	size_t key_block_buf_len
+)
 {
 	int r;
 	struct tr31_state_t state;
 	struct tr31_header_t* header;
 	size_t opt_blk_len_total = 0;
 	void* ptr;
+	uint8_t kcv_algorithm;
+	uint8_t kcv[sizeof(ctx->key.kcv)];
+	size_t kcv_len;
 
 	if (!ctx || !kbpk || !key_block || !key_block_buf_len) {
 		return -1;
 	}
+
+	// encoding ends when the state object is ready for the binding functions
+	TR31_TRACE_BEGIN(trace_encode);
 	if (!ctx->key.data || !ctx->key.length) {
 		return TR31_ERROR_INVALID_KEY_LENGTH;
 	}
@@ -2394,18 +3021,21 @@ int tr31_export(
 			!ctx->opt_blocks[i].data_length &&
 			!ctx->opt_blocks[i].data
 		) {
-			if (!ctx->key.kcv_len) {
-				return TR31_ERROR_KCV_NOT_AVAILABLE;
+			// KCV is only computed when optional block KC is requested
+			r = tr31_key_compute_kcv(&ctx->key, &kcv_algorithm, kcv, &kcv_len);
+			if (r) {
+				// return error value as-is
+				return r;
 			}
 
 			// build optional block KC (KCV of wrapped key)
 			// see ANSI X9.143:2021, 6.3.6.7
-			ctx->opt_blocks[i].data_length = tr31_opt_block_kcv_data_length(ctx->key.kcv_len);
-			ctx->opt_blocks[i].data = calloc(1, ctx->opt_blocks[i].data_length);
+			ctx->opt_blocks[i].data_length = tr31_opt_block_kcv_data_length(kcv_len);
+			ctx->opt_blocks[i].data = tr31_calloc(1, ctx->opt_blocks[i].data_length);
 			r = tr31_opt_block_encode_kcv(
-				ctx->key.kcv_algorithm,
-				ctx->key.kcv,
-				ctx->key.kcv_len,
+				kcv_algorithm,
+				kcv,
+				kcv_len,
 				ctx->opt_blocks[i].data,
 				ctx->opt_blocks[i].data_length
 			);
@@ -2420,18 +3050,21 @@ int tr31_export(
 			!ctx->opt_blocks[i].data_length &&
 			!ctx->opt_blocks[i].data
 		) {
-			if (!kbpk->kcv_len) {
-				return TR31_ERROR_KCV_NOT_AVAILABLE;
+			// KCV is only computed when optional block KP is requested
+			r = tr31_key_compute_kcv(kbpk, &kcv_algorithm, kcv, &kcv_len);
+			if (r) {
+				// return error value as-is
+				return r;
 			}
 
 			// build optional block KP (KCV of KBPK)
 			// see ANSI X9.143:2021, 6.3.6.7
-			ctx->opt_blocks[i].data_length = tr31_opt_block_kcv_data_length(kbpk->kcv_len);
-			ctx->opt_blocks[i].data = calloc(1, ctx->opt_blocks[i].data_length);
+			ctx->opt_blocks[i].data_length = tr31_opt_block_kcv_data_length(kcv_len);
+			ctx->opt_blocks[i].data = tr31_calloc(1, ctx->opt_blocks[i].data_length);
 			r = tr31_opt_block_encode_kcv(
-				kbpk->kcv_algorithm,
-				kbpk->kcv,
-				kbpk->kcv_len,
+				kcv_algorithm,
+				kcv,
+				kcv_len,
 				ctx->opt_blocks[i].data,
 				ctx->opt_blocks[i].data_length
 			);
@@ -2525,8 +3158,9 @@ int tr31_export(
 	);
 	if (r) {
 		// return error value as-is
-		return r;
+		goto error;
 	}
+	TR31_TRACE_END(TR31_TRACE_STAGE_ENCODE, trace_encode);
 
 	switch (ctx->version) {
 		case TR31_VERSION_A:
@@ -2548,90 +3182,1054 @@ int tr31_export(
 			}
 			break;
 
-		case TR31_VERSION_B:
-			// only allow TDES key block protection keys
-			if (kbpk->algorithm != TR31_KEY_ALGORITHM_TDES) {
-				r = TR31_ERROR_UNSUPPORTED_KBPK_ALGORITHM;
-				goto error;
-			}
+		case TR31_VERSION_B:
+			// only allow TDES key block protection keys
+			if (kbpk->algorithm != TR31_KEY_ALGORITHM_TDES) {
+				r = TR31_ERROR_UNSUPPORTED_KBPK_ALGORITHM;
+				goto error;
+			}
+
+			// sign and encrypt payload
+			// this will write data into:
+			// - state.payload
+			// - state.authenticator
+			r = tr31_tdes_encrypt_sign_derivation_binding(&state, kbpk);
+			if (r) {
+				// return error value as-is
+				goto error;
+			}
+			break;
+
+		case TR31_VERSION_D:
+			// only allow AES key block protection keys
+			if (kbpk->algorithm != TR31_KEY_ALGORITHM_AES) {
+				r = TR31_ERROR_UNSUPPORTED_KBPK_ALGORITHM;
+				goto error;
+			}
+
+			// sign and encrypt payload
+			// this will write data into:
+			// - state.payload
+			// - state.authenticator
+			r = tr31_aes_encrypt_sign_derivation_binding(&state, kbpk);
+			if (r) {
+				// return error value as-is
+				goto error;
+			}
+			break;
+
+		case TR31_VERSION_E:
+			// only allow AES key block protection keys
+			if (kbpk->algorithm != TR31_KEY_ALGORITHM_AES) {
+				r = TR31_ERROR_UNSUPPORTED_KBPK_ALGORITHM;
+				goto error;
+			}
+
+			// sign and encrypt payload
+			// this will write data into:
+			// - state.payload
+			// - state.authenticator
+			r = tr31_aes_encrypt_sign_derivation_binding(&state, kbpk);
+			if (r) {
+				// return error value as-is
+				goto error;
+			}
+			break;
+
+		default:
+			// invalid format version
+			r = -5;
+			goto error;
+	}
+
+	// add payload and authenticator to key block output
+	r = bin_to_hex(
+		state.payload,
+		state.payload_length + state.authenticator_length,
+		ptr,
+		key_block_buf_len - state.header_length
+	);
+	if (r) {
+		// internal error
+		r = -6;
+		goto error;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+error:
+exit:
+	tr31_state_release(&state);
+	return r;
+}
+
+int tr31_rewrap(
+	const char* key_block,
+	size_t key_block_len,
+	const struct tr31_key_t* kbpk_old,
+	const struct tr31_key_t* kbpk_new,
+	uint8_t version_id,
+	uint32_t import_flags,
+	uint32_t export_flags,
+	char* new_key_block,
+	size_t new_key_block_buf_len
+)
+{
+	int r;
+	struct tr31_ctx_t ctx;
+	struct tr31_opt_ctx_t* opt_ctx;
+
+	if (!key_block || !kbpk_old || !kbpk_new || !new_key_block) {
+		return -1;
+	}
+
+	// verify and decrypt key block using old KBPK
+	// NOTE: the key block context object is only available to this function
+	// and its key data is the only buffer that holds the cleartext key, which
+	// tr31_release() will cleanse
+	// NOTE: the header is not reused verbatim because the length field,
+	// optional block KP and optional block PB may all change; tr31_export()
+	// re-encodes it from the decoded fields, which is negligible compared
+	// to the cryptographic operations
+	r = tr31_import(key_block, key_block_len, kbpk_old, import_flags, &ctx);
+	if (r) {
+		// return error value as-is
+		return r;
+	}
+
+	// update key block format version, if required
+	if (version_id) {
+		ctx.version = version_id;
+	}
+
+	// remove optional block PB because it depends on the format version
+	// NOTE: it will be recreated by tr31_export(), if required
+	tr31_opt_block_remove(&ctx, TR31_OPT_BLOCK_PB);
+
+	// clear optional block KP because it depends on the KBPK
+	// NOTE: it will be recomputed by tr31_export() for the new KBPK
+	opt_ctx = tr31_opt_block_find(&ctx, TR31_OPT_BLOCK_KP);
+	if (opt_ctx) {
+		if (opt_ctx->data) {
+			tr31_free(opt_ctx->data);
+		}
+		opt_ctx->data = NULL;
+		opt_ctx->data_length = 0;
+	}
+
+	// encrypt and sign key block using new KBPK
+	r = tr31_export(&ctx, kbpk_new, export_flags, new_key_block, new_key_block_buf_len);
+	if (r) {
+		// return error value as-is
+		goto error;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+error:
+exit:
+	tr31_release(&ctx);
+	return r;
+}
+
+static void tr31_rewrap_batch_process(struct tr31_rewrap_batch_t* batch)
+{
+	size_t i;
+
+	// claim items until none remain
+	while ((i = atomic_fetch_add(&batch->next_item, 1)) < batch->items_count) {
+		struct tr31_rewrap_item_t* item = &batch->items[i];
+
+		item->result = tr31_rewrap(
+			item->key_block,
+			item->key_block_len,
+			batch->kbpk_old,
+			batch->kbpk_new,
+			batch->version_id,
+			batch->import_flags,
+			batch->export_flags,
+			item->new_key_block,
+			item->new_key_block_buf_len
+		);
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void* tr31_rewrap_batch_thread(void* arg)
+{
+	tr31_rewrap_batch_process(arg);
+	return NULL;
+}
+#endif
+
+int tr31_rewrap_batch(
+	struct tr31_rewrap_item_t* items,
+	size_t items_count,
+	const struct tr31_key_t* kbpk_old,
+	const struct tr31_key_t* kbpk_new,
+	uint8_t version_id,
+	uint32_t import_flags,
+	uint32_t export_flags,
+	unsigned int thread_count
+)
+{
+	struct tr31_rewrap_batch_t batch;
+
+	if (!items && items_count) {
+		return -1;
+	}
+	if (!kbpk_old || !kbpk_new) {
+		return -1;
+	}
+
+	batch.items = items;
+	batch.items_count = items_count;
+	atomic_init(&batch.next_item, 0);
+	batch.kbpk_old = kbpk_old;
+	batch.kbpk_new = kbpk_new;
+	batch.version_id = version_id;
+	batch.import_flags = import_flags;
+	batch.export_flags = export_flags;
+
+	// there is no point in having more threads than items
+	if (thread_count > items_count) {
+		thread_count = items_count;
+	}
+
+#ifdef HAVE_PTHREAD
+	if (thread_count > 1) {
+		pthread_t* threads;
+		unsigned int threads_started = 0;
+
+		threads = tr31_malloc(sizeof(*threads) * (thread_count - 1));
+		if (threads) {
+			for (unsigned int i = 0; i < thread_count - 1; ++i) {
+				if (pthread_create(&threads[i], NULL, tr31_rewrap_batch_thread, &batch)) {
+					// continue with the threads that were started
+					break;
+				}
+				++threads_started;
+			}
+		}
+
+		// calling thread also processes items
+		tr31_rewrap_batch_process(&batch);
+
+		for (unsigned int i = 0; i < threads_started; ++i) {
+			pthread_join(threads[i], NULL);
+		}
+		tr31_free(threads);
+
+	} else {
+		tr31_rewrap_batch_process(&batch);
+	}
+#else
+	// threading not available; process all items using the calling thread
+	tr31_rewrap_batch_process(&batch);
+#endif
+
+	// report the first item that failed, if any
+	for (size_t i = 0; i < items_count; ++i) {
+		if (items[i].result) {
+			return items[i].result;
+		}
+	}
+
+	return 0;
+}
+
+static uint32_t tr31_keyring_hash(unsigned int kbpk_algorithm, uint8_t kcv_algorithm, const uint8_t* kcv)
+{
+	const uint8_t buf[] = { (uint8_t)kbpk_algorithm, kcv_algorithm, kcv[0], kcv[1] };
+	uint32_t hash = 2166136261U; // FNV-1a offset basis
+
+	for (size_t i = 0; i < sizeof(buf); ++i) {
+		hash ^= buf[i];
+		hash *= 16777619U; // FNV-1a prime
+	}
+
+	return hash;
+}
+
+static int tr31_keyring_derived_index(
+	uint8_t version_id,
+	unsigned int* kbpk_algorithm,
+	unsigned int* derived_index
+)
+{
+	switch (version_id) {
+		case TR31_VERSION_A:
+		case TR31_VERSION_C:
+			// format versions A and C use the same KBPK variants
+			*kbpk_algorithm = TR31_KEY_ALGORITHM_TDES;
+			*derived_index = 0;
+			return 0;
+
+		case TR31_VERSION_B:
+			*kbpk_algorithm = TR31_KEY_ALGORITHM_TDES;
+			*derived_index = 1;
+			return 0;
+
+		case TR31_VERSION_D:
+			*kbpk_algorithm = TR31_KEY_ALGORITHM_AES;
+			*derived_index = 0;
+			return 0;
+
+		case TR31_VERSION_E:
+			*kbpk_algorithm = TR31_KEY_ALGORITHM_AES;
+			*derived_index = 1;
+			return 0;
+
+		default:
+			// invalid format version
+			return -1;
+	}
+}
+
+static int tr31_keyring_entry_create(const struct tr31_key_t* kbpk, struct tr31_keyring_entry_t** entry)
+{
+	int r;
+	static const uint8_t tdes_versions[] = { TR31_VERSION_A, TR31_VERSION_B };
+	static const uint8_t aes_versions[] = { TR31_VERSION_D, TR31_VERSION_E };
+	const uint8_t* versions;
+	struct tr31_keyring_entry_t* new_entry;
+
+	switch (kbpk->algorithm) {
+		case TR31_KEY_ALGORITHM_TDES:
+			versions = tdes_versions;
+			break;
+
+		case TR31_KEY_ALGORITHM_AES:
+			versions = aes_versions;
+			break;
+
+		default:
+			return TR31_ERROR_UNSUPPORTED_KBPK_ALGORITHM;
+	}
+
+	new_entry = tr31_calloc(1, sizeof(*new_entry));
+	if (!new_entry) {
+		return -2;
+	}
+
+	r = tr31_key_copy(kbpk, &new_entry->kbpk);
+	if (r) {
+		// return error value as-is
+		goto error;
+	}
+
+	// KCV is used for selecting the KBPK using optional block KP
+	r = tr31_key_get_kcv(&new_entry->kbpk);
+	if (r) {
+		r = TR31_ERROR_UNSUPPORTED_KBPK_LENGTH;
+		goto error;
+	}
+
+	// derive keys for all format versions that allow the KBPK algorithm
+	for (size_t i = 0; i < sizeof(new_entry->derived) / sizeof(new_entry->derived[0]); ++i) {
+		r = tr31_kbpk_derive_internal(
+			versions[i],
+			&new_entry->kbpk,
+			new_entry->derived[i].kbek,
+			new_entry->derived[i].kbak
+		);
+		if (r) {
+			r = TR31_ERROR_UNSUPPORTED_KBPK_LENGTH;
+			goto error;
+		}
+		tr31_stats_add(TR31_STATS_INDEX(kbpk_derive_count), 1);
+	}
+
+	new_entry->hash = tr31_keyring_hash(new_entry->kbpk.algorithm, new_entry->kbpk.kcv_algorithm, new_entry->kbpk.kcv);
+	*entry = new_entry;
+
+	// success
+	r = 0;
+	goto exit;
+
+error:
+	tr31_keyring_entry_destroy(new_entry);
+exit:
+	return r;
+}
+
+static void tr31_keyring_entry_destroy(struct tr31_keyring_entry_t* entry)
+{
+	tr31_key_release(&entry->kbpk);
+
+	// cleanse derived keys
+	crypto_cleanse(entry, sizeof(*entry));
+	tr31_free(entry);
+}
+
+static struct tr31_keyring_snapshot_t* tr31_keyring_snapshot_create(
+	const struct tr31_keyring_snapshot_t* snapshot,
+	struct tr31_keyring_entry_t* add_entry,
+	const struct tr31_keyring_entry_t* remove_entry
+)
+{
+	struct tr31_keyring_snapshot_t* new_snapshot;
+	size_t entries_count = snapshot ? snapshot->entries_count : 0;
+	size_t buckets_count = 16;
+	void* ptr;
+
+	if (add_entry) {
+		++entries_count;
+	}
+	if (remove_entry) {
+		--entries_count;
+	}
+
+	// keep hash bucket load factor at most one half
+	while (buckets_count < entries_count * 2) {
+		buckets_count *= 2;
+	}
+
+	// allocate snapshot and its arrays as a single object
+	new_snapshot = tr31_calloc(1,
+		sizeof(*new_snapshot) +
+		sizeof(new_snapshot->entries[0]) * entries_count +
+		sizeof(new_snapshot->next[0]) * entries_count +
+		sizeof(new_snapshot->buckets[0]) * buckets_count
+	);
+	if (!new_snapshot) {
+		return NULL;
+	}
+	ptr = new_snapshot + 1;
+	new_snapshot->entries = ptr;
+	ptr += sizeof(new_snapshot->entries[0]) * entries_count;
+	new_snapshot->next = ptr;
+	ptr += sizeof(new_snapshot->next[0]) * entries_count;
+	new_snapshot->buckets = ptr;
+	new_snapshot->buckets_count = buckets_count;
+	new_snapshot->version = snapshot ? snapshot->version + 1 : 0;
+
+	// copy entries, except the removed entry, followed by the added entry
+	if (snapshot) {
+		for (size_t i = 0; i < snapshot->entries_count; ++i) {
+			if (snapshot->entries[i] == remove_entry) {
+				continue;
+			}
+			new_snapshot->entries[new_snapshot->entries_count++] = snapshot->entries[i];
+		}
+	}
+	if (add_entry) {
+		new_snapshot->entries[new_snapshot->entries_count++] = add_entry;
+	}
+
+	// link entries into hash buckets
+	for (size_t i = 0; i < new_snapshot->entries_count; ++i) {
+		size_t bucket = new_snapshot->entries[i]->hash & (buckets_count - 1);
+
+		new_snapshot->next[i] = new_snapshot->buckets[bucket];
+		new_snapshot->buckets[bucket] = i + 1;
+	}
+
+	return new_snapshot;
+}
+
+static void tr31_keyring_snapshot_destroy(struct tr31_keyring_snapshot_t* snapshot)
+{
+	// entries that remain in other snapshots are not released
+	if (snapshot->removed) {
+		tr31_keyring_entry_destroy(snapshot->removed);
+	}
+	tr31_free(snapshot);
+}
+
+static int tr31_keyring_update(
+	struct tr31_keyring_t* keyring,
+	struct tr31_keyring_entry_t* add_entry,
+	const size_t* remove_id,
+	size_t* kbpk_id
+)
+{
+	int r;
+	struct tr31_keyring_snapshot_t* snapshot;
+	struct tr31_keyring_snapshot_t* new_snapshot;
+	struct tr31_keyring_entry_t* remove_entry = NULL;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&keyring->mutex);
+#endif
+
+	// only writers replace the current snapshot
+	snapshot = atomic_load(&keyring->snapshot);
+
+	if (remove_id) {
+		for (size_t i = 0; i < snapshot->entries_count; ++i) {
+			if (snapshot->entries[i]->id == *remove_id) {
+				remove_entry = snapshot->entries[i];
+				break;
+			}
+		}
+		if (!remove_entry) {
+			// unknown KBPK identifier
+			r = -1;
+			goto exit;
+		}
+	}
+
+	// entries must be complete before they are published
+	if (add_entry) {
+		add_entry->id = keyring->next_id;
+	}
+	new_snapshot = tr31_keyring_snapshot_create(snapshot, add_entry, remove_entry);
+	if (!new_snapshot) {
+		r = -2;
+		goto exit;
+	}
+	if (add_entry) {
+		++keyring->next_id;
+		if (kbpk_id) {
+			*kbpk_id = add_entry->id;
+		}
+	}
+
+	// publish new snapshot and retire current snapshot
+	// NOTE: readers may still be using the current snapshot but never
+	// access the fields used for reclamation
+	atomic_store(&keyring->snapshot, new_snapshot);
+	snapshot->removed = remove_entry;
+	snapshot->retired_epoch = atomic_load(&keyring->epoch);
+	snapshot->retired_next = keyring->retired;
+	keyring->retired = snapshot;
+
+	tr31_keyring_reclaim_internal(keyring);
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&keyring->mutex);
+#endif
+	return r;
+}
+
+static size_t tr31_keyring_reclaim_internal(struct tr31_keyring_t* keyring)
+{
+	uint64_t epoch;
+	struct tr31_keyring_snapshot_t** retired;
+	size_t pending = 0;
+
+	// advance the epoch if no readers remain registered in the previous
+	// epoch, which shares its counter with the next epoch
+	// readers of a snapshot replaced during an epoch may remain until the
+	// epoch has advanced twice, so attempt both advances now
+	for (unsigned int i = 0; i < 2; ++i) {
+		epoch = atomic_load(&keyring->epoch);
+		if (atomic_load(&keyring->readers[(epoch + 1) & 1])) {
+			break;
+		}
+		atomic_store(&keyring->epoch, epoch + 1);
+	}
+	epoch = atomic_load(&keyring->epoch);
+
+	// reclaim snapshots that no reader can still be using
+	retired = &keyring->retired;
+	while (*retired) {
+		struct tr31_keyring_snapshot_t* snapshot = *retired;
+
+		if (snapshot->retired_epoch + 2 <= epoch) {
+			*retired = snapshot->retired_next;
+			tr31_keyring_snapshot_destroy(snapshot);
+		} else {
+			retired = &snapshot->retired_next;
+			++pending;
+		}
+	}
+
+	return pending;
+}
+
+static const struct tr31_keyring_snapshot_t* tr31_keyring_read_begin(
+	struct tr31_keyring_t* keyring,
+	unsigned int* reader
+)
+{
+	uint64_t epoch;
+
+	// register reader in the counter for the current epoch and retry if the
+	// epoch advanced before the registration became visible to writers
+	for (;;) {
+		epoch = atomic_load(&keyring->epoch);
+		atomic_fetch_add(&keyring->readers[epoch & 1], 1);
+		if (atomic_load(&keyring->epoch) == epoch) {
+			break;
+		}
+		atomic_fetch_sub(&keyring->readers[epoch & 1], 1);
+	}
+	*reader = epoch & 1;
+
+	return atomic_load(&keyring->snapshot);
+}
+
+static void tr31_keyring_read_end(struct tr31_keyring_t* keyring, unsigned int reader)
+{
+	atomic_fetch_sub(&keyring->readers[reader], 1);
+}
+
+struct tr31_keyring_t* tr31_keyring_create(void)
+{
+	struct tr31_keyring_t* keyring;
+	struct tr31_keyring_snapshot_t* snapshot;
+
+	keyring = tr31_calloc(1, sizeof(*keyring));
+	if (!keyring) {
+		return NULL;
+	}
+
+	// readers always have a snapshot, even if it is empty
+	snapshot = tr31_keyring_snapshot_create(NULL, NULL, NULL);
+	if (!snapshot) {
+		tr31_free(keyring);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD
+	if (pthread_mutex_init(&keyring->mutex, NULL)) {
+		tr31_free(snapshot);
+		tr31_free(keyring);
+		return NULL;
+	}
+#endif
+
+	atomic_init(&keyring->snapshot, snapshot);
+	atomic_init(&keyring->epoch, 0);
+	atomic_init(&keyring->readers[0], 0);
+	atomic_init(&keyring->readers[1], 0);
+
+	return keyring;
+}
+
+void tr31_keyring_destroy(struct tr31_keyring_t* keyring)
+{
+	struct tr31_keyring_snapshot_t* snapshot;
+
+	if (!keyring) {
+		return;
+	}
+
+	// release all entries of current snapshot
+	snapshot = atomic_load(&keyring->snapshot);
+	for (size_t i = 0; i < snapshot->entries_count; ++i) {
+		tr31_keyring_entry_destroy(snapshot->entries[i]);
+	}
+	tr31_keyring_snapshot_destroy(snapshot);
+
+	// release replaced snapshots, including entries that were removed
+	while (keyring->retired) {
+		snapshot = keyring->retired;
+		keyring->retired = snapshot->retired_next;
+		tr31_keyring_snapshot_destroy(snapshot);
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&keyring->mutex);
+#endif
+	tr31_free(keyring);
+}
+
+int tr31_keyring_add(
+	struct tr31_keyring_t* keyring,
+	const struct tr31_key_t* kbpk,
+	size_t* kbpk_id
+)
+{
+	int r;
+	struct tr31_keyring_entry_t* entry;
+
+	if (!keyring || !kbpk || !kbpk->data) {
+		return -1;
+	}
+
+	// prepare entry before publishing it
+	r = tr31_keyring_entry_create(kbpk, &entry);
+	if (r) {
+		// return error value as-is
+		return r;
+	}
+
+	r = tr31_keyring_update(keyring, entry, NULL, kbpk_id);
+	if (r) {
+		tr31_keyring_entry_destroy(entry);
+		// return error value as-is
+		return r;
+	}
+
+	return 0;
+}
+
+int tr31_keyring_remove(struct tr31_keyring_t* keyring, size_t kbpk_id)
+{
+	if (!keyring) {
+		return -1;
+	}
+
+	return tr31_keyring_update(keyring, NULL, &kbpk_id, NULL);
+}
+
+int tr31_keyring_rotate(
+	struct tr31_keyring_t* keyring,
+	size_t old_kbpk_id,
+	const struct tr31_key_t* kbpk,
+	size_t* kbpk_id
+)
+{
+	int r;
+	struct tr31_keyring_entry_t* entry;
+
+	if (!keyring || !kbpk || !kbpk->data) {
+		return -1;
+	}
+
+	// prepare entry before publishing it
+	r = tr31_keyring_entry_create(kbpk, &entry);
+	if (r) {
+		// return error value as-is
+		return r;
+	}
+
+	// add new KBPK and remove old KBPK using a single snapshot such that
+	// readers observe either the old KBPK or the new KBPK
+	r = tr31_keyring_update(keyring, entry, &old_kbpk_id, kbpk_id);
+	if (r) {
+		tr31_keyring_entry_destroy(entry);
+		// return error value as-is
+		return r;
+	}
+
+	return 0;
+}
+
+size_t tr31_keyring_reclaim(struct tr31_keyring_t* keyring)
+{
+	size_t pending;
+
+	if (!keyring) {
+		return 0;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&keyring->mutex);
+#endif
+	pending = tr31_keyring_reclaim_internal(keyring);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&keyring->mutex);
+#endif
+
+	return pending;
+}
+
+static void tr31_keyring_trial_process(struct tr31_keyring_trial_t* trial)
+{
+	size_t i;
+
+	// claim entries until none remain or another thread completed the trial
+	while (!atomic_load(&trial->found) &&
+		(i = atomic_fetch_add(&trial->next_entry, 1)) < trial->snapshot->entries_count
+	) {
+		const struct tr31_keyring_entry_t* entry = trial->snapshot->entries[i];
+		struct tr31_ctx_t ctx;
+		size_t expected = 0;
+		int r;
+
+		if (entry->kbpk.algorithm != trial->kbpk_algorithm) {
+			continue;
+		}
+
+		// import into a private context object such that only the entry
+		// that completes the trial populates the caller's context object
+		memset(&ctx, 0, sizeof(ctx));
+		r = tr31_import_internal(
+			trial->key_block,
+			trial->key_block_len,
+			&entry->kbpk,
+			&entry->derived[trial->derived_index],
+			trial->flags,
+			false,
+			&ctx
+		);
+		if (r == TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED) {
+			// incorrect KBPK; try next entry
+			continue;
+		}
+
+		// either the key block was imported or it failed for a reason
+		// that does not depend on the KBPK; failed imports have already
+		// released the context object
+		if (atomic_compare_exchange_strong(&trial->found, &expected, i + 1)) {
+			trial->result = r;
+			if (!r) {
+				// hand over imported key block to the caller
+				*trial->ctx = ctx;
+				return;
+			}
+		}
+		tr31_release(&ctx);
+		return;
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void* tr31_keyring_trial_thread(void* arg)
+{
+	tr31_keyring_trial_process(arg);
+	return NULL;
+}
+#endif
+
+static int tr31_keyring_trial(
+	const struct tr31_keyring_snapshot_t* snapshot,
+	const char* key_block,
+	size_t key_block_len,
+	uint32_t flags,
+	unsigned int kbpk_algorithm,
+	unsigned int derived_index,
+	unsigned int thread_count,
+	struct tr31_ctx_t* ctx,
+	size_t* found
+)
+{
+	struct tr31_keyring_trial_t trial;
+	size_t candidate_count = 0;
+
+	// there is no point in having more threads than candidate entries
+	for (size_t i = 0; i < snapshot->entries_count; ++i) {
+		if (snapshot->entries[i]->kbpk.algorithm == kbpk_algorithm) {
+			++candidate_count;
+		}
+	}
+	if (!candidate_count) {
+		return TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED;
+	}
+	if (thread_count > candidate_count) {
+		thread_count = candidate_count;
+	}
+
+	trial.snapshot = snapshot;
+	trial.key_block = key_block;
+	trial.key_block_len = key_block_len;
+	trial.flags = flags;
+	trial.kbpk_algorithm = kbpk_algorithm;
+	trial.derived_index = derived_index;
+	atomic_init(&trial.next_entry, 0);
+	atomic_init(&trial.found, 0);
+	trial.result = TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED;
+	trial.ctx = ctx;
+
+#ifdef HAVE_PTHREAD
+	if (thread_count > 1) {
+		pthread_t* threads;
+		unsigned int threads_started = 0;
+
+		threads = tr31_malloc(sizeof(*threads) * (thread_count - 1));
+		if (threads) {
+			for (unsigned int i = 0; i < thread_count - 1; ++i) {
+				if (pthread_create(&threads[i], NULL, tr31_keyring_trial_thread, &trial)) {
+					// continue with the threads that were started
+					break;
+				}
+				++threads_started;
+			}
+		}
+
+		// calling thread also imports using entries
+		tr31_keyring_trial_process(&trial);
+
+		for (unsigned int i = 0; i < threads_started; ++i) {
+			pthread_join(threads[i], NULL);
+		}
+		tr31_free(threads);
+
+	} else {
+		tr31_keyring_trial_process(&trial);
+	}
+#else
+	// threading not available; import using all entries on the calling thread
+	(void)thread_count;
+	tr31_keyring_trial_process(&trial);
+#endif
+
+	*found = atomic_load(&trial.found);
+	return trial.result;
+}
+
+int tr31_keyring_import(
+	struct tr31_keyring_t* keyring,
+	const char* key_block,
+	size_t key_block_len,
+	uint32_t flags,
+	unsigned int thread_count,
+	struct tr31_ctx_t* ctx,
+	size_t* kbpk_id
+)
+{
+	int r;
+	uint8_t version_id = key_block && key_block_len ? key_block[0] : 0;
+
+	TR31_PROBE3(import__entry, version_id, key_block_len, flags);
+	TR31_TRACE_BEGIN(trace_import);
+	if (keyring) {
+		const struct tr31_keyring_snapshot_t* snapshot;
+		unsigned int reader;
+
+		// snapshot remains valid until reader is unregistered
+		snapshot = tr31_keyring_read_begin(keyring, &reader);
+		r = tr31_keyring_import_internal(snapshot, key_block, key_block_len, flags, thread_count, ctx, kbpk_id);
+		tr31_keyring_read_end(keyring, reader);
+	} else {
+		r = -1;
+	}
+	TR31_TRACE_END(TR31_TRACE_STAGE_IMPORT, trace_import);
+	TR31_PROBE3(import__return, version_id, key_block_len, r);
+	tr31_stats_update(TR31_STATS_INDEX(import_count), version_id, key_block_len, r);
+
+	return r;
+}
+
+static int tr31_keyring_import_internal(
+	const struct tr31_keyring_snapshot_t* snapshot,
+	const char* key_block,
+	size_t key_block_len,
+	uint32_t flags,
+	unsigned int thread_count,
+	struct tr31_ctx_t* ctx,
+	size_t* kbpk_id
+)
+{
+	int r;
+	unsigned int kbpk_algorithm;
+	unsigned int derived_index;
+	const struct tr31_opt_ctx_t* opt_ctx;
+	struct tr31_opt_blk_kcv_data_t kcv_data;
+	bool kcv_found;
+	size_t found = 0; // index + 1 of entry that imported the key block; zero for none
+
+	if (!snapshot || !key_block || !ctx) {
+		return -1;
+	}
+
+	// parse key block without KBPK to validate it and to obtain optional
+	// block KP, if available
+	r = tr31_import_internal(key_block, key_block_len, NULL, NULL, flags, false, ctx);
+	if (r) {
+		// return error value as-is
+		return r;
+	}
+	r = tr31_keyring_derived_index(ctx->version, &kbpk_algorithm, &derived_index);
+	if (r) {
+		// invalid format version
+		tr31_release(ctx);
+		return -1;
+	}
+	opt_ctx = tr31_opt_block_find(ctx, TR31_OPT_BLOCK_KP);
+	kcv_found = opt_ctx &&
+		tr31_opt_block_decode_KP(opt_ctx, &kcv_data) == 0 &&
+		kcv_data.kcv_len >= 2;
+	tr31_release(ctx);
+
+	// select KBPK using KCV provided by optional block KP and import the key
+	// block directly into the caller's context object
+	if (kcv_found) {
+		uint32_t hash = tr31_keyring_hash(kbpk_algorithm, kcv_data.kcv_algorithm, kcv_data.kcv);
 
-			// sign and encrypt payload
-			// this will write data into:
-			// - state.payload
-			// - state.authenticator
-			r = tr31_tdes_encrypt_sign_derivation_binding(&state, kbpk);
-			if (r) {
-				// return error value as-is
-				goto error;
-			}
-			break;
+		for (size_t i = snapshot->buckets[hash & (snapshot->buckets_count - 1)]; i; i = snapshot->next[i - 1]) {
+			const struct tr31_keyring_entry_t* entry = snapshot->entries[i - 1];
+			size_t kcv_len;
 
-		case TR31_VERSION_D:
-			// only allow AES key block protection keys
-			if (kbpk->algorithm != TR31_KEY_ALGORITHM_AES) {
-				r = TR31_ERROR_UNSUPPORTED_KBPK_ALGORITHM;
-				goto error;
+			if (entry->hash != hash ||
+				entry->kbpk.algorithm != kbpk_algorithm ||
+				entry->kbpk.kcv_algorithm != kcv_data.kcv_algorithm
+			) {
+				continue;
 			}
 
-			// sign and encrypt payload
-			// this will write data into:
-			// - state.payload
-			// - state.authenticator
-			r = tr31_aes_encrypt_sign_derivation_binding(&state, kbpk);
-			if (r) {
-				// return error value as-is
-				goto error;
+			// KCV in optional block KP may be truncated
+			kcv_len = kcv_data.kcv_len < entry->kbpk.kcv_len ? kcv_data.kcv_len : entry->kbpk.kcv_len;
+			if (memcmp(entry->kbpk.kcv, kcv_data.kcv, kcv_len) != 0) {
+				continue;
 			}
-			break;
 
-		case TR31_VERSION_E:
-			// only allow AES key block protection keys
-			if (kbpk->algorithm != TR31_KEY_ALGORITHM_AES) {
-				r = TR31_ERROR_UNSUPPORTED_KBPK_ALGORITHM;
-				goto error;
+			// KCVs may collide and therefore only a verification failure
+			// continues with the next entry
+			r = tr31_import_internal(
+				key_block,
+				key_block_len,
+				&entry->kbpk,
+				&entry->derived[derived_index],
+				flags,
+				false,
+				ctx
+			);
+			if (r == TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED) {
+				continue;
 			}
-
-			// sign and encrypt payload
-			// this will write data into:
-			// - state.payload
-			// - state.authenticator
-			r = tr31_aes_encrypt_sign_derivation_binding(&state, kbpk);
 			if (r) {
 				// return error value as-is
-				goto error;
+				return r;
 			}
+			found = i;
 			break;
+		}
+	}
 
-		default:
-			// invalid format version
-			r = -5;
-			goto error;
+	// otherwise trial all KBPKs that allow the key block format version
+	if (!found) {
+		r = tr31_keyring_trial(
+			snapshot,
+			key_block,
+			key_block_len,
+			flags,
+			kbpk_algorithm,
+			derived_index,
+			thread_count,
+			ctx,
+			&found
+		);
+		if (r) {
+			// return error value as-is
+			return r;
+		}
 	}
 
-	// add payload and authenticator to key block output
-	r = bin_to_hex(
-		state.payload,
-		state.payload_length + state.authenticator_length,
-		ptr,
-		key_block_buf_len - state.header_length
-	);
-	if (r) {
-		// internal error
-		r = -6;
-		goto error;
+	if (kbpk_id) {
+		*kbpk_id = snapshot->entries[found - 1]->id;
 	}
 
-	// success
-	r = 0;
-	goto exit;
+	return 0;
+}
+
+static int tr31_opt_block_parse(
+	const struct tr31_state_t* state,
+	const void* ptr,
+	size_t remaining_len,
+	size_t* opt_blk_len,
+	struct tr31_opt_ctx_t* opt_ctx
+)
+{
+	int r;
+
+	TR31_PROBE2(opt_block_parse__entry, state->version_id, remaining_len);
+	r = tr31_opt_block_parse_internal(state, ptr, remaining_len, opt_blk_len, opt_ctx);
+	TR31_PROBE4(
+		opt_block_parse__return,
+		state->version_id,
+		opt_ctx ? opt_ctx->id : 0,
+		opt_blk_len ? *opt_blk_len : 0,
+		r
+	);
 
-error:
-exit:
-	tr31_state_release(&state);
 	return r;
 }
 
-static int tr31_opt_block_parse(
+static int tr31_opt_block_parse_internal(
 	const struct tr31_state_t* state,
 	const void* ptr,
 	size_t remaining_len,
@@ -2721,7 +4319,7 @@ static int tr31_opt_block_parse(
 		// NOTE: tr31_import() and tr31_init_from_header() have already
 		// validated the whole key block as printable ASCII (format PA)
 		opt_ctx->data_length = (*opt_blk_len - opt_blk_hdr_len);
-		opt_ctx->data = malloc(opt_ctx->data_length);
+		opt_ctx->data = tr31_malloc(opt_ctx->data_length);
 		memcpy(opt_ctx->data, opt_blk_data, opt_ctx->data_length);
 		return 0;
 	}
@@ -2743,7 +4341,7 @@ static int tr31_opt_block_parse(
 			if (r) {
 				return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
 			}
-			opt_ctx->data = malloc(opt_ctx->data_length);
+			opt_ctx->data = tr31_malloc(opt_ctx->data_length);
 			memcpy(opt_ctx->data, opt_blk_data, opt_ctx->data_length);
 			return 0;
 
@@ -2754,7 +4352,7 @@ static int tr31_opt_block_parse(
 			if (r) {
 				return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
 			}
-			opt_ctx->data = malloc(opt_ctx->data_length);
+			opt_ctx->data = tr31_malloc(opt_ctx->data_length);
 			memcpy(opt_ctx->data, opt_blk_data, opt_ctx->data_length);
 			return 0;
 
@@ -2764,7 +4362,7 @@ static int tr31_opt_block_parse(
 			// NOTE: tr31_import() and tr31_init_from_header() have already
 			// validated the whole key block as printable ASCII (format PA)
 			opt_ctx->data_length = (*opt_blk_len - opt_blk_hdr_len);
-			opt_ctx->data = malloc(opt_ctx->data_length);
+			opt_ctx->data = tr31_malloc(opt_ctx->data_length);
 			memcpy(opt_ctx->data, opt_blk_data, opt_ctx->data_length);
 			return 0;
 
@@ -2776,7 +4374,7 @@ static int tr31_opt_block_parse(
 			if (r) {
 				return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
 			}
-			opt_ctx->data = malloc(opt_ctx->data_length);
+			opt_ctx->data = tr31_malloc(opt_ctx->data_length);
 			memcpy(opt_ctx->data, opt_blk_data, opt_ctx->data_length);
 			return 0;
 
@@ -2786,7 +4384,7 @@ static int tr31_opt_block_parse(
 			// NOTE: tr31_import() and tr31_init_from_header() have already
 			// validated the whole key block as printable ASCII (format PA)
 			opt_ctx->data_length = (*opt_blk_len - opt_blk_hdr_len);
-			opt_ctx->data = malloc(opt_ctx->data_length);
+			opt_ctx->data = tr31_malloc(opt_ctx->data_length);
 			memcpy(opt_ctx->data, opt_blk_data, opt_ctx->data_length);
 			return 0;
 	}
@@ -2840,6 +4438,142 @@ static int tr31_opt_block_validate_iso8601(const char* str, size_t str_len)
 	return 0;
 }
 
+static int tr31_opt_block_decode_iso8601(
+	const struct tr31_opt_ctx_t* opt_ctx,
+	struct tr31_opt_blk_time_data_t* time_data
+)
+{
+	const char* str = opt_ctx->data;
+	size_t str_len = opt_ctx->data_length;
+	size_t offset[7]; // offsets of year, month, day, hour, minute, second and fraction
+	int year;
+	int month;
+	int day;
+	int hour;
+	int minute;
+	int second;
+	int days_in_month;
+	int64_t y;
+	int64_t era;
+	int64_t year_of_era;
+	int64_t day_of_year;
+	int64_t day_of_era;
+	int64_t days;
+
+	if (!str) {
+		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+	}
+
+	// determine ISO 8601 format based on string length
+	// see ANSI X9.143:2021, 6.3.6.13, table 21
+	// see ANSI X9.143:2021, 6.3.6.14, table 22
+	switch (str_len) {
+		case 0x13 - 4: // YYYYMMDDhhmmssZ
+		case 0x15 - 4: // YYYYMMDDhhmmssssZ
+			offset[0] = 0;
+			offset[1] = 4;
+			offset[2] = 6;
+			offset[3] = 8;
+			offset[4] = 10;
+			offset[5] = 12;
+			offset[6] = 14;
+			break;
+
+		case 0x18 - 4: // YYYY-MM-DDThh:mm:ssZ
+		case 0x1B - 4: // YYYY-MM-DDThh:mm:ss.ssZ
+			if (str[4] != '-' ||
+				str[7] != '-' ||
+				str[10] != 'T' ||
+				str[13] != ':' ||
+				str[16] != ':'
+			) {
+				return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+			}
+			if (str_len == 0x1B - 4 && str[19] != '.') {
+				return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+			}
+			offset[0] = 0;
+			offset[1] = 5;
+			offset[2] = 8;
+			offset[3] = 11;
+			offset[4] = 14;
+			offset[5] = 17;
+			offset[6] = 20;
+			break;
+
+		default:
+			return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+	}
+
+	// validate ISO 8601 designator (must be UTC)
+	if (str[str_len - 1] != 'Z') {
+		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+	}
+
+	// validate that all fields only contain decimal digits
+	for (size_t i = 0; i < sizeof(offset) / sizeof(offset[0]); ++i) {
+		// each field has two digits, except for the year with four digits
+		// and the optional fraction with two digits
+		size_t field_len = i == 0 ? 4 : 2;
+
+		if (offset[i] + field_len > str_len - 1) {
+			// no fraction
+			break;
+		}
+		for (size_t j = offset[i]; j < offset[i] + field_len; ++j) {
+			if (str[j] < '0' || str[j] > '9') {
+				return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+			}
+		}
+	}
+
+	// parse and validate fields
+	year = dec_to_int(str + offset[0], 4);
+	month = dec_to_int(str + offset[1], 2);
+	day = dec_to_int(str + offset[2], 2);
+	hour = dec_to_int(str + offset[3], 2);
+	minute = dec_to_int(str + offset[4], 2);
+	second = dec_to_int(str + offset[5], 2);
+	if (month < 1 || month > 12) {
+		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+	}
+	if (month == 2) {
+		bool leap_year = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+		days_in_month = leap_year ? 29 : 28;
+	} else if (month == 4 || month == 6 || month == 9 || month == 11) {
+		days_in_month = 30;
+	} else {
+		days_in_month = 31;
+	}
+	if (day < 1 || day > days_in_month) {
+		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+	}
+	// NOTE: a leap second (60) is accepted and results in the same time as
+	// the first second of the next minute
+	if (hour > 23 || minute > 59 || second > 60) {
+		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+	}
+
+	// convert proleptic Gregorian calendar date to days since 1970-01-01
+	// using eras of 400 years (146097 days) that start on 1 March, such that
+	// the leap day is the last day of each year of the era
+	y = year - (month <= 2);
+	era = (y >= 0 ? y : y - 399) / 400;
+	year_of_era = y - era * 400; // [0, 399]
+	day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1; // [0, 365]
+	day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year; // [0, 146096]
+	days = era * 146097 + day_of_era - 719468; // 719468 days from 0000-03-01 to 1970-01-01
+
+	time_data->seconds = days * 86400 + hour * 3600 + minute * 60 + second;
+	if (str_len == 0x15 - 4 || str_len == 0x1B - 4) {
+		time_data->centiseconds = dec_to_int(str + offset[6], 2);
+	} else {
+		time_data->centiseconds = 0;
+	}
+
+	return 0;
+}
+
 static int tr31_opt_block_export(
 	const struct tr31_opt_ctx_t* opt_ctx,
 	size_t remaining_len,
@@ -2919,41 +4653,57 @@ static int tr31_opt_block_export_PB(
 	struct tr31_opt_blk_t* opt_blk
 )
 {
+	int r;
+	size_t data_len = pb_len - 4;
+	size_t data_pos = 0;
+
 	opt_blk->id = htons(TR31_OPT_BLOCK_PB);
 	int_to_hex(pb_len, opt_blk->length, sizeof(opt_blk->length));
 
-	if ((state->flags & TR31_EXPORT_ZERO_OPT_BLOCK_PB) == 0) {
-		// populate with random data and then transpose to the required range
-		crypto_rand(opt_blk->data, pb_len - 4);
-	} else {
+	if (state->flags & TR31_EXPORT_ZERO_OPT_BLOCK_PB) {
 		// populate with zeros instead of random data
-		memset(opt_blk->data, 0, pb_len - 4);
+		memset(opt_blk->data, '0', data_len);
+		return 0;
 	}
 
-	for (size_t i = 0; i < pb_len - 4; ++i) {
-		// although optional block PB may contain printable ASCII characters in
-		// the range 0x20 to 0x7E, characters outside the ranges of '0'-'9',
-		// 'A'-'Z' and 'a'-'z' are problematic when using HSM protocols that
-		// may use other printable ASCII characters as delimiters
+	// although optional block PB may contain printable ASCII characters in
+	// the range 0x20 to 0x7E, characters outside the ranges of '0'-'9',
+	// 'A'-'Z' and 'a'-'z' are problematic when using HSM protocols that
+	// may use other printable ASCII characters as delimiters
+	while (data_pos < data_len) {
+		uint8_t buf[32];
+		char chars[sizeof(buf)];
+		size_t chars_count = 0;
 
-		// use unsigned integers for sanity but cast to uint8_t to fix negative
-		// char values without setting high order bits due to 2s complement
-		unsigned int tmp = (uint8_t)opt_blk->data[i];
+		r = tr31_rand(buf, sizeof(buf));
+		if (r) {
+			return r;
+		}
 
-		// clamp range to [0 - 61] for 62 possible characters
-		tmp = (tmp * 61) / 0xFF;
+		// use rejection sampling of 6-bit random values to obtain uniformly
+		// distributed values in the range [0 - 61] for 62 possible characters
+		// and map them without branches or table lookups such that the
+		// processing time does not depend on the random data
+		for (size_t i = 0; i < sizeof(buf); ++i) {
+			unsigned int tmp = buf[i] & 0x3F;
+			unsigned int accept = (tmp - 62) >> (sizeof(tmp) * 8 - 1); // 1 if tmp < 62
+			unsigned int c;
+
+			// split range into ranges of '0'-'9', 'A'-'Z' and 'a'-'z'
+			c = tmp + '0';
+			c += ((9 - tmp) >> (sizeof(tmp) * 8 - 1)) * ('A' - '9' - 1); // tmp >= 10
+			c += ((35 - tmp) >> (sizeof(tmp) * 8 - 1)) * ('a' - 'Z' - 1); // tmp >= 36
+
+			// always store character but only advance if accepted
+			chars[chars_count] = c;
+			chars_count += accept;
+		}
 
-		// split range into ranges of '0'-'9', 'A'-'Z' and 'a'-'z'
-		if (tmp < 10) {
-			opt_blk->data[i] = tmp + '0'; // '0'-'9'
-		} else if (tmp < 36) {
-			opt_blk->data[i] = tmp - 10 + 'A'; // 'A'-'Z'
-		} else if (tmp < 62) {
-			opt_blk->data[i] = tmp - 36 + 'a'; // 'a'-'z'
-		} else {
-			// This should never happen
-			return -1;
+		if (chars_count > data_len - data_pos) {
+			chars_count = data_len - data_pos;
 		}
+		memcpy(opt_blk->data + data_pos, chars, chars_count);
+		data_pos += chars_count;
 	}
 
 	return 0;
@@ -2963,6 +4713,7 @@ static int tr31_state_init(uint32_t flags, uint8_t version_id, struct tr31_state
 {
 	memset(state, 0, sizeof(*state));
 	state->flags = flags;
+	state->version_id = version_id;
 
 	// determine authenticator length and encryption block size
 	switch (version_id) {
@@ -3019,7 +4770,7 @@ static int tr31_state_prepare_import(
 
 	// prepare decoded key block buffer
 	state->decoded_key_block_length = state->header_length + state->payload_length + state->authenticator_length;
-	state->decoded_key_block = malloc(state->decoded_key_block_length);
+	state->decoded_key_block = tr31_malloc(state->decoded_key_block_length);
 	memcpy(state->decoded_key_block, key_block, state->header_length);
 
 	// decode payload
@@ -3049,6 +4800,7 @@ static int tr31_state_prepare_export(
 	const struct tr31_key_t* key
 )
 {
+	int r;
 	size_t padded_key_length;
 	size_t length;
 	struct tr31_payload_t* payload;
@@ -3126,7 +4878,7 @@ static int tr31_state_prepare_export(
 
 	// prepare decoded key block buffer
 	state->decoded_key_block_length = state->header_length + state->payload_length + state->authenticator_length;
-	state->decoded_key_block = malloc(state->decoded_key_block_length);
+	state->decoded_key_block = tr31_malloc(state->decoded_key_block_length);
 	memcpy(state->decoded_key_block, header, state->header_length);
 	state->payload = state->decoded_key_block + state->header_length;
 	state->authenticator = state->payload + state->payload_length;
@@ -3135,10 +4887,13 @@ static int tr31_state_prepare_export(
 	payload = state->payload;
 	payload->length = htons(key->length * 8); // payload length is big endian and in bits, not bytes
 	memcpy(payload->data, key->data, key->length);
-	crypto_rand(
+	r = tr31_rand(
 		payload->data + key->length,
 		state->payload_length - sizeof(struct tr31_payload_t) - key->length
 	);
+	if (r) {
+		return r;
+	}
 
 	return 0;
 }
@@ -3149,11 +4904,62 @@ static void tr31_state_release(struct tr31_state_t* state)
 		// cleanse this buffer because it contains the cleartext key during
 		// derivation binding CMAC generation/verification
 		crypto_cleanse(state->decoded_key_block, state->decoded_key_block_length);
-		free(state->decoded_key_block);
+		tr31_free(state->decoded_key_block);
 	}
 	memset(state, 0, sizeof(*state));
 }
 
+static int tr31_kbpk_derive_internal(uint8_t version_id, const struct tr31_key_t* kbpk, uint8_t* kbek, uint8_t* kbak)
+{
+	switch (version_id) {
+		case TR31_VERSION_A:
+		case TR31_VERSION_C:
+			// output key block encryption key variant and key block authentication key variant
+			return tr31_tdes_kbpk_variant(kbpk->data, kbpk->length, kbek, kbak);
+
+		case TR31_VERSION_B:
+			return tr31_tdes_kbpk_derive(kbpk->data, kbpk->length, kbek, kbak);
+
+		case TR31_VERSION_D:
+			// format version D uses CBC block mode
+			return tr31_aes_kbpk_derive(kbpk->data, kbpk->length, TR31_AES_MODE_CBC, kbek, kbak);
+
+		case TR31_VERSION_E:
+			// format version E uses CTR block mode
+			return tr31_aes_kbpk_derive(kbpk->data, kbpk->length, TR31_AES_MODE_CTR, kbek, kbak);
+
+		default:
+			// invalid format version
+			return -1;
+	}
+}
+
+static int tr31_kbpk_derive(const struct tr31_state_t* state, const struct tr31_key_t* kbpk, uint8_t* kbek, uint8_t* kbak)
+{
+	int r;
+
+	if (state->kbpk_derived) {
+		// use keys previously derived for the same format version
+		memcpy(kbek, state->kbpk_derived->kbek, kbpk->length);
+		memcpy(kbak, state->kbpk_derived->kbak, kbpk->length);
+		tr31_stats_add(TR31_STATS_INDEX(kbpk_derive_cached_count), 1);
+		return 0;
+	}
+
+	TR31_PROBE2(kbpk_derive__entry, state->version_id, kbpk->length);
+	TR31_TRACE_BEGIN(trace_kbpk);
+	r = tr31_kbpk_derive_internal(state->version_id, kbpk, kbek, kbak);
+	TR31_TRACE_END(TR31_TRACE_STAGE_KBPK_DERIVE, trace_kbpk);
+	TR31_PROBE3(kbpk_derive__return, state->version_id, kbpk->length, r);
+	if (r) {
+		// return error value as-is
+		return r;
+	}
+	tr31_stats_add(TR31_STATS_INDEX(kbpk_derive_count), 1);
+
+	return 0;
+}
+
 static int tr31_tdes_decrypt_verify_variant_binding(const struct tr31_state_t* state, const struct tr31_key_t* kbpk, struct tr31_key_t* key)
 {
 	int r;
@@ -3162,14 +4968,17 @@ static int tr31_tdes_decrypt_verify_variant_binding(const struct tr31_state_t* s
 	struct tr31_payload_t* decrypted_payload = NULL;
 	size_t key_length;
 
+	TR31_PROBE2(tdes_decrypt_verify_variant_binding__entry, state->version_id, state->decoded_key_block_length);
+
 	// output key block encryption key variant and key block authentication key variant
-	r = tr31_tdes_kbpk_variant(kbpk->data, kbpk->length, kbek, kbak);
+	r = tr31_kbpk_derive(state, kbpk, kbek, kbak);
 	if (r) {
 		// return error value as-is
 		goto error;
 	}
 
 	// verify authenticator
+	TR31_TRACE_BEGIN(trace_mac);
 	r = tr31_tdes_verify_cbcmac(
 		kbak,
 		kbpk->length,
@@ -3178,13 +4987,22 @@ static int tr31_tdes_decrypt_verify_variant_binding(const struct tr31_state_t* s
 		state->authenticator,
 		state->authenticator_length
 	);
+	TR31_TRACE_END(TR31_TRACE_STAGE_MAC_VERIFY, trace_mac);
 	if (r) {
 		r = TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED;
 		goto error;
 	}
 
+	if (!key) {
+		// verify only; the authenticator is computed over the encrypted
+		// payload and therefore decryption is not required
+		r = 0;
+		goto exit;
+	}
+
 	// decrypt key payload; note that the key block header is used as the IV
-	decrypted_payload = malloc(state->payload_length);
+	decrypted_payload = tr31_malloc(state->payload_length);
+	TR31_TRACE_BEGIN(trace_decrypt);
 	r = crypto_tdes_decrypt(
 		kbek,
 		kbpk->length,
@@ -3193,6 +5011,7 @@ static int tr31_tdes_decrypt_verify_variant_binding(const struct tr31_state_t* s
 		state->payload_length,
 		decrypted_payload
 	);
+	TR31_TRACE_END(TR31_TRACE_STAGE_DECRYPT, trace_decrypt);
 	if (r) {
 		// return error value as-is
 		goto error;
@@ -3230,9 +5049,10 @@ exit:
 	crypto_cleanse(kbak, sizeof(kbak));
 	if (decrypted_payload) {
 		crypto_cleanse(decrypted_payload, state->payload_length);
-		free(decrypted_payload);
+		tr31_free(decrypted_payload);
 	}
 
+	TR31_PROBE3(tdes_decrypt_verify_variant_binding__return, state->version_id, state->decoded_key_block_length, r);
 	return r;
 }
 
@@ -3244,15 +5064,18 @@ static int tr31_tdes_encrypt_sign_variant_binding(struct tr31_state_t* state, co
 	uint8_t* encrypted_payload = NULL;
 	uint8_t mac[DES_CBCMAC_SIZE];
 
+	TR31_PROBE2(tdes_encrypt_sign_variant_binding__entry, state->version_id, state->decoded_key_block_length);
+
 	// output key block encryption key variant and key block authentication key variant
-	r = tr31_tdes_kbpk_variant(kbpk->data, kbpk->length, kbek, kbak);
+	r = tr31_kbpk_derive(state, kbpk, kbek, kbak);
 	if (r) {
 		// return error value as-is
 		goto error;
 	}
 
 	// encrypt key payload; note that the key block header is used as the IV
-	encrypted_payload = malloc(state->payload_length);
+	encrypted_payload = tr31_malloc(state->payload_length);
+	TR31_TRACE_BEGIN(trace_encrypt);
 	r = crypto_tdes_encrypt(
 		kbek,
 		kbpk->length,
@@ -3261,6 +5084,7 @@ static int tr31_tdes_encrypt_sign_variant_binding(struct tr31_state_t* state, co
 		state->payload_length,
 		encrypted_payload
 	);
+	TR31_TRACE_END(TR31_TRACE_STAGE_ENCRYPT, trace_encrypt);
 	if (r) {
 		// return error value as-is
 		goto error;
@@ -3268,6 +5092,7 @@ static int tr31_tdes_encrypt_sign_variant_binding(struct tr31_state_t* state, co
 
 	// generate authenticator
 	memcpy(state->payload, encrypted_payload, state->payload_length);
+	TR31_TRACE_BEGIN(trace_mac);
 	r = crypto_tdes_cbcmac(
 		kbak,
 		kbpk->length,
@@ -3275,6 +5100,7 @@ static int tr31_tdes_encrypt_sign_variant_binding(struct tr31_state_t* state, co
 		state->header_length + state->payload_length,
 		mac
 	);
+	TR31_TRACE_END(TR31_TRACE_STAGE_MAC_GENERATE, trace_mac);
 	if (r > 0) {
 		// internal error
 		r = -10;
@@ -3297,10 +5123,11 @@ exit:
 	crypto_cleanse(kbak, sizeof(kbak));
 	if (encrypted_payload) {
 		crypto_cleanse(encrypted_payload, state->payload_length);
-		free(encrypted_payload);
+		tr31_free(encrypted_payload);
 	}
 	crypto_cleanse(mac, sizeof(mac));
 
+	TR31_PROBE3(tdes_encrypt_sign_variant_binding__return, state->version_id, state->decoded_key_block_length, r);
 	return r;
 }
 
@@ -3312,15 +5139,18 @@ static int tr31_tdes_decrypt_verify_derivation_binding(struct tr31_state_t* stat
 	struct tr31_payload_t* decrypted_payload = NULL;
 	size_t key_length;
 
+	TR31_PROBE2(tdes_decrypt_verify_derivation_binding__entry, state->version_id, state->decoded_key_block_length);
+
 	// derive key block encryption key and key block authentication key from key block protection key
-	r = tr31_tdes_kbpk_derive(kbpk->data, kbpk->length, kbek, kbak);
+	r = tr31_kbpk_derive(state, kbpk, kbek, kbak);
 	if (r) {
 		// return error value as-is
 		goto error;
 	}
 
 	// decrypt key payload; note that the authenticator is used as the IV
-	decrypted_payload = malloc(state->payload_length);
+	decrypted_payload = tr31_malloc(state->payload_length);
+	TR31_TRACE_BEGIN(trace_decrypt);
 	r = crypto_tdes_decrypt(
 		kbek,
 		kbpk->length,
@@ -3329,27 +5159,15 @@ static int tr31_tdes_decrypt_verify_derivation_binding(struct tr31_state_t* stat
 		state->payload_length,
 		decrypted_payload
 	);
+	TR31_TRACE_END(TR31_TRACE_STAGE_DECRYPT, trace_decrypt);
 	if (r) {
 		// return error value as-is
 		goto error;
 	}
 
-	// extract payload length field
-	key_length = ntohs(decrypted_payload->length); // payload length is big endian and in bits, not bytes
-	if ((key_length & 0x7) != 0) {
-		// invalid key length is not a multiple of 8 bits
-		r = TR31_ERROR_INVALID_KEY_LENGTH;
-		goto error;
-	}
-	key_length /= 8; // convert to bytes
-	if (key_length > state->payload_length - 2) {
-		// invalid key length relative to encrypted payload length
-		r = TR31_ERROR_INVALID_KEY_LENGTH;
-		goto error;
-	}
-
 	// verify authenticator
 	memcpy(state->payload, decrypted_payload, state->payload_length);
+	TR31_TRACE_BEGIN(trace_mac);
 	r = tr31_tdes_verify_cmac(
 		kbak,
 		kbpk->length,
@@ -3358,11 +5176,36 @@ static int tr31_tdes_decrypt_verify_derivation_binding(struct tr31_state_t* stat
 		state->authenticator,
 		state->authenticator_length
 	);
+	TR31_TRACE_END(TR31_TRACE_STAGE_MAC_VERIFY, trace_mac);
 	if (r) {
 		r = TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED;
 		goto error;
 	}
 
+	// extract payload length field only after the authenticator was
+	// verified such that an incorrect KBPK is always reported as a
+	// verification failure
+	key_length = ntohs(decrypted_payload->length); // payload length is big endian and in bits, not bytes
+	if ((key_length & 0x7) != 0) {
+		// invalid key length is not a multiple of 8 bits
+		r = TR31_ERROR_INVALID_KEY_LENGTH;
+		goto error;
+	}
+	key_length /= 8; // convert to bytes
+	if (key_length > state->payload_length - 2) {
+		// invalid key length relative to encrypted payload length
+		r = TR31_ERROR_INVALID_KEY_LENGTH;
+		goto error;
+	}
+
+	if (!key) {
+		// verify only; cleanse the decrypted payload immediately and do not
+		// extract the key data
+		crypto_cleanse(state->payload, state->payload_length);
+		r = 0;
+		goto exit;
+	}
+
 	// extract key data
 	r = tr31_key_set_data(key, decrypted_payload->data, key_length);
 	if (r) {
@@ -3381,9 +5224,10 @@ exit:
 	crypto_cleanse(kbak, sizeof(kbak));
 	if (decrypted_payload) {
 		crypto_cleanse(decrypted_payload, state->payload_length);
-		free(decrypted_payload);
+		tr31_free(decrypted_payload);
 	}
 
+	TR31_PROBE3(tdes_decrypt_verify_derivation_binding__return, state->version_id, state->decoded_key_block_length, r);
 	return r;
 }
 
@@ -3395,14 +5239,17 @@ static int tr31_tdes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 	uint8_t cmac[DES_CMAC_SIZE];
 	uint8_t* encrypted_payload = NULL;
 
+	TR31_PROBE2(tdes_encrypt_sign_derivation_binding__entry, state->version_id, state->decoded_key_block_length);
+
 	// derive key block encryption key and key block authentication key from key block protection key
-	r = tr31_tdes_kbpk_derive(kbpk->data, kbpk->length, kbek, kbak);
+	r = tr31_kbpk_derive(state, kbpk, kbek, kbak);
 	if (r) {
 		// return error value as-is
 		goto error;
 	}
 
 	// generate authenticator
+	TR31_TRACE_BEGIN(trace_mac);
 	r = crypto_tdes_cmac(
 		kbak,
 		kbpk->length,
@@ -3410,6 +5257,7 @@ static int tr31_tdes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 		state->header_length + state->payload_length,
 		cmac
 	);
+	TR31_TRACE_END(TR31_TRACE_STAGE_MAC_GENERATE, trace_mac);
 	if (r > 0) {
 		// internal error
 		r = -10;
@@ -3422,7 +5270,8 @@ static int tr31_tdes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 	memcpy(state->authenticator, cmac, state->authenticator_length);
 
 	// encrypt key payload; note that the authenticator is used as the IV
-	encrypted_payload = malloc(state->payload_length);
+	encrypted_payload = tr31_malloc(state->payload_length);
+	TR31_TRACE_BEGIN(trace_encrypt);
 	r = crypto_tdes_encrypt(
 		kbek,
 		kbpk->length,
@@ -3431,6 +5280,7 @@ static int tr31_tdes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 		state->payload_length,
 		encrypted_payload
 	);
+	TR31_TRACE_END(TR31_TRACE_STAGE_ENCRYPT, trace_encrypt);
 	if (r) {
 		// return error value as-is
 		goto error;
@@ -3448,10 +5298,11 @@ exit:
 	crypto_cleanse(kbak, sizeof(kbak));
 	if (encrypted_payload) {
 		crypto_cleanse(encrypted_payload, state->payload_length);
-		free(encrypted_payload);
+		tr31_free(encrypted_payload);
 	}
 	crypto_cleanse(cmac, sizeof(cmac));
 
+	TR31_PROBE3(tdes_encrypt_sign_derivation_binding__return, state->version_id, state->decoded_key_block_length, r);
 	return r;
 }
 
@@ -3464,18 +5315,21 @@ static int tr31_aes_decrypt_verify_derivation_binding(struct tr31_state_t* state
 	struct tr31_payload_t* decrypted_payload = NULL;
 	size_t key_length;
 
+	TR31_PROBE2(aes_decrypt_verify_derivation_binding__entry, state->version_id, state->decoded_key_block_length);
+
 	header = state->decoded_key_block;
 	if (header->version_id == TR31_VERSION_D) {
 		// derive key block encryption key and key block authentication key from key block protection key
 		// format version D uses CBC block mode
-		r = tr31_aes_kbpk_derive(kbpk->data, kbpk->length, TR31_AES_MODE_CBC, kbek, kbak);
+		r = tr31_kbpk_derive(state, kbpk, kbek, kbak);
 		if (r) {
 			// return error value as-is
 			goto error;
 		}
 
 		// decrypt key payload; note that the authenticator is used as the IV
-		decrypted_payload = malloc(state->payload_length);
+		decrypted_payload = tr31_malloc(state->payload_length);
+		TR31_TRACE_BEGIN(trace_decrypt);
 		r = crypto_aes_decrypt(
 			kbek,
 			kbpk->length,
@@ -3484,6 +5338,7 @@ static int tr31_aes_decrypt_verify_derivation_binding(struct tr31_state_t* state
 			state->payload_length,
 			decrypted_payload
 		);
+		TR31_TRACE_END(TR31_TRACE_STAGE_DECRYPT, trace_decrypt);
 		if (r) {
 			// return error value as-is
 			goto error;
@@ -3492,14 +5347,15 @@ static int tr31_aes_decrypt_verify_derivation_binding(struct tr31_state_t* state
 	} else if (header->version_id == TR31_VERSION_E) {
 		// derive key block encryption key and key block authentication key from key block protection key
 		// format version E uses CTR block mode
-		r = tr31_aes_kbpk_derive(kbpk->data, kbpk->length, TR31_AES_MODE_CTR, kbek, kbak);
+		r = tr31_kbpk_derive(state, kbpk, kbek, kbak);
 		if (r) {
 			// return error value as-is
 			goto error;
 		}
 
 		// decrypt key payload; note that the authenticator is used as the IV/nonce
-		decrypted_payload = malloc(state->payload_length);
+		decrypted_payload = tr31_malloc(state->payload_length);
+		TR31_TRACE_BEGIN(trace_decrypt);
 		r = crypto_aes_decrypt_ctr(
 			kbek,
 			kbpk->length,
@@ -3508,6 +5364,7 @@ static int tr31_aes_decrypt_verify_derivation_binding(struct tr31_state_t* state
 			state->payload_length,
 			decrypted_payload
 		);
+		TR31_TRACE_END(TR31_TRACE_STAGE_DECRYPT, trace_decrypt);
 		if (r) {
 			// return error value as-is
 			goto error;
@@ -3515,25 +5372,13 @@ static int tr31_aes_decrypt_verify_derivation_binding(struct tr31_state_t* state
 
 	} else {
 		// invalid format version
-		return -1;
-	}
-
-	// extract payload length field
-	key_length = ntohs(decrypted_payload->length); // payload length is big endian and in bits, not bytes
-	if ((key_length & 0x7) != 0) {
-		// invalid key length is not a multiple of 8 bits
-		r = TR31_ERROR_INVALID_KEY_LENGTH;
-		goto error;
-	}
-	key_length /= 8; // convert to bytes
-	if (key_length > state->payload_length - 2) {
-		// invalid key length relative to encrypted payload length
-		r = TR31_ERROR_INVALID_KEY_LENGTH;
+		r = -1;
 		goto error;
 	}
 
 	// verify authenticator
 	memcpy(state->payload, decrypted_payload, state->payload_length);
+	TR31_TRACE_BEGIN(trace_mac);
 	r = tr31_aes_verify_cmac(
 		kbak,
 		kbpk->length,
@@ -3542,11 +5387,36 @@ static int tr31_aes_decrypt_verify_derivation_binding(struct tr31_state_t* state
 		state->authenticator,
 		state->authenticator_length
 	);
+	TR31_TRACE_END(TR31_TRACE_STAGE_MAC_VERIFY, trace_mac);
 	if (r) {
 		r = TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED;
 		goto error;
 	}
 
+	// extract payload length field only after the authenticator was
+	// verified such that an incorrect KBPK is always reported as a
+	// verification failure
+	key_length = ntohs(decrypted_payload->length); // payload length is big endian and in bits, not bytes
+	if ((key_length & 0x7) != 0) {
+		// invalid key length is not a multiple of 8 bits
+		r = TR31_ERROR_INVALID_KEY_LENGTH;
+		goto error;
+	}
+	key_length /= 8; // convert to bytes
+	if (key_length > state->payload_length - 2) {
+		// invalid key length relative to encrypted payload length
+		r = TR31_ERROR_INVALID_KEY_LENGTH;
+		goto error;
+	}
+
+	if (!key) {
+		// verify only; cleanse the decrypted payload immediately and do not
+		// extract the key data
+		crypto_cleanse(state->payload, state->payload_length);
+		r = 0;
+		goto exit;
+	}
+
 	// extract key data
 	r = tr31_key_set_data(key, decrypted_payload->data, key_length);
 	if (r) {
@@ -3565,9 +5435,10 @@ exit:
 	crypto_cleanse(kbak, sizeof(kbak));
 	if (decrypted_payload) {
 		crypto_cleanse(decrypted_payload, state->payload_length);
-		free(decrypted_payload);
+		tr31_free(decrypted_payload);
 	}
 
+	TR31_PROBE3(aes_decrypt_verify_derivation_binding__return, state->version_id, state->decoded_key_block_length, r);
 	return r;
 }
 
@@ -3580,17 +5451,20 @@ static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 	uint8_t cmac[AES_CMAC_SIZE];
 	uint8_t* encrypted_payload = NULL;
 
+	TR31_PROBE2(aes_encrypt_sign_derivation_binding__entry, state->version_id, state->decoded_key_block_length);
+
 	header = state->decoded_key_block;
 	if (header->version_id == TR31_VERSION_D) {
 		// derive key block encryption key and key block authentication key from key block protection key
 		// format version D uses CBC block mode
-		r = tr31_aes_kbpk_derive(kbpk->data, kbpk->length, TR31_AES_MODE_CBC, kbek, kbak);
+		r = tr31_kbpk_derive(state, kbpk, kbek, kbak);
 		if (r) {
 			// return error value as-is
 			goto error;
 		}
 
 		// generate authenticator
+		TR31_TRACE_BEGIN(trace_mac);
 		r = crypto_aes_cmac(
 			kbak,
 			kbpk->length,
@@ -3598,6 +5472,7 @@ static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 			state->header_length + state->payload_length,
 			cmac
 		);
+		TR31_TRACE_END(TR31_TRACE_STAGE_MAC_GENERATE, trace_mac);
 		if (r) {
 			// return error value as-is
 			goto error;
@@ -3605,7 +5480,8 @@ static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 		memcpy(state->authenticator, cmac, state->authenticator_length);
 
 		// encrypt key payload; note that the authenticator is used as the IV
-		encrypted_payload = malloc(state->payload_length);
+		encrypted_payload = tr31_malloc(state->payload_length);
+		TR31_TRACE_BEGIN(trace_encrypt);
 		r = crypto_aes_encrypt(
 			kbek,
 			kbpk->length,
@@ -3614,6 +5490,7 @@ static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 			state->payload_length,
 			encrypted_payload
 		);
+		TR31_TRACE_END(TR31_TRACE_STAGE_ENCRYPT, trace_encrypt);
 		if (r) {
 			// return error value as-is
 			goto error;
@@ -3623,13 +5500,14 @@ static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 	} else if (header->version_id == TR31_VERSION_E) {
 		// derive key block encryption key and key block authentication key from key block protection key
 		// format version E uses CTR block mode
-		r = tr31_aes_kbpk_derive(kbpk->data, kbpk->length, TR31_AES_MODE_CTR, kbek, kbak);
+		r = tr31_kbpk_derive(state, kbpk, kbek, kbak);
 		if (r) {
 			// return error value as-is
 			goto error;
 		}
 
 		// generate authenticator
+		TR31_TRACE_BEGIN(trace_mac);
 		r = crypto_aes_cmac(
 			kbak,
 			kbpk->length,
@@ -3637,6 +5515,7 @@ static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 			state->header_length + state->payload_length,
 			cmac
 		);
+		TR31_TRACE_END(TR31_TRACE_STAGE_MAC_GENERATE, trace_mac);
 		if (r) {
 			// return error value as-is
 			goto error;
@@ -3644,7 +5523,8 @@ static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 		memcpy(state->authenticator, cmac, state->authenticator_length);
 
 		// encrypt key payload; note that the authenticator is used as the IV/nonce
-		encrypted_payload = malloc(state->payload_length);
+		encrypted_payload = tr31_malloc(state->payload_length);
+		TR31_TRACE_BEGIN(trace_encrypt);
 		r = crypto_aes_encrypt_ctr(
 			kbek,
 			kbpk->length,
@@ -3653,6 +5533,7 @@ static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 			state->payload_length,
 			encrypted_payload
 		);
+		TR31_TRACE_END(TR31_TRACE_STAGE_ENCRYPT, trace_encrypt);
 		if (r) {
 			// return error value as-is
 			goto error;
@@ -3661,7 +5542,8 @@ static int tr31_aes_encrypt_sign_derivation_binding(struct tr31_state_t* state,
 
 	} else {
 		// invalid format version
-		return -1;
+		r = -1;
+		goto error;
 	}
 
 	// success
@@ -3675,10 +5557,11 @@ exit:
 	crypto_cleanse(kbak, sizeof(kbak));
 	if (encrypted_payload) {
 		crypto_cleanse(encrypted_payload, state->payload_length);
-		free(encrypted_payload);
+		tr31_free(encrypted_payload);
 	}
 	crypto_cleanse(cmac, sizeof(cmac));
 
+	TR31_PROBE3(aes_encrypt_sign_derivation_binding__return, state->version_id, state->decoded_key_block_length, r);
 	return r;
 }
 
@@ -3693,12 +5576,12 @@ void tr31_release(struct tr31_ctx_t* ctx)
 	if (ctx->opt_blocks) {
 		for (size_t i = 0; i < ctx->opt_blocks_count; ++i) {
 			if (ctx->opt_blocks[i].data) {
-				free(ctx->opt_blocks[i].data);
+				tr31_free(ctx->opt_blocks[i].data);
 			}
 			ctx->opt_blocks[i].data = NULL;
 		}
 
-		free(ctx->opt_blocks);
+		tr31_free(ctx->opt_blocks);
 		ctx->opt_blocks = NULL;
 	}
 }
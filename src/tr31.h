@@ -273,6 +273,7 @@ enum tr31_key_version_t {
  */
 /// @{
 #define TR31_IMPORT_NO_STRICT_VALIDATION        (0x01) ///< Disable strict ANSI X9.143 / ISO 20038 validation during import. This is useful for importing non-standard key blocks.
+#define TR31_IMPORT_COMPUTE_KCV                 (0x02) ///< Compute Key Check Value (KCV) of decrypted key during import instead of when first requested by @ref tr31_key_get_kcv()
 /// @}
 
 /**
@@ -312,9 +313,9 @@ struct tr31_key_t {
 	size_t length; ///< Key data length in bytes
 	void* data; ///< Key data
 
-	uint8_t kcv_algorithm; ///< KCV algorithm (@ref TR31_OPT_BLOCK_KCV_LEGACY or @ref TR31_OPT_BLOCK_KCV_CMAC)
-	size_t kcv_len; ///< Key Check Value (KCV) length in bytes
-	uint8_t kcv[5]; ///< Key Check Value (KCV)
+	uint8_t kcv_algorithm; ///< KCV algorithm (@ref TR31_OPT_BLOCK_KCV_LEGACY or @ref TR31_OPT_BLOCK_KCV_CMAC). Valid if @ref tr31_key_t.kcv_len is non-zero.
+	size_t kcv_len; ///< Key Check Value (KCV) length in bytes. Zero until computed by @ref tr31_key_get_kcv().
+	uint8_t kcv[5]; ///< Key Check Value (KCV). Valid if @ref tr31_key_t.kcv_len is non-zero.
 };
 
 /// Optional block context object
@@ -373,6 +374,16 @@ struct tr31_opt_blk_kcv_data_t {
 	uint8_t kcv[5]; ///< Key Check Value (KCV)
 };
 
+/**
+ * Decoded optional block Time of Creation (TC) or Time Stamp (TS) data
+ * @see ANSI X9.143:2021, 6.3.6.13, table 21
+ * @see ANSI X9.143:2021, 6.3.6.14, table 22
+ */
+struct tr31_opt_blk_time_data_t {
+	int64_t seconds; ///< Seconds since 1970-01-01T00:00:00Z (Unix time), not counting leap seconds
+	unsigned int centiseconds; ///< Hundredths of a second. Zero if the encoding does not provide fractional seconds.
+};
+
 /**
  * Decoded optional block Wrapping Pedigree (WP) data
  * @see @ref optional-block-wp-values "Wrapping Pedigree (WP) optional block values"
@@ -385,6 +396,55 @@ struct tr31_opt_blk_wp_data_t {
 	} v0; ///< Wrapping Pedigree (WP) version 0. Valid if @ref tr31_opt_blk_wp_data_t.version is @ref TR31_OPT_BLOCK_WP_VERSION_0
 };
 
+/**
+ * @name Decoded optional blocks
+ * @remark Presence bits of @ref tr31_opt_blocks_decoded_t
+ * @anchor opt-blocks-decoded-values
+ */
+/// @{
+#define TR31_OPT_BLOCKS_DECODED_AL      (0x0001) ///< Optional block AL for Asymmetric Key Life (AKL)
+#define TR31_OPT_BLOCKS_DECODED_BI      (0x0002) ///< Optional block BI for Base Derivation Key Identifier (BDK ID) for DUKPT
+#define TR31_OPT_BLOCKS_DECODED_DA      (0x0004) ///< Optional block DA for Derivation(s) Allowed
+#define TR31_OPT_BLOCKS_DECODED_HM      (0x0008) ///< Optional block HM for HMAC hash algorithm
+#define TR31_OPT_BLOCKS_DECODED_IK      (0x0010) ///< Optional block IK for Initial Key Identifier (IKID) for AES DUKPT
+#define TR31_OPT_BLOCKS_DECODED_KC      (0x0020) ///< Optional block KC for Key Check Value (KCV) of wrapped key
+#define TR31_OPT_BLOCKS_DECODED_KP      (0x0040) ///< Optional block KP for Key Check Value (KCV) of KBPK
+#define TR31_OPT_BLOCKS_DECODED_KS      (0x0080) ///< Optional block KS for Initial Key Serial Number (KSN)
+#define TR31_OPT_BLOCKS_DECODED_PK      (0x0100) ///< Optional block PK for Key Check Value (KCV) of export protection key
+#define TR31_OPT_BLOCKS_DECODED_TC      (0x0200) ///< Optional block TC for Time of Creation
+#define TR31_OPT_BLOCKS_DECODED_TS      (0x0400) ///< Optional block TS for Time Stamp
+#define TR31_OPT_BLOCKS_DECODED_WP      (0x0800) ///< Optional block WP for Wrapping Pedigree
+/// @}
+
+/// Number of Derivation Allowed (DA) attributes stored by @ref tr31_opt_blocks_decoded_t
+#define TR31_OPT_BLOCKS_DECODED_DA_MAX  (16)
+
+/**
+ * Decoded data of all supported optional blocks of a key block
+ * @see @ref tr31_opt_blocks_decode_all()
+ */
+struct tr31_opt_blocks_decoded_t {
+	uint32_t present; ///< Optional blocks that were decoded. See @ref opt-blocks-decoded-values "decoded optional blocks".
+	uint32_t invalid; ///< Optional blocks that are present but could not be decoded. See @ref opt-blocks-decoded-values "decoded optional blocks".
+
+	struct tr31_opt_blk_akl_data_t akl; ///< Decoded optional block AL. Valid if @ref TR31_OPT_BLOCKS_DECODED_AL is present.
+	uint8_t hash_algorithm; ///< Decoded optional block HM. Valid if @ref TR31_OPT_BLOCKS_DECODED_HM is present.
+	struct tr31_opt_blk_wp_data_t wp; ///< Decoded optional block WP. Valid if @ref TR31_OPT_BLOCKS_DECODED_WP is present.
+	uint8_t ikid[8]; ///< Decoded optional block IK. Valid if @ref TR31_OPT_BLOCKS_DECODED_IK is present.
+	uint8_t iksn[10]; ///< Decoded optional block KS. Valid if @ref TR31_OPT_BLOCKS_DECODED_KS is present.
+	size_t iksn_len; ///< Length of @ref tr31_opt_blocks_decoded_t.iksn in bytes. Either 10 bytes or 8 bytes for legacy encodings.
+	struct tr31_opt_blk_bdkid_data_t bdkid; ///< Decoded optional block BI. Valid if @ref TR31_OPT_BLOCKS_DECODED_BI is present.
+	struct tr31_opt_blk_kcv_data_t kc; ///< Decoded optional block KC. Valid if @ref TR31_OPT_BLOCKS_DECODED_KC is present.
+	struct tr31_opt_blk_kcv_data_t kp; ///< Decoded optional block KP. Valid if @ref TR31_OPT_BLOCKS_DECODED_KP is present.
+	struct tr31_opt_blk_kcv_data_t pk; ///< Decoded optional block PK. Valid if @ref TR31_OPT_BLOCKS_DECODED_PK is present.
+	struct tr31_opt_blk_time_data_t tc; ///< Decoded optional block TC. Valid if @ref TR31_OPT_BLOCKS_DECODED_TC is present.
+	struct tr31_opt_blk_time_data_t ts; ///< Decoded optional block TS. Valid if @ref TR31_OPT_BLOCKS_DECODED_TS is present.
+
+	unsigned int da_version; ///< Derivation(s) Allowed (DA) version. Valid if @ref TR31_OPT_BLOCKS_DECODED_DA is present.
+	size_t da_count; ///< Number of Derivation Allowed (DA) attributes in optional block DA. Only the first @ref TR31_OPT_BLOCKS_DECODED_DA_MAX attributes are stored in @ref tr31_opt_blocks_decoded_t.da.
+	struct tr31_opt_blk_da_attr_t da[TR31_OPT_BLOCKS_DECODED_DA_MAX]; ///< Derivation Allowed (DA) attributes. Valid if @ref TR31_OPT_BLOCKS_DECODED_DA is present.
+};
+
 /**
  * @brief Key block context object.
  *
@@ -490,8 +550,8 @@ int tr31_key_copy(
 );
 
 /**
- * Populate key data in key object. This function will also populate the KCV in
- * the key object when possible.
+ * Populate key data in key object. This function will not compute the KCV.
+ * Use @ref tr31_key_get_kcv() to compute the KCV when required.
  *
  * @note This function requires a populated key object
  *       (after @ref tr31_key_init(), @ref tr31_key_copy() or @ref tr31_export())
@@ -503,6 +563,23 @@ int tr31_key_copy(
  */
 int tr31_key_set_data(struct tr31_key_t* key, const void* data, size_t length);
 
+/**
+ * Obtain Key Check Value (KCV) of key object. The KCV is computed when first
+ * requested and cached in the key object such that subsequent invocations
+ * do not repeat the computation. Upon success, @ref tr31_key_t.kcv_algorithm,
+ * @ref tr31_key_t.kcv and @ref tr31_key_t.kcv_len are valid.
+ *
+ * The KCV is computed according to ANSI X9.24-1:2017, 7.7.2, using the legacy
+ * KCV for TDES keys and the CMAC-based KCV for AES keys.
+ *
+ * @note This function modifies the key object and concurrent invocations for
+ *       the same key object therefore require external synchronisation.
+ *
+ * @param key Key object
+ * @return Zero for success. Less than zero for internal error. Greater than zero if KCV not available. See @ref tr31_error_t
+ */
+int tr31_key_get_kcv(struct tr31_key_t* key);
+
 /**
  * Decode key version field and populate it in key object
  *
@@ -977,6 +1054,25 @@ int tr31_opt_block_add_TC(
 	const char* tc_str
 );
 
+/**
+ * Decode optional block 'TC' for time of creation of the wrapped key.
+ * This function supports all ISO 8601 formats of ANSI X9.143:2021, 6.3.6.13,
+ * table 21, and does not depend on the locale, the time zone or memory
+ * allocation.
+ *
+ * @note This function complies with ANSI X9.143 and will fail for
+ *       non-compliant encodings of this optional block, including invalid
+ *       dates and times.
+ *
+ * @param opt_ctx Optional block context object
+ * @param time_data Decoded time of creation output
+ * @return Zero for success. Less than zero for internal error. Greater than zero for data error. See @ref tr31_error_t
+ */
+int tr31_opt_block_decode_TC(
+	const struct tr31_opt_ctx_t* opt_ctx,
+	struct tr31_opt_blk_time_data_t* time_data
+);
+
 /**
  * Add optional block 'TS' for time stamp indicating when key block was formed
  * to key block context object
@@ -992,6 +1088,25 @@ int tr31_opt_block_add_TS(
 	const char* ts_str
 );
 
+/**
+ * Decode optional block 'TS' for time stamp indicating when key block was
+ * formed. This function supports all ISO 8601 formats of ANSI X9.143:2021,
+ * 6.3.6.14, table 22, and does not depend on the locale, the time zone or
+ * memory allocation.
+ *
+ * @note This function complies with ANSI X9.143 and will fail for
+ *       non-compliant encodings of this optional block, including invalid
+ *       dates and times.
+ *
+ * @param opt_ctx Optional block context object
+ * @param time_data Decoded time stamp output
+ * @return Zero for success. Less than zero for internal error. Greater than zero for data error. See @ref tr31_error_t
+ */
+int tr31_opt_block_decode_TS(
+	const struct tr31_opt_ctx_t* opt_ctx,
+	struct tr31_opt_blk_time_data_t* time_data
+);
+
 /**
  * Add optional block 'WP' for Wrapping Pedigree to key block context object.
  *
@@ -1021,6 +1136,168 @@ int tr31_opt_block_decode_WP(
 	struct tr31_opt_blk_wp_data_t* wp_data
 );
 
+/**
+ * Decode all supported optional blocks of key block context object in a
+ * single pass. This avoids repeated optional block lookups and provides the
+ * Derivation(s) Allowed (DA) attributes without a separately allocated
+ * buffer. Use this function after @ref tr31_import() such that subsequent
+ * processing of the key block does not need to parse optional block data.
+ *
+ * Optional blocks that could not be decoded are indicated by
+ * @ref tr31_opt_blocks_decoded_t.invalid and decoding continues with the
+ * remaining optional blocks. If optional block DA contains more than
+ * @ref TR31_OPT_BLOCKS_DECODED_DA_MAX attributes, only the first
+ * @ref TR31_OPT_BLOCKS_DECODED_DA_MAX attributes are stored and
+ * @ref tr31_opt_block_decode_DA() can be used to decode all of them.
+ *
+ * @note This function complies with ANSI X9.143 and will indicate
+ *       non-compliant encodings of optional blocks as invalid.
+ *
+ * @param ctx Key block context object
+ * @param decoded Decoded optional blocks output
+ * @return Zero for success. Less than zero for internal error. Greater than zero for the first data error. See @ref tr31_error_t
+ */
+int tr31_opt_blocks_decode_all(
+	const struct tr31_ctx_t* ctx,
+	struct tr31_opt_blocks_decoded_t* decoded
+);
+
+/**
+ * Random number generator function for use with @ref tr31_set_rng()
+ *
+ * @param ctx Context provided to @ref tr31_set_rng()
+ * @param buf Output buffer
+ * @param len Number of random bytes to generate
+ * @return Zero for success. Non-zero for error.
+ */
+typedef int (*tr31_rng_func_t)(void* ctx, void* buf, size_t len);
+
+/**
+ * Set random number generator used for key length obfuscation padding and
+ * for optional block PB (Padding Block) during key block export. By default,
+ * this library uses a buffered per-thread DRBG that is seeded using the
+ * random number generator of the crypto implementation.
+ *
+ * @note This function is not thread safe and should be called before other
+ *       threads use this library. The random number generator itself must
+ *       be thread safe if this library is used by multiple threads.
+ *
+ * @param func Random number generator function. NULL to restore the default.
+ * @param ctx Context for random number generator function
+ */
+void tr31_set_rng(tr31_rng_func_t func, void* ctx);
+
+/// Memory allocator for use with @ref tr31_set_allocator()
+struct tr31_allocator_t {
+	void* (*malloc_func)(void* ctx, size_t size); ///< Allocate memory. Same semantics as malloc().
+	void* (*realloc_func)(void* ctx, void* ptr, size_t size); ///< Resize memory. Same semantics as realloc().
+	void (*free_func)(void* ctx, void* ptr); ///< Free memory. Same semantics as free().
+	void* ctx; ///< Context provided to allocator functions
+};
+
+/**
+ * Set memory allocator used for key data, optional block data and temporary
+ * buffers during key block import and export. By default, this library uses
+ * malloc(), realloc() and free().
+ *
+ * @note This function is not thread safe and should be called before other
+ *       threads use this library. Memory allocated by this library must be
+ *       released using @ref tr31_release() or @ref tr31_key_release() before
+ *       the allocator is changed. The allocator itself must be thread safe if
+ *       this library is used by multiple threads.
+ *
+ * @param allocator Memory allocator. NULL to restore the default. All
+ *                  functions must be provided.
+ */
+void tr31_set_allocator(const struct tr31_allocator_t* allocator);
+
+/// Key block processing stages reported by @ref tr31_trace_func_t
+enum tr31_trace_stage_t {
+	TR31_TRACE_STAGE_IMPORT = 0, ///< Complete @ref tr31_import() invocation
+	TR31_TRACE_STAGE_EXPORT, ///< Complete @ref tr31_export() invocation
+	TR31_TRACE_STAGE_PARSE, ///< Key block header and optional block parsing during import
+	TR31_TRACE_STAGE_ENCODE, ///< Key block header and optional block encoding during export
+	TR31_TRACE_STAGE_KBPK_DERIVE, ///< Key Block Encryption Key (KBEK) and Key Block Authentication Key (KBAK) derivation from the Key Block Protection Key (KBPK)
+	TR31_TRACE_STAGE_DECRYPT, ///< Key block payload decryption
+	TR31_TRACE_STAGE_ENCRYPT, ///< Key block payload encryption
+	TR31_TRACE_STAGE_MAC_VERIFY, ///< Key block authenticator computation and verification during import
+	TR31_TRACE_STAGE_MAC_GENERATE, ///< Key block authenticator computation during export
+	TR31_TRACE_STAGE_KCV, ///< Key Check Value (KCV) computation
+
+	TR31_TRACE_STAGE_COUNT, ///< Number of stages. Not a stage.
+};
+
+/**
+ * Trace hook function for use with @ref tr31_set_trace_hook()
+ *
+ * Stages may be nested; for example, @ref TR31_TRACE_STAGE_DECRYPT is
+ * reported within @ref TR31_TRACE_STAGE_IMPORT. Each stage is reported once
+ * it has completed. @ref TR31_TRACE_STAGE_IMPORT and
+ * @ref TR31_TRACE_STAGE_EXPORT are always reported, but other stages may not
+ * be reported if processing fails before they complete.
+ *
+ * @param ctx Context provided to @ref tr31_set_trace_hook()
+ * @param stage Key block processing stage
+ * @param start_ns Monotonic timestamp in nanoseconds at start of stage
+ * @param end_ns Monotonic timestamp in nanoseconds at end of stage
+ */
+typedef void (*tr31_trace_func_t)(void* ctx, enum tr31_trace_stage_t stage, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * Set trace hook used to report per-stage timestamps during key block import
+ * and export. Tracing is only available if this library was built with the
+ * TR31_ENABLE_TRACE option and is disabled until a trace hook is set.
+ *
+ * @note This function is not thread safe and should be called before other
+ *       threads use this library. The trace hook itself must be thread safe
+ *       if this library is used by multiple threads.
+ *
+ * @param func Trace hook function. NULL to disable tracing.
+ * @param ctx Context for trace hook function
+ * @return Zero for success. Non-zero if tracing is not available.
+ */
+int tr31_set_trace_hook(tr31_trace_func_t func, void* ctx);
+
+#define TR31_STATS_VERSION_COUNT (5) ///< Number of key block format versions in @ref tr31_stats_t, from @ref TR31_VERSION_A to @ref TR31_VERSION_E
+#define TR31_STATS_ERROR_COUNT (TR31_ERROR_KCV_NOT_AVAILABLE + 1) ///< Number of error counters in @ref tr31_stats_t
+
+/**
+ * Library-wide operation and error counters for use with
+ * @ref tr31_stats_snapshot(). All counters are cumulative since the library
+ * was loaded and all fields are 64-bit counters.
+ */
+struct tr31_stats_t {
+	uint64_t import_count[TR31_STATS_VERSION_COUNT]; ///< Successful key block imports per format version. Index 0 is @ref TR31_VERSION_A.
+	uint64_t import_bytes; ///< Total length in bytes of successfully imported key blocks
+	uint64_t import_failed_count; ///< Failed key block imports
+	uint64_t export_count[TR31_STATS_VERSION_COUNT]; ///< Successful key block exports per format version. Index 0 is @ref TR31_VERSION_A.
+	uint64_t export_bytes; ///< Total length in bytes of successfully exported key blocks
+	uint64_t export_failed_count; ///< Failed key block exports
+	uint64_t error_count[TR31_STATS_ERROR_COUNT]; ///< Failed imports and exports per @ref tr31_error_t. Index 0 is for internal errors.
+	uint64_t kbpk_derive_count; ///< Key Block Encryption Key (KBEK) and Key Block Authentication Key (KBAK) derivations performed
+	uint64_t kbpk_derive_cached_count; ///< KBEK and KBAK derivations served from previously derived keys
+	uint64_t alloc_count; ///< Memory allocations by this library, including reallocations
+	uint64_t alloc_bytes; ///< Total size in bytes of memory allocations by this library
+	uint64_t alloc_failed_count; ///< Failed memory allocations by this library
+};
+
+/**
+ * Retrieve a snapshot of the library-wide operation and error counters.
+ *
+ * Counters are maintained per thread without locking or atomic
+ * read-modify-write operations and are aggregated by this function, which
+ * makes it suitable for infrequent reads, like periodic metrics collection,
+ * without affecting the throughput of other threads. Counters of threads that
+ * have exited are retained.
+ *
+ * @note Counters of other threads are read individually and the snapshot is
+ *       therefore not atomic with respect to concurrent operations.
+ *
+ * @param stats Counters output
+ * @return Zero for success. Less than zero for internal error.
+ */
+int tr31_stats_snapshot(struct tr31_stats_t* stats);
+
 /**
  * Import key block. This function will also decrypt the key data if possible.
  *
@@ -1042,6 +1319,34 @@ int tr31_import(
 	struct tr31_ctx_t* ctx
 );
 
+/**
+ * Verify key block authenticator without extracting the key data. This
+ * function parses and validates the key block in the same manner as
+ * @ref tr31_import() but does not populate a key block context object or
+ * key object.
+ *
+ * For format versions A and C, the authenticator is computed over the
+ * encrypted key data and is therefore verified without any decryption. For
+ * format versions B, D and E, the authenticator is computed over the
+ * decrypted key data and the key data is therefore decrypted into a scratch
+ * buffer that is cleansed immediately after verification.
+ *
+ * @note The key length is not validated against the key algorithm because
+ *       the key data is not extracted.
+ *
+ * @param key_block Key block. Must contain printable ASCII characters. Null-termination not required.
+ * @param key_block_len Length of key block in bytes, excluding null-termination.
+ * @param kbpk Key block protection key
+ * @param flags Key block import flags. See @ref import-flags "import flags".
+ * @return Zero for success. Less than zero for internal error. Greater than zero for data error. See @ref tr31_error_t
+ */
+int tr31_verify(
+	const char* key_block,
+	size_t key_block_len,
+	const struct tr31_key_t* kbpk,
+	uint32_t flags
+);
+
 /**
  * Export key block. This function will create and encrypt the key block.
  *
@@ -1063,6 +1368,230 @@ int tr31_export(
 	size_t key_block_buf_len
 );
 
+/**
+ * Re-wrap (translate) key block from one key block protection key (KBPK) to
+ * another. The key block is verified and decrypted using the old KBPK and
+ * then encrypted and signed using the new KBPK. The wrapped key is only held
+ * by an internal key block context object that is cleansed before this
+ * function returns.
+ *
+ * @note Optional block KP (KCV of KBPK) and optional block PB (Padding Block)
+ *       will be recomputed for the new KBPK and the new key block format
+ *       version. All other header fields and optional blocks are retained
+ *       as-is.
+ *
+ * @param key_block Key block input. Must contain printable ASCII characters. Null-termination not required.
+ * @param key_block_len Length of key block input in bytes, excluding null-termination.
+ * @param kbpk_old Key block protection key used to verify and decrypt the key block input.
+ * @param kbpk_new Key block protection key used to encrypt and sign the key block output.
+ * @param version_id Key block format version of the key block output. Zero to retain the format version of the key block input.
+ * @param import_flags Key block import flags. See @ref import-flags "import flags".
+ * @param export_flags Key block export flags. See @ref export-flags "export flags".
+ * @param new_key_block Key block output. Will contain printable ASCII characters and will be null-terminated.
+ * @param new_key_block_buf_len Key block output buffer length.
+ * @return Zero for success. Less than zero for internal error. Greater than zero for data error. See @ref tr31_error_t
+ */
+int tr31_rewrap(
+	const char* key_block,
+	size_t key_block_len,
+	const struct tr31_key_t* kbpk_old,
+	const struct tr31_key_t* kbpk_new,
+	uint8_t version_id,
+	uint32_t import_flags,
+	uint32_t export_flags,
+	char* new_key_block,
+	size_t new_key_block_buf_len
+);
+
+/// Key block re-wrap item for use with @ref tr31_rewrap_batch()
+struct tr31_rewrap_item_t {
+	const char* key_block; ///< Key block input. Must contain printable ASCII characters. Null-termination not required.
+	size_t key_block_len; ///< Length of key block input in bytes, excluding null-termination.
+	char* new_key_block; ///< Key block output. Will contain printable ASCII characters and will be null-terminated.
+	size_t new_key_block_buf_len; ///< Key block output buffer length.
+	int result; ///< Result of @ref tr31_rewrap() for this item. Populated by @ref tr31_rewrap_batch().
+};
+
+/**
+ * Re-wrap (translate) multiple key blocks from one key block protection key
+ * (KBPK) to another. See @ref tr31_rewrap() for details. Items are
+ * distributed across the calling thread and up to @p thread_count - 1
+ * additional worker threads, if threading is available. The result of each
+ * item is stored in @ref tr31_rewrap_item_t.result.
+ *
+ * @note The crypto implementation used by this library must be thread safe
+ *       when @p thread_count is greater than one.
+ *
+ * @param items Array of key block re-wrap items
+ * @param items_count Number of key block re-wrap items
+ * @param kbpk_old Key block protection key used to verify and decrypt the key block inputs.
+ * @param kbpk_new Key block protection key used to encrypt and sign the key block outputs.
+ * @param version_id Key block format version of the key block outputs. Zero to retain the format version of each key block input.
+ * @param import_flags Key block import flags. See @ref import-flags "import flags".
+ * @param export_flags Key block export flags. See @ref export-flags "export flags".
+ * @param thread_count Maximum number of threads to use, including the calling thread. Zero or one to process all items using the calling thread.
+ * @return Zero if all items were successful. Less than zero for internal error.
+ *         Greater than zero if any item failed, in which case the value is
+ *         the result of the first item that failed. See @ref tr31_error_t
+ */
+int tr31_rewrap_batch(
+	struct tr31_rewrap_item_t* items,
+	size_t items_count,
+	const struct tr31_key_t* kbpk_old,
+	const struct tr31_key_t* kbpk_new,
+	uint8_t version_id,
+	uint32_t import_flags,
+	uint32_t export_flags,
+	unsigned int thread_count
+);
+
+/**
+ * Opaque keyring of key block protection keys (KBPKs) for use with
+ * @ref tr31_keyring_import().
+ *
+ * Keyring updates publish a new immutable snapshot of the keyring, including
+ * the KCVs and derived keys of its KBPKs, while the previous snapshot remains
+ * available to imports that are still using it. Imports do not take any lock
+ * and may therefore be performed concurrently with each other and with
+ * keyring updates. Replaced snapshots, and the KBPKs that were removed by
+ * keyring updates, are cleansed and released once no import can still be
+ * using them.
+ */
+struct tr31_keyring_t;
+
+/**
+ * Create empty keyring of key block protection keys (KBPKs).
+ *
+ * @note Use @ref tr31_keyring_destroy() to release and cleanse resources when done.
+ *
+ * @return Keyring object. NULL for error.
+ */
+struct tr31_keyring_t* tr31_keyring_create(void);
+
+/**
+ * Destroy keyring and cleanse all key block protection keys and derived keys
+ * that it contains.
+ *
+ * @note This function must not be used concurrently with other functions
+ *       that use the same keyring.
+ *
+ * @param keyring Keyring object
+ */
+void tr31_keyring_destroy(struct tr31_keyring_t* keyring);
+
+/**
+ * Add key block protection key (KBPK) to keyring. The KBPK is copied and its
+ * Key Check Value (KCV), as well as the key block encryption and
+ * authentication keys for every format version that allows the KBPK
+ * algorithm, are computed before the KBPK is published to imports. TDES KBPKs
+ * are used for format versions A, B and C while AES KBPKs are used for format
+ * versions D and E.
+ *
+ * @note Keyring updates are serialised if threading is available.
+ *
+ * @param keyring Keyring object
+ * @param kbpk Key block protection key
+ * @param kbpk_id Identifier of key block protection key in keyring output. Identifiers are assigned sequentially from zero and are not reused. NULL if not required.
+ * @return Zero for success. Less than zero for internal error. Greater than zero for data error. See @ref tr31_error_t
+ */
+int tr31_keyring_add(
+	struct tr31_keyring_t* keyring,
+	const struct tr31_key_t* kbpk,
+	size_t* kbpk_id
+);
+
+/**
+ * Remove key block protection key (KBPK) from keyring. Imports that started
+ * before the removal may still use the KBPK, after which it is cleansed and
+ * released.
+ *
+ * @note Keyring updates are serialised if threading is available.
+ *
+ * @param keyring Keyring object
+ * @param kbpk_id Identifier of key block protection key in keyring
+ * @return Zero for success. Less than zero for internal error, including unknown @p kbpk_id.
+ */
+int tr31_keyring_remove(struct tr31_keyring_t* keyring, size_t kbpk_id);
+
+/**
+ * Replace key block protection key (KBPK) in keyring with a new KBPK. The
+ * new KBPK is prepared as described for @ref tr31_keyring_add() and a
+ * single keyring update then adds the new KBPK and removes the old KBPK,
+ * such that every import observes exactly one of them.
+ *
+ * @note Keyring updates are serialised if threading is available.
+ *
+ * @param keyring Keyring object
+ * @param old_kbpk_id Identifier of key block protection key in keyring to replace
+ * @param kbpk New key block protection key
+ * @param kbpk_id Identifier of new key block protection key in keyring output. NULL if not required.
+ * @return Zero for success. Less than zero for internal error, including unknown @p old_kbpk_id.
+ *         Greater than zero for data error. See @ref tr31_error_t
+ */
+int tr31_keyring_rotate(
+	struct tr31_keyring_t* keyring,
+	size_t old_kbpk_id,
+	const struct tr31_key_t* kbpk,
+	size_t* kbpk_id
+);
+
+/**
+ * Cleanse and release replaced keyring snapshots, and the key block
+ * protection keys that were removed, that are no longer used by any import.
+ * Keyring updates also perform this reclamation, but applications that
+ * remove key block protection keys infrequently can use this function to
+ * avoid retaining removed key block protection keys until the next update.
+ *
+ * @param keyring Keyring object
+ * @return Number of replaced keyring snapshots that are still awaiting reclamation.
+ */
+size_t tr31_keyring_reclaim(struct tr31_keyring_t* keyring);
+
+/**
+ * Import key block using the key block protection key (KBPK) in the keyring
+ * that verifies it. See @ref tr31_import() for details.
+ *
+ * If the key block contains optional block KP (KCV of KBPK), the KBPK is
+ * selected using a hash lookup of the KCV and KBPK algorithm. Otherwise, or
+ * if none of the matching KBPKs verify the key block, all KBPKs that are
+ * suitable for the key block format version are trialled. The trials are
+ * distributed across the calling thread and up to @p thread_count - 1
+ * additional worker threads, if threading is available, but no more threads
+ * than there are suitable KBPKs. Each candidate KBPK imports the key block
+ * directly and the next candidate is only tried if verification failed, such
+ * that a successful import decrypts and verifies the key block only once.
+ * All imports use the derived keys that were computed when the KBPK was
+ * added.
+ *
+ * This function does not take any lock and uses the keyring snapshot that
+ * was current when it started, regardless of concurrent keyring updates.
+ *
+ * @note This function will populate a new key block context object.
+ *       Use @ref tr31_release() to release internal resources when done.
+ * @note The crypto implementation used by this library must be thread safe
+ *       when @p thread_count is greater than one.
+ *
+ * @param keyring Keyring object
+ * @param key_block Key block. Must contain printable ASCII characters. Null-termination not required.
+ * @param key_block_len Length of key block in bytes, excluding null-termination.
+ * @param flags Key block import flags. See @ref import-flags "import flags".
+ * @param thread_count Maximum number of threads to use for trials, including the calling thread. Zero or one to use only the calling thread.
+ * @param ctx Key block context object output
+ * @param kbpk_id Identifier of key block protection key in keyring that was used. NULL if not required.
+ * @return Zero for success. Less than zero for internal error. Greater than zero for data error.
+ *         @ref TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED if no key block protection key in the keyring verifies the key block.
+ *         See @ref tr31_error_t
+ */
+int tr31_keyring_import(
+	struct tr31_keyring_t* keyring,
+	const char* key_block,
+	size_t key_block_len,
+	uint32_t flags,
+	unsigned int thread_count,
+	struct tr31_ctx_t* ctx,
+	size_t* kbpk_id
+);
+
 /**
  * Release key block context object resources
  * @param ctx Key block context object
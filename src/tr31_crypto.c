@@ -26,10 +26,17 @@
 #include "crypto_tdes.h"
 #include "crypto_aes.h"
 #include "crypto_mem.h"
+#include "crypto_rand.h"
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #if defined(HAVE_ARPA_INET_H)
 #include <arpa/inet.h> // For htons and friends
 #elif defined(HAVE_WINSOCK_H)
@@ -39,6 +46,9 @@
 #define TR31_KBEK_VARIANT_XOR (0x45)
 #define TR31_KBAK_VARIANT_XOR (0x4D)
 
+#define TR31_DRBG_BUF_SIZE (512) ///< Number of buffered DRBG output bytes
+#define TR31_DRBG_RESEED_INTERVAL (2048) ///< Number of DRBG buffer refills before reseeding
+
 // Key derivation input data
 // See ANSI X9.143:2021, 7.2.1.1, table 24
 // See ANSI X9.143:2021, 7.2.2.1, table 25
@@ -65,6 +75,34 @@ enum tr31_derivation_algorithm_t {
 	TR31_DERIVATION_ALGORITHM_AES256 = 0x0004,
 };
 
+// Random number generator provided by tr31_set_rng()
+static tr31_rng_func_t tr31_rng_func = NULL;
+static void* tr31_rng_ctx = NULL;
+
+#ifdef HAVE_PTHREAD
+// Buffered AES-256 CTR DRBG state
+// The DRBG is seeded using crypto_rand() and after every buffer refill, the
+// DRBG key and counter are replaced with additional DRBG output such that
+// previous output cannot be recovered from the current state.
+struct tr31_drbg_t {
+	uint8_t key[AES256_KEY_SIZE];
+	uint8_t ctr[AES_BLOCK_SIZE];
+	uint8_t buf[TR31_DRBG_BUF_SIZE];
+	size_t buf_pos;
+	unsigned int refill_count;
+	unsigned int fork_generation;
+	bool seeded;
+};
+
+// Each thread has its own DRBG state to avoid contention
+static _Thread_local struct tr31_drbg_t tr31_drbg;
+
+// Incremented in child processes such that a forked DRBG state is reseeded
+static atomic_uint tr31_drbg_fork_generation;
+static pthread_once_t tr31_drbg_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tr31_drbg_key;
+#endif
+
 int tr31_tdes_verify_cbcmac(
 	const void* key,
 	size_t key_len,
@@ -335,3 +373,131 @@ int tr31_aes_kbpk_derive(
 
 	return 0;
 }
+
+#ifdef HAVE_PTHREAD
+static void tr31_drbg_atfork_child(void)
+{
+	atomic_fetch_add(&tr31_drbg_fork_generation, 1);
+}
+
+static void tr31_drbg_thread_exit(void* arg)
+{
+	// cleanse DRBG state when thread exits
+	crypto_cleanse(arg, sizeof(struct tr31_drbg_t));
+}
+
+static void tr31_drbg_init_once(void)
+{
+	pthread_atfork(NULL, NULL, &tr31_drbg_atfork_child);
+	pthread_key_create(&tr31_drbg_key, &tr31_drbg_thread_exit);
+}
+
+static int tr31_drbg_refill(struct tr31_drbg_t* drbg)
+{
+	int r;
+	unsigned int fork_generation;
+	static const uint8_t zero[TR31_DRBG_BUF_SIZE + AES256_KEY_SIZE + AES_BLOCK_SIZE] = { 0 };
+	uint8_t output[sizeof(zero)];
+
+	fork_generation = atomic_load_explicit(&tr31_drbg_fork_generation, memory_order_relaxed);
+	if (!drbg->seeded ||
+		drbg->refill_count >= TR31_DRBG_RESEED_INTERVAL ||
+		drbg->fork_generation != fork_generation
+	) {
+		if (!drbg->seeded) {
+			pthread_once(&tr31_drbg_once, &tr31_drbg_init_once);
+			pthread_setspecific(tr31_drbg_key, drbg);
+		}
+
+		crypto_rand(drbg->key, sizeof(drbg->key));
+		crypto_rand(drbg->ctr, sizeof(drbg->ctr));
+		drbg->refill_count = 0;
+		drbg->fork_generation = fork_generation;
+		drbg->seeded = true;
+	}
+
+	// generate DRBG buffer, followed by the next DRBG key and counter
+	r = crypto_aes_encrypt_ctr(drbg->key, sizeof(drbg->key), drbg->ctr, zero, sizeof(zero), output);
+	if (r) {
+		drbg->seeded = false;
+		r = -1;
+		goto exit;
+	}
+	memcpy(drbg->buf, output, sizeof(drbg->buf));
+	memcpy(drbg->key, output + sizeof(drbg->buf), sizeof(drbg->key));
+	memcpy(drbg->ctr, output + sizeof(drbg->buf) + sizeof(drbg->key), sizeof(drbg->ctr));
+	drbg->buf_pos = 0;
+	++drbg->refill_count;
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	crypto_cleanse(output, sizeof(output));
+	return r;
+}
+#endif
+
+int tr31_rand(void* buf, size_t len)
+{
+	if (!buf && len) {
+		return -1;
+	}
+	if (!len) {
+		return 0;
+	}
+
+	if (tr31_rng_func) {
+		return tr31_rng_func(tr31_rng_ctx, buf, len) ? -1 : 0;
+	}
+
+#ifdef HAVE_PTHREAD
+	uint8_t* ptr = buf;
+	struct tr31_drbg_t* drbg = &tr31_drbg;
+
+	// reseed forked DRBG state before using buffered output
+	if (drbg->seeded &&
+		drbg->fork_generation != atomic_load_explicit(&tr31_drbg_fork_generation, memory_order_relaxed)
+	) {
+		drbg->buf_pos = sizeof(drbg->buf);
+	}
+
+	while (len) {
+		size_t chunk_len;
+
+		if (!drbg->seeded || drbg->buf_pos >= sizeof(drbg->buf)) {
+			int r;
+
+			r = tr31_drbg_refill(drbg);
+			if (r) {
+				return r;
+			}
+		}
+
+		chunk_len = sizeof(drbg->buf) - drbg->buf_pos;
+		if (chunk_len > len) {
+			chunk_len = len;
+		}
+		memcpy(ptr, drbg->buf + drbg->buf_pos, chunk_len);
+
+		// output is only provided once
+		crypto_cleanse(drbg->buf + drbg->buf_pos, chunk_len);
+		drbg->buf_pos += chunk_len;
+		ptr += chunk_len;
+		len -= chunk_len;
+	}
+
+	return 0;
+#else
+	// without thread support, thread local DRBG state is not available
+	crypto_rand(buf, len);
+	return 0;
+#endif
+}
+
+void tr31_set_rng(tr31_rng_func_t func, void* ctx)
+{
+	tr31_rng_func = func;
+	tr31_rng_ctx = ctx;
+}
@@ -153,6 +153,18 @@ int tr31_aes_kbpk_derive(
 	void* kbak
 );
 
+/**
+ * Generate random bytes. Small requests are served from a buffered per-thread
+ * DRBG that is seeded using the crypto implementation's random number
+ * generator, unless a random number generator was provided using
+ * @ref tr31_set_rng().
+ *
+ * @param buf Output buffer
+ * @param len Number of random bytes to generate
+ * @return Zero for success. Less than zero for internal error.
+ */
+int tr31_rand(void* buf, size_t len);
+
 __END_DECLS
 
 #endif
@@ -0,0 +1,660 @@
+/**
+ * @file tr31_engine.c
+ * @brief Asynchronous TR-31 key block processing engine
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31_engine.h"
+#include "tr31_config.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#define TR31_ENGINE_QUEUE_SIZE_DEFAULT (1024)
+#define TR31_ENGINE_CACHE_LINE_SIZE (64)
+
+// bounded queue cell
+struct tr31_engine_cell_t {
+	atomic_size_t sequence;
+	struct tr31_engine_req_t* req;
+};
+
+// bounded lock-free multi-producer/multi-consumer queue
+// see Dmitry Vyukov's bounded MPMC queue
+struct tr31_engine_queue_t {
+	struct tr31_engine_cell_t* cells;
+	size_t mask;
+
+	// producer and consumer positions are kept on separate cache lines
+	char pad0[TR31_ENGINE_CACHE_LINE_SIZE];
+	atomic_size_t enqueue_pos;
+	char pad1[TR31_ENGINE_CACHE_LINE_SIZE];
+	atomic_size_t dequeue_pos;
+	char pad2[TR31_ENGINE_CACHE_LINE_SIZE];
+};
+
+struct tr31_engine_t {
+	struct tr31_engine_queue_t submit_queue;
+	struct tr31_engine_queue_t completion_queue;
+
+	// requests that were submitted but not yet completed, or that are in the
+	// completion queue, are in flight
+	size_t capacity;
+	atomic_size_t in_flight;
+
+	// completion queue notification
+	// for eventfd, both descriptors are the same
+	int notify_rfd;
+	int notify_wfd;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	atomic_uint idle_workers;
+	atomic_bool shutdown;
+	pthread_t* threads;
+	unsigned int thread_count;
+#endif
+};
+
+// helper functions
+static int tr31_engine_queue_init(struct tr31_engine_queue_t* queue, size_t size);
+static void tr31_engine_queue_release(struct tr31_engine_queue_t* queue);
+static bool tr31_engine_queue_push(struct tr31_engine_queue_t* queue, struct tr31_engine_req_t* req);
+static struct tr31_engine_req_t* tr31_engine_queue_pop(struct tr31_engine_queue_t* queue);
+static int tr31_engine_notify_init(struct tr31_engine_t* engine);
+static void tr31_engine_notify(struct tr31_engine_t* engine);
+static void tr31_engine_notify_reset(struct tr31_engine_t* engine);
+static void tr31_engine_notify_release(struct tr31_engine_t* engine);
+static void tr31_engine_process(struct tr31_engine_t* engine, struct tr31_engine_req_t* req);
+#ifdef HAVE_PTHREAD
+static void* tr31_engine_worker(void* arg);
+static void tr31_engine_stop(struct tr31_engine_t* engine, unsigned int thread_count);
+#endif
+
+static int tr31_engine_queue_init(struct tr31_engine_queue_t* queue, size_t size)
+{
+	queue->cells = malloc(sizeof(*queue->cells) * size);
+	if (!queue->cells) {
+		return -1;
+	}
+	for (size_t i = 0; i < size; ++i) {
+		atomic_init(&queue->cells[i].sequence, i);
+		queue->cells[i].req = NULL;
+	}
+	queue->mask = size - 1;
+	atomic_init(&queue->enqueue_pos, 0);
+	atomic_init(&queue->dequeue_pos, 0);
+
+	return 0;
+}
+
+static void tr31_engine_queue_release(struct tr31_engine_queue_t* queue)
+{
+	free(queue->cells);
+	queue->cells = NULL;
+}
+
+static bool tr31_engine_queue_push(struct tr31_engine_queue_t* queue, struct tr31_engine_req_t* req)
+{
+	struct tr31_engine_cell_t* cell;
+	size_t pos;
+
+	pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+	for (;;) {
+		size_t seq;
+		intptr_t diff;
+
+		cell = &queue->cells[pos & queue->mask];
+		seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			// cell is available; attempt to claim it
+			if (atomic_compare_exchange_weak_explicit(
+				&queue->enqueue_pos,
+				&pos,
+				pos + 1,
+				memory_order_relaxed,
+				memory_order_relaxed
+			)) {
+				break;
+			}
+			// pos was updated by the failed exchange
+		} else if (diff < 0) {
+			// queue is full
+			return false;
+		} else {
+			// another producer claimed the cell
+			pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	cell->req = req;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+	return true;
+}
+
+static struct tr31_engine_req_t* tr31_engine_queue_pop(struct tr31_engine_queue_t* queue)
+{
+	struct tr31_engine_cell_t* cell;
+	struct tr31_engine_req_t* req;
+	size_t pos;
+
+	pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+	for (;;) {
+		size_t seq;
+		intptr_t diff;
+
+		cell = &queue->cells[pos & queue->mask];
+		seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (diff == 0) {
+			// cell is populated; attempt to claim it
+			if (atomic_compare_exchange_weak_explicit(
+				&queue->dequeue_pos,
+				&pos,
+				pos + 1,
+				memory_order_relaxed,
+				memory_order_relaxed
+			)) {
+				break;
+			}
+			// pos was updated by the failed exchange
+		} else if (diff < 0) {
+			// queue is empty
+			return NULL;
+		} else {
+			// another consumer claimed the cell
+			pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+		}
+	}
+
+	req = cell->req;
+	atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+
+	return req;
+}
+
+static int tr31_engine_notify_init(struct tr31_engine_t* engine)
+{
+	engine->notify_rfd = -1;
+	engine->notify_wfd = -1;
+
+#if defined(HAVE_SYS_EVENTFD_H)
+	engine->notify_rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (engine->notify_rfd < 0) {
+		return -1;
+	}
+	engine->notify_wfd = engine->notify_rfd;
+
+#elif defined(HAVE_UNISTD_H)
+	int fds[2];
+
+	if (pipe(fds)) {
+		return -1;
+	}
+	engine->notify_rfd = fds[0];
+	engine->notify_wfd = fds[1];
+	for (unsigned int i = 0; i < 2; ++i) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, fcntl(fds[i], F_GETFD) | FD_CLOEXEC);
+	}
+#endif
+
+	return 0;
+}
+
+static void tr31_engine_notify(struct tr31_engine_t* engine)
+{
+	if (engine->notify_wfd < 0) {
+		return;
+	}
+
+#if defined(HAVE_SYS_EVENTFD_H)
+	eventfd_write(engine->notify_wfd, 1);
+#elif defined(HAVE_UNISTD_H)
+	const char c = 0;
+	ssize_t r;
+
+	// a full pipe is already readable
+	do {
+		r = write(engine->notify_wfd, &c, sizeof(c));
+	} while (r < 0 && errno == EINTR);
+#endif
+}
+
+static void tr31_engine_notify_reset(struct tr31_engine_t* engine)
+{
+	if (engine->notify_rfd < 0) {
+		return;
+	}
+
+#if defined(HAVE_SYS_EVENTFD_H)
+	eventfd_t value;
+	eventfd_read(engine->notify_rfd, &value);
+#elif defined(HAVE_UNISTD_H)
+	char buf[64];
+	ssize_t r;
+
+	do {
+		r = read(engine->notify_rfd, buf, sizeof(buf));
+	} while (r > 0 || (r < 0 && errno == EINTR));
+#endif
+}
+
+static void tr31_engine_notify_release(struct tr31_engine_t* engine)
+{
+#ifdef HAVE_UNISTD_H
+	if (engine->notify_wfd >= 0 && engine->notify_wfd != engine->notify_rfd) {
+		close(engine->notify_wfd);
+	}
+	if (engine->notify_rfd >= 0) {
+		close(engine->notify_rfd);
+	}
+#endif
+	engine->notify_rfd = -1;
+	engine->notify_wfd = -1;
+}
+
+static int tr31_engine_export(const struct tr31_engine_req_t* req)
+{
+	int r;
+	struct tr31_ctx_t job_ctx;
+
+	// tr31_export() finalises empty KC/KP optional blocks in the key block
+	// context object that it is given. Export from a private copy such that
+	// concurrent export requests may share the caller's context object.
+	r = tr31_init(req->ctx->version, &req->ctx->key, &job_ctx);
+	if (r) {
+		goto exit;
+	}
+	for (size_t i = 0; i < req->ctx->opt_blocks_count; ++i) {
+		const struct tr31_opt_ctx_t* opt_ctx = &req->ctx->opt_blocks[i];
+
+		r = tr31_opt_block_add(&job_ctx, opt_ctx->id, opt_ctx->data, opt_ctx->data_length);
+		if (r) {
+			goto exit;
+		}
+	}
+
+	r = tr31_export(
+		&job_ctx,
+		req->kbpk,
+		req->flags,
+		req->key_block_buf,
+		req->key_block_buf_len
+	);
+
+exit:
+	tr31_release(&job_ctx);
+	return r;
+}
+
+static void tr31_engine_process(struct tr31_engine_t* engine, struct tr31_engine_req_t* req)
+{
+	tr31_engine_callback_t callback;
+
+	switch (req->op) {
+		case TR31_ENGINE_OP_IMPORT:
+			req->result = tr31_import(
+				req->key_block,
+				req->key_block_len,
+				req->kbpk,
+				req->flags,
+				req->ctx
+			);
+			break;
+
+		case TR31_ENGINE_OP_EXPORT:
+			req->result = tr31_engine_export(req);
+			break;
+
+		default:
+			req->result = -1;
+	}
+
+	callback = req->callback;
+	if (callback) {
+		// request may be released by the callback and must not be accessed
+		// after the callback returns
+		callback(req);
+		atomic_fetch_sub_explicit(&engine->in_flight, 1, memory_order_release);
+		return;
+	}
+
+	// the completion queue is as large as the maximum number of requests in
+	// flight and can only appear full while the consumer is releasing a cell
+	while (!tr31_engine_queue_push(&engine->completion_queue, req)) {
+	}
+	tr31_engine_notify(engine);
+}
+
+#ifdef HAVE_PTHREAD
+static void* tr31_engine_worker(void* arg)
+{
+	struct tr31_engine_t* engine = arg;
+	struct tr31_engine_req_t* req;
+
+	for (;;) {
+		req = tr31_engine_queue_pop(&engine->submit_queue);
+		if (req) {
+			tr31_engine_process(engine, req);
+			continue;
+		}
+
+		// submit queue is empty; wait for next request or shutdown
+		pthread_mutex_lock(&engine->mutex);
+		atomic_fetch_add(&engine->idle_workers, 1);
+		// pairs with the fence in tr31_engine_submit() such that either the
+		// submitter observes this idle worker or this worker observes the
+		// submitted request
+		atomic_thread_fence(memory_order_seq_cst);
+		while (!(req = tr31_engine_queue_pop(&engine->submit_queue)) &&
+			!atomic_load(&engine->shutdown)
+		) {
+			pthread_cond_wait(&engine->cond, &engine->mutex);
+		}
+		atomic_fetch_sub(&engine->idle_workers, 1);
+		pthread_mutex_unlock(&engine->mutex);
+
+		if (!req) {
+			// shutdown and submit queue is empty
+			break;
+		}
+		tr31_engine_process(engine, req);
+	}
+
+	return NULL;
+}
+
+static void tr31_engine_stop(struct tr31_engine_t* engine, unsigned int thread_count)
+{
+	pthread_mutex_lock(&engine->mutex);
+	atomic_store(&engine->shutdown, true);
+	pthread_cond_broadcast(&engine->cond);
+	pthread_mutex_unlock(&engine->mutex);
+
+	for (unsigned int i = 0; i < thread_count; ++i) {
+		pthread_join(engine->threads[i], NULL);
+	}
+}
+#endif
+
+struct tr31_engine_t* tr31_engine_create(unsigned int thread_count, size_t queue_size)
+{
+	struct tr31_engine_t* engine;
+	size_t capacity;
+
+	if (!queue_size) {
+		queue_size = TR31_ENGINE_QUEUE_SIZE_DEFAULT;
+	}
+	if (queue_size > (SIZE_MAX >> 2)) {
+		return NULL;
+	}
+	if (!thread_count) {
+		thread_count = 1;
+	}
+
+	// queue size must be a power of two
+	capacity = 1;
+	while (capacity < queue_size) {
+		capacity <<= 1;
+	}
+
+	engine = calloc(1, sizeof(*engine));
+	if (!engine) {
+		return NULL;
+	}
+	engine->capacity = capacity;
+	atomic_init(&engine->in_flight, 0);
+
+	if (tr31_engine_queue_init(&engine->submit_queue, capacity)) {
+		goto error;
+	}
+	if (tr31_engine_queue_init(&engine->completion_queue, capacity)) {
+		goto error;
+	}
+	if (tr31_engine_notify_init(engine)) {
+		goto error;
+	}
+
+#ifdef HAVE_PTHREAD
+	atomic_init(&engine->idle_workers, 0);
+	atomic_init(&engine->shutdown, false);
+	if (pthread_mutex_init(&engine->mutex, NULL)) {
+		goto error;
+	}
+	if (pthread_cond_init(&engine->cond, NULL)) {
+		pthread_mutex_destroy(&engine->mutex);
+		goto error;
+	}
+
+	engine->threads = malloc(sizeof(*engine->threads) * thread_count);
+	if (!engine->threads) {
+		goto error_threads;
+	}
+	for (unsigned int i = 0; i < thread_count; ++i) {
+		if (pthread_create(&engine->threads[i], NULL, tr31_engine_worker, engine)) {
+			tr31_engine_stop(engine, i);
+			goto error_threads;
+		}
+	}
+	engine->thread_count = thread_count;
+#endif
+
+	// success
+	return engine;
+
+#ifdef HAVE_PTHREAD
+error_threads:
+	free(engine->threads);
+	pthread_cond_destroy(&engine->cond);
+	pthread_mutex_destroy(&engine->mutex);
+#endif
+error:
+	tr31_engine_notify_release(engine);
+	tr31_engine_queue_release(&engine->completion_queue);
+	tr31_engine_queue_release(&engine->submit_queue);
+	free(engine);
+	return NULL;
+}
+
+void tr31_engine_destroy(struct tr31_engine_t* engine)
+{
+	if (!engine) {
+		return;
+	}
+
+#ifdef HAVE_PTHREAD
+	// workers process the remaining requests before exiting
+	tr31_engine_stop(engine, engine->thread_count);
+	free(engine->threads);
+	pthread_cond_destroy(&engine->cond);
+	pthread_mutex_destroy(&engine->mutex);
+#endif
+
+	tr31_engine_notify_release(engine);
+	tr31_engine_queue_release(&engine->completion_queue);
+	tr31_engine_queue_release(&engine->submit_queue);
+	free(engine);
+}
+
+int tr31_engine_submit(struct tr31_engine_t* engine, struct tr31_engine_req_t* req)
+{
+	if (!engine || !req) {
+		return -1;
+	}
+	if (req->op != TR31_ENGINE_OP_IMPORT &&
+		req->op != TR31_ENGINE_OP_EXPORT
+	) {
+		return -1;
+	}
+
+	// reserve capacity for request
+	if (atomic_fetch_add_explicit(&engine->in_flight, 1, memory_order_acquire) >= engine->capacity) {
+		atomic_fetch_sub_explicit(&engine->in_flight, 1, memory_order_relaxed);
+		return TR31_ENGINE_BUSY;
+	}
+
+#ifdef HAVE_PTHREAD
+	if (!tr31_engine_queue_push(&engine->submit_queue, req)) {
+		// a consumer is still releasing the cell
+		atomic_fetch_sub_explicit(&engine->in_flight, 1, memory_order_relaxed);
+		return TR31_ENGINE_BUSY;
+	}
+
+	// wake an idle worker, if any
+	// see tr31_engine_worker()
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&engine->idle_workers, memory_order_relaxed)) {
+		pthread_mutex_lock(&engine->mutex);
+		pthread_cond_signal(&engine->cond);
+		pthread_mutex_unlock(&engine->mutex);
+	}
+#else
+	// threading not available; process request using the calling thread
+	tr31_engine_process(engine, req);
+#endif
+
+	return 0;
+}
+
+int tr31_import_async(
+	struct tr31_engine_t* engine,
+	const char* key_block,
+	size_t key_block_len,
+	const struct tr31_key_t* kbpk,
+	uint32_t flags,
+	struct tr31_ctx_t* ctx,
+	tr31_engine_callback_t callback,
+	void* user_data,
+	struct tr31_engine_req_t* req
+)
+{
+	if (!req) {
+		return -1;
+	}
+
+	req->op = TR31_ENGINE_OP_IMPORT;
+	req->key_block = key_block;
+	req->key_block_len = key_block_len;
+	req->key_block_buf = NULL;
+	req->key_block_buf_len = 0;
+	req->kbpk = kbpk;
+	req->flags = flags;
+	req->ctx = ctx;
+	req->result = -1;
+	req->callback = callback;
+	req->user_data = user_data;
+
+	return tr31_engine_submit(engine, req);
+}
+
+int tr31_export_async(
+	struct tr31_engine_t* engine,
+	const struct tr31_ctx_t* ctx,
+	const struct tr31_key_t* kbpk,
+	uint32_t flags,
+	char* key_block,
+	size_t key_block_buf_len,
+	tr31_engine_callback_t callback,
+	void* user_data,
+	struct tr31_engine_req_t* req
+)
+{
+	if (!req) {
+		return -1;
+	}
+
+	req->op = TR31_ENGINE_OP_EXPORT;
+	req->key_block = NULL;
+	req->key_block_len = 0;
+	req->key_block_buf = key_block;
+	req->key_block_buf_len = key_block_buf_len;
+	req->kbpk = kbpk;
+	req->flags = flags;
+	// the engine exports from a private copy of the key block context object
+	// and does not modify it
+	req->ctx = (struct tr31_ctx_t*)ctx;
+	req->result = -1;
+	req->callback = callback;
+	req->user_data = user_data;
+
+	return tr31_engine_submit(engine, req);
+}
+
+size_t tr31_engine_poll(
+	struct tr31_engine_t* engine,
+	struct tr31_engine_req_t** reqs,
+	size_t reqs_count
+)
+{
+	size_t count = 0;
+
+	if (!engine || !reqs) {
+		return 0;
+	}
+
+	// reset notification before draining the completion queue such that
+	// later completions notify again
+	tr31_engine_notify_reset(engine);
+
+	while (count < reqs_count) {
+		struct tr31_engine_req_t* req;
+
+		req = tr31_engine_queue_pop(&engine->completion_queue);
+		if (!req) {
+			break;
+		}
+		reqs[count++] = req;
+		atomic_fetch_sub_explicit(&engine->in_flight, 1, memory_order_release);
+	}
+
+	if (count == reqs_count) {
+		// completion queue may not be empty yet
+		tr31_engine_notify(engine);
+	}
+
+	return count;
+}
+
+int tr31_engine_get_fd(const struct tr31_engine_t* engine)
+{
+	if (!engine) {
+		return -1;
+	}
+
+	return engine->notify_rfd;
+}
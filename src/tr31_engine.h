@@ -0,0 +1,201 @@
+/**
+ * @file tr31_engine.h
+ * @brief Asynchronous TR-31 key block processing engine
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTR31_ENGINE_H
+#define LIBTR31_ENGINE_H
+
+#include "tr31.h"
+
+#include <sys/cdefs.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_DECLS
+
+/// Opaque asynchronous key block processing engine
+struct tr31_engine_t;
+
+/// Asynchronous key block operations
+enum tr31_engine_op_t {
+	TR31_ENGINE_OP_IMPORT, ///< Key block import using @ref tr31_import()
+	TR31_ENGINE_OP_EXPORT, ///< Key block export using @ref tr31_export()
+};
+
+/// Engine submission result when the engine is at capacity
+#define TR31_ENGINE_BUSY (-2)
+
+struct tr31_engine_req_t;
+
+/**
+ * Asynchronous request completion callback. Called by an engine worker
+ * thread once the request has been processed.
+ * @param req Completed request
+ */
+typedef void (*tr31_engine_callback_t)(struct tr31_engine_req_t* req);
+
+/**
+ * Asynchronous key block request. The request object is owned by the caller
+ * and, together with all buffers and objects that it references, must remain
+ * valid until the request completes.
+ */
+struct tr31_engine_req_t {
+	enum tr31_engine_op_t op; ///< Key block operation
+
+	const char* key_block; ///< Key block input. Only for @ref TR31_ENGINE_OP_IMPORT.
+	size_t key_block_len; ///< Length of key block input. Only for @ref TR31_ENGINE_OP_IMPORT.
+	char* key_block_buf; ///< Key block output. Only for @ref TR31_ENGINE_OP_EXPORT.
+	size_t key_block_buf_len; ///< Key block output buffer length. Only for @ref TR31_ENGINE_OP_EXPORT.
+	const struct tr31_key_t* kbpk; ///< Key block protection key
+	uint32_t flags; ///< Key block import or export flags
+	struct tr31_ctx_t* ctx; ///< Key block context object output for import, or input for export
+
+	int result; ///< Result of key block operation. See @ref tr31_error_t
+	tr31_engine_callback_t callback; ///< Completion callback. NULL to use the completion queue.
+	void* user_data; ///< Caller data. Not used by the engine.
+};
+
+/**
+ * Create asynchronous key block processing engine. Requests are submitted to
+ * a lock-free queue and processed by a pool of worker threads.
+ *
+ * @note The crypto implementation used by this library must be thread safe
+ *       when @p thread_count is greater than one.
+ * @note If this library was built without thread support, requests are
+ *       processed during submission and @p thread_count is ignored.
+ *
+ * @param thread_count Number of worker threads. Zero for one worker thread.
+ * @param queue_size Maximum number of requests in flight. Rounded up to a power of two. Zero for default.
+ * @return Engine object. NULL for error.
+ */
+struct tr31_engine_t* tr31_engine_create(unsigned int thread_count, size_t queue_size);
+
+/**
+ * Destroy asynchronous key block processing engine. Requests that were
+ * already submitted are processed before the worker threads exit, but
+ * completions that were not yet retrieved using @ref tr31_engine_poll() are
+ * discarded.
+ * @param engine Engine object
+ */
+void tr31_engine_destroy(struct tr31_engine_t* engine);
+
+/**
+ * Submit asynchronous key block request. The request must be populated by
+ * the caller. See @ref tr31_import_async() and @ref tr31_export_async() for
+ * convenience functions.
+ *
+ * If @ref tr31_engine_req_t.callback is NULL, the completed request is
+ * added to the completion queue and can be retrieved using
+ * @ref tr31_engine_poll().
+ *
+ * @param engine Engine object
+ * @param req Key block request
+ * @return Zero for success. Less than zero for internal error.
+ *         @ref TR31_ENGINE_BUSY if the engine is at capacity and the request
+ *         should be submitted again after other requests have completed.
+ */
+int tr31_engine_submit(struct tr31_engine_t* engine, struct tr31_engine_req_t* req);
+
+/**
+ * Submit asynchronous key block import request. See @ref tr31_import().
+ *
+ * @param engine Engine object
+ * @param key_block Key block. Must contain printable ASCII characters. Null-termination not required.
+ * @param key_block_len Length of key block in bytes, excluding null-termination.
+ * @param kbpk Key block protection key. NULL if not available or decryption is not required.
+ * @param flags Key block import flags. See @ref import-flags "import flags".
+ * @param ctx Key block context object output. Use @ref tr31_release() after completion.
+ * @param callback Completion callback. NULL to use the completion queue.
+ * @param user_data Caller data stored in @ref tr31_engine_req_t.user_data
+ * @param req Key block request object to populate and submit
+ * @return See @ref tr31_engine_submit()
+ */
+int tr31_import_async(
+	struct tr31_engine_t* engine,
+	const char* key_block,
+	size_t key_block_len,
+	const struct tr31_key_t* kbpk,
+	uint32_t flags,
+	struct tr31_ctx_t* ctx,
+	tr31_engine_callback_t callback,
+	void* user_data,
+	struct tr31_engine_req_t* req
+);
+
+/**
+ * Submit asynchronous key block export request. See @ref tr31_export().
+ *
+ * @note The request is exported from a private copy of @p ctx and empty
+ *       KC/KP optional blocks in @p ctx are not finalised. Concurrent
+ *       requests may therefore share @p ctx as long as it is not modified.
+ *
+ * @param engine Engine object
+ * @param ctx Key block context object input
+ * @param kbpk Key block protection key.
+ * @param flags Key block export flags. See @ref export-flags "export flags".
+ * @param key_block Key block output. Will contain printable ASCII characters and will be null-terminated.
+ * @param key_block_buf_len Key block output buffer length.
+ * @param callback Completion callback. NULL to use the completion queue.
+ * @param user_data Caller data stored in @ref tr31_engine_req_t.user_data
+ * @param req Key block request object to populate and submit
+ * @return See @ref tr31_engine_submit()
+ */
+int tr31_export_async(
+	struct tr31_engine_t* engine,
+	const struct tr31_ctx_t* ctx,
+	const struct tr31_key_t* kbpk,
+	uint32_t flags,
+	char* key_block,
+	size_t key_block_buf_len,
+	tr31_engine_callback_t callback,
+	void* user_data,
+	struct tr31_engine_req_t* req
+);
+
+/**
+ * Retrieve completed requests from the completion queue. This function does
+ * not block and should be called by a single thread, typically an event loop
+ * when the file descriptor provided by @ref tr31_engine_get_fd() is readable.
+ *
+ * @param engine Engine object
+ * @param reqs Completed requests output
+ * @param reqs_count Maximum number of completed requests to retrieve
+ * @return Number of completed requests retrieved
+ */
+size_t tr31_engine_poll(
+	struct tr31_engine_t* engine,
+	struct tr31_engine_req_t** reqs,
+	size_t reqs_count
+);
+
+/**
+ * Retrieve file descriptor that becomes readable when the completion queue
+ * is not empty. The file descriptor is reset by @ref tr31_engine_poll() and
+ * must not be read or closed by the caller. On Linux this is an eventfd and
+ * on other POSIX platforms it is the read end of a pipe.
+ *
+ * @param engine Engine object
+ * @return File descriptor. Less than zero if not available on this platform.
+ */
+int tr31_engine_get_fd(const struct tr31_engine_t* engine);
+
+__END_DECLS
+
+#endif
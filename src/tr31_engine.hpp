@@ -0,0 +1,191 @@
+/**
+ * @file tr31_engine.hpp
+ * @brief C++20 coroutine interface for asynchronous TR-31 key block processing
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTR31_ENGINE_HPP
+#define LIBTR31_ENGINE_HPP
+
+#include "tr31_engine.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace tr31 {
+
+/**
+ * Awaitable key block request. Awaiting submits the request to the engine
+ * and the awaiting coroutine is resumed by @ref engine::dispatch() once the
+ * request has completed. The result of awaiting is the result of the key
+ * block operation. See @ref tr31_error_t
+ */
+class request {
+public:
+	explicit request(struct tr31_engine_t* engine, const struct tr31_engine_req_t& req) noexcept
+	: m_engine(engine), m_req(req)
+	{
+	}
+
+	request(const request&) = delete;
+	request& operator=(const request&) = delete;
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<> handle) noexcept
+	{
+		// completions are retrieved using the completion queue such that
+		// the coroutine is resumed by the thread that calls engine::dispatch()
+		m_req.callback = nullptr;
+		m_req.user_data = handle.address();
+		m_submit_result = tr31_engine_submit(m_engine, &m_req);
+
+		// resume immediately if submission failed
+		return m_submit_result == 0;
+	}
+
+	int await_resume() const noexcept
+	{
+		if (m_submit_result) {
+			return m_submit_result;
+		}
+		return m_req.result;
+	}
+
+private:
+	struct tr31_engine_t* m_engine;
+	struct tr31_engine_req_t m_req;
+	int m_submit_result = 0;
+};
+
+/**
+ * Asynchronous key block processing engine for use with C++20 coroutines.
+ *
+ * The event loop should call @ref dispatch() whenever the file descriptor
+ * provided by @ref fd() is readable. Awaiting coroutines are resumed by
+ * @ref dispatch() and therefore on the event loop thread.
+ */
+class engine {
+public:
+	/**
+	 * Create engine. See @ref tr31_engine_create()
+	 * @throw std::bad_alloc if engine creation failed
+	 */
+	explicit engine(unsigned int thread_count = 0, std::size_t queue_size = 0)
+	: m_engine(tr31_engine_create(thread_count, queue_size))
+	{
+		if (!m_engine) {
+			throw std::bad_alloc();
+		}
+	}
+
+	~engine()
+	{
+		tr31_engine_destroy(m_engine);
+	}
+
+	engine(const engine&) = delete;
+	engine& operator=(const engine&) = delete;
+
+	/// Completion queue file descriptor. See @ref tr31_engine_get_fd()
+	int fd() const noexcept
+	{
+		return tr31_engine_get_fd(m_engine);
+	}
+
+	/**
+	 * Resume coroutines of all completed requests
+	 * @return Number of coroutines resumed
+	 */
+	std::size_t dispatch()
+	{
+		struct tr31_engine_req_t* reqs[64];
+		std::size_t total = 0;
+		std::size_t count;
+
+		do {
+			count = tr31_engine_poll(m_engine, reqs, sizeof(reqs) / sizeof(reqs[0]));
+			for (std::size_t i = 0; i < count; ++i) {
+				std::coroutine_handle<>::from_address(reqs[i]->user_data).resume();
+			}
+			total += count;
+		} while (count == sizeof(reqs) / sizeof(reqs[0]));
+
+		return total;
+	}
+
+	/**
+	 * Awaitable key block import. See @ref tr31_import()
+	 * @note All parameters must remain valid until the request has completed.
+	 */
+	request import(
+		const char* key_block,
+		std::size_t key_block_len,
+		const struct tr31_key_t* kbpk,
+		std::uint32_t flags,
+		struct tr31_ctx_t* ctx
+	) noexcept
+	{
+		struct tr31_engine_req_t req{};
+		req.op = TR31_ENGINE_OP_IMPORT;
+		req.key_block = key_block;
+		req.key_block_len = key_block_len;
+		req.kbpk = kbpk;
+		req.flags = flags;
+		req.ctx = ctx;
+		req.result = -1;
+		return request(m_engine, req);
+	}
+
+	/**
+	 * Awaitable key block export. See @ref tr31_export()
+	 * @note All parameters must remain valid until the request has completed.
+	 */
+	request export_(
+		const struct tr31_ctx_t* ctx,
+		const struct tr31_key_t* kbpk,
+		std::uint32_t flags,
+		char* key_block,
+		std::size_t key_block_buf_len
+	) noexcept
+	{
+		struct tr31_engine_req_t req{};
+		req.op = TR31_ENGINE_OP_EXPORT;
+		req.key_block_buf = key_block;
+		req.key_block_buf_len = key_block_buf_len;
+		req.kbpk = kbpk;
+		req.flags = flags;
+		// the engine exports from a private copy of the key block context
+		// object and does not modify it
+		req.ctx = const_cast<struct tr31_ctx_t*>(ctx);
+		req.result = -1;
+		return request(m_engine, req);
+	}
+
+private:
+	struct tr31_engine_t* m_engine;
+};
+
+} // namespace tr31
+
+#endif
@@ -0,0 +1,653 @@
+/**
+ * @file tr31_serialize.c
+ * @brief TR-31 key block context serialization
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31_serialize.h"
+#include "tr31.h"
+#include "tr31_strings.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// maximum nesting depth of serialized output
+#define TR31_WRITER_MAX_DEPTH (8)
+
+// CBOR major types (RFC 8949, 3.1)
+#define CBOR_MAJOR_UINT (0)
+#define CBOR_MAJOR_NINT (1)
+#define CBOR_MAJOR_BSTR (2)
+#define CBOR_MAJOR_TSTR (3)
+#define CBOR_MAJOR_ARRAY (4)
+#define CBOR_MAJOR_MAP (5)
+#define CBOR_NULL (0xF6)
+
+// serialization output state
+struct tr31_writer_t {
+	bool cbor; // CBOR output instead of JSON output
+	uint8_t* buf; // output buffer; NULL for length query
+	size_t buf_len; // output buffer length
+	size_t len; // output length; continues counting beyond the buffer length
+
+	// JSON separator state
+	unsigned int depth; // current object/array nesting depth
+	bool first[TR31_WRITER_MAX_DEPTH]; // whether the next member/element is the first at each depth
+	bool member; // whether a member name was written and its value is pending
+};
+
+// decoded optional block data
+union tr31_serialize_decoded_t {
+	struct tr31_opt_blk_akl_data_t akl;
+	struct tr31_opt_blk_bdkid_data_t bdkid;
+	uint8_t hash_algorithm;
+	uint8_t ikid[8];
+	uint8_t iksn[10];
+	struct tr31_opt_blk_kcv_data_t kcv;
+	struct tr31_opt_blk_time_data_t time;
+	struct tr31_opt_blk_wp_data_t wp;
+	unsigned int ct_format;
+};
+
+// helper functions
+static void tr31_writer_append(struct tr31_writer_t* w, const void* data, size_t len);
+static void tr31_writer_cbor_head(struct tr31_writer_t* w, uint8_t major, uint64_t value);
+static void tr31_writer_json_sep(struct tr31_writer_t* w);
+static void tr31_writer_json_uint(struct tr31_writer_t* w, uint64_t value);
+static void tr31_writer_begin(struct tr31_writer_t* w, uint8_t major, size_t count);
+static void tr31_writer_end(struct tr31_writer_t* w, uint8_t major);
+static void tr31_writer_member(struct tr31_writer_t* w, const char* name);
+static void tr31_writer_str(struct tr31_writer_t* w, const void* str, size_t str_len);
+static void tr31_writer_char(struct tr31_writer_t* w, unsigned int c);
+static void tr31_writer_bin(struct tr31_writer_t* w, const void* bin, size_t bin_len);
+static void tr31_writer_uint(struct tr31_writer_t* w, uint64_t value);
+static void tr31_writer_int(struct tr31_writer_t* w, int64_t value);
+static void tr31_writer_null(struct tr31_writer_t* w);
+static int tr31_serialize_opt_block_decode(const struct tr31_opt_ctx_t* opt_ctx, union tr31_serialize_decoded_t* decoded);
+static void tr31_serialize_opt_block(struct tr31_writer_t* w, const struct tr31_opt_ctx_t* opt_ctx);
+static int tr31_serialize_ctx(struct tr31_writer_t* w, const struct tr31_ctx_t* ctx, uint32_t flags);
+
+static void tr31_writer_append(struct tr31_writer_t* w, const void* data, size_t len)
+{
+	// once the output no longer fits, subsequent output will also not fit
+	// and therefore the output buffer never contains gaps
+	if (w->buf && len <= w->buf_len && w->len <= w->buf_len - len) {
+		memcpy(w->buf + w->len, data, len);
+	}
+	w->len += len;
+}
+
+static void tr31_writer_cbor_head(struct tr31_writer_t* w, uint8_t major, uint64_t value)
+{
+	uint8_t head[9];
+	size_t head_len;
+
+	// RFC 8949, 3: use the shortest argument encoding
+	major <<= 5;
+	if (value < 24) {
+		head[0] = major | value;
+		head_len = 1;
+	} else if (value <= 0xFF) {
+		head[0] = major | 24;
+		head_len = 2;
+	} else if (value <= 0xFFFF) {
+		head[0] = major | 25;
+		head_len = 3;
+	} else if (value <= 0xFFFFFFFF) {
+		head[0] = major | 26;
+		head_len = 5;
+	} else {
+		head[0] = major | 27;
+		head_len = 9;
+	}
+	for (size_t i = head_len - 1; i > 0; --i) {
+		head[i] = value & 0xFF;
+		value >>= 8;
+	}
+
+	tr31_writer_append(w, head, head_len);
+}
+
+static void tr31_writer_json_sep(struct tr31_writer_t* w)
+{
+	if (w->member) {
+		// value of member; separator already written
+		w->member = false;
+		return;
+	}
+	if (!w->depth) {
+		return;
+	}
+	if (!w->first[w->depth - 1]) {
+		tr31_writer_append(w, ",", 1);
+	}
+	w->first[w->depth - 1] = false;
+}
+
+static void tr31_writer_json_uint(struct tr31_writer_t* w, uint64_t value)
+{
+	char str[20];
+	size_t i = sizeof(str);
+
+	do {
+		str[--i] = '0' + (value % 10);
+		value /= 10;
+	} while (value);
+
+	tr31_writer_append(w, str + i, sizeof(str) - i);
+}
+
+static void tr31_writer_begin(struct tr31_writer_t* w, uint8_t major, size_t count)
+{
+	if (w->cbor) {
+		tr31_writer_cbor_head(w, major, count);
+	} else {
+		tr31_writer_json_sep(w);
+		tr31_writer_append(w, major == CBOR_MAJOR_MAP ? "{" : "[", 1);
+	}
+
+	w->first[w->depth++] = true;
+}
+
+static void tr31_writer_end(struct tr31_writer_t* w, uint8_t major)
+{
+	--w->depth;
+	if (!w->cbor) {
+		tr31_writer_append(w, major == CBOR_MAJOR_MAP ? "}" : "]", 1);
+	}
+}
+
+static void tr31_writer_member(struct tr31_writer_t* w, const char* name)
+{
+	size_t name_len = strlen(name);
+
+	if (w->cbor) {
+		tr31_writer_cbor_head(w, CBOR_MAJOR_TSTR, name_len);
+		tr31_writer_append(w, name, name_len);
+		return;
+	}
+
+	// member names never require escaping
+	tr31_writer_json_sep(w);
+	tr31_writer_append(w, "\"", 1);
+	tr31_writer_append(w, name, name_len);
+	tr31_writer_append(w, "\":", 2);
+	w->member = true;
+}
+
+static void tr31_writer_str(struct tr31_writer_t* w, const void* str, size_t str_len)
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+	const uint8_t* ptr = str;
+	size_t start = 0;
+
+	if (w->cbor) {
+		tr31_writer_cbor_head(w, CBOR_MAJOR_TSTR, str_len);
+		tr31_writer_append(w, str, str_len);
+		return;
+	}
+
+	tr31_writer_json_sep(w);
+	tr31_writer_append(w, "\"", 1);
+	for (size_t i = 0; i < str_len; ++i) {
+		char esc[6];
+
+		if (ptr[i] >= 0x20 && ptr[i] <= 0x7E && ptr[i] != '"' && ptr[i] != '\\') {
+			continue;
+		}
+
+		// output unescaped characters up to this point
+		tr31_writer_append(w, ptr + start, i - start);
+		start = i + 1;
+
+		if (ptr[i] == '"' || ptr[i] == '\\') {
+			esc[0] = '\\';
+			esc[1] = ptr[i];
+			tr31_writer_append(w, esc, 2);
+		} else {
+			esc[0] = '\\';
+			esc[1] = 'u';
+			esc[2] = '0';
+			esc[3] = '0';
+			esc[4] = hex_digits[ptr[i] >> 4];
+			esc[5] = hex_digits[ptr[i] & 0xF];
+			tr31_writer_append(w, esc, sizeof(esc));
+		}
+	}
+	tr31_writer_append(w, ptr + start, str_len - start);
+	tr31_writer_append(w, "\"", 1);
+}
+
+static void tr31_writer_char(struct tr31_writer_t* w, unsigned int c)
+{
+	// header fields are ASCII characters
+	char str = c;
+	tr31_writer_str(w, &str, 1);
+}
+
+static void tr31_writer_bin(struct tr31_writer_t* w, const void* bin, size_t bin_len)
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+	const uint8_t* ptr = bin;
+
+	if (w->cbor) {
+		tr31_writer_cbor_head(w, CBOR_MAJOR_BSTR, bin_len);
+		tr31_writer_append(w, bin, bin_len);
+		return;
+	}
+
+	// JSON has no binary type; use hex string
+	tr31_writer_json_sep(w);
+	tr31_writer_append(w, "\"", 1);
+	for (size_t i = 0; i < bin_len; ++i) {
+		char hex[2];
+		hex[0] = hex_digits[ptr[i] >> 4];
+		hex[1] = hex_digits[ptr[i] & 0xF];
+		tr31_writer_append(w, hex, sizeof(hex));
+	}
+	tr31_writer_append(w, "\"", 1);
+}
+
+static void tr31_writer_uint(struct tr31_writer_t* w, uint64_t value)
+{
+	if (w->cbor) {
+		tr31_writer_cbor_head(w, CBOR_MAJOR_UINT, value);
+		return;
+	}
+
+	tr31_writer_json_sep(w);
+	tr31_writer_json_uint(w, value);
+}
+
+static void tr31_writer_int(struct tr31_writer_t* w, int64_t value)
+{
+	if (value >= 0) {
+		tr31_writer_uint(w, value);
+		return;
+	}
+
+	// RFC 8949, 3.1: major type 1 encodes -1 minus the argument
+	if (w->cbor) {
+		tr31_writer_cbor_head(w, CBOR_MAJOR_NINT, -(value + 1));
+		return;
+	}
+
+	tr31_writer_json_sep(w);
+	tr31_writer_append(w, "-", 1);
+	tr31_writer_json_uint(w, (uint64_t)(-(value + 1)) + 1);
+}
+
+static void tr31_writer_null(struct tr31_writer_t* w)
+{
+	if (w->cbor) {
+		uint8_t null = CBOR_NULL;
+		tr31_writer_append(w, &null, 1);
+		return;
+	}
+
+	tr31_writer_json_sep(w);
+	tr31_writer_append(w, "null", 4);
+}
+
+static int tr31_serialize_opt_block_decode(const struct tr31_opt_ctx_t* opt_ctx, union tr31_serialize_decoded_t* decoded)
+{
+	const char* data = opt_ctx->data;
+
+	switch (opt_ctx->id) {
+		case TR31_OPT_BLOCK_AL:
+			return tr31_opt_block_decode_AL(opt_ctx, &decoded->akl);
+
+		case TR31_OPT_BLOCK_BI:
+			return tr31_opt_block_decode_BI(opt_ctx, &decoded->bdkid);
+
+		case TR31_OPT_BLOCK_CT:
+			// only the certificate format of the first (or only) certificate
+			// is decoded; see ANSI X9.143:2021, 6.3.6.3, table 10
+			if (opt_ctx->data_length < 2 ||
+				data[0] != '0' ||
+				data[1] < '0' || data[1] > '2'
+			) {
+				return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+			}
+			decoded->ct_format = data[1] - '0';
+			return 0;
+
+		case TR31_OPT_BLOCK_DA:
+			// validate the structure without decoding the attributes; the
+			// attributes are serialized directly from the optional block
+			// data and therefore do not require an output buffer
+			// see ANSI X9.143:2021, 6.3.6.4, table 11
+			if (opt_ctx->data_length < 7 ||
+				(opt_ctx->data_length - 2) % 5 != 0 ||
+				data[0] != '0' || data[1] != '1'
+			) {
+				return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+			}
+			return 0;
+
+		case TR31_OPT_BLOCK_HM:
+			return tr31_opt_block_decode_HM(opt_ctx, &decoded->hash_algorithm);
+
+		case TR31_OPT_BLOCK_IK:
+			return tr31_opt_block_decode_IK(opt_ctx, decoded->ikid, sizeof(decoded->ikid));
+
+		case TR31_OPT_BLOCK_KC:
+			return tr31_opt_block_decode_KC(opt_ctx, &decoded->kcv);
+
+		case TR31_OPT_BLOCK_KP:
+			return tr31_opt_block_decode_KP(opt_ctx, &decoded->kcv);
+
+		case TR31_OPT_BLOCK_KS:
+			return tr31_opt_block_decode_KS(opt_ctx, decoded->iksn, sizeof(decoded->iksn));
+
+		case TR31_OPT_BLOCK_PK:
+			return tr31_opt_block_decode_PK(opt_ctx, &decoded->kcv);
+
+		case TR31_OPT_BLOCK_TC:
+			return tr31_opt_block_decode_TC(opt_ctx, &decoded->time);
+
+		case TR31_OPT_BLOCK_TS:
+			return tr31_opt_block_decode_TS(opt_ctx, &decoded->time);
+
+		case TR31_OPT_BLOCK_WP:
+			return tr31_opt_block_decode_WP(opt_ctx, &decoded->wp);
+
+		default:
+			// no decoder available
+			return 1;
+	}
+}
+
+static void tr31_serialize_opt_block(struct tr31_writer_t* w, const struct tr31_opt_ctx_t* opt_ctx)
+{
+	int r;
+	union tr31_serialize_decoded_t decoded;
+	char ascii_buf[3];
+	const char* data = opt_ctx->data;
+
+	// decode first such that the number of map entries is known
+	r = tr31_serialize_opt_block_decode(opt_ctx, &decoded);
+
+	tr31_writer_begin(w, CBOR_MAJOR_MAP, r ? 2 : 3);
+	tr31_opt_block_id_get_ascii(opt_ctx->id, ascii_buf, sizeof(ascii_buf));
+	tr31_writer_member(w, "id");
+	tr31_writer_str(w, ascii_buf, strlen(ascii_buf));
+	tr31_writer_member(w, "data");
+	tr31_writer_str(w, opt_ctx->data, opt_ctx->data_length);
+	if (r) {
+		// optional block data could not be decoded
+		tr31_writer_end(w, CBOR_MAJOR_MAP);
+		return;
+	}
+
+	tr31_writer_member(w, "decoded");
+	switch (opt_ctx->id) {
+		case TR31_OPT_BLOCK_AL:
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 2);
+			tr31_writer_member(w, "version");
+			tr31_writer_uint(w, decoded.akl.version);
+			tr31_writer_member(w, "akl");
+			tr31_writer_uint(w, decoded.akl.v1.akl);
+			break;
+
+		case TR31_OPT_BLOCK_BI:
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 2);
+			tr31_writer_member(w, "key_type");
+			tr31_writer_uint(w, decoded.bdkid.key_type);
+			tr31_writer_member(w, "bdkid");
+			tr31_writer_bin(w, decoded.bdkid.bdkid, decoded.bdkid.bdkid_len);
+			break;
+
+		case TR31_OPT_BLOCK_CT:
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 1);
+			tr31_writer_member(w, "certificate_format");
+			tr31_writer_uint(w, decoded.ct_format);
+			break;
+
+		case TR31_OPT_BLOCK_DA: {
+			size_t count = (opt_ctx->data_length - 2) / 5;
+
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 2);
+			tr31_writer_member(w, "version");
+			tr31_writer_uint(w, 1);
+			tr31_writer_member(w, "attributes");
+			tr31_writer_begin(w, CBOR_MAJOR_ARRAY, count);
+			for (size_t i = 0; i < count; ++i) {
+				const char* attr = data + 2 + (i * 5);
+
+				tr31_writer_begin(w, CBOR_MAJOR_MAP, 4);
+				tr31_writer_member(w, "key_usage");
+				tr31_writer_str(w, attr, 2);
+				tr31_writer_member(w, "algorithm");
+				tr31_writer_str(w, attr + 2, 1);
+				tr31_writer_member(w, "mode_of_use");
+				tr31_writer_str(w, attr + 3, 1);
+				tr31_writer_member(w, "exportability");
+				tr31_writer_str(w, attr + 4, 1);
+				tr31_writer_end(w, CBOR_MAJOR_MAP);
+			}
+			tr31_writer_end(w, CBOR_MAJOR_ARRAY);
+			break;
+		}
+
+		case TR31_OPT_BLOCK_HM:
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 1);
+			tr31_writer_member(w, "hash_algorithm");
+			tr31_writer_uint(w, decoded.hash_algorithm);
+			break;
+
+		case TR31_OPT_BLOCK_IK:
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 1);
+			tr31_writer_member(w, "ikid");
+			tr31_writer_bin(w, decoded.ikid, sizeof(decoded.ikid));
+			break;
+
+		case TR31_OPT_BLOCK_KC:
+		case TR31_OPT_BLOCK_KP:
+		case TR31_OPT_BLOCK_PK:
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 2);
+			tr31_writer_member(w, "kcv_algorithm");
+			tr31_writer_uint(w, decoded.kcv.kcv_algorithm);
+			tr31_writer_member(w, "kcv");
+			tr31_writer_bin(w, decoded.kcv.kcv, decoded.kcv.kcv_len);
+			break;
+
+		case TR31_OPT_BLOCK_KS:
+			// legacy KSN optional blocks only contain 8 bytes
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 1);
+			tr31_writer_member(w, "iksn");
+			tr31_writer_bin(w, decoded.iksn, opt_ctx->data_length / 2);
+			break;
+
+		case TR31_OPT_BLOCK_TC:
+		case TR31_OPT_BLOCK_TS:
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 2);
+			tr31_writer_member(w, "seconds");
+			tr31_writer_int(w, decoded.time.seconds);
+			tr31_writer_member(w, "centiseconds");
+			tr31_writer_uint(w, decoded.time.centiseconds);
+			break;
+
+		case TR31_OPT_BLOCK_WP:
+			tr31_writer_begin(w, CBOR_MAJOR_MAP, 2);
+			tr31_writer_member(w, "version");
+			tr31_writer_uint(w, decoded.wp.version);
+			tr31_writer_member(w, "wrapping_pedigree");
+			tr31_writer_uint(w, decoded.wp.v0.wrapping_pedigree);
+			break;
+	}
+	tr31_writer_end(w, CBOR_MAJOR_MAP);
+
+	tr31_writer_end(w, CBOR_MAJOR_MAP);
+}
+
+static int tr31_serialize_ctx(struct tr31_writer_t* w, const struct tr31_ctx_t* ctx, uint32_t flags)
+{
+	char ascii_buf[3];
+	size_t count;
+	size_t opt_blocks_count;
+	bool key_available;
+
+	if (!ctx->version) {
+		// key block header fields are not available
+		return -1;
+	}
+
+	// opt_blocks might be NULL when tr31_import() fails
+	opt_blocks_count = ctx->opt_blocks ? ctx->opt_blocks_count : 0;
+	key_available = ctx->key.length && ctx->key.data;
+
+	// determine number of top level members for CBOR map
+	count = 9; // header fields and optional blocks
+	if (key_available) {
+		++count; // key_length
+		if (flags & TR31_SERIALIZE_FLAG_INCLUDE_KEY) {
+			++count; // key
+		}
+		if (ctx->key.kcv_len) {
+			++count; // kcv
+		}
+	}
+
+	tr31_writer_begin(w, CBOR_MAJOR_MAP, count);
+	tr31_writer_member(w, "version");
+	tr31_writer_char(w, ctx->version);
+	tr31_writer_member(w, "length");
+	tr31_writer_uint(w, ctx->length);
+	tr31_writer_member(w, "key_usage");
+	tr31_key_usage_get_ascii(ctx->key.usage, ascii_buf, sizeof(ascii_buf));
+	tr31_writer_str(w, ascii_buf, strlen(ascii_buf));
+	tr31_writer_member(w, "algorithm");
+	tr31_writer_char(w, ctx->key.algorithm);
+	tr31_writer_member(w, "mode_of_use");
+	tr31_writer_char(w, ctx->key.mode_of_use);
+	tr31_writer_member(w, "key_version");
+	if (ctx->key.key_version == TR31_KEY_VERSION_IS_UNUSED) {
+		tr31_writer_null(w);
+	} else {
+		tr31_writer_str(w, ctx->key.key_version_str, strlen(ctx->key.key_version_str));
+	}
+	tr31_writer_member(w, "exportability");
+	tr31_writer_char(w, ctx->key.exportability);
+	tr31_writer_member(w, "key_context");
+	tr31_writer_char(w, ctx->key.key_context);
+
+	tr31_writer_member(w, "opt_blocks");
+	tr31_writer_begin(w, CBOR_MAJOR_ARRAY, opt_blocks_count);
+	for (size_t i = 0; i < opt_blocks_count; ++i) {
+		tr31_serialize_opt_block(w, &ctx->opt_blocks[i]);
+	}
+	tr31_writer_end(w, CBOR_MAJOR_ARRAY);
+
+	// if available, output decrypted key information
+	if (key_available) {
+		tr31_writer_member(w, "key_length");
+		tr31_writer_uint(w, ctx->key.length);
+		if (flags & TR31_SERIALIZE_FLAG_INCLUDE_KEY) {
+			tr31_writer_member(w, "key");
+			tr31_writer_bin(w, ctx->key.data, ctx->key.length);
+		}
+		if (ctx->key.kcv_len) {
+			tr31_writer_member(w, "kcv");
+			tr31_writer_bin(w, ctx->key.kcv, ctx->key.kcv_len);
+		}
+	}
+	tr31_writer_end(w, CBOR_MAJOR_MAP);
+
+	return 0;
+}
+
+int tr31_ctx_to_json(
+	const struct tr31_ctx_t* ctx,
+	uint32_t flags,
+	char* buf,
+	size_t buf_len,
+	size_t* out_len
+)
+{
+	int r;
+	struct tr31_writer_t w;
+
+	if (!ctx || !out_len) {
+		return -1;
+	}
+	if (buf && !buf_len) {
+		return -1;
+	}
+
+	memset(&w, 0, sizeof(w));
+	w.cbor = false;
+	w.buf = (uint8_t*)buf;
+	// reserve space for NULL terminator
+	w.buf_len = buf ? buf_len - 1 : 0;
+
+	r = tr31_serialize_ctx(&w, ctx, flags);
+	if (r) {
+		return r;
+	}
+	*out_len = w.len;
+
+	if (!buf) {
+		// length query
+		return 0;
+	}
+	if (w.len > w.buf_len) {
+		// output buffer too small; do not provide partial output
+		buf[0] = 0;
+		return 1;
+	}
+	buf[w.len] = 0;
+
+	return 0;
+}
+
+int tr31_ctx_to_cbor(
+	const struct tr31_ctx_t* ctx,
+	uint32_t flags,
+	void* buf,
+	size_t buf_len,
+	size_t* out_len
+)
+{
+	int r;
+	struct tr31_writer_t w;
+
+	if (!ctx || !out_len) {
+		return -1;
+	}
+
+	memset(&w, 0, sizeof(w));
+	w.cbor = true;
+	w.buf = buf;
+	w.buf_len = buf ? buf_len : 0;
+
+	r = tr31_serialize_ctx(&w, ctx, flags);
+	if (r) {
+		return r;
+	}
+	*out_len = w.len;
+
+	if (buf && w.len > w.buf_len) {
+		// output buffer too small
+		return 1;
+	}
+
+	return 0;
+}
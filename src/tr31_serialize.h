@@ -0,0 +1,98 @@
+/**
+ * @file tr31_serialize.h
+ * @brief TR-31 key block context serialization
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TR31_SERIALIZE_H
+#define TR31_SERIALIZE_H
+
+#include <sys/cdefs.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_DECLS
+
+// Forward declarations
+struct tr31_ctx_t;
+
+/**
+ * @name TR-31 serialization flags
+ * @anchor serialize-flags
+ */
+/// @{
+#define TR31_SERIALIZE_FLAG_INCLUDE_KEY (0x01) ///< Include decrypted key data, if available. Only use this flag if the output is protected accordingly.
+/// @}
+
+/**
+ * Serialize key block context object as a single JSON object. The output
+ * contains the key block header fields, the optional blocks (including the
+ * decoded optional block data for optional blocks that can be decoded) and,
+ * if available, the key length and Key Check Value (KCV). The KCV is only
+ * available if it was computed by @ref tr31_key_get_kcv() or during import
+ * using @ref TR31_IMPORT_COMPUTE_KCV.
+ *
+ * The output is written in a single pass without any heap allocation. If
+ * @p buf is NULL, no output is written and only the required length is
+ * provided in @p out_len. The output is NULL terminated and the terminator is
+ * not included in @p out_len. Therefore @p buf_len must be at least one more
+ * than the length provided in @p out_len.
+ *
+ * @param ctx Key block context object
+ * @param flags Serialization flags. See @ref serialize-flags "serialization flags".
+ * @param buf JSON output buffer. NULL for length query.
+ * @param buf_len Length of JSON output buffer in bytes
+ * @param out_len Length of JSON output in bytes, excluding the NULL terminator. Populated even if @p buf is NULL or too small.
+ * @return Zero for success. Less than zero for internal error. Greater than zero if output buffer is too small.
+ */
+int tr31_ctx_to_json(
+	const struct tr31_ctx_t* ctx,
+	uint32_t flags,
+	char* buf,
+	size_t buf_len,
+	size_t* out_len
+);
+
+/**
+ * Serialize key block context object as a single CBOR map (RFC 8949) with the
+ * same structure and member names as @ref tr31_ctx_to_json(). Binary fields
+ * (such as KCVs, key data and decoded identifiers) are encoded as CBOR byte
+ * strings instead of hex strings and only definite length items are used.
+ *
+ * The output is written in a single pass without any heap allocation. If
+ * @p buf is NULL, no output is written and only the required length is
+ * provided in @p out_len.
+ *
+ * @param ctx Key block context object
+ * @param flags Serialization flags. See @ref serialize-flags "serialization flags".
+ * @param buf CBOR output buffer. NULL for length query.
+ * @param buf_len Length of CBOR output buffer in bytes
+ * @param out_len Length of CBOR output in bytes. Populated even if @p buf is NULL or too small.
+ * @return Zero for success. Less than zero for internal error. Greater than zero if output buffer is too small.
+ */
+int tr31_ctx_to_cbor(
+	const struct tr31_ctx_t* ctx,
+	uint32_t flags,
+	void* buf,
+	size_t buf_len,
+	size_t* out_len
+);
+
+__END_DECLS
+
+#endif
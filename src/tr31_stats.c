@@ -0,0 +1,199 @@
+/**
+ * @file tr31_stats.c
+ * @brief TR-31 library-wide operation and error counters
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31_stats.h"
+#include "tr31_config.h"
+#include "tr31.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// tr31_stats_update() relies on the byte and failure counters following the
+// per format version counters
+_Static_assert(sizeof(struct tr31_stats_t) % sizeof(uint64_t) == 0, "struct tr31_stats_t must only contain 64-bit counters");
+_Static_assert(TR31_STATS_INDEX(import_bytes) == TR31_STATS_INDEX(import_count) + TR31_STATS_VERSION_COUNT, "unexpected import counter layout");
+_Static_assert(TR31_STATS_INDEX(import_failed_count) == TR31_STATS_INDEX(import_bytes) + 1, "unexpected import counter layout");
+_Static_assert(TR31_STATS_INDEX(export_bytes) == TR31_STATS_INDEX(export_count) + TR31_STATS_VERSION_COUNT, "unexpected export counter layout");
+_Static_assert(TR31_STATS_INDEX(export_failed_count) == TR31_STATS_INDEX(export_bytes) + 1, "unexpected export counter layout");
+
+#ifdef HAVE_PTHREAD
+// Per-thread counters
+// Each counter only has a single writer, the owning thread, and therefore
+// does not require atomic read-modify-write operations. Relaxed atomic loads
+// and stores are used such that tr31_stats_snapshot() can read the counters
+// of other threads without a data race.
+struct tr31_stats_thread_t {
+	atomic_uint_least64_t counters[TR31_STATS_COUNTER_COUNT];
+	bool registered;
+
+	// list of registered threads; protected by tr31_stats_mutex
+	struct tr31_stats_thread_t* next;
+	struct tr31_stats_thread_t* prev;
+};
+
+// Each thread has its own counters to avoid contention
+static _Thread_local struct tr31_stats_thread_t tr31_stats_thread;
+
+// Registered threads and the counters of threads that have exited
+static pthread_mutex_t tr31_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct tr31_stats_thread_t* tr31_stats_threads = NULL;
+static uint64_t tr31_stats_exited[TR31_STATS_COUNTER_COUNT];
+static pthread_once_t tr31_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tr31_stats_key;
+
+#else
+// Without threads, use shared atomic counters
+static atomic_uint_least64_t tr31_stats_counters[TR31_STATS_COUNTER_COUNT];
+#endif
+
+#ifdef HAVE_PTHREAD
+static void tr31_stats_atfork_prepare(void)
+{
+	pthread_mutex_lock(&tr31_stats_mutex);
+}
+
+static void tr31_stats_atfork_release(void)
+{
+	pthread_mutex_unlock(&tr31_stats_mutex);
+}
+
+static void tr31_stats_thread_exit(void* arg)
+{
+	struct tr31_stats_thread_t* thread = arg;
+
+	// retain counters of thread and remove it from the list
+	pthread_mutex_lock(&tr31_stats_mutex);
+	for (size_t i = 0; i < TR31_STATS_COUNTER_COUNT; ++i) {
+		tr31_stats_exited[i] += atomic_load_explicit(&thread->counters[i], memory_order_relaxed);
+	}
+	if (thread->prev) {
+		thread->prev->next = thread->next;
+	} else {
+		tr31_stats_threads = thread->next;
+	}
+	if (thread->next) {
+		thread->next->prev = thread->prev;
+	}
+	pthread_mutex_unlock(&tr31_stats_mutex);
+
+	memset(thread, 0, sizeof(*thread));
+}
+
+static void tr31_stats_init_once(void)
+{
+	pthread_atfork(&tr31_stats_atfork_prepare, &tr31_stats_atfork_release, &tr31_stats_atfork_release);
+	pthread_key_create(&tr31_stats_key, &tr31_stats_thread_exit);
+}
+
+static void tr31_stats_thread_register(struct tr31_stats_thread_t* thread)
+{
+	pthread_once(&tr31_stats_once, &tr31_stats_init_once);
+
+	pthread_mutex_lock(&tr31_stats_mutex);
+	thread->prev = NULL;
+	thread->next = tr31_stats_threads;
+	if (tr31_stats_threads) {
+		tr31_stats_threads->prev = thread;
+	}
+	tr31_stats_threads = thread;
+	thread->registered = true;
+	pthread_mutex_unlock(&tr31_stats_mutex);
+
+	pthread_setspecific(tr31_stats_key, thread);
+}
+#endif
+
+void tr31_stats_add(size_t index, uint64_t value)
+{
+#ifdef HAVE_PTHREAD
+	struct tr31_stats_thread_t* thread = &tr31_stats_thread;
+	atomic_uint_least64_t* counter;
+
+	if (!thread->registered) {
+		tr31_stats_thread_register(thread);
+	}
+
+	// single writer; no atomic read-modify-write required
+	counter = &thread->counters[index];
+	atomic_store_explicit(
+		counter,
+		atomic_load_explicit(counter, memory_order_relaxed) + value,
+		memory_order_relaxed
+	);
+#else
+	atomic_fetch_add_explicit(&tr31_stats_counters[index], value, memory_order_relaxed);
+#endif
+}
+
+void tr31_stats_update(size_t count_index, unsigned int version, size_t length, int result)
+{
+	if (result) {
+		// failure counter follows byte counter
+		tr31_stats_add(count_index + TR31_STATS_VERSION_COUNT + 1, 1);
+		if (result > 0 && result < TR31_STATS_ERROR_COUNT) {
+			tr31_stats_add(TR31_STATS_INDEX(error_count) + result, 1);
+		} else {
+			// internal error or unknown error
+			tr31_stats_add(TR31_STATS_INDEX(error_count), 1);
+		}
+		return;
+	}
+
+	if (version >= TR31_VERSION_A && version < TR31_VERSION_A + TR31_STATS_VERSION_COUNT) {
+		tr31_stats_add(count_index + (version - TR31_VERSION_A), 1);
+	}
+	// byte counter follows per format version counters
+	tr31_stats_add(count_index + TR31_STATS_VERSION_COUNT, length);
+}
+
+int tr31_stats_snapshot(struct tr31_stats_t* stats)
+{
+	uint64_t counters[TR31_STATS_COUNTER_COUNT];
+
+	if (!stats) {
+		return -1;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&tr31_stats_mutex);
+	memcpy(counters, tr31_stats_exited, sizeof(counters));
+	for (const struct tr31_stats_thread_t* thread = tr31_stats_threads; thread; thread = thread->next) {
+		for (size_t i = 0; i < TR31_STATS_COUNTER_COUNT; ++i) {
+			counters[i] += atomic_load_explicit(&thread->counters[i], memory_order_relaxed);
+		}
+	}
+	pthread_mutex_unlock(&tr31_stats_mutex);
+#else
+	for (size_t i = 0; i < TR31_STATS_COUNTER_COUNT; ++i) {
+		counters[i] = atomic_load_explicit(&tr31_stats_counters[i], memory_order_relaxed);
+	}
+#endif
+
+	memcpy(stats, counters, sizeof(*stats));
+	return 0;
+}
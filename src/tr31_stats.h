@@ -0,0 +1,61 @@
+/**
+ * @file tr31_stats.h
+ * @brief TR-31 library-wide operation and error counters
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTR31_STATS_H
+#define LIBTR31_STATS_H
+
+#include "tr31.h"
+
+#include <sys/cdefs.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_DECLS
+
+/// Number of 64-bit counters in @ref tr31_stats_t
+#define TR31_STATS_COUNTER_COUNT (sizeof(struct tr31_stats_t) / sizeof(uint64_t))
+
+/// Index of counter field in @ref tr31_stats_t, for use with @ref tr31_stats_add()
+#define TR31_STATS_INDEX(field) (offsetof(struct tr31_stats_t, field) / sizeof(uint64_t))
+
+/**
+ * Add value to counter of the current thread
+ *
+ * @param index Index of counter. See @ref TR31_STATS_INDEX
+ * @param value Value to add
+ */
+void tr31_stats_add(size_t index, uint64_t value);
+
+/**
+ * Update counters for completed key block import or export
+ *
+ * @param count_index Index of per format version counters. Either
+ *                    @ref TR31_STATS_INDEX(import_count) or
+ *                    @ref TR31_STATS_INDEX(export_count)
+ * @param version Key block format version
+ * @param length Length of key block in bytes
+ * @param result Result of import or export
+ */
+void tr31_stats_update(size_t count_index, unsigned int version, size_t length, int result);
+
+__END_DECLS
+
+#endif
@@ -25,6 +25,7 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 
 #if defined(HAVE_ARPA_INET_H)
@@ -40,8 +41,22 @@
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
-#ifndef HAVE_STRPTIME
-#include <stdio.h> // For sscanf()
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#if defined(HAVE_NEWLOCALE) && defined(HAVE_STRFTIME_L)
+#define TR31_USE_TIME_LOCALE
+#endif
+
+// Time locale according to environment variables, determined only once
+#ifdef TR31_USE_TIME_LOCALE
+static locale_t tr31_time_locale = (locale_t)0;
+#endif
+#ifdef HAVE_PTHREAD
+static pthread_once_t tr31_time_locale_once = PTHREAD_ONCE_INIT;
+#else
+static bool tr31_time_locale_done = false;
 #endif
 #endif // TR31_ENABLE_DATETIME_CONVERSION
 
@@ -52,11 +67,15 @@ static const char* tr31_opt_block_BI_get_string(const struct tr31_opt_ctx_t* opt
 static const char* tr31_opt_block_CT_get_string(const struct tr31_opt_ctx_t* opt_block);
 static const char* tr31_opt_block_hmac_get_string(const struct tr31_opt_ctx_t* opt_block);
 static const char* tr31_opt_block_kcv_get_string(const struct tr31_opt_ctx_t* opt_block);
+#ifdef TR31_ENABLE_DATETIME_CONVERSION
+static void tr31_time_locale_init(void);
+#endif
 static int tr31_opt_block_iso8601_get_string(const struct tr31_opt_ctx_t* opt_block, char* str, size_t str_len);
 static const char* tr31_opt_block_wrapping_pedigree_get_string(const struct tr31_opt_ctx_t* opt_block);
 static bool tr31_opt_block_is_ibm(const struct tr31_opt_ctx_t* opt_block);
 static bool tr31_opt_block_ibm_found(const struct tr31_ctx_t* ctx);
 static const char* tr31_opt_block_ibm_get_string(const struct tr31_opt_ctx_t* opt_block);
+static int tr31_stats_append(char* str, size_t str_len, size_t* len, const char* name, const char* help, const char* label, const char* const* label_values, const uint64_t* values, size_t count);
 
 static int tr31_validate_format_an(const char* buf, size_t buf_len)
 {
@@ -508,120 +527,82 @@ static const char* tr31_opt_block_kcv_get_string(const struct tr31_opt_ctx_t* op
 	return "Unknown";
 }
 
+#ifdef TR31_ENABLE_DATETIME_CONVERSION
+static void tr31_time_locale_init(void)
+{
+#ifdef TR31_USE_TIME_LOCALE
+	// Create time locale according to environment variables without
+	// modifying the global locale of the application
+	tr31_time_locale = newlocale(LC_TIME_MASK, "", (locale_t)0);
+#else
+	// Set time locale according to environment variables
+	setlocale(LC_TIME, "");
+#endif
+}
+#endif
+
 static int tr31_opt_block_iso8601_get_string(const struct tr31_opt_ctx_t* opt_block, char* str, size_t str_len)
 {
 #ifdef TR31_ENABLE_DATETIME_CONVERSION
-	char* iso8601_str;
-#ifdef HAVE_STRPTIME
-	char* ptr;
-#else
 	int r;
-#endif
-	struct tm ztm; // Time structure in UTC
-	time_t lt; // Calendar/Unix/POSIX time in local time
-	struct tm* ltm; // Time structure in local time
+	struct tr31_opt_blk_time_data_t time_data;
+	time_t lt; // Calendar/Unix/POSIX time
+	struct tm ltm; // Time structure in local time
 	size_t ret;
 
-	if (!opt_block->data_length) {
-		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
-	}
-
-	// Copy optional block data to NULL-terminated string
-	iso8601_str = malloc(opt_block->data_length + 1);
-	memcpy(iso8601_str, opt_block->data, opt_block->data_length);
-	iso8601_str[opt_block->data_length] = 0;
-
-	// Validate ISO 8601 format based on string length
+	// Decode ISO 8601 date/time without allocation or locale
 	// NOTE: struct tm cannot hold sub-second values and they will be ignored
-	// during parsing
-	// See ANSI X9.143:2021, 6.3.6.13, table 21
-	// See ANSI X9.143:2021, 6.3.6.14, table 22
-	memset(&ztm, 0, sizeof(ztm));
-#ifdef HAVE_STRPTIME
-	switch (opt_block->data_length) {
-		case 0x13 - 4: // YYYYMMDDhhmmssZ
-			ptr = strptime(iso8601_str, "%Y%m%d%H%M%SZ", &ztm);
-			break;
-
-		case 0x15 - 4: // YYYYMMDDhhmmssssZ
-			ptr = strptime(iso8601_str, "%Y%m%d%H%M%S", &ztm);
-			if (ptr - iso8601_str == 0x15 - 4 - 3 && *(ptr + 2) == 'Z') {
-				ptr += 3;
-			}
-			break;
-
-		case 0x18 - 4: // YYYY-MM-DDThh:mm:ssZ
-			ptr = strptime(iso8601_str, "%Y-%m-%dT%H:%M:%SZ", &ztm);
-			break;
-
-		case 0x1B - 4: // YYYY-MM-DDThh:mm:ss.ssZ
-			ptr = strptime(iso8601_str, "%Y-%m-%dT%H:%M:%S", &ztm);
-			if (ptr - iso8601_str == 0x1B - 4 - 4 && *ptr == '.' && *(ptr + 3) == 'Z') {
-				ptr += 4;
-			}
-			break;
-
-		default:
-			ptr = NULL; // Don't return before free()'ing iso8601_str
-	}
-	// NOTE: strptime() returns NULL if it fails to match the format string or
-	// returns a pointer to the first character after the matched format
-	// string. Therefore iso8601_str may only be free()'d after evaluating *ptr
-	if (!ptr || *ptr) {
-		free(iso8601_str);
-		iso8601_str = NULL;
+	if (opt_block->id == TR31_OPT_BLOCK_TC) {
+		r = tr31_opt_block_decode_TC(opt_block, &time_data);
+	} else {
+		r = tr31_opt_block_decode_TS(opt_block, &time_data);
+	}
+	if (r) {
+		// Return error value as-is
+		return r;
+	}
+	lt = time_data.seconds;
+	if ((int64_t)lt != time_data.seconds) {
+		// Date/time not representable by time_t
 		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
 	}
-#else
-	switch (opt_block->data_length) {
-		case 0x13 - 4: // YYYYMMDDhhmmssZ
-			r = sscanf(iso8601_str, "%4d%2d%2d%2d%2d%2dZ", &ztm.tm_year, &ztm.tm_mon, &ztm.tm_mday, &ztm.tm_hour, &ztm.tm_min, &ztm.tm_sec);
-			break;
 
-		case 0x15 - 4: // YYYYMMDDhhmmssssZ
-			r = sscanf(iso8601_str, "%4d%2d%2d%2d%2d%2d%*c%*cZ", &ztm.tm_year, &ztm.tm_mon, &ztm.tm_mday, &ztm.tm_hour, &ztm.tm_min, &ztm.tm_sec);
-			break;
-
-		case 0x18 - 4: // YYYY-MM-DDThh:mm:ssZ
-			r = sscanf(iso8601_str, "%4d-%2d-%2dT%2d:%2d:%2dZ", &ztm.tm_year, &ztm.tm_mon, &ztm.tm_mday, &ztm.tm_hour, &ztm.tm_min, &ztm.tm_sec);
-			break;
-
-		case 0x1B - 4: // YYYY-MM-DDThh:mm:ss.ssZ
-			r = sscanf(iso8601_str, "%4d-%2d-%2dT%2d:%2d:%2d*c%*cZ", &ztm.tm_year, &ztm.tm_mon, &ztm.tm_mday, &ztm.tm_hour, &ztm.tm_min, &ztm.tm_sec);
-			break;
-
-		default:
-			r = 0; // Don't return before free()'ing iso8601_str
-	}
-	// Fix year and month in time structure
-	ztm.tm_year -= 1900;
-	ztm.tm_min -= 1;
-	// NOTE: sscanf() returns number of matched input items
-	if (r != 6) {
-		free(iso8601_str);
-		iso8601_str = NULL;
-		return TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA;
+	// Convert to local time
+#ifdef HAVE_LOCALTIME_R
+	if (!localtime_r(&lt, &ltm)) {
+		// Unexpected failure
+		return -1;
+	}
+#elif defined(HAVE_LOCALTIME_S)
+	if (localtime_s(&ltm, &lt)) {
+		// Unexpected failure
+		return -1;
 	}
-#endif
-	free(iso8601_str);
-	iso8601_str = NULL;
-
-	// Convert UTC time to local time
-#ifdef HAVE_TIMEGM
-	lt = timegm(&ztm);
-#elif defined(HAVE_MKGMTIME)
-	lt = _mkgmtime(&ztm);
 #else
 #error "No platform function to convert UTC time to local time"
 #endif
-	ltm = localtime(&lt);
-	ztm = *ltm;
 
-	// Set time locale according to environment variable
-	setlocale(LC_TIME, "");
+	// Determine time locale only once
+#ifdef HAVE_PTHREAD
+	pthread_once(&tr31_time_locale_once, &tr31_time_locale_init);
+#else
+	if (!tr31_time_locale_done) {
+		tr31_time_locale_init();
+		tr31_time_locale_done = true;
+	}
+#endif
 
 	// Provide time according to locale
-	ret = strftime(str, str_len, "%c", &ztm);
+#ifdef TR31_USE_TIME_LOCALE
+	if (tr31_time_locale) {
+		ret = strftime_l(str, str_len, "%c", &ltm, tr31_time_locale);
+	} else {
+		// Environment locale not available; use global locale
+		ret = strftime(str, str_len, "%c", &ltm);
+	}
+#else
+	ret = strftime(str, str_len, "%c", &ltm);
+#endif
 	if (!ret) {
 		// Unexpected failure
 		return -1;
@@ -731,3 +712,131 @@ static const char* tr31_opt_block_ibm_get_string(const struct tr31_opt_ctx_t* op
 
 	return 0;
 }
+
+static int tr31_stats_append(
+	char* str,
+	size_t str_len,
+	size_t* len,
+	const char* name,
+	const char* help,
+	const char* label,
+	const char* const* label_values,
+	const uint64_t* values,
+	size_t count
+)
+{
+	int r;
+
+	r = snprintf(str + *len, str_len - *len, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+	if (r < 0) {
+		return -1;
+	}
+	if ((size_t)r >= str_len - *len) {
+		return 1;
+	}
+	*len += r;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (label) {
+			r = snprintf(str + *len, str_len - *len, "%s{%s=\"%s\"} %llu\n",
+				name, label, label_values[i], (unsigned long long)values[i]
+			);
+		} else {
+			r = snprintf(str + *len, str_len - *len, "%s %llu\n",
+				name, (unsigned long long)values[i]
+			);
+		}
+		if (r < 0) {
+			return -1;
+		}
+		if ((size_t)r >= str_len - *len) {
+			return 1;
+		}
+		*len += r;
+	}
+
+	return 0;
+}
+
+int tr31_stats_get_prometheus_string(const struct tr31_stats_t* stats, char* str, size_t str_len)
+{
+	int r;
+	size_t len = 0;
+	static const char* const versions[TR31_STATS_VERSION_COUNT] = { "A", "B", "C", "D", "E" };
+	static const char* const errors[] = {
+		"internal",
+		"invalid_length",
+		"invalid_character",
+		"unsupported_version",
+		"invalid_length_field",
+		"unsupported_key_usage",
+		"unsupported_algorithm",
+		"unsupported_mode_of_use",
+		"invalid_key_version_field",
+		"unsupported_exportability",
+		"unsupported_key_context",
+		"invalid_number_of_optional_blocks_field",
+		"duplicate_optional_block_id",
+		"invalid_optional_block_length",
+		"invalid_optional_block_data",
+		"invalid_optional_block_padding",
+		"invalid_payload_field",
+		"invalid_authenticator_field",
+		"unsupported_kbpk_algorithm",
+		"unsupported_kbpk_length",
+		"invalid_key_length",
+		"key_block_verification_failed",
+		"kcv_not_available",
+	};
+	_Static_assert(sizeof(errors) / sizeof(errors[0]) == TR31_STATS_ERROR_COUNT, "error labels must match enum tr31_error_t");
+	static const char* const kbpk_sources[] = { "derived", "cached" };
+	uint64_t kbpk_derivations[2];
+
+	if (!stats || !str || !str_len) {
+		return -1;
+	}
+	str[0] = 0;
+
+	kbpk_derivations[0] = stats->kbpk_derive_count;
+	kbpk_derivations[1] = stats->kbpk_derive_cached_count;
+
+	// each metric is appended in turn until the buffer is exhausted
+	r = tr31_stats_append(str, str_len, &len, "tr31_imports_total", "Successful key block imports per format version", "version", versions, stats->import_count, TR31_STATS_VERSION_COUNT);
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_import_bytes_total", "Total length of successfully imported key blocks", NULL, NULL, &stats->import_bytes, 1);
+	}
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_import_failures_total", "Failed key block imports", NULL, NULL, &stats->import_failed_count, 1);
+	}
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_exports_total", "Successful key block exports per format version", "version", versions, stats->export_count, TR31_STATS_VERSION_COUNT);
+	}
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_export_bytes_total", "Total length of successfully exported key blocks", NULL, NULL, &stats->export_bytes, 1);
+	}
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_export_failures_total", "Failed key block exports", NULL, NULL, &stats->export_failed_count, 1);
+	}
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_errors_total", "Failed key block imports and exports per error", "error", errors, stats->error_count, TR31_STATS_ERROR_COUNT);
+	}
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_kbpk_derivations_total", "KBEK and KBAK derivations from KBPK, either derived or served from previously derived keys", "source", kbpk_sources, kbpk_derivations, 2);
+	}
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_allocations_total", "Memory allocations by the TR-31 library", NULL, NULL, &stats->alloc_count, 1);
+	}
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_allocated_bytes_total", "Total size of memory allocations by the TR-31 library", NULL, NULL, &stats->alloc_bytes, 1);
+	}
+	if (!r) {
+		r = tr31_stats_append(str, str_len, &len, "tr31_allocation_failures_total", "Failed memory allocations by the TR-31 library", NULL, NULL, &stats->alloc_failed_count, 1);
+	}
+	if (r) {
+		// do not output partial metrics
+		str[0] = 0;
+		return r;
+	}
+
+	return 0;
+}
@@ -30,6 +30,7 @@ __BEGIN_DECLS
 // Forward declarations
 struct tr31_ctx_t;
 struct tr31_opt_ctx_t;
+struct tr31_stats_t;
 
 /**
  * Create ASCII string associated with key usage value
@@ -131,6 +132,17 @@ const char* tr31_opt_block_id_get_desc(const struct tr31_opt_ctx_t* opt_block);
  */
 int tr31_opt_block_data_get_desc(const struct tr31_opt_ctx_t* opt_block, char* str, size_t str_len);
 
+/**
+ * Format library-wide operation and error counters in the Prometheus text
+ * exposition format. All metrics are counters and are prefixed with "tr31_".
+ *
+ * @param stats Counters obtained using @ref tr31_stats_snapshot()
+ * @param str String buffer output
+ * @param str_len Length of string buffer in bytes
+ * @return Zero for success. Less than zero for internal error. Greater than zero if string buffer is too small.
+ */
+int tr31_stats_get_prometheus_string(const struct tr31_stats_t* stats, char* str, size_t str_len);
+
 __END_DECLS
 
 #endif
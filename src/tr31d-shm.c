@@ -0,0 +1,657 @@
+/**
+ * @file tr31d-shm.c
+ * @brief Shared memory submission/completion rings for the TR-31 key block
+ *        daemon
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31d-shm.h"
+#include "tr31_config.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#ifdef HAVE_SYS_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define TR31D_SHM_SPIN_COUNT (4096) // ring checks before sleeping
+#define TR31D_SHM_POLL_INTERVAL_US (100) // sleep interval without futex
+#define TR31D_SHM_CLIENT_TIMEOUT_MS (100) // interval for checking daemon liveness
+
+// helper functions
+static size_t tr31d_shm_size(unsigned int entries);
+static int tr31d_shm_map(int fd, size_t size, struct tr31d_shm_t* shm);
+static void tr31d_shm_wait(atomic_uint* addr, unsigned int value, unsigned int timeout_ms);
+static void tr31d_shm_wake(atomic_uint* addr);
+static void tr31d_shm_cleanse(void* buf, size_t len);
+static int tr31d_shm_client_request(struct tr31d_shm_client_t* client, const struct tr31d_shm_cqe_t** cqe);
+
+static size_t tr31d_shm_size(unsigned int entries)
+{
+	return sizeof(struct tr31d_shm_hdr_t) +
+		entries * sizeof(struct tr31d_shm_sqe_t) +
+		entries * sizeof(struct tr31d_shm_cqe_t);
+}
+
+static int tr31d_shm_map(int fd, size_t size, struct tr31d_shm_t* shm)
+{
+	void* addr;
+	unsigned int entries;
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		return -1;
+	}
+
+	shm->hdr = addr;
+	shm->size = size;
+	entries = (size - sizeof(struct tr31d_shm_hdr_t)) /
+		(sizeof(struct tr31d_shm_sqe_t) + sizeof(struct tr31d_shm_cqe_t));
+	shm->mask = entries - 1;
+	shm->sqes = (struct tr31d_shm_sqe_t*)(shm->hdr + 1);
+	shm->cqes = (struct tr31d_shm_cqe_t*)(shm->sqes + entries);
+
+	return 0;
+}
+
+int tr31d_shm_create(const char* name, unsigned int entries, struct tr31d_shm_t* shm)
+{
+	int r;
+	int fd;
+	size_t size;
+
+	if (!name || !shm) {
+		return -1;
+	}
+	memset(shm, 0, sizeof(*shm));
+
+	if (!entries) {
+		entries = TR31D_SHM_ENTRIES_DEFAULT;
+	}
+	if (entries > TR31D_SHM_ENTRIES_MAX || (entries & (entries - 1))) {
+		// number of entries must be a power of two
+		return 1;
+	}
+	size = tr31d_shm_size(entries);
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return -2;
+	}
+	if (ftruncate(fd, size)) {
+		close(fd);
+		shm_unlink(name);
+		return -3;
+	}
+	r = tr31d_shm_map(fd, size, shm);
+	close(fd);
+	if (r) {
+		shm_unlink(name);
+		return -4;
+	}
+
+	// new shared memory objects are zero filled
+	shm->hdr->magic = TR31D_SHM_MAGIC;
+	shm->hdr->version = TR31D_SHM_VERSION;
+	shm->hdr->entries = entries;
+
+	return 0;
+}
+
+int tr31d_shm_attach(const char* name, struct tr31d_shm_t* shm)
+{
+	int r;
+	int fd;
+	struct stat st;
+	uint32_t entries;
+
+	if (!name || !shm) {
+		return -1;
+	}
+	memset(shm, 0, sizeof(*shm));
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		return 1;
+	}
+	if (fstat(fd, &st) ||
+		st.st_uid != geteuid() ||
+		(st.st_mode & 0077) ||
+		(size_t)st.st_size < sizeof(struct tr31d_shm_hdr_t)
+	) {
+		// segment must belong to the current user and not be accessible by
+		// other users
+		close(fd);
+		return 2;
+	}
+	r = tr31d_shm_map(fd, st.st_size, shm);
+	close(fd);
+	if (r) {
+		return -2;
+	}
+
+	// validate layout; the size must match the number of entries exactly
+	// such that entries cannot be outside the mapping
+	entries = shm->hdr->entries;
+	if (shm->hdr->magic != TR31D_SHM_MAGIC ||
+		shm->hdr->version != TR31D_SHM_VERSION ||
+		!entries ||
+		entries > TR31D_SHM_ENTRIES_MAX ||
+		(entries & (entries - 1)) ||
+		tr31d_shm_size(entries) != shm->size
+	) {
+		munmap(shm->hdr, shm->size);
+		memset(shm, 0, sizeof(*shm));
+		return 3;
+	}
+
+	return 0;
+}
+
+void tr31d_shm_detach(struct tr31d_shm_t* shm)
+{
+	if (!shm || !shm->hdr) {
+		return;
+	}
+
+	// wake the other side regardless of which ring it waits on
+	atomic_store(&shm->hdr->closed, 1);
+	tr31d_shm_wake(&shm->hdr->sq.head);
+	tr31d_shm_wake(&shm->hdr->sq.tail);
+	tr31d_shm_wake(&shm->hdr->cq.head);
+	tr31d_shm_wake(&shm->hdr->cq.tail);
+
+	munmap(shm->hdr, shm->size);
+	memset(shm, 0, sizeof(*shm));
+}
+
+static void tr31d_shm_wait(atomic_uint* addr, unsigned int value, unsigned int timeout_ms)
+{
+#ifdef HAVE_SYS_FUTEX
+	struct timespec ts;
+
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+	// shared futex because the other side is a different process
+	syscall(SYS_futex, (unsigned int*)addr, FUTEX_WAIT, value, &ts, NULL, 0);
+#else
+	struct timespec ts = { 0, TR31D_SHM_POLL_INTERVAL_US * 1000L };
+
+	// poll at a fixed interval without futex
+	(void)addr;
+	(void)value;
+	(void)timeout_ms;
+	nanosleep(&ts, NULL);
+#endif
+}
+
+static void tr31d_shm_wake(atomic_uint* addr)
+{
+#ifdef HAVE_SYS_FUTEX
+	syscall(SYS_futex, (unsigned int*)addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+	(void)addr;
+#endif
+}
+
+static void tr31d_shm_cleanse(void* buf, size_t len)
+{
+	// volatile pointer prevents the compiler from removing the memset
+	volatile uint8_t* ptr = buf;
+	while (len--) {
+		*ptr++ = 0;
+	}
+}
+
+int tr31d_shm_ring_wait_entries(struct tr31d_shm_t* shm, struct tr31d_shm_ring_t* ring, unsigned int timeout_ms)
+{
+	unsigned int head;
+	unsigned int tail;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	// spin while the producer is likely to be busy
+	for (unsigned int i = 0; i < TR31D_SHM_SPIN_COUNT; ++i) {
+		if (atomic_load_explicit(&ring->tail, memory_order_acquire) != head) {
+			return 0;
+		}
+		if (atomic_load_explicit(&shm->hdr->closed, memory_order_relaxed)) {
+			return -1;
+		}
+	}
+
+	// announce that the consumer is idle before checking the ring again;
+	// together with the producer publishing before checking this flag, this
+	// ensures that the producer either observes the flag or the consumer
+	// observes the new entries
+	atomic_store(&ring->consumer_idle, 1);
+	tail = atomic_load(&ring->tail);
+	if (tail == head && !atomic_load(&shm->hdr->closed)) {
+		tr31d_shm_wait(&ring->tail, tail, timeout_ms);
+		tail = atomic_load(&ring->tail);
+	}
+	atomic_store_explicit(&ring->consumer_idle, 0, memory_order_relaxed);
+
+	if (tail != head) {
+		return 0;
+	}
+	if (atomic_load(&shm->hdr->closed)) {
+		return -1;
+	}
+	return 1;
+}
+
+int tr31d_shm_ring_wait_space(struct tr31d_shm_t* shm, struct tr31d_shm_ring_t* ring, unsigned int tail, unsigned int timeout_ms)
+{
+	unsigned int head;
+
+	// spin while the consumer is likely to be busy
+	for (unsigned int i = 0; i < TR31D_SHM_SPIN_COUNT; ++i) {
+		if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) <= shm->mask) {
+			return 0;
+		}
+		if (atomic_load_explicit(&shm->hdr->closed, memory_order_relaxed)) {
+			return -1;
+		}
+	}
+
+	// see tr31d_shm_ring_wait_entries()
+	atomic_store(&ring->producer_idle, 1);
+	head = atomic_load(&ring->head);
+	if (tail - head > shm->mask && !atomic_load(&shm->hdr->closed)) {
+		tr31d_shm_wait(&ring->head, head, timeout_ms);
+		head = atomic_load(&ring->head);
+	}
+	atomic_store_explicit(&ring->producer_idle, 0, memory_order_relaxed);
+
+	if (tail - head <= shm->mask) {
+		return 0;
+	}
+	if (atomic_load(&shm->hdr->closed)) {
+		return -1;
+	}
+	return 1;
+}
+
+void tr31d_shm_ring_publish(struct tr31d_shm_ring_t* ring, unsigned int tail)
+{
+	atomic_store(&ring->tail, tail);
+	if (atomic_load(&ring->consumer_idle)) {
+		tr31d_shm_wake(&ring->tail);
+	}
+}
+
+void tr31d_shm_ring_release(struct tr31d_shm_ring_t* ring, unsigned int head)
+{
+	atomic_store(&ring->head, head);
+	if (atomic_load(&ring->producer_idle)) {
+		tr31d_shm_wake(&ring->head);
+	}
+}
+
+int tr31d_shm_client_open(const char* socket_path, unsigned int entries, struct tr31d_shm_client_t* client)
+{
+	int r;
+	static atomic_uint counter;
+	char name[64];
+	struct sockaddr_un addr;
+	uint8_t req[TR31D_REQ_HEADER_LEN + sizeof(name)];
+	uint8_t resp[TR31D_RESP_HEADER_LEN];
+	size_t name_len;
+	size_t len;
+	uint32_t value;
+
+	if (!socket_path || !client) {
+		return -1;
+	}
+	memset(client, 0, sizeof(*client));
+	client->fd = -1;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		return -1;
+	}
+
+	// create shared memory segment with a unique name
+	r = snprintf(name, sizeof(name), "/tr31d-%ld-%u",
+		(long)getpid(),
+		atomic_fetch_add(&counter, 1)
+	);
+	if (r < 0 || (size_t)r >= sizeof(name)) {
+		return -1;
+	}
+	name_len = r;
+	r = tr31d_shm_create(name, entries, &client->shm);
+	if (r) {
+		return r;
+	}
+
+	// connect to daemon
+	client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (client->fd < 0) {
+		r = -2;
+		goto error;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, socket_path, strlen(socket_path) + 1);
+	if (connect(client->fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		r = -3;
+		goto error;
+	}
+
+	// request daemon to attach shared memory segment
+	memset(req, 0, sizeof(req));
+	value = htonl(TR31D_REQ_HEADER_LEN - 4 + name_len);
+	memcpy(req, &value, sizeof(value));
+	req[8] = TR31D_OP_SHM_ATTACH;
+	memcpy(req + TR31D_REQ_HEADER_LEN, name, name_len);
+	if (write(client->fd, req, TR31D_REQ_HEADER_LEN + name_len) != (ssize_t)(TR31D_REQ_HEADER_LEN + name_len)) {
+		r = -4;
+		goto error;
+	}
+	for (len = 0; len < sizeof(resp); ) {
+		ssize_t read_len = read(client->fd, resp + len, sizeof(resp) - len);
+		if (read_len <= 0) {
+			r = -5;
+			goto error;
+		}
+		len += read_len;
+	}
+	memcpy(&value, resp + 8, sizeof(value));
+	r = (int32_t)ntohl(value);
+	if (r) {
+		// daemon refused segment
+		r = 1;
+		goto error;
+	}
+
+	// daemon has mapped the segment and the name is no longer needed
+	shm_unlink(name);
+
+	// success
+	r = 0;
+	goto exit;
+
+error:
+	shm_unlink(name);
+	tr31d_shm_client_close(client);
+exit:
+	return r;
+}
+
+void tr31d_shm_client_close(struct tr31d_shm_client_t* client)
+{
+	if (!client) {
+		return;
+	}
+
+	tr31d_shm_detach(&client->shm);
+	if (client->fd >= 0) {
+		close(client->fd);
+	}
+	memset(client, 0, sizeof(*client));
+	client->fd = -1;
+}
+
+struct tr31d_shm_sqe_t* tr31d_shm_client_get_sqe(struct tr31d_shm_client_t* client)
+{
+	struct tr31d_shm_sqe_t* sqe;
+
+	if (!client || !client->shm.hdr) {
+		return NULL;
+	}
+
+	// limiting the number of entries in flight to the ring size ensures that
+	// neither the submission queue nor the completion queue can overflow
+	if (client->in_flight > client->shm.mask) {
+		return NULL;
+	}
+
+	sqe = &client->shm.sqes[client->sq_tail & client->shm.mask];
+	++client->sq_tail;
+	++client->in_flight;
+	return sqe;
+}
+
+void tr31d_shm_client_submit(struct tr31d_shm_client_t* client)
+{
+	if (!client || !client->shm.hdr) {
+		return;
+	}
+
+	if (atomic_load_explicit(&client->shm.hdr->sq.tail, memory_order_relaxed) != client->sq_tail) {
+		tr31d_shm_ring_publish(&client->shm.hdr->sq, client->sq_tail);
+	}
+}
+
+int tr31d_shm_client_wait_cqe(struct tr31d_shm_client_t* client, const struct tr31d_shm_cqe_t** cqe)
+{
+	int r;
+
+	if (!client || !client->shm.hdr || !cqe) {
+		return -1;
+	}
+	if (!client->in_flight) {
+		return -2;
+	}
+
+	while (true) {
+		struct pollfd pfd = { .fd = client->fd, .events = POLLIN };
+
+		r = tr31d_shm_ring_wait_entries(&client->shm, &client->shm.hdr->cq, TR31D_SHM_CLIENT_TIMEOUT_MS);
+		if (r == 0) {
+			break;
+		}
+		if (r < 0) {
+			// daemon has detached
+			return -3;
+		}
+
+		// daemon never writes to the socket after attaching, therefore any
+		// activity indicates that the connection has been closed
+		if (poll(&pfd, 1, 0) != 0) {
+			return -4;
+		}
+	}
+
+	*cqe = &client->shm.cqes[atomic_load_explicit(&client->shm.hdr->cq.head, memory_order_relaxed) & client->shm.mask];
+	return 0;
+}
+
+void tr31d_shm_client_cqe_seen(struct tr31d_shm_client_t* client)
+{
+	struct tr31d_shm_cqe_t* cqe;
+	size_t payload_len;
+
+	if (!client || !client->shm.hdr || !client->in_flight) {
+		return;
+	}
+
+	// import responses contain cleartext keys that must not remain in
+	// shared memory once the completion has been consumed
+	cqe = &client->shm.cqes[atomic_load_explicit(&client->shm.hdr->cq.head, memory_order_relaxed) & client->shm.mask];
+	payload_len = cqe->payload_len;
+	if (payload_len > sizeof(cqe->payload)) {
+		payload_len = sizeof(cqe->payload);
+	}
+	tr31d_shm_cleanse(cqe->payload, payload_len);
+
+	tr31d_shm_ring_release(
+		&client->shm.hdr->cq,
+		atomic_load_explicit(&client->shm.hdr->cq.head, memory_order_relaxed) + 1
+	);
+	--client->in_flight;
+}
+
+static int tr31d_shm_client_request(struct tr31d_shm_client_t* client, const struct tr31d_shm_cqe_t** cqe)
+{
+	int r;
+
+	tr31d_shm_client_submit(client);
+	r = tr31d_shm_client_wait_cqe(client, cqe);
+	if (r) {
+		return r;
+	}
+	if ((*cqe)->id != client->next_id - 1 || (*cqe)->payload_len > TR31D_MAX_PAYLOAD_LEN) {
+		// unexpected completion
+		tr31d_shm_client_cqe_seen(client);
+		return -5;
+	}
+
+	return 0;
+}
+
+int tr31d_shm_import(
+	struct tr31d_shm_client_t* client,
+	unsigned int kbpk_index,
+	const char* key_block,
+	size_t key_block_len,
+	uint32_t flags,
+	struct tr31_ctx_t* ctx
+)
+{
+	int r;
+	struct tr31d_shm_sqe_t* sqe;
+	const struct tr31d_shm_cqe_t* cqe;
+	size_t kcv_len;
+
+	if (!client || !key_block || !ctx) {
+		return -1;
+	}
+	if (client->in_flight || kbpk_index > 0xFF || key_block_len > TR31D_MAX_PAYLOAD_LEN) {
+		return -1;
+	}
+
+	sqe = tr31d_shm_client_get_sqe(client);
+	sqe->id = client->next_id++;
+	sqe->op = TR31D_OP_IMPORT;
+	sqe->version = 0;
+	sqe->kbpk_index = kbpk_index;
+	sqe->kbpk_new_index = 0;
+	sqe->import_flags = flags;
+	sqe->export_flags = 0;
+	sqe->payload_len = key_block_len;
+	memcpy(sqe->payload, key_block, key_block_len);
+
+	r = tr31d_shm_client_request(client, &cqe);
+	if (r) {
+		return r;
+	}
+	if (cqe->result) {
+		r = cqe->result;
+		tr31d_shm_client_cqe_seen(client);
+		return r;
+	}
+
+	// the daemon only provides the key; decode the key block attributes
+	// locally without a KBPK and populate the key afterwards
+	kcv_len = cqe->payload_len ? cqe->payload[0] : 0;
+	if (!cqe->payload_len || 1 + kcv_len >= cqe->payload_len) {
+		tr31d_shm_client_cqe_seen(client);
+		return -6;
+	}
+	r = tr31_import(key_block, key_block_len, NULL, flags, ctx);
+	if (r) {
+		tr31d_shm_client_cqe_seen(client);
+		return r;
+	}
+	r = tr31_key_set_data(&ctx->key, cqe->payload + 1 + kcv_len, cqe->payload_len - 1 - kcv_len);
+	tr31d_shm_client_cqe_seen(client);
+	if (r) {
+		tr31_release(ctx);
+		return r;
+	}
+
+	return 0;
+}
+
+int tr31d_shm_export(
+	struct tr31d_shm_client_t* client,
+	unsigned int kbpk_index,
+	const char* header,
+	size_t header_len,
+	const void* key,
+	size_t key_len,
+	uint32_t flags,
+	char* key_block,
+	size_t key_block_buf_len
+)
+{
+	int r;
+	struct tr31d_shm_sqe_t* sqe;
+	const struct tr31d_shm_cqe_t* cqe;
+
+	if (!client || !header || !key || !key_block || !key_block_buf_len) {
+		return -1;
+	}
+	if (client->in_flight ||
+		kbpk_index > 0xFF ||
+		header_len > 0xFFFF ||
+		2 + header_len + key_len > TR31D_MAX_PAYLOAD_LEN
+	) {
+		return -1;
+	}
+
+	sqe = tr31d_shm_client_get_sqe(client);
+	sqe->id = client->next_id++;
+	sqe->op = TR31D_OP_EXPORT;
+	sqe->version = 0;
+	sqe->kbpk_index = kbpk_index;
+	sqe->kbpk_new_index = 0;
+	sqe->import_flags = 0;
+	sqe->export_flags = flags;
+	sqe->payload[0] = header_len >> 8;
+	sqe->payload[1] = header_len;
+	memcpy(sqe->payload + 2, header, header_len);
+	memcpy(sqe->payload + 2 + header_len, key, key_len);
+	sqe->payload_len = 2 + header_len + key_len;
+
+	r = tr31d_shm_client_request(client, &cqe);
+	if (r) {
+		return r;
+	}
+	if (cqe->result) {
+		r = cqe->result;
+		tr31d_shm_client_cqe_seen(client);
+		return r;
+	}
+	if (cqe->payload_len >= key_block_buf_len) {
+		tr31d_shm_client_cqe_seen(client);
+		return TR31_ERROR_INVALID_LENGTH;
+	}
+	memcpy(key_block, cqe->payload, cqe->payload_len);
+	key_block[cqe->payload_len] = 0;
+	tr31d_shm_client_cqe_seen(client);
+
+	return 0;
+}
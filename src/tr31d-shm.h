@@ -0,0 +1,291 @@
+/**
+ * @file tr31d-shm.h
+ * @brief Shared memory submission/completion rings for the TR-31 key block
+ *        daemon
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TR31D_SHM_H
+#define TR31D_SHM_H
+
+#include "tr31.h"
+#include "tr31d.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup tr31d-shm TR-31 key block daemon shared memory rings
+ * @brief Lock-free submission and completion rings shared with tr31d
+ *
+ * A client creates a shared memory segment containing a submission queue
+ * (SQ) and a completion queue (CQ), each being a single-producer/
+ * single-consumer ring, and attaches it to the daemon using
+ * @ref TR31D_OP_SHM_ATTACH. The client then writes requests in place into
+ * submission queue entries and the daemon writes responses in place into
+ * completion queue entries, without any system calls while both sides are
+ * busy. A side only sleeps, using a futex where available, after its ring
+ * has been idle for a while, and the other side only issues a wakeup if it
+ * observed that the ring is idle.
+ *
+ * @{
+ */
+
+#define TR31D_SHM_MAGIC                 (0x54523331) ///< Shared memory segment magic value ("TR31")
+#define TR31D_SHM_VERSION               (1) ///< Shared memory segment layout version
+#define TR31D_SHM_ENTRIES_DEFAULT       (64) ///< Default number of ring entries
+#define TR31D_SHM_ENTRIES_MAX           (4096) ///< Maximum number of ring entries
+#define TR31D_SHM_CACHE_LINE_SIZE       (64) ///< Alignment of ring positions
+
+/// Submission queue entry. Fields are in host byte order.
+struct tr31d_shm_sqe_t {
+	uint32_t id; ///< Request ID, echoed by completion queue entry
+	uint8_t op; ///< Operation. See @ref TR31D_OP_IMPORT and friends.
+	uint8_t version; ///< Key block format version. Only for @ref TR31D_OP_REWRAP.
+	uint8_t kbpk_index; ///< Zero-based index of KBPK loaded by the daemon
+	uint8_t kbpk_new_index; ///< Zero-based index of new KBPK. Only for @ref TR31D_OP_REWRAP.
+	uint16_t import_flags; ///< Import flags. See @ref import-flags "import flags".
+	uint16_t export_flags; ///< Export flags. See @ref export-flags "export flags".
+	uint32_t payload_len; ///< Length of request payload in bytes
+	uint8_t payload[TR31D_MAX_PAYLOAD_LEN]; ///< Request payload, as for the socket protocol. Cleansed by the daemon once the request has been taken.
+};
+
+/// Completion queue entry. Fields are in host byte order.
+struct tr31d_shm_cqe_t {
+	uint32_t id; ///< Request ID of submission queue entry
+	int32_t result; ///< Result. See @ref tr31_error_t
+	uint32_t payload_len; ///< Length of response payload in bytes
+	uint8_t payload[TR31D_MAX_PAYLOAD_LEN]; ///< Response payload, as for the socket protocol
+};
+
+/**
+ * Single-producer/single-consumer ring positions. Positions increase
+ * monotonically and wrap around at 2^32, while entries are indexed using the
+ * position modulo the number of entries.
+ */
+struct tr31d_shm_ring_t {
+	// consumer and producer positions are kept on separate cache lines
+	char pad0[TR31D_SHM_CACHE_LINE_SIZE];
+	atomic_uint head; ///< Consumer position. Also used as futex by waiting producer.
+	atomic_uint producer_idle; ///< Non-zero while producer waits for space
+	char pad1[TR31D_SHM_CACHE_LINE_SIZE];
+	atomic_uint tail; ///< Producer position. Also used as futex by waiting consumer.
+	atomic_uint consumer_idle; ///< Non-zero while consumer waits for entries
+	char pad2[TR31D_SHM_CACHE_LINE_SIZE];
+};
+
+/// Shared memory segment header. Followed by the ring entries.
+struct tr31d_shm_hdr_t {
+	uint32_t magic; ///< Must be @ref TR31D_SHM_MAGIC
+	uint32_t version; ///< Must be @ref TR31D_SHM_VERSION
+	uint32_t entries; ///< Number of entries per ring. Must be a power of two.
+	atomic_uint closed; ///< Non-zero once either side has detached
+	struct tr31d_shm_ring_t sq; ///< Submission queue, produced by client
+	struct tr31d_shm_ring_t cq; ///< Completion queue, produced by daemon
+};
+
+/// Shared memory segment mapping
+struct tr31d_shm_t {
+	struct tr31d_shm_hdr_t* hdr; ///< Segment header
+	struct tr31d_shm_sqe_t* sqes; ///< Submission queue entries
+	struct tr31d_shm_cqe_t* cqes; ///< Completion queue entries
+	size_t size; ///< Size of segment in bytes
+	unsigned int mask; ///< Number of entries minus one
+};
+
+/// Shared memory client
+struct tr31d_shm_client_t {
+	int fd; ///< Unix domain socket connected to the daemon
+	struct tr31d_shm_t shm; ///< Shared memory segment
+	unsigned int sq_tail; ///< Submission queue position, including unsubmitted entries
+	unsigned int in_flight; ///< Number of entries that have not been seen
+	uint32_t next_id; ///< Next request ID used by the synchronous functions
+};
+
+/**
+ * Create shared memory segment. The segment is only accessible by the
+ * current user.
+ * @param name Name of shared memory object. See shm_open().
+ * @param entries Number of entries per ring. Must be a power of two. Zero for
+ *                @ref TR31D_SHM_ENTRIES_DEFAULT.
+ * @param shm Shared memory segment output
+ * @return Zero for success. Less than zero for internal error.
+ *         Greater than zero for invalid parameters.
+ */
+int tr31d_shm_create(const char* name, unsigned int entries, struct tr31d_shm_t* shm);
+
+/**
+ * Map existing shared memory segment and validate its layout
+ * @param name Name of shared memory object. See shm_open().
+ * @param shm Shared memory segment output
+ * @return Zero for success. Less than zero for internal error.
+ *         Greater than zero for invalid segment.
+ */
+int tr31d_shm_attach(const char* name, struct tr31d_shm_t* shm);
+
+/**
+ * Mark shared memory segment as closed, wake the other side and unmap the
+ * segment.
+ * @param shm Shared memory segment
+ */
+void tr31d_shm_detach(struct tr31d_shm_t* shm);
+
+/**
+ * Wait until ring has at least one entry to consume. Spins briefly before
+ * sleeping.
+ * @param shm Shared memory segment
+ * @param ring Ring to consume from
+ * @param timeout_ms Maximum time to sleep in milliseconds
+ * @return Zero if entries are available. Less than zero if the segment is
+ *         closed. Greater than zero for timeout.
+ */
+int tr31d_shm_ring_wait_entries(struct tr31d_shm_t* shm, struct tr31d_shm_ring_t* ring, unsigned int timeout_ms);
+
+/**
+ * Wait until ring has space for at least one entry. Spins briefly before
+ * sleeping.
+ * @param shm Shared memory segment
+ * @param ring Ring to produce to
+ * @param tail Producer position of next entry
+ * @param timeout_ms Maximum time to sleep in milliseconds
+ * @return Zero if space is available. Less than zero if the segment is
+ *         closed. Greater than zero for timeout.
+ */
+int tr31d_shm_ring_wait_space(struct tr31d_shm_t* shm, struct tr31d_shm_ring_t* ring, unsigned int tail, unsigned int timeout_ms);
+
+/**
+ * Publish produced entries and wake the consumer if it is idle
+ * @param ring Ring produced to
+ * @param tail New producer position
+ */
+void tr31d_shm_ring_publish(struct tr31d_shm_ring_t* ring, unsigned int tail);
+
+/**
+ * Release consumed entries and wake the producer if it is idle
+ * @param ring Ring consumed from
+ * @param head New consumer position
+ */
+void tr31d_shm_ring_release(struct tr31d_shm_ring_t* ring, unsigned int head);
+
+/**
+ * Connect to daemon, create shared memory segment and attach it to the
+ * daemon. The name of the shared memory object is removed once the daemon
+ * has attached it.
+ * @param socket_path Unix domain socket of daemon
+ * @param entries Number of entries per ring. Must be a power of two. Zero for
+ *                @ref TR31D_SHM_ENTRIES_DEFAULT.
+ * @param client Shared memory client output
+ * @return Zero for success. Less than zero for internal error.
+ *         Greater than zero if the daemon refused the segment.
+ */
+int tr31d_shm_client_open(const char* socket_path, unsigned int entries, struct tr31d_shm_client_t* client);
+
+/**
+ * Detach shared memory segment and disconnect from daemon
+ * @param client Shared memory client
+ */
+void tr31d_shm_client_close(struct tr31d_shm_client_t* client);
+
+/**
+ * Obtain next submission queue entry to populate in place. The entry is only
+ * visible to the daemon after @ref tr31d_shm_client_submit().
+ * @param client Shared memory client
+ * @return Submission queue entry. NULL if all entries are in flight.
+ */
+struct tr31d_shm_sqe_t* tr31d_shm_client_get_sqe(struct tr31d_shm_client_t* client);
+
+/**
+ * Submit all submission queue entries obtained using
+ * @ref tr31d_shm_client_get_sqe().
+ * @param client Shared memory client
+ */
+void tr31d_shm_client_submit(struct tr31d_shm_client_t* client);
+
+/**
+ * Wait for next completion queue entry. The entry remains valid until
+ * @ref tr31d_shm_client_cqe_seen().
+ * @param client Shared memory client
+ * @param cqe Completion queue entry output
+ * @return Zero for success. Less than zero for internal error, including when
+ *         no entries are in flight or the daemon has detached.
+ */
+int tr31d_shm_client_wait_cqe(struct tr31d_shm_client_t* client, const struct tr31d_shm_cqe_t** cqe);
+
+/**
+ * Release completion queue entry obtained using
+ * @ref tr31d_shm_client_wait_cqe(). The response payload is cleansed before
+ * the entry is released.
+ * @param client Shared memory client
+ */
+void tr31d_shm_client_cqe_seen(struct tr31d_shm_client_t* client);
+
+/**
+ * Import key block using the daemon. Equivalent to @ref tr31_import() using
+ * the KBPK loaded by the daemon at @p kbpk_index. No other requests may be in
+ * flight.
+ * @param client Shared memory client
+ * @param kbpk_index Zero-based index of KBPK loaded by the daemon
+ * @param key_block Key block. Null-termination not required.
+ * @param key_block_len Length of key block in bytes, excluding null-termination.
+ * @param flags Key block import flags. See @ref import-flags "import flags".
+ * @param ctx Key block context object output. Use @ref tr31_release() to release.
+ * @return Zero for success. Less than zero for internal error.
+ *         Greater than zero for data error. See @ref tr31_error_t
+ */
+int tr31d_shm_import(
+	struct tr31d_shm_client_t* client,
+	unsigned int kbpk_index,
+	const char* key_block,
+	size_t key_block_len,
+	uint32_t flags,
+	struct tr31_ctx_t* ctx
+);
+
+/**
+ * Export key block using the daemon. Equivalent to @ref tr31_export() using
+ * the KBPK loaded by the daemon at @p kbpk_index, but with the key block
+ * attributes provided as an export header. No other requests may be in
+ * flight.
+ * @param client Shared memory client
+ * @param kbpk_index Zero-based index of KBPK loaded by the daemon
+ * @param header Export header, including optional blocks. Null-termination not required.
+ * @param header_len Length of export header in bytes
+ * @param key Key data to wrap
+ * @param key_len Length of key data in bytes
+ * @param flags Key block export flags. See @ref export-flags "export flags".
+ * @param key_block Key block output. Will be null-terminated.
+ * @param key_block_buf_len Key block output buffer length.
+ * @return Zero for success. Less than zero for internal error.
+ *         Greater than zero for data error. See @ref tr31_error_t
+ */
+int tr31d_shm_export(
+	struct tr31d_shm_client_t* client,
+	unsigned int kbpk_index,
+	const char* header,
+	size_t header_len,
+	const void* key,
+	size_t key_len,
+	uint32_t flags,
+	char* key_block,
+	size_t key_block_buf_len
+);
+
+/// @}
+
+#endif
@@ -0,0 +1,1332 @@
+/**
+ * @file tr31d.c
+ * @brief TR-31 key block daemon serving requests over a Unix domain socket
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+#include "tr31_strings.h"
+#include "tr31d.h"
+#include "tr31d-shm.h"
+#include "tr31-tool-io.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <argp.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define TR31D_MAX_KBPK_COUNT (256) // KBPK index is a single byte
+#define TR31D_DEFAULT_QUEUE_SIZE (1024)
+#define TR31D_CONN_QUEUE_SIZE (64) // maximum number of queued requests per connection
+#define TR31D_DEFAULT_WRITE_TIMEOUT_MS (5000)
+#define TR31D_SHUTDOWN_GRACE_MS (1000) // interval for connections to drain before they are closed
+#define TR31D_LATENCY_BUCKETS (32) // log2 microsecond buckets
+#define TR31D_SHM_TIMEOUT_MS (100) // interval for checking connection of shared memory session
+
+// command line options
+struct tr31d_options_t {
+	const char* socket_path;
+	const char* kbpk_file_path;
+	unsigned int threads;
+	size_t queue_size;
+	unsigned int write_timeout_ms;
+};
+
+// key block protection key for each algorithm
+struct tr31d_kbpk_t {
+	struct tr31_key_t tdes;
+	struct tr31_key_t aes;
+};
+
+// per operation statistics
+struct tr31d_op_stats_t {
+	atomic_ulong requests;
+	atomic_ulong errors;
+	atomic_ullong latency_sum; // microseconds
+	atomic_ullong latency_max; // microseconds
+	atomic_ulong latency_buckets[TR31D_LATENCY_BUCKETS];
+};
+
+// client connection
+struct tr31d_conn_t {
+	struct tr31d_conn_t* next;
+	struct tr31d_t* tr31d;
+	int fd;
+	pthread_mutex_t write_mutex;
+	pthread_cond_t space_cond; // signalled when the connection may queue another request
+	size_t job_count; // queued or processing requests; protected by tr31d_t.mutex
+	atomic_uint refs; // connection thread, outstanding requests and shared memory session
+	atomic_bool failed;
+	atomic_bool closed; // connection thread has stopped reading
+};
+
+// request fields common to socket and shared memory requests
+struct tr31d_req_t {
+	uint8_t op;
+	uint8_t version;
+	uint8_t kbpk_index;
+	uint8_t kbpk_new_index;
+	uint16_t import_flags;
+	uint16_t export_flags;
+	const uint8_t* payload;
+	size_t payload_len;
+};
+
+// queued request
+struct tr31d_job_t {
+	struct tr31d_job_t* next;
+	struct tr31d_conn_t* conn;
+	uint64_t start_time; // microseconds
+
+	uint32_t id;
+	uint8_t op;
+	uint8_t version;
+	uint8_t kbpk_index;
+	uint8_t kbpk_new_index;
+	uint16_t import_flags;
+	uint16_t export_flags;
+
+	size_t payload_len;
+	uint8_t payload[];
+};
+
+// shared memory session
+struct tr31d_shm_session_t {
+	struct tr31d_t* tr31d;
+	struct tr31d_conn_t* conn;
+	struct tr31d_shm_t shm;
+	uint8_t payload[TR31D_MAX_PAYLOAD_LEN]; // private copy of request payload
+};
+
+// daemon state
+struct tr31d_t {
+	struct tr31d_kbpk_t* kbpks;
+	size_t kbpk_count;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t conn_cond;
+	struct tr31d_job_t* job_head;
+	struct tr31d_job_t* job_tail;
+	size_t job_count;
+	size_t queue_size;
+	size_t conn_queue_size;
+	bool shutdown;
+	struct tr31d_conn_t* conns;
+	size_t conn_count;
+
+	pthread_t* workers;
+	unsigned int worker_count;
+
+	struct tr31d_op_stats_t stats[TR31D_OP_STATS + 1];
+};
+
+// argp option keys
+enum tr31d_option_keys_t {
+	TR31D_OPTION_SOCKET = -255, // negative value to avoid short options
+	TR31D_OPTION_KBPK_FILE,
+	TR31D_OPTION_THREADS,
+	TR31D_OPTION_QUEUE_SIZE,
+	TR31D_OPTION_WRITE_TIMEOUT,
+	TR31D_OPTION_VERSION,
+};
+
+// helper functions
+static error_t argp_parser_helper(int key, char* arg, struct argp_state* state);
+static void tr31d_cleanse(void* buf, size_t len);
+static uint64_t tr31d_now(void);
+static int tr31d_load_kbpks(const char* path, struct tr31d_t* tr31d);
+static const struct tr31_key_t* tr31d_select_kbpk(const struct tr31d_t* tr31d, unsigned int index, unsigned int format_version);
+static int tr31d_read_full(int fd, void* buf, size_t len);
+static int tr31d_write_full(int fd, const void* buf, size_t len);
+static void tr31d_conn_put(struct tr31d_t* tr31d, struct tr31d_conn_t* conn);
+static void tr31d_conn_fail(struct tr31d_conn_t* conn);
+static void* tr31d_conn_thread(void* arg);
+static void* tr31d_worker_thread(void* arg);
+static int tr31d_execute(struct tr31d_t* tr31d, const struct tr31d_req_t* req, uint8_t* out, size_t* out_len);
+static void tr31d_update_stats(struct tr31d_t* tr31d, unsigned int op, int result, uint64_t start_time);
+static void tr31d_process(struct tr31d_t* tr31d, struct tr31d_job_t* job);
+static int tr31d_shm_start(struct tr31d_t* tr31d, struct tr31d_conn_t* conn, const uint8_t* name, size_t name_len);
+static void* tr31d_shm_thread(void* arg);
+static size_t tr31d_format_stats(struct tr31d_t* tr31d, char* buf, size_t buf_len);
+
+// argp option structure
+static struct argp_option argp_options[] = {
+	{ "socket", TR31D_OPTION_SOCKET, "PATH", 0, "Unix domain socket to listen on. The socket is only accessible by the current user." },
+	{ "kbpk-file", TR31D_OPTION_KBPK_FILE, "FILE", 0, "File containing key block protection keys as hex digits, one per line. Requests refer to KBPKs by zero-based line index." },
+	{ "threads", TR31D_OPTION_THREADS, "N", 0, "Number of worker threads. Default is the number of online processors." },
+	{ "queue-size", TR31D_OPTION_QUEUE_SIZE, "N", 0, "Maximum number of queued requests before connections are throttled. Default is 1024." },
+	{ "write-timeout", TR31D_OPTION_WRITE_TIMEOUT, "MS", 0, "Time in milliseconds that a response may take to be written before the connection is closed. Default is 5000." },
+	{ "version", TR31D_OPTION_VERSION, NULL, 0, "Display TR-31 library version" },
+	{ 0 },
+};
+
+// argp configuration
+static struct argp argp_config = {
+	argp_options,
+	argp_parser_helper,
+	NULL,
+	" \v" // force the text to be after the options in the help message
+	"Serve key block import, export and re-wrap requests over a Unix domain socket. "
+	"Key block protection keys are loaded once and kept in locked memory. "
+	"Send SIGINT or SIGTERM to stop. See tr31d.h for the protocol.",
+};
+
+// signal pipe used to interrupt the accept loop
+static int signal_pipe[2] = { -1, -1 };
+
+// argp parser helper function
+static error_t argp_parser_helper(int key, char* arg, struct argp_state* state)
+{
+	struct tr31d_options_t* options;
+	char* endptr;
+	unsigned long value;
+
+	options = state->input;
+	if (!options) {
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	switch (key) {
+		case TR31D_OPTION_SOCKET:
+			if (strlen(arg) >= sizeof(((struct sockaddr_un*)0)->sun_path)) {
+				argp_error(state, "Socket path is too long");
+			}
+			options->socket_path = arg;
+			return 0;
+
+		case TR31D_OPTION_KBPK_FILE:
+			options->kbpk_file_path = arg;
+			return 0;
+
+		case TR31D_OPTION_THREADS:
+			value = strtoul(arg, &endptr, 10);
+			if (!arg[0] || *endptr || value < 1 || value > 1024) {
+				argp_error(state, "Number of threads must be from 1 to 1024");
+			}
+			options->threads = value;
+			return 0;
+
+		case TR31D_OPTION_QUEUE_SIZE:
+			value = strtoul(arg, &endptr, 10);
+			if (!arg[0] || *endptr || value < 1 || value > 1048576) {
+				argp_error(state, "Queue size must be from 1 to 1048576");
+			}
+			options->queue_size = value;
+			return 0;
+
+		case TR31D_OPTION_WRITE_TIMEOUT:
+			value = strtoul(arg, &endptr, 10);
+			if (!arg[0] || *endptr || value < 1 || value > 3600000) {
+				argp_error(state, "Write timeout must be from 1 to 3600000 milliseconds");
+			}
+			options->write_timeout_ms = value;
+			return 0;
+
+		case TR31D_OPTION_VERSION: {
+			const char* version;
+
+			version = tr31_lib_version_string();
+			if (version) {
+				printf("%s\n", version);
+			} else {
+				printf("Unknown\n");
+			}
+			exit(EXIT_SUCCESS);
+			return 0;
+		}
+
+		case ARGP_KEY_END:
+			if (!options->socket_path || !options->kbpk_file_path) {
+				argp_error(state, "The --socket option and --kbpk-file option are required");
+			}
+			return 0;
+
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+}
+
+static void tr31d_cleanse(void* buf, size_t len)
+{
+	// volatile pointer prevents the compiler from removing the memset
+	volatile uint8_t* ptr = buf;
+	while (len--) {
+		*ptr++ = 0;
+	}
+}
+
+static uint64_t tr31d_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int tr31d_load_kbpks(const char* path, struct tr31d_t* tr31d)
+{
+	int r;
+	FILE* file;
+	char* buf = NULL;
+	size_t buf_len = 0;
+	char* line;
+
+	file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Failed to open KBPK file \"%s\": %s\n", path, strerror(errno));
+		return 1;
+	}
+	buf = tr31_tool_io_read_file(file, &buf_len);
+	fclose(file);
+	if (!buf) {
+		fprintf(stderr, "Failed to read KBPK file \"%s\"\n", path);
+		return 1;
+	}
+
+	tr31d->kbpks = calloc(TR31D_MAX_KBPK_COUNT, sizeof(*tr31d->kbpks));
+	if (!tr31d->kbpks) {
+		fprintf(stderr, "Memory allocation failed\n");
+		r = 1;
+		goto exit;
+	}
+	line = buf;
+	while (line < buf + buf_len) {
+		char* eol = memchr(line, '\n', buf + buf_len - line);
+		size_t line_len = eol ? (size_t)(eol - line) : (size_t)(buf + buf_len - line);
+		uint8_t kbpk_buf[32]; // max 256-bit KBPK
+		size_t kbpk_len;
+		struct tr31d_kbpk_t* kbpk;
+
+		// remove trailing whitespace, including carriage return
+		while (line_len && isspace((unsigned char)line[line_len - 1])) {
+			--line_len;
+		}
+		if (!line_len) {
+			fprintf(stderr, "KBPK file line %zu is empty\n", tr31d->kbpk_count + 1);
+			r = 1;
+			goto exit;
+		}
+		if (tr31d->kbpk_count >= TR31D_MAX_KBPK_COUNT) {
+			fprintf(stderr, "KBPK file may not contain more than %u KBPKs\n", TR31D_MAX_KBPK_COUNT);
+			r = 1;
+			goto exit;
+		}
+
+		// parse hex digits
+		kbpk_len = line_len / 2;
+		if (line_len % 2 != 0 || kbpk_len > sizeof(kbpk_buf)) {
+			fprintf(stderr, "KBPK file line %zu must have an even number of digits and at most %zu digits\n",
+				tr31d->kbpk_count + 1,
+				sizeof(kbpk_buf) * 2
+			);
+			r = 1;
+			goto exit;
+		}
+		for (size_t i = 0; i < kbpk_len; ++i) {
+			char hex[3] = { line[i * 2], line[i * 2 + 1], 0 };
+			if (!isxdigit((unsigned char)hex[0]) || !isxdigit((unsigned char)hex[1])) {
+				fprintf(stderr, "KBPK file line %zu must consist of hex digits\n", tr31d->kbpk_count + 1);
+				tr31d_cleanse(kbpk_buf, sizeof(kbpk_buf));
+				r = 1;
+				goto exit;
+			}
+			kbpk_buf[i] = strtoul(hex, NULL, 16);
+		}
+
+		// populate KBPK for each algorithm that allows its length
+		kbpk = &tr31d->kbpks[tr31d->kbpk_count];
+		if (kbpk_len == 16 || kbpk_len == 24) {
+			r = tr31_key_init(
+				TR31_KEY_USAGE_TR31_KBPK,
+				TR31_KEY_ALGORITHM_TDES,
+				TR31_KEY_MODE_OF_USE_ENC_DEC,
+				"00",
+				TR31_KEY_EXPORT_NONE,
+				TR31_KEY_CONTEXT_NONE,
+				kbpk_buf,
+				kbpk_len,
+				&kbpk->tdes
+			);
+			if (r) {
+				fprintf(stderr, "KBPK error %d: %s\n", r, tr31_get_error_string(r));
+				tr31d_cleanse(kbpk_buf, sizeof(kbpk_buf));
+				r = 1;
+				goto exit;
+			}
+		}
+		if (kbpk_len == 16 || kbpk_len == 24 || kbpk_len == 32) {
+			r = tr31_key_init(
+				TR31_KEY_USAGE_TR31_KBPK,
+				TR31_KEY_ALGORITHM_AES,
+				TR31_KEY_MODE_OF_USE_ENC_DEC,
+				"00",
+				TR31_KEY_EXPORT_NONE,
+				TR31_KEY_CONTEXT_NONE,
+				kbpk_buf,
+				kbpk_len,
+				&kbpk->aes
+			);
+			if (r) {
+				fprintf(stderr, "KBPK error %d: %s\n", r, tr31_get_error_string(r));
+				tr31d_cleanse(kbpk_buf, sizeof(kbpk_buf));
+				r = 1;
+				goto exit;
+			}
+		}
+		tr31d_cleanse(kbpk_buf, sizeof(kbpk_buf));
+		if (!kbpk->tdes.length && !kbpk->aes.length) {
+			fprintf(stderr, "KBPK file line %zu: %s\n",
+				tr31d->kbpk_count + 1,
+				tr31_get_error_string(TR31_ERROR_UNSUPPORTED_KBPK_LENGTH)
+			);
+			r = 1;
+			goto exit;
+		}
+
+		// keep KBPKs in locked memory such that they are never swapped
+		if ((kbpk->tdes.data && mlock(kbpk->tdes.data, kbpk->tdes.length)) ||
+			(kbpk->aes.data && mlock(kbpk->aes.data, kbpk->aes.length))
+		) {
+			fprintf(stderr, "Warning: failed to lock KBPK memory: %s\n", strerror(errno));
+		}
+
+		// cache KCVs for optional block KP such that requests need not
+		// compute them
+		tr31_key_get_kcv(&kbpk->tdes);
+		tr31_key_get_kcv(&kbpk->aes);
+
+		++tr31d->kbpk_count;
+		line = eol ? eol + 1 : buf + buf_len;
+	}
+	if (!tr31d->kbpk_count) {
+		fprintf(stderr, "KBPK file \"%s\" contains no KBPKs\n", path);
+		r = 1;
+		goto exit;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	tr31d_cleanse(buf, buf_len);
+	free(buf);
+	return r;
+}
+
+static const struct tr31_key_t* tr31d_select_kbpk(const struct tr31d_t* tr31d, unsigned int index, unsigned int format_version)
+{
+	const struct tr31_key_t* kbpk;
+
+	if (index >= tr31d->kbpk_count) {
+		return NULL;
+	}
+
+	switch (format_version) {
+		case TR31_VERSION_A:
+		case TR31_VERSION_B:
+		case TR31_VERSION_C:
+			kbpk = &tr31d->kbpks[index].tdes;
+			break;
+
+		case TR31_VERSION_D:
+		case TR31_VERSION_E:
+			kbpk = &tr31d->kbpks[index].aes;
+			break;
+
+		default:
+			return NULL;
+	}
+	if (!kbpk->length) {
+		return NULL;
+	}
+
+	return kbpk;
+}
+
+static int tr31d_read_full(int fd, void* buf, size_t len)
+{
+	uint8_t* ptr = buf;
+
+	while (len) {
+		ssize_t r = read(fd, ptr, len);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (r == 0) {
+			// end of stream
+			return 1;
+		}
+		ptr += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static int tr31d_write_full(int fd, const void* buf, size_t len)
+{
+	const uint8_t* ptr = buf;
+
+	while (len) {
+		ssize_t r = write(fd, ptr, len);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		ptr += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static void tr31d_conn_put(struct tr31d_t* tr31d, struct tr31d_conn_t* conn)
+{
+	if (atomic_fetch_sub(&conn->refs, 1) != 1) {
+		return;
+	}
+
+	// last reference; remove connection from list
+	pthread_mutex_lock(&tr31d->mutex);
+	for (struct tr31d_conn_t** ptr = &tr31d->conns; *ptr; ptr = &(*ptr)->next) {
+		if (*ptr == conn) {
+			*ptr = conn->next;
+			break;
+		}
+	}
+	--tr31d->conn_count;
+	pthread_cond_broadcast(&tr31d->conn_cond);
+	pthread_mutex_unlock(&tr31d->mutex);
+
+	close(conn->fd);
+	pthread_cond_destroy(&conn->space_cond);
+	pthread_mutex_destroy(&conn->write_mutex);
+	free(conn);
+}
+
+static void tr31d_conn_fail(struct tr31d_conn_t* conn)
+{
+	// stop reading and writing such that neither the connection thread nor
+	// the workers wait for this connection any longer
+	atomic_store(&conn->failed, true);
+	shutdown(conn->fd, SHUT_RDWR);
+}
+
+static void* tr31d_conn_thread(void* arg)
+{
+	struct tr31d_conn_t* conn = arg;
+	struct tr31d_t* tr31d = conn->tr31d;
+	uint8_t hdr[TR31D_REQ_HEADER_LEN];
+
+	while (!atomic_load(&conn->failed)) {
+		uint32_t len;
+		struct tr31d_job_t* job;
+
+		if (tr31d_read_full(conn->fd, hdr, sizeof(hdr))) {
+			// end of stream or connection error
+			break;
+		}
+		memcpy(&len, hdr, sizeof(len));
+		len = ntohl(len);
+		if (len < TR31D_REQ_HEADER_LEN - 4 ||
+			len - (TR31D_REQ_HEADER_LEN - 4) > TR31D_MAX_PAYLOAD_LEN
+		) {
+			// invalid frame; framing cannot be recovered
+			break;
+		}
+
+		job = malloc(sizeof(*job) + len - (TR31D_REQ_HEADER_LEN - 4));
+		if (!job) {
+			break;
+		}
+		job->next = NULL;
+		job->conn = conn;
+		job->start_time = tr31d_now();
+		memcpy(&job->id, hdr + 4, sizeof(job->id)); // echoed as-is
+		job->op = hdr[8];
+		job->version = hdr[9];
+		job->kbpk_index = hdr[10];
+		job->kbpk_new_index = hdr[11];
+		job->import_flags = ((uint16_t)hdr[12] << 8) | hdr[13];
+		job->export_flags = ((uint16_t)hdr[14] << 8) | hdr[15];
+		job->payload_len = len - (TR31D_REQ_HEADER_LEN - 4);
+		if (tr31d_read_full(conn->fd, job->payload, job->payload_len)) {
+			free(job);
+			break;
+		}
+
+		// queue job and wait for space if either the queue is full or this
+		// connection already has its share of the queue, such that clients
+		// that do not read their responses cannot starve other clients
+		pthread_mutex_lock(&tr31d->mutex);
+		while ((tr31d->job_count >= tr31d->queue_size || conn->job_count >= tr31d->conn_queue_size) &&
+			!tr31d->shutdown &&
+			!atomic_load(&conn->failed)
+		) {
+			pthread_cond_wait(&conn->space_cond, &tr31d->mutex);
+		}
+		if (atomic_load(&conn->failed)) {
+			pthread_mutex_unlock(&tr31d->mutex);
+			tr31d_cleanse(job->payload, job->payload_len);
+			free(job);
+			break;
+		}
+		atomic_fetch_add(&conn->refs, 1);
+		++conn->job_count;
+		if (tr31d->job_tail) {
+			tr31d->job_tail->next = job;
+		} else {
+			tr31d->job_head = job;
+		}
+		tr31d->job_tail = job;
+		++tr31d->job_count;
+		pthread_cond_signal(&tr31d->job_cond);
+		pthread_mutex_unlock(&tr31d->mutex);
+	}
+
+	// outstanding requests retain the connection until they complete
+	atomic_store(&conn->closed, true);
+	shutdown(conn->fd, SHUT_RD);
+	tr31d_conn_put(tr31d, conn);
+	return NULL;
+}
+
+static void* tr31d_worker_thread(void* arg)
+{
+	struct tr31d_t* tr31d = arg;
+
+	while (true) {
+		struct tr31d_job_t* job;
+
+		pthread_mutex_lock(&tr31d->mutex);
+		while (!tr31d->job_head && !tr31d->shutdown) {
+			pthread_cond_wait(&tr31d->job_cond, &tr31d->mutex);
+		}
+		job = tr31d->job_head;
+		if (!job) {
+			// shutdown and no jobs remaining
+			pthread_mutex_unlock(&tr31d->mutex);
+			break;
+		}
+		tr31d->job_head = job->next;
+		if (!tr31d->job_head) {
+			tr31d->job_tail = NULL;
+		}
+		if (tr31d->job_count-- == tr31d->queue_size) {
+			// queue is no longer full; any connection may be waiting
+			for (struct tr31d_conn_t* conn = tr31d->conns; conn; conn = conn->next) {
+				pthread_cond_signal(&conn->space_cond);
+			}
+		}
+		pthread_mutex_unlock(&tr31d->mutex);
+
+		tr31d_process(tr31d, job);
+
+		pthread_mutex_lock(&tr31d->mutex);
+		--job->conn->job_count;
+		pthread_cond_signal(&job->conn->space_cond);
+		pthread_mutex_unlock(&tr31d->mutex);
+		tr31d_conn_put(tr31d, job->conn);
+		tr31d_cleanse(job->payload, job->payload_len);
+		free(job);
+	}
+
+	return NULL;
+}
+
+static int tr31d_execute(struct tr31d_t* tr31d, const struct tr31d_req_t* req, uint8_t* out, size_t* out_len)
+{
+	int r;
+	const struct tr31_key_t* kbpk;
+	const struct tr31_key_t* kbpk_new;
+	struct tr31_ctx_t tr31_ctx;
+
+	*out_len = 0;
+	switch (req->op) {
+		case TR31D_OP_IMPORT:
+			if (!req->payload_len) {
+				r = TR31D_ERROR_INVALID_REQUEST;
+				break;
+			}
+			kbpk = tr31d_select_kbpk(tr31d, req->kbpk_index, req->payload[0]);
+			if (!kbpk) {
+				r = TR31D_ERROR_INVALID_REQUEST;
+				break;
+			}
+			r = tr31_import((const char*)req->payload, req->payload_len, kbpk, req->import_flags | TR31_IMPORT_COMPUTE_KCV, &tr31_ctx);
+			if (r) {
+				break;
+			}
+			if (tr31_ctx.key.length + tr31_ctx.key.kcv_len + 1 > TR31D_MAX_PAYLOAD_LEN) {
+				tr31_release(&tr31_ctx);
+				r = TR31D_ERROR_INVALID_REQUEST;
+				break;
+			}
+			out[0] = tr31_ctx.key.kcv_len;
+			memcpy(out + 1, tr31_ctx.key.kcv, tr31_ctx.key.kcv_len);
+			memcpy(out + 1 + tr31_ctx.key.kcv_len, tr31_ctx.key.data, tr31_ctx.key.length);
+			*out_len = 1 + tr31_ctx.key.kcv_len + tr31_ctx.key.length;
+			tr31_release(&tr31_ctx);
+			break;
+
+		case TR31D_OP_EXPORT: {
+			size_t header_len;
+
+			if (req->payload_len < 2) {
+				r = TR31D_ERROR_INVALID_REQUEST;
+				break;
+			}
+			header_len = ((size_t)req->payload[0] << 8) | req->payload[1];
+			if (header_len < 16 || header_len >= req->payload_len - 2) {
+				r = TR31D_ERROR_INVALID_REQUEST;
+				break;
+			}
+			kbpk = tr31d_select_kbpk(tr31d, req->kbpk_index, req->payload[2]);
+			if (!kbpk) {
+				r = TR31D_ERROR_INVALID_REQUEST;
+				break;
+			}
+
+			// populate key block context object from export header
+			r = tr31_init_from_header(
+				(const char*)req->payload + 2,
+				header_len,
+				TR31_IMPORT_NO_STRICT_VALIDATION,
+				&tr31_ctx
+			);
+			if (r) {
+				break;
+			}
+			r = tr31_key_set_data(&tr31_ctx.key, req->payload + 2 + header_len, req->payload_len - 2 - header_len);
+			if (r) {
+				tr31_release(&tr31_ctx);
+				break;
+			}
+			r = tr31_export(&tr31_ctx, kbpk, req->export_flags, (char*)out, TR31D_MAX_PAYLOAD_LEN);
+			tr31_release(&tr31_ctx);
+			if (r) {
+				break;
+			}
+			*out_len = strlen((const char*)out);
+			break;
+		}
+
+		case TR31D_OP_REWRAP:
+			if (!req->payload_len) {
+				r = TR31D_ERROR_INVALID_REQUEST;
+				break;
+			}
+			kbpk = tr31d_select_kbpk(tr31d, req->kbpk_index, req->payload[0]);
+			kbpk_new = tr31d_select_kbpk(tr31d, req->kbpk_new_index, req->version ? req->version : req->payload[0]);
+			if (!kbpk || !kbpk_new) {
+				r = TR31D_ERROR_INVALID_REQUEST;
+				break;
+			}
+			r = tr31_rewrap(
+				(const char*)req->payload,
+				req->payload_len,
+				kbpk,
+				kbpk_new,
+				req->version,
+				req->import_flags,
+				req->export_flags,
+				(char*)out,
+				TR31D_MAX_PAYLOAD_LEN
+			);
+			if (r) {
+				break;
+			}
+			*out_len = strlen((const char*)out);
+			break;
+
+		case TR31D_OP_STATS:
+			*out_len = tr31d_format_stats(tr31d, (char*)out, TR31D_MAX_PAYLOAD_LEN);
+			r = 0;
+			break;
+
+		case TR31D_OP_METRICS: {
+			struct tr31_stats_t stats;
+
+			r = tr31_stats_snapshot(&stats);
+			if (r) {
+				break;
+			}
+			r = tr31_stats_get_prometheus_string(&stats, (char*)out, TR31D_MAX_PAYLOAD_LEN);
+			if (r) {
+				// internal error
+				r = -1;
+				break;
+			}
+			*out_len = strlen((const char*)out);
+			break;
+		}
+
+		default:
+			r = TR31D_ERROR_INVALID_REQUEST;
+			break;
+	}
+
+	return r;
+}
+
+static void tr31d_update_stats(struct tr31d_t* tr31d, unsigned int op, int result, uint64_t start_time)
+{
+	struct tr31d_op_stats_t* stats;
+	uint64_t latency;
+	unsigned int bucket;
+	unsigned long long max;
+
+	if (op >= sizeof(tr31d->stats) / sizeof(tr31d->stats[0])) {
+		return;
+	}
+	stats = &tr31d->stats[op];
+
+	latency = tr31d_now() - start_time;
+	for (bucket = 0; bucket < TR31D_LATENCY_BUCKETS - 1 && (latency >> (bucket + 1)); ++bucket);
+
+	atomic_fetch_add(&stats->requests, 1);
+	if (result) {
+		atomic_fetch_add(&stats->errors, 1);
+	}
+	atomic_fetch_add(&stats->latency_sum, latency);
+	atomic_fetch_add(&stats->latency_buckets[bucket], 1);
+	max = atomic_load(&stats->latency_max);
+	while (latency > max && !atomic_compare_exchange_weak(&stats->latency_max, &max, latency));
+}
+
+static void tr31d_process(struct tr31d_t* tr31d, struct tr31d_job_t* job)
+{
+	int r;
+	uint8_t resp[TR31D_RESP_HEADER_LEN + TR31D_MAX_PAYLOAD_LEN];
+	uint8_t* payload = resp + TR31D_RESP_HEADER_LEN;
+	size_t payload_len = 0;
+	struct tr31d_req_t req;
+	uint32_t value;
+
+	if (atomic_load(&job->conn->failed)) {
+		// response cannot be delivered; skip processing
+		return;
+	}
+
+	req.op = job->op;
+	req.version = job->version;
+	req.kbpk_index = job->kbpk_index;
+	req.kbpk_new_index = job->kbpk_new_index;
+	req.import_flags = job->import_flags;
+	req.export_flags = job->export_flags;
+	req.payload = job->payload;
+	req.payload_len = job->payload_len;
+	if (req.op == TR31D_OP_SHM_ATTACH) {
+		r = tr31d_shm_start(tr31d, job->conn, job->payload, job->payload_len);
+	} else {
+		r = tr31d_execute(tr31d, &req, payload, &payload_len);
+	}
+
+	// populate response header
+	value = htonl(TR31D_RESP_HEADER_LEN - 4 + payload_len);
+	memcpy(resp, &value, sizeof(value));
+	memcpy(resp + 4, &job->id, sizeof(job->id));
+	value = htonl((uint32_t)r);
+	memcpy(resp + 8, &value, sizeof(value));
+
+	// writes are limited by the socket send timeout and a stalled write
+	// fails the connection because framing cannot be recovered
+	pthread_mutex_lock(&job->conn->write_mutex);
+	if (!atomic_load(&job->conn->failed) &&
+		tr31d_write_full(job->conn->fd, resp, TR31D_RESP_HEADER_LEN + payload_len)
+	) {
+		tr31d_conn_fail(job->conn);
+	}
+	pthread_mutex_unlock(&job->conn->write_mutex);
+	tr31d_cleanse(payload, payload_len);
+
+	tr31d_update_stats(tr31d, job->op, r, job->start_time);
+}
+
+static int tr31d_shm_start(struct tr31d_t* tr31d, struct tr31d_conn_t* conn, const uint8_t* name, size_t name_len)
+{
+	int r;
+	struct tr31d_shm_session_t* session;
+	char name_str[256];
+	pthread_t thread;
+
+	if (!name_len || name_len >= sizeof(name_str) || memchr(name, 0, name_len)) {
+		return TR31D_ERROR_INVALID_REQUEST;
+	}
+	memcpy(name_str, name, name_len);
+	name_str[name_len] = 0;
+
+	session = calloc(1, sizeof(*session));
+	if (!session) {
+		return -1;
+	}
+	session->tr31d = tr31d;
+	session->conn = conn;
+	r = tr31d_shm_attach(name_str, &session->shm);
+	if (r) {
+		free(session);
+		return TR31D_ERROR_INVALID_REQUEST;
+	}
+
+	// the session retains the connection until the client disconnects
+	atomic_fetch_add(&conn->refs, 1);
+	r = pthread_create(&thread, NULL, &tr31d_shm_thread, session);
+	if (r) {
+		tr31d_shm_detach(&session->shm);
+		tr31d_conn_put(tr31d, conn);
+		free(session);
+		return -1;
+	}
+	pthread_detach(thread);
+
+	return 0;
+}
+
+static void* tr31d_shm_thread(void* arg)
+{
+	int r;
+	struct tr31d_shm_session_t* session = arg;
+	struct tr31d_t* tr31d = session->tr31d;
+	struct tr31d_shm_t* shm = &session->shm;
+	unsigned int sq_head;
+	unsigned int cq_tail;
+
+	// entries are processed in order by this thread, in place, and without
+	// system calls while the client keeps the submission queue busy
+	sq_head = atomic_load(&shm->hdr->sq.head);
+	cq_tail = atomic_load(&shm->hdr->cq.tail);
+	while (!atomic_load(&session->conn->closed)) {
+		unsigned int sq_tail;
+
+		r = tr31d_shm_ring_wait_entries(shm, &shm->hdr->sq, TR31D_SHM_TIMEOUT_MS);
+		if (r < 0) {
+			// client has detached
+			break;
+		}
+		if (r > 0) {
+			// idle; check connection again
+			continue;
+		}
+
+		sq_tail = atomic_load_explicit(&shm->hdr->sq.tail, memory_order_acquire);
+		while (sq_head != sq_tail) {
+			struct tr31d_shm_sqe_t* sqe = &shm->sqes[sq_head & shm->mask];
+			struct tr31d_shm_cqe_t* cqe = &shm->cqes[cq_tail & shm->mask];
+			struct tr31d_req_t req;
+			uint64_t start_time;
+			size_t payload_len = 0;
+
+			// the client should never exceed the completion queue capacity
+			r = tr31d_shm_ring_wait_space(shm, &shm->hdr->cq, cq_tail, TR31D_SHM_TIMEOUT_MS);
+			if (r < 0 || atomic_load(&session->conn->closed)) {
+				goto exit;
+			}
+			if (r > 0) {
+				continue;
+			}
+
+			// the client may modify the entry at any time, therefore each
+			// field is read exactly once and the payload is copied to
+			// private memory before it is validated and used
+			start_time = tr31d_now();
+			req.op = sqe->op;
+			req.version = sqe->version;
+			req.kbpk_index = sqe->kbpk_index;
+			req.kbpk_new_index = sqe->kbpk_new_index;
+			req.import_flags = sqe->import_flags;
+			req.export_flags = sqe->export_flags;
+			req.payload = session->payload;
+			req.payload_len = sqe->payload_len;
+			cqe->id = sqe->id;
+			if (req.payload_len > TR31D_MAX_PAYLOAD_LEN || req.op == TR31D_OP_SHM_ATTACH) {
+				tr31d_cleanse(sqe->payload, sizeof(sqe->payload));
+				r = TR31D_ERROR_INVALID_REQUEST;
+			} else {
+				// export requests contain cleartext keys that must not
+				// remain in shared memory once the request has been taken
+				memcpy(session->payload, sqe->payload, req.payload_len);
+				tr31d_cleanse(sqe->payload, req.payload_len);
+				r = tr31d_execute(tr31d, &req, cqe->payload, &payload_len);
+				tr31d_cleanse(session->payload, req.payload_len);
+			}
+			cqe->result = r;
+			cqe->payload_len = payload_len;
+			tr31d_update_stats(tr31d, req.op, r, start_time);
+
+			++sq_head;
+			++cq_tail;
+			tr31d_shm_ring_release(&shm->hdr->sq, sq_head);
+			tr31d_shm_ring_publish(&shm->hdr->cq, cq_tail);
+		}
+	}
+
+exit:
+	tr31d_shm_detach(shm);
+	tr31d_conn_put(tr31d, session->conn);
+	free(session);
+	return NULL;
+}
+
+static size_t tr31d_format_stats(struct tr31d_t* tr31d, char* buf, size_t buf_len)
+{
+	static const char* op_names[] = { NULL, "import", "export", "rewrap", "stats" };
+	size_t len = 0;
+	int r;
+
+	r = snprintf(buf, buf_len, "%-8s %12s %12s %10s %10s %10s %10s\n",
+		"op", "requests", "errors", "mean_us", "p50_us", "p99_us", "max_us"
+	);
+	if (r < 0 || (size_t)r >= buf_len) {
+		return 0;
+	}
+	len = r;
+
+	for (size_t op = TR31D_OP_IMPORT; op < sizeof(tr31d->stats) / sizeof(tr31d->stats[0]); ++op) {
+		struct tr31d_op_stats_t* stats = &tr31d->stats[op];
+		unsigned long requests = atomic_load(&stats->requests);
+		unsigned long long percentiles[2] = { 0, 0 };
+		const unsigned long thresholds[2] = {
+			(requests * 50 + 99) / 100,
+			(requests * 99 + 99) / 100,
+		};
+
+		// approximate percentiles using the upper bound of each log2 bucket
+		for (size_t p = 0; p < 2; ++p) {
+			unsigned long count = 0;
+			for (size_t bucket = 0; bucket < TR31D_LATENCY_BUCKETS && requests; ++bucket) {
+				count += atomic_load(&stats->latency_buckets[bucket]);
+				if (count >= thresholds[p]) {
+					percentiles[p] = (2ULL << bucket) - 1;
+					break;
+				}
+			}
+		}
+
+		for (size_t p = 0; p < 2; ++p) {
+			if (percentiles[p] > atomic_load(&stats->latency_max)) {
+				percentiles[p] = atomic_load(&stats->latency_max);
+			}
+		}
+
+		r = snprintf(buf + len, buf_len - len, "%-8s %12lu %12lu %10llu %10llu %10llu %10llu\n",
+			op_names[op],
+			requests,
+			atomic_load(&stats->errors),
+			requests ? atomic_load(&stats->latency_sum) / requests : 0,
+			percentiles[0],
+			percentiles[1],
+			atomic_load(&stats->latency_max)
+		);
+		if (r < 0 || (size_t)r >= buf_len - len) {
+			break;
+		}
+		len += r;
+	}
+
+	return len;
+}
+
+static void signal_handler(int sig)
+{
+	int saved_errno = errno;
+	uint8_t value = sig;
+
+	// wake up the accept loop; nothing else is safe in a signal handler
+	if (write(signal_pipe[1], &value, sizeof(value)) < 0) {
+		// ignore
+	}
+	errno = saved_errno;
+}
+
+int main(int argc, char** argv)
+{
+	int r;
+	struct tr31d_options_t options;
+	struct tr31d_t tr31d;
+	int listen_fd = -1;
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct stat st;
+	struct timeval write_timeout;
+	struct timespec deadline;
+	char stats_buf[1024];
+	bool socket_created = false;
+
+	memset(&options, 0, sizeof(options));
+	memset(&tr31d, 0, sizeof(tr31d));
+	pthread_mutex_init(&tr31d.mutex, NULL);
+	pthread_cond_init(&tr31d.job_cond, NULL);
+	pthread_cond_init(&tr31d.conn_cond, NULL);
+
+	if (argc == 1) {
+		// No command line options
+		argp_help(&argp_config, stdout, ARGP_HELP_STD_HELP, argv[0]);
+		return 1;
+	}
+
+	// parse command line options
+	r = argp_parse(&argp_config, argc, argv, 0, 0, &options);
+	if (r) {
+		fprintf(stderr, "Failed to parse command line\n");
+		return 1;
+	}
+
+	// load key block protection keys once
+	r = tr31d_load_kbpks(options.kbpk_file_path, &tr31d);
+	if (r) {
+		goto exit;
+	}
+
+	// stop gracefully on SIGINT and SIGTERM, and report write errors to
+	// closed connections instead of terminating
+	if (pipe(signal_pipe)) {
+		fprintf(stderr, "Failed to create signal pipe: %s\n", strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	fcntl(signal_pipe[1], F_SETFL, O_NONBLOCK);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// start worker threads
+	tr31d.queue_size = options.queue_size ? options.queue_size : TR31D_DEFAULT_QUEUE_SIZE;
+	tr31d.conn_queue_size = tr31d.queue_size < TR31D_CONN_QUEUE_SIZE ? tr31d.queue_size : TR31D_CONN_QUEUE_SIZE;
+	if (!options.write_timeout_ms) {
+		options.write_timeout_ms = TR31D_DEFAULT_WRITE_TIMEOUT_MS;
+	}
+	write_timeout.tv_sec = options.write_timeout_ms / 1000;
+	write_timeout.tv_usec = (options.write_timeout_ms % 1000) * 1000;
+	tr31d.worker_count = options.threads;
+	if (!tr31d.worker_count) {
+		long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+		tr31d.worker_count = cpu_count > 0 ? cpu_count : 1;
+	}
+	tr31d.workers = calloc(tr31d.worker_count, sizeof(*tr31d.workers));
+	if (!tr31d.workers) {
+		fprintf(stderr, "Memory allocation failed\n");
+		tr31d.worker_count = 0;
+		r = 1;
+		goto exit;
+	}
+	for (unsigned int i = 0; i < tr31d.worker_count; ++i) {
+		r = pthread_create(&tr31d.workers[i], NULL, &tr31d_worker_thread, &tr31d);
+		if (r) {
+			fprintf(stderr, "Failed to start worker thread: %s\n", strerror(r));
+			tr31d.worker_count = i;
+			r = 1;
+			goto exit;
+		}
+	}
+
+	// create socket that is only accessible by the current user
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, options.socket_path, sizeof(addr.sun_path) - 1);
+	if (lstat(options.socket_path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "Socket path \"%s\" already exists and is not a socket\n", options.socket_path);
+			r = 1;
+			goto exit;
+		}
+		// remove stale socket from previous instance
+		unlink(options.socket_path);
+	}
+	umask(0077);
+	if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		fprintf(stderr, "Failed to bind socket \"%s\": %s\n", options.socket_path, strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	socket_created = true;
+	if (listen(listen_fd, SOMAXCONN)) {
+		fprintf(stderr, "Failed to listen on socket \"%s\": %s\n", options.socket_path, strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	fprintf(stderr, "Listening on \"%s\" with %u worker threads and %zu KBPKs\n",
+		options.socket_path,
+		tr31d.worker_count,
+		tr31d.kbpk_count
+	);
+
+	// accept connections until interrupted by a signal
+	while (true) {
+		struct pollfd fds[2] = {
+			{ .fd = listen_fd, .events = POLLIN },
+			{ .fd = signal_pipe[0], .events = POLLIN },
+		};
+		struct tr31d_conn_t* conn;
+		pthread_t thread;
+		int fd;
+
+		r = poll(fds, 2, -1);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "Failed to poll socket: %s\n", strerror(errno));
+			r = 1;
+			goto exit;
+		}
+		if (fds[1].revents) {
+			// interrupted by signal
+			break;
+		}
+		if (!(fds[0].revents & POLLIN)) {
+			continue;
+		}
+
+		fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			continue;
+		}
+		// clients that do not read their responses must not block workers
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &write_timeout, sizeof(write_timeout));
+		conn = calloc(1, sizeof(*conn));
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+		conn->tr31d = &tr31d;
+		conn->fd = fd;
+		pthread_mutex_init(&conn->write_mutex, NULL);
+		pthread_cond_init(&conn->space_cond, NULL);
+		atomic_init(&conn->refs, 1);
+		atomic_init(&conn->failed, false);
+		atomic_init(&conn->closed, false);
+
+		// track connection such that it can be stopped during shutdown
+		pthread_mutex_lock(&tr31d.mutex);
+		conn->next = tr31d.conns;
+		tr31d.conns = conn;
+		++tr31d.conn_count;
+		pthread_mutex_unlock(&tr31d.mutex);
+		if (pthread_create(&thread, NULL, &tr31d_conn_thread, conn)) {
+			// release the reference intended for the connection thread
+			tr31d_conn_put(&tr31d, conn);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	if (listen_fd >= 0) {
+		close(listen_fd);
+	}
+	if (socket_created) {
+		unlink(options.socket_path);
+	}
+
+	// stop reading from connections and wait for outstanding requests
+	pthread_mutex_lock(&tr31d.mutex);
+	for (struct tr31d_conn_t* conn = tr31d.conns; conn; conn = conn->next) {
+		shutdown(conn->fd, SHUT_RD);
+	}
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += TR31D_SHUTDOWN_GRACE_MS / 1000;
+	deadline.tv_nsec += (TR31D_SHUTDOWN_GRACE_MS % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		++deadline.tv_sec;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	while (tr31d.conn_count) {
+		if (pthread_cond_timedwait(&tr31d.conn_cond, &tr31d.mutex, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+
+	// close connections that did not drain during the grace period, such as
+	// those of clients that do not read their responses
+	for (struct tr31d_conn_t* conn = tr31d.conns; conn; conn = conn->next) {
+		tr31d_conn_fail(conn);
+		pthread_cond_signal(&conn->space_cond);
+	}
+	while (tr31d.conn_count) {
+		pthread_cond_wait(&tr31d.conn_cond, &tr31d.mutex);
+	}
+	tr31d.shutdown = true;
+	pthread_cond_broadcast(&tr31d.job_cond);
+	pthread_mutex_unlock(&tr31d.mutex);
+	for (unsigned int i = 0; i < tr31d.worker_count; ++i) {
+		pthread_join(tr31d.workers[i], NULL);
+	}
+	free(tr31d.workers);
+
+	if (!r) {
+		tr31d_format_stats(&tr31d, stats_buf, sizeof(stats_buf));
+		fprintf(stderr, "%s", stats_buf);
+	}
+
+	if (tr31d.kbpks) {
+		for (size_t i = 0; i < tr31d.kbpk_count; ++i) {
+			tr31_key_release(&tr31d.kbpks[i].tdes);
+			tr31_key_release(&tr31d.kbpks[i].aes);
+		}
+		free(tr31d.kbpks);
+	}
+	if (signal_pipe[0] >= 0) {
+		close(signal_pipe[0]);
+		close(signal_pipe[1]);
+	}
+	pthread_cond_destroy(&tr31d.conn_cond);
+	pthread_cond_destroy(&tr31d.job_cond);
+	pthread_mutex_destroy(&tr31d.mutex);
+
+	return r;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file tr31d.h
+ * @brief Protocol definitions for the TR-31 key block daemon
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TR31D_H
+#define TR31D_H
+
+/**
+ * @defgroup tr31d-protocol TR-31 key block daemon protocol
+ * @brief Length-prefixed binary protocol used over the Unix domain socket
+ *
+ * All integers are unsigned and in network byte order, except for the
+ * response result which is a signed 32-bit integer in network byte order.
+ * Every frame starts with a 32-bit length field that specifies the number of
+ * bytes that follow it.
+ *
+ * Request frame:
+ * - length (4 bytes)
+ * - request ID (4 bytes), echoed by the response
+ * - operation (1 byte), see @ref TR31D_OP_IMPORT and friends
+ * - key block format version (1 byte), only for @ref TR31D_OP_REWRAP
+ * - KBPK index (1 byte), zero-based index of KBPK loaded by the daemon
+ * - new KBPK index (1 byte), only for @ref TR31D_OP_REWRAP
+ * - import flags (2 bytes), see @ref import-flags "import flags"
+ * - export flags (2 bytes), see @ref export-flags "export flags"
+ * - payload (remaining bytes)
+ *
+ * Response frame:
+ * - length (4 bytes)
+ * - request ID (4 bytes)
+ * - result (4 bytes). See @ref tr31_error_t
+ * - payload (remaining bytes), only if result is zero
+ *
+ * Requests may be pipelined and are processed concurrently. Responses are
+ * therefore not necessarily in request order and must be matched using the
+ * request ID.
+ *
+ * @{
+ */
+
+#define TR31D_REQ_HEADER_LEN            (16) ///< Length of request frame header, including length field
+#define TR31D_RESP_HEADER_LEN           (12) ///< Length of response frame header, including length field
+#define TR31D_MAX_PAYLOAD_LEN           (16384) ///< Maximum payload length of request or response frame
+
+#define TR31D_ERROR_INVALID_REQUEST     (-3) ///< Response result for unknown operation, unknown KBPK index or malformed payload
+
+/**
+ * Import key block.
+ * Request payload: key block.
+ * Response payload: KCV length (1 byte), KCV and key data.
+ */
+#define TR31D_OP_IMPORT                 (0x01)
+
+/**
+ * Export key block.
+ * Request payload: export header length (2 bytes), export header including
+ * optional blocks (see tr31-tool --export-header) and key data.
+ * Response payload: key block.
+ */
+#define TR31D_OP_EXPORT                 (0x02)
+
+/**
+ * Re-wrap key block from KBPK to new KBPK. See @ref tr31_rewrap()
+ * Request payload: key block.
+ * Response payload: key block.
+ */
+#define TR31D_OP_REWRAP                 (0x03)
+
+/**
+ * Retrieve request and latency statistics.
+ * Request payload: none.
+ * Response payload: human readable statistics.
+ */
+#define TR31D_OP_STATS                  (0x04)
+
+/**
+ * Attach shared memory submission and completion rings. See @ref tr31d-shm
+ * Request payload: name of shared memory object created using
+ * tr31d_shm_create().
+ * Response payload: none.
+ * Requests submitted using the rings are served until the connection is
+ * closed. No further requests may be sent over the connection.
+ */
+#define TR31D_OP_SHM_ATTACH             (0x05)
+
+/**
+ * Retrieve library-wide operation and error counters in Prometheus text
+ * format. See @ref tr31_stats_snapshot()
+ * Request payload: none.
+ * Response payload: Prometheus text exposition format.
+ */
+#define TR31D_OP_METRICS                (0x06)
+
+/// @}
+
+#endif
@@ -0,0 +1,283 @@
+/**
+ * @file tr31_alloc_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// allocation statistics
+struct test_alloc_stats_t {
+	size_t count;
+	size_t bytes;
+	size_t current;
+	size_t peak;
+};
+
+// allocation header used to track the size of each allocation
+union test_alloc_hdr_t {
+	size_t size;
+	max_align_t align;
+};
+
+// allocation thresholds for a key block; lower these when allocations are
+// reduced such that regressions are detected
+struct test_alloc_limits_t {
+	size_t count;
+	size_t bytes;
+	size_t peak;
+};
+
+// key block corpus entry
+struct test_corpus_t {
+	const char* name;
+	unsigned int kbpk_algorithm;
+	const uint8_t* kbpk;
+	size_t kbpk_len;
+	const char* key_block;
+	struct test_alloc_limits_t import_limits;
+	struct test_alloc_limits_t export_limits;
+};
+
+// example data generated using a Thales payShield 10k HSM
+static const uint8_t test1_kbpk[] = { 0xEF, 0xE0, 0x85, 0x3B, 0x25, 0x6B, 0x58, 0x3D, 0x86, 0x8F, 0x25, 0x1C, 0xE9, 0x9E, 0xA1, 0xD9 };
+static const char test1_tr31_format_a[] = "A0072K0TN00N0000F40D5672C6D0EC86F860BA88D44D00F0CA9A8CE8CD2F640287A9A9EB";
+static const char test1_tr31_format_b[] = "B0080K0TN00N00001C414014375212C24995E405B5EE052CB92B67F455EA2680F6751088F9F1C228";
+static const char test1_tr31_format_c[] = "C0072K0TN00N0000C9B875FF7A5316BF221C09ED52080DE0B45632A4EA9CE87699CB565E";
+
+// TR-31:2018, A.7.3.2
+static const uint8_t test5_kbpk[] = { 0x1D, 0x22, 0xBF, 0x32, 0x38, 0x7C, 0x60, 0x0A, 0xD9, 0x7F, 0x9B, 0x97, 0xA5, 0x13, 0x11, 0xAC };
+static const char test5_tr31_ascii[] = "B0104B0TX12S0100KS1800604B120F9292800000BB68BE8680A400D9191AD4ECE45B6E6C0D21C4738A52190E248719E24B433627";
+
+// example data generated using a Thales payShield 10k HSM
+static const uint8_t test7_kbpk[] = {
+	0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+	0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+};
+static const char test7_tr31_ascii[] = "D0112B0TN00N000037DB9B046B7B0048785690759580ABC3B9842AB4BB7717B49E92528E575785D8123559376A2553B27BE94F054F4E971C";
+
+// ISO 20038:2017, B.2
+static const uint8_t test9_kbpk[] = {
+	0x32, 0x35, 0x36, 0x2D, 0x62, 0x69, 0x74, 0x20, 0x41, 0x45, 0x53, 0x20, 0x77, 0x72, 0x61, 0x70,
+	0x70, 0x69, 0x6E, 0x67, 0x20, 0x28, 0x49, 0x53, 0x4F, 0x20, 0x32, 0x30, 0x30, 0x33, 0x38, 0x29,
+};
+static const char test9_tr31_ascii[] = "E0084B0TV16N0000B2AE5E26BBA7F246E84D5EA24167E208A6B66EF2E27E55A52DB52F0AEACB94C57547";
+
+// ANSI X9.143:2021, 8.6
+static const uint8_t test18_kbpk[] = {
+	0x88, 0xE1, 0xAB, 0x2A, 0x2E, 0x3D, 0xD3, 0x8C, 0x1F, 0xA0, 0x39, 0xA5, 0x36, 0x50, 0x0C, 0xC8,
+	0xA8, 0x7A, 0xB9, 0xD6, 0x2D, 0xC9, 0x2C, 0x01, 0x05, 0x8F, 0xA7, 0x9F, 0x44, 0x65, 0x7D, 0xE6,
+};
+static const char test18_tr31_ascii[] =
+	// Header
+	"D1840S0ES00N0400CT000405CC020002F0MIICLjCCAdSgAwIBAgIIGDrdWBxuNpAwCgYIKoZIzj0EAwIwMTEXMBUGA1UECgwOQWxwaGEgTWVyY2hhbnQxFjAUBgNVBAMMDVNhbXBsZSBFQ0MgQ0EwHhcNMjAwODE1MDIxMDEwWhcNMjEwODE1MDIxMDEwWjBPMRcwFQYDVQQKDA5BbHBoYSBNZXJjaGFudDEfMB0GA1UECwwWVExTIENsaWVudCBDZXJ0aWZpY2F0ZTETMBEGA1UEAwwKMTIzNDU2Nzg5MDBZMBMGByqGSM49AgEGCCqGSM49AwEHA0IABEI/SLrH6fITA9y6Y3BneuoT/5+EHSepZxCYeSstGll2sVvmSDZWWSbN6lh5Fb/zagrDjjQ/gZtWIOTf2wL1vSGjgbcwgbQwCQYDVR0TBAIwADAOBgNVHQ8BAf8EBAMCB4AwEwYDVR0lBAwwCgYIKwYBBQUHAwIwHQYDVR0OBBYEFHuvP526vFMywEoVoXZ5aXNfhnfeMB8GA1UdIwQYMBaAFI+ZFhOWF+oMtcfYwg15vH5WmWccMEIGA1UdHwQ7MDkwN6A1oDOGMWh0dHA6Ly9jcmwuYWxwaGEtbWVyY2hhbnQuZXhhbXBsZS9TYW1wbGVFQ0NDQS5jcmwwCgYIKoZIzj0EAwIDSAAwRQIhAPuWWvCTmOdvQzUjCUmTX7H4sX4Ebpw+CI+aOQLu1DqwAiA0eR4FdMtvXV4P6+WMz5B10oea5xtLTfSgoBDoTkvKYQ==0002C4MIICDjCCAbOgAwIBAgIIfnOsCbsxHjwwCgYIKoZIzj0EAwIwNjEXMBUGA1UECgwOQWxwaGEgTWVyY2hhbnQxGzAZBgNVBAMMElNhbXBsZSBSb290IEVDQyBDQTAeFw0yMDA4MTUwMjEwMDlaFw0zMDA4MTMwMjEwMDlaMDExFzAVBgNVBAoMDkFscGhhIE1lcmNoYW50MRYwFAYDVQQDDA1TYW1wbGUgRUNDIENBMFkwEwYHKoZIzj0CAQYIKoZIzj0DAQcDQgAEHCanM9n+Rji+3EROj+HlogmXMU1Fk1td7N3I/8rfFnre1GwWCUqXSePHxwQ9DRHCV3oht3OUU2kDfitfUIujA6OBrzCBrDASBgNVHRMBAf8ECDAGAQH/AgEAMA4GA1UdDwEB/wQEAwIBhjAdBgNVHQ4EFgQUj5kWE5YX6gy1x9jCDXm8flaZZxwwHwYDVR0jBBgwFoAUvElIifFlt6oeUaopV9Y0lJtyPVQwRgYDVR0fBD8wPTA7oDmgN4Y1aHR0cDovL2NybC5hbHBoYS1tZXJjaGFudC5leGFtcGxlL1NhbXBsZVJvb3RFQ0NDQS5jcmwwCgYIKoZIzj0EAwIDSQAwRgIhALT8+DG+++KuqqUGyBQ4YG4s34fqbujclxZTHxYWVVSNAiEAn3v5Xmct7fkLpkjGexiHsy6D90r0K2LlUqpN/069y5s=KP10012331550BC9TS1320200818004100ZPB110000000000000"
+
+	// Encrypted data
+	"23806274FDDE312047FA37117320D914DD1CF20705A140E39FF88DF107110F26DDFDB20AD909B4C67987C76907C6518B63C8BB7969A52BA3EE6218C9B29F02C243D23E5DF5F87D4CBC0E587DD619F1F228D3F605316DC39DDD6E9D13BAB633D13A97BE7EF67DBEECADA32FA968E57BDF87EE5AEAA47CDCF427154AE66508B99E"
+
+	// MAC
+	"F6186011C7BE905F875B24C5D05EA14E";
+
+#define TEST_KBPK(name) name, sizeof(name)
+
+// allocation thresholds for { count, bytes, peak } of import and export as
+// measured on a 64-bit platform; see test_alloc_limits_t
+static const struct test_corpus_t test_corpus[] = {
+	{ "format version A", TR31_KEY_ALGORITHM_TDES, TEST_KBPK(test1_kbpk), test1_tr31_format_a, { 3, 84, 84 }, { 2, 84, 84 } },
+	{ "format version B", TR31_KEY_ALGORITHM_TDES, TEST_KBPK(test1_kbpk), test1_tr31_format_b, { 3, 88, 88 }, { 2, 88, 88 } },
+	{ "format version C", TR31_KEY_ALGORITHM_TDES, TEST_KBPK(test1_kbpk), test1_tr31_format_c, { 3, 84, 84 }, { 2, 84, 84 } },
+	{ "format version B with KS", TR31_KEY_ALGORITHM_TDES, TEST_KBPK(test5_kbpk), test5_tr31_ascii, { 5, 156, 156 }, { 2, 112, 112 } },
+	{ "format version D", TR31_KEY_ALGORITHM_AES, TEST_KBPK(test7_kbpk), test7_tr31_ascii, { 3, 112, 112 }, { 2, 96, 96 } },
+	{ "format version E", TR31_KEY_ALGORITHM_AES, TEST_KBPK(test9_kbpk), test9_tr31_ascii, { 3, 84, 84 }, { 2, 84, 84 } },
+	{ "format version D with CT, KP, TS and PB", TR31_KEY_ALGORITHM_AES, TEST_KBPK(test18_kbpk), test18_tr31_ascii, { 8, 3555, 3555 }, { 2, 1824, 1824 } },
+};
+
+static struct test_alloc_stats_t test_stats;
+
+static void* test_malloc(void* ctx, size_t size)
+{
+	struct test_alloc_stats_t* stats = ctx;
+	union test_alloc_hdr_t* hdr;
+
+	hdr = malloc(sizeof(*hdr) + size);
+	if (!hdr) {
+		return NULL;
+	}
+	hdr->size = size;
+
+	stats->count += 1;
+	stats->bytes += size;
+	stats->current += size;
+	if (stats->current > stats->peak) {
+		stats->peak = stats->current;
+	}
+
+	return hdr + 1;
+}
+
+static void test_free(void* ctx, void* ptr)
+{
+	struct test_alloc_stats_t* stats = ctx;
+	union test_alloc_hdr_t* hdr;
+
+	if (!ptr) {
+		return;
+	}
+	hdr = (union test_alloc_hdr_t*)ptr - 1;
+	stats->current -= hdr->size;
+	free(hdr);
+}
+
+static void* test_realloc(void* ctx, void* ptr, size_t size)
+{
+	union test_alloc_hdr_t* hdr;
+	void* new_ptr;
+
+	if (!ptr) {
+		return test_malloc(ctx, size);
+	}
+
+	// always move such that a reallocation counts as a new allocation
+	new_ptr = test_malloc(ctx, size);
+	if (!new_ptr) {
+		return NULL;
+	}
+	hdr = (union test_alloc_hdr_t*)ptr - 1;
+	memcpy(new_ptr, ptr, hdr->size < size ? hdr->size : size);
+	test_free(ctx, ptr);
+
+	return new_ptr;
+}
+
+static int test_check_limits(
+	const char* name,
+	const char* op,
+	const struct test_alloc_stats_t* stats,
+	const struct test_alloc_limits_t* limits
+)
+{
+	int r = 0;
+
+	printf("%s: %s allocations=%zu bytes=%zu peak=%zu\n",
+		name, op, stats->count, stats->bytes, stats->peak
+	);
+	if (stats->count > limits->count) {
+		fprintf(stderr, "%s: %s allocation count %zu exceeds threshold %zu\n", name, op, stats->count, limits->count);
+		r = 1;
+	}
+	if (stats->bytes > limits->bytes) {
+		fprintf(stderr, "%s: %s allocated bytes %zu exceeds threshold %zu\n", name, op, stats->bytes, limits->bytes);
+		r = 1;
+	}
+	if (stats->peak > limits->peak) {
+		fprintf(stderr, "%s: %s peak heap %zu exceeds threshold %zu\n", name, op, stats->peak, limits->peak);
+		r = 1;
+	}
+	if (!r &&
+		(stats->count < limits->count || stats->bytes < limits->bytes || stats->peak < limits->peak)
+	) {
+		printf("%s: %s allocations are below threshold; consider lowering threshold\n", name, op);
+	}
+
+	return r;
+}
+
+int main(void)
+{
+	int r;
+	const struct tr31_allocator_t allocator = {
+		&test_malloc,
+		&test_realloc,
+		&test_free,
+		&test_stats,
+	};
+	struct tr31_key_t kbpk;
+	struct tr31_ctx_t tr31;
+	char key_block[4096];
+	int failed = 0;
+	int test_failed;
+
+	// all library allocations must use the test allocator, including those
+	// released after the statistics are reset
+	tr31_set_allocator(&allocator);
+
+	for (size_t i = 0; i < sizeof(test_corpus) / sizeof(test_corpus[0]); ++i) {
+		const struct test_corpus_t* entry = &test_corpus[i];
+
+		printf("Test %zu (%s)...\n", i + 1, entry->name);
+
+		// populate key block protection key without allocation
+		memset(&kbpk, 0, sizeof(kbpk));
+		kbpk.usage = TR31_KEY_USAGE_KEK;
+		kbpk.algorithm = entry->kbpk_algorithm;
+		kbpk.mode_of_use = TR31_KEY_MODE_OF_USE_ENC_DEC;
+		kbpk.length = entry->kbpk_len;
+		kbpk.data = (void*)entry->kbpk;
+
+		memset(&test_stats, 0, sizeof(test_stats));
+		r = tr31_import(entry->key_block, strlen(entry->key_block), &kbpk, 0, &tr31);
+		if (r) {
+			fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		test_failed = test_check_limits(entry->name, "import", &test_stats, &entry->import_limits);
+
+		// exclude memory retained by the imported context object
+		test_stats.count = 0;
+		test_stats.bytes = 0;
+		test_stats.peak = test_stats.current;
+		r = tr31_export(&tr31, &kbpk, 0, key_block, sizeof(key_block));
+		if (r) {
+			fprintf(stderr, "tr31_export() error %d: %s\n", r, tr31_get_error_string(r));
+			tr31_release(&tr31);
+			r = 1;
+			goto exit;
+		}
+		test_stats.peak -= test_stats.current;
+		test_failed |= test_check_limits(entry->name, "export", &test_stats, &entry->export_limits);
+
+		tr31_release(&tr31);
+		if (test_stats.current) {
+			fprintf(stderr, "%s: %zu bytes not released\n", entry->name, test_stats.current);
+			r = 1;
+			goto exit;
+		}
+
+		printf("Test %zu (%s) %s\n", i + 1, entry->name, test_failed ? "failed" : "success");
+		failed |= test_failed;
+	}
+
+	if (failed) {
+		r = 1;
+		goto exit;
+	}
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_set_allocator(NULL);
+	return r;
+}
@@ -36,6 +36,47 @@ static const uint8_t test4_ksn_verify[] = { 0xFF, 0xFF, 0x00, 0xA0, 0x20, 0x00,
 static const uint8_t test4_kcv_verify[] = { 0x01, 0x69, 0xE3 };
 static const uint8_t test4_kcv_kbpk_verify[] = { 0xEC, 0xAD, 0x62 };
 
+static const char test5_tr31_ascii[] = "D0176D0TB00S0300TC1B2017-05-17T19:41:38.21ZTS1B2018-06-18T20:42:39.22ZPB0A0tGy4eABD31E32E882F6BC6E198890F6EDA720396691AC57710BBC6CF22CC164A1E80D06FE38EE315657DD0DA9ED1EDC6754B2";
+static const int64_t test5_tc_seconds_verify = 1495050098; // 2017-05-17T19:41:38Z
+static const unsigned int test5_tc_centiseconds_verify = 21;
+static const int64_t test5_ts_seconds_verify = 1529354559; // 2018-06-18T20:42:39Z
+static const unsigned int test5_ts_centiseconds_verify = 22;
+
+// ISO 8601 formats of optional blocks TC and TS
+// see ANSI X9.143:2021, 6.3.6.13, table 21
+// see ANSI X9.143:2021, 6.3.6.14, table 22
+struct test6_iso8601_t {
+	const char* str;
+	int r;
+	int64_t seconds;
+	unsigned int centiseconds;
+};
+static const struct test6_iso8601_t test6_iso8601[] = {
+	{ "20190717181929Z", 0, 1563387569, 0 },
+	{ "2019071718192921Z", 0, 1563387569, 21 },
+	{ "2017-05-17T19:41:38Z", 0, 1495050098, 0 },
+	{ "2017-05-17T19:41:38.99Z", 0, 1495050098, 99 },
+	{ "20240229235959Z", 0, 1709251199, 0 },
+	{ "19691231235959Z", 0, -1, 0 },
+	{ "0001-01-01T00:00:00Z", 0, -62135596800, 0 },
+	{ "9999-12-31T23:59:59Z", 0, 253402300799, 0 },
+	{ "20230229000000Z", TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA, 0, 0 }, // not a leap year
+	{ "20190017181929Z", TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA, 0, 0 }, // invalid month
+	{ "20190431181929Z", TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA, 0, 0 }, // invalid day
+	{ "20190717241929Z", TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA, 0, 0 }, // invalid hour
+	{ "2019071718192 Z", TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA, 0, 0 }, // invalid digit
+	{ "20190717181929+", TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA, 0, 0 }, // not UTC
+	{ "2017-05-17 19:41:38Z", TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA, 0, 0 }, // invalid delimiter
+	{ "2017-05-17T19:41:38,99Z", TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA, 0, 0 }, // invalid decimal sign
+	{ "201907171819Z", TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA, 0, 0 }, // invalid length
+};
+
+// more Derivation Allowed (DA) attributes than TR31_OPT_BLOCKS_DECODED_DA_MAX
+static const char test8_da[] =
+	"B0TXN" "B1TXN" "B2AXN" "P0TEN" "P0AEN" "D0AEN" "D0ADN" "K0TEN"
+	"K0AEN" "K1TBN" "K1ABN" "M3TCN" "M6ACN" "M7ACN" "E0TXN" "E1TXN"
+	"V2TCN";
+
 int main(void)
 {
 	int r;
@@ -43,6 +84,9 @@ int main(void)
 	const struct tr31_opt_ctx_t* opt_ctx;
 	uint8_t tmp[32];
 	struct tr31_opt_blk_kcv_data_t kcv_data;
+	struct tr31_opt_blk_time_data_t time_data;
+	struct tr31_key_t test_key;
+	struct tr31_opt_blocks_decoded_t opt_blocks_decoded;
 
 	// test key block decoding for format version B with optional block KS
 	printf("Test 1 (Format version B with optional block KS)...\n");
@@ -254,6 +298,182 @@ int main(void)
 	}
 	tr31_release(&test_tr31);
 
+	// test key block decoding for format version D with optional blocks TC and TS
+	printf("Test 5 (Format version D with optional blocks TC and TS)...\n");
+	r = tr31_import(test5_tr31_ascii, strlen(test5_tr31_ascii), NULL, 0, &test_tr31);
+	if (r) {
+		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+		goto exit;
+	}
+	opt_ctx = tr31_opt_block_find(&test_tr31, TR31_OPT_BLOCK_TC);
+	if (!opt_ctx) {
+		fprintf(stderr, "tr31_opt_block_find() failed\n");
+		r = 1;
+		goto exit;
+	}
+	memset(&time_data, 0, sizeof(time_data));
+	r = tr31_opt_block_decode_TC(opt_ctx, &time_data);
+	if (r) {
+		fprintf(stderr, "tr31_opt_block_decode_TC() failed; r=%d\n", r);
+		goto exit;
+	}
+	if (time_data.seconds != test5_tc_seconds_verify ||
+		time_data.centiseconds != test5_tc_centiseconds_verify
+	) {
+		fprintf(stderr, "TR-31 optional block TC decoded data is incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	r = tr31_opt_block_decode_TS(opt_ctx, &time_data);
+	if (r >= 0) {
+		fprintf(stderr, "tr31_opt_block_decode_TS() did not fail for optional block TC; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	opt_ctx = tr31_opt_block_find(&test_tr31, TR31_OPT_BLOCK_TS);
+	if (!opt_ctx) {
+		fprintf(stderr, "tr31_opt_block_find() failed\n");
+		r = 1;
+		goto exit;
+	}
+	memset(&time_data, 0, sizeof(time_data));
+	r = tr31_opt_block_decode_TS(opt_ctx, &time_data);
+	if (r) {
+		fprintf(stderr, "tr31_opt_block_decode_TS() failed; r=%d\n", r);
+		goto exit;
+	}
+	if (time_data.seconds != test5_ts_seconds_verify ||
+		time_data.centiseconds != test5_ts_centiseconds_verify
+	) {
+		fprintf(stderr, "TR-31 optional block TS decoded data is incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	tr31_release(&test_tr31);
+
+	// test decoding of all ISO 8601 formats and invalid dates/times
+	printf("Test 6 (ISO 8601 formats of optional blocks TC and TS)...\n");
+	for (size_t i = 0; i < sizeof(test6_iso8601) / sizeof(test6_iso8601[0]); ++i) {
+		struct tr31_opt_ctx_t test6_opt_ctx;
+
+		test6_opt_ctx.id = TR31_OPT_BLOCK_TS;
+		test6_opt_ctx.data_length = strlen(test6_iso8601[i].str);
+		test6_opt_ctx.data = (void*)test6_iso8601[i].str;
+		memset(&time_data, 0, sizeof(time_data));
+		r = tr31_opt_block_decode_TS(&test6_opt_ctx, &time_data);
+		if (r != test6_iso8601[i].r) {
+			fprintf(stderr, "tr31_opt_block_decode_TS(\"%s\") returned %d; expected %d\n", test6_iso8601[i].str, r, test6_iso8601[i].r);
+			r = 1;
+			goto exit;
+		}
+		if (!r && (
+			time_data.seconds != test6_iso8601[i].seconds ||
+			time_data.centiseconds != test6_iso8601[i].centiseconds
+		)) {
+			fprintf(stderr, "tr31_opt_block_decode_TS(\"%s\") decoded data is incorrect\n", test6_iso8601[i].str);
+			r = 1;
+			goto exit;
+		}
+	}
+
+	// test decoding of all optional blocks at once
+	printf("Test 7 (Decode all optional blocks KS, KC, KP)...\n");
+	r = tr31_import(test4_tr31_ascii, strlen(test4_tr31_ascii), NULL, 0, &test_tr31);
+	if (r) {
+		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+		goto exit;
+	}
+	r = tr31_opt_blocks_decode_all(&test_tr31, &opt_blocks_decoded);
+	if (r) {
+		fprintf(stderr, "tr31_opt_blocks_decode_all() failed; r=%d\n", r);
+		goto exit;
+	}
+	if (opt_blocks_decoded.present != (TR31_OPT_BLOCKS_DECODED_KS | TR31_OPT_BLOCKS_DECODED_KC | TR31_OPT_BLOCKS_DECODED_KP) ||
+		opt_blocks_decoded.invalid != 0 ||
+		opt_blocks_decoded.iksn_len != sizeof(test4_ksn_verify) ||
+		memcmp(opt_blocks_decoded.iksn, test4_ksn_verify, sizeof(test4_ksn_verify)) != 0 ||
+		opt_blocks_decoded.kc.kcv_algorithm != TR31_OPT_BLOCK_KCV_LEGACY ||
+		opt_blocks_decoded.kc.kcv_len != sizeof(test4_kcv_verify) ||
+		memcmp(opt_blocks_decoded.kc.kcv, test4_kcv_verify, sizeof(test4_kcv_verify)) != 0 ||
+		opt_blocks_decoded.kp.kcv_algorithm != TR31_OPT_BLOCK_KCV_LEGACY ||
+		opt_blocks_decoded.kp.kcv_len != sizeof(test4_kcv_kbpk_verify) ||
+		memcmp(opt_blocks_decoded.kp.kcv, test4_kcv_kbpk_verify, sizeof(test4_kcv_kbpk_verify)) != 0
+	) {
+		fprintf(stderr, "Decoded optional blocks are incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	tr31_release(&test_tr31);
+
+	printf("Test 8 (Decode all optional blocks DA, TC and invalid WP)...\n");
+	r = tr31_key_init(
+		TR31_KEY_USAGE_BDK,
+		TR31_KEY_ALGORITHM_AES,
+		TR31_KEY_MODE_OF_USE_DERIVE,
+		"00",
+		TR31_KEY_EXPORT_TRUSTED,
+		TR31_KEY_CONTEXT_NONE,
+		NULL,
+		0,
+		&test_key
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		goto exit;
+	}
+	r = tr31_init(TR31_VERSION_D, &test_key, &test_tr31);
+	tr31_key_release(&test_key);
+	if (r) {
+		fprintf(stderr, "tr31_init() error %d: %s\n", r, tr31_get_error_string(r));
+		goto exit;
+	}
+	r = tr31_opt_block_add_DA(&test_tr31, test8_da, strlen(test8_da));
+	if (r) {
+		fprintf(stderr, "tr31_opt_block_add_DA() error %d: %s\n", r, tr31_get_error_string(r));
+		goto exit;
+	}
+	r = tr31_opt_block_add_TC(&test_tr31, "2017-05-17T19:41:38.21Z");
+	if (r) {
+		fprintf(stderr, "tr31_opt_block_add_TC() error %d: %s\n", r, tr31_get_error_string(r));
+		goto exit;
+	}
+	r = tr31_opt_block_add_WP(&test_tr31, 1);
+	if (r) {
+		fprintf(stderr, "tr31_opt_block_add_WP() error %d: %s\n", r, tr31_get_error_string(r));
+		goto exit;
+	}
+	// invalidate wrapping pedigree
+	opt_ctx = tr31_opt_block_find(&test_tr31, TR31_OPT_BLOCK_WP);
+	if (!opt_ctx) {
+		fprintf(stderr, "tr31_opt_block_find() failed\n");
+		r = 1;
+		goto exit;
+	}
+	((char*)opt_ctx->data)[2] = '9';
+	r = tr31_opt_blocks_decode_all(&test_tr31, &opt_blocks_decoded);
+	if (r != TR31_ERROR_INVALID_OPTIONAL_BLOCK_DATA) {
+		fprintf(stderr, "tr31_opt_blocks_decode_all() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	if (opt_blocks_decoded.present != (TR31_OPT_BLOCKS_DECODED_DA | TR31_OPT_BLOCKS_DECODED_TC) ||
+		opt_blocks_decoded.invalid != TR31_OPT_BLOCKS_DECODED_WP ||
+		opt_blocks_decoded.da_version != TR31_OPT_BLOCK_DA_VERSION_1 ||
+		opt_blocks_decoded.da_count != 17 ||
+		opt_blocks_decoded.da[0].key_usage != TR31_KEY_USAGE_BDK ||
+		opt_blocks_decoded.da[0].algorithm != TR31_KEY_ALGORITHM_TDES ||
+		opt_blocks_decoded.da[0].mode_of_use != TR31_KEY_MODE_OF_USE_DERIVE ||
+		opt_blocks_decoded.da[0].exportability != TR31_KEY_EXPORT_NONE ||
+		opt_blocks_decoded.da[15].key_usage != TR31_KEY_USAGE_EMV_MKSMC ||
+		opt_blocks_decoded.da[15].algorithm != TR31_KEY_ALGORITHM_TDES ||
+		opt_blocks_decoded.tc.seconds != test5_tc_seconds_verify ||
+		opt_blocks_decoded.tc.centiseconds != test5_tc_centiseconds_verify
+	) {
+		fprintf(stderr, "Decoded optional blocks are incorrect\n");
+		r = 1;
+		goto exit;
+	}
+
 	printf("All tests passed.\n");
 	r = 0;
 	goto exit;
@@ -230,6 +230,11 @@ int main(void)
 		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
 		goto exit;
 	}
+	if (test_tr31.key.kcv_len) {
+		fprintf(stderr, "TR-31 key data KCV computed during import\n");
+		r = 1;
+		goto exit;
+	}
 	if (test_tr31.version != TR31_VERSION_A ||
 		test_tr31.length != 72 ||
 		test_tr31.key.usage != TR31_KEY_USAGE_KEK ||
@@ -253,7 +258,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test1_tr31_kcv_verify, sizeof(test1_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test1_tr31_kcv_verify, sizeof(test1_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -262,11 +268,16 @@ int main(void)
 
 	// test key block decryption for format version B
 	printf("Test 1 (Basic format version B)...\n");
-	r = tr31_import(test1_tr31_format_b, strlen(test1_tr31_format_b), &test_kbpk, 0, &test_tr31);
+	r = tr31_import(test1_tr31_format_b, strlen(test1_tr31_format_b), &test_kbpk, TR31_IMPORT_COMPUTE_KCV, &test_tr31);
 	if (r) {
 		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
 		goto exit;
 	}
+	if (test_tr31.key.kcv_len != sizeof(test1_tr31_kcv_verify)) {
+		fprintf(stderr, "TR-31 key data KCV not computed during import\n");
+		r = 1;
+		goto exit;
+	}
 	if (test_tr31.version != TR31_VERSION_B ||
 		test_tr31.length != 80 ||
 		test_tr31.key.usage != TR31_KEY_USAGE_KEK ||
@@ -290,7 +301,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test1_tr31_kcv_verify, sizeof(test1_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test1_tr31_kcv_verify, sizeof(test1_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -327,7 +339,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test1_tr31_kcv_verify, sizeof(test1_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test1_tr31_kcv_verify, sizeof(test1_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -370,7 +383,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test2_tr31_kcv_verify, sizeof(test2_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test2_tr31_kcv_verify, sizeof(test2_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -413,7 +427,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test3_tr31_kcv_verify, sizeof(test3_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test3_tr31_kcv_verify, sizeof(test3_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -458,7 +473,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test4_tr31_kcv_verify, sizeof(test4_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test4_tr31_kcv_verify, sizeof(test4_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -525,7 +541,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test5_tr31_kcv_verify, sizeof(test5_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test5_tr31_kcv_verify, sizeof(test5_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -590,7 +607,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test6_tr31_kcv_verify, sizeof(test6_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test6_tr31_kcv_verify, sizeof(test6_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -633,7 +651,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test7_tr31_kcv_verify, sizeof(test7_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test7_tr31_kcv_verify, sizeof(test7_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -676,7 +695,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test8_tr31_kcv_verify, sizeof(test8_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test8_tr31_kcv_verify, sizeof(test8_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -719,7 +739,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test9_tr31_kcv_verify, sizeof(test9_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test9_tr31_kcv_verify, sizeof(test9_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -762,7 +783,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test10_tr31_kcv_verify, sizeof(test10_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test10_tr31_kcv_verify, sizeof(test10_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -805,7 +827,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test11_tr31_kcv_verify, sizeof(test11_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test11_tr31_kcv_verify, sizeof(test11_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -850,7 +873,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test15_tr31_kcv_verify, sizeof(test15_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test15_tr31_kcv_verify, sizeof(test15_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -917,7 +941,8 @@ int main(void)
 		r = 1;
 		goto exit;
 	}
-	if (memcmp(test_tr31.key.kcv, test16_tr31_kcv_verify, sizeof(test16_tr31_kcv_verify)) != 0) {
+	r = tr31_key_get_kcv(&test_tr31.key);
+	if (r || memcmp(test_tr31.key.kcv, test16_tr31_kcv_verify, sizeof(test16_tr31_kcv_verify)) != 0) {
 		fprintf(stderr, "TR-31 key data KCV is incorrect\n");
 		r = 1;
 		goto exit;
@@ -0,0 +1,207 @@
+/**
+ * @file tr31_engine_hpp_test.cpp
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+#include "tr31_engine.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <thread>
+
+#define TEST_REQ_COUNT (64)
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const char test_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const std::uint8_t test_kbpk_data[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+static const std::uint8_t test_key_data[] = { 0xBF, 0x82, 0xDA, 0xC6, 0xA3, 0x3D, 0xF9, 0x2C, 0xE6, 0x6E, 0x15, 0xB7, 0x0E, 0x5D, 0xCE, 0xB6 };
+
+static char key_blocks[TEST_REQ_COUNT][1024];
+static int results[TEST_REQ_COUNT];
+static std::size_t completed_count;
+
+static const char* test_error_string(int r)
+{
+	return tr31_get_error_string(static_cast<enum tr31_error_t>(r));
+}
+
+// coroutine that starts immediately and is destroyed once it completes
+struct test_task {
+	struct promise_type {
+		test_task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
+
+static test_task test_import(
+	tr31::engine& engine,
+	const struct tr31_key_t* kbpk,
+	struct tr31_ctx_t* ctx,
+	int* result
+)
+{
+	*result = co_await engine.import(test_key_block, std::strlen(test_key_block), kbpk, 0, ctx);
+	++completed_count;
+}
+
+static test_task test_export(
+	tr31::engine& engine,
+	const struct tr31_ctx_t* ctx,
+	const struct tr31_key_t* kbpk,
+	std::size_t i
+)
+{
+	results[i] = co_await engine.export_(ctx, kbpk, 0, key_blocks[i], sizeof(key_blocks[i]));
+	++completed_count;
+}
+
+static void test_wait(tr31::engine& engine, std::size_t count)
+{
+	// coroutines are resumed by the thread that calls dispatch()
+	while (completed_count < count) {
+		if (!engine.dispatch()) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+int main(void)
+{
+	int r;
+	struct tr31_key_t kbpk;
+	struct tr31_ctx_t import_ctx{};
+	struct tr31_ctx_t export_ctx{};
+	struct tr31_ctx_t verify_ctx{};
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		test_kbpk_data,
+		sizeof(test_kbpk_data),
+		&kbpk
+	);
+	if (r) {
+		std::fprintf(stderr, "tr31_key_init() error %d: %s\n", r, test_error_string(r));
+		return 1;
+	}
+
+	try {
+		tr31::engine engine(4, TEST_REQ_COUNT);
+
+		std::printf("Test 1 (awaitable import)...\n");
+		completed_count = 0;
+		test_import(engine, &kbpk, &import_ctx, &r);
+		test_wait(engine, 1);
+		if (r) {
+			std::fprintf(stderr, "engine::import() error %d: %s\n", r, test_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		if (import_ctx.key.length != sizeof(test_key_data) ||
+			std::memcmp(import_ctx.key.data, test_key_data, sizeof(test_key_data)) != 0
+		) {
+			std::fprintf(stderr, "engine::import() key data is incorrect\n");
+			r = 1;
+			goto exit;
+		}
+		std::printf("All tests passed.\n");
+
+		std::printf("Test 2 (concurrent awaitable exports sharing context)...\n");
+		r = tr31_init(TR31_VERSION_B, &import_ctx.key, &export_ctx);
+		if (r) {
+			std::fprintf(stderr, "tr31_init() error %d: %s\n", r, test_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		r = tr31_opt_block_add_KC(&export_ctx);
+		if (r) {
+			std::fprintf(stderr, "tr31_opt_block_add_KC() error %d: %s\n", r, test_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		r = tr31_opt_block_add_KP(&export_ctx);
+		if (r) {
+			std::fprintf(stderr, "tr31_opt_block_add_KP() error %d: %s\n", r, test_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		completed_count = 0;
+		for (std::size_t i = 0; i < TEST_REQ_COUNT; ++i) {
+			test_export(engine, &export_ctx, &kbpk, i);
+		}
+		test_wait(engine, TEST_REQ_COUNT);
+
+		// shared context object must remain unmodified
+		for (std::size_t i = 0; i < export_ctx.opt_blocks_count; ++i) {
+			if (export_ctx.opt_blocks[i].data_length || export_ctx.opt_blocks[i].data) {
+				std::fprintf(stderr, "Shared context object was modified\n");
+				r = 1;
+				goto exit;
+			}
+		}
+		for (std::size_t i = 0; i < TEST_REQ_COUNT; ++i) {
+			if (results[i]) {
+				std::fprintf(stderr, "Request %zu error %d: %s\n", i, results[i], test_error_string(results[i]));
+				r = 1;
+				goto exit;
+			}
+			r = tr31_import(key_blocks[i], std::strlen(key_blocks[i]), &kbpk, 0, &verify_ctx);
+			if (r) {
+				std::fprintf(stderr, "Request %zu tr31_import() error %d: %s\n", i, r, test_error_string(r));
+				r = 1;
+				goto exit;
+			}
+			if (verify_ctx.key.length != sizeof(test_key_data) ||
+				std::memcmp(verify_ctx.key.data, test_key_data, sizeof(test_key_data)) != 0 ||
+				!tr31_opt_block_find(&verify_ctx, TR31_OPT_BLOCK_KC) ||
+				!tr31_opt_block_find(&verify_ctx, TR31_OPT_BLOCK_KP)
+			) {
+				std::fprintf(stderr, "Request %zu key block is incorrect\n", i);
+				r = 1;
+				goto exit;
+			}
+			tr31_release(&verify_ctx);
+		}
+		std::printf("All tests passed.\n");
+	} catch (const std::bad_alloc&) {
+		std::fprintf(stderr, "tr31::engine() failed\n");
+		r = 1;
+		goto exit;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_release(&verify_ctx);
+	tr31_release(&export_ctx);
+	tr31_release(&import_ctx);
+	tr31_key_release(&kbpk);
+	return r;
+}
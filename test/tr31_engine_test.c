@@ -0,0 +1,240 @@
+/**
+ * @file tr31_engine_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+#include "tr31_engine.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_REQ_COUNT (256)
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const char test_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const char test_key_block_corrupt[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E6";
+static const uint8_t test_kbpk_data[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+static const uint8_t test_key_data[] = { 0xBF, 0x82, 0xDA, 0xC6, 0xA3, 0x3D, 0xF9, 0x2C, 0xE6, 0x6E, 0x15, 0xB7, 0x0E, 0x5D, 0xCE, 0xB6 };
+
+static struct tr31_engine_req_t reqs[TEST_REQ_COUNT];
+static struct tr31_ctx_t ctxs[TEST_REQ_COUNT];
+static char key_blocks[TEST_REQ_COUNT][1024];
+static atomic_size_t callback_count;
+
+static void test_callback(struct tr31_engine_req_t* req)
+{
+	// user data must be provided unchanged
+	if (req->user_data != &reqs[req - reqs]) {
+		req->result = -1;
+	}
+	atomic_fetch_add(&callback_count, 1);
+}
+
+static int verify_import(size_t i, int expected_result)
+{
+	if (reqs[i].result != expected_result) {
+		fprintf(stderr, "Request %zu unexpected result %d: %s\n", i, reqs[i].result, tr31_get_error_string(reqs[i].result));
+		return 1;
+	}
+	if (expected_result) {
+		return 0;
+	}
+	if (ctxs[i].key.length != sizeof(test_key_data) ||
+		memcmp(ctxs[i].key.data, test_key_data, sizeof(test_key_data)) != 0
+	) {
+		fprintf(stderr, "Request %zu key data is incorrect\n", i);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int r;
+	struct tr31_key_t kbpk;
+	struct tr31_engine_t* engine = NULL;
+	struct tr31_engine_req_t* completed[16];
+	size_t completed_count;
+	size_t submitted;
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		test_kbpk_data,
+		sizeof(test_kbpk_data),
+		&kbpk
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+
+	engine = tr31_engine_create(4, TEST_REQ_COUNT);
+	if (!engine) {
+		fprintf(stderr, "tr31_engine_create() failed\n");
+		r = 1;
+		goto exit;
+	}
+
+	printf("Test 1 (asynchronous import with callback)...\n");
+	atomic_init(&callback_count, 0);
+	for (size_t i = 0; i < TEST_REQ_COUNT; ++i) {
+		r = tr31_import_async(
+			engine,
+			i == 42 ? test_key_block_corrupt : test_key_block,
+			strlen(test_key_block),
+			&kbpk,
+			0,
+			&ctxs[i],
+			&test_callback,
+			&reqs[i],
+			&reqs[i]
+		);
+		if (r) {
+			fprintf(stderr, "tr31_import_async() error %d\n", r);
+			r = 1;
+			goto exit;
+		}
+	}
+	while (atomic_load(&callback_count) < TEST_REQ_COUNT) {
+		// wait for all callbacks
+	}
+	for (size_t i = 0; i < TEST_REQ_COUNT; ++i) {
+		r = verify_import(i, i == 42 ? TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED : 0);
+		if (r) {
+			goto exit;
+		}
+	}
+	printf("Test 1 (asynchronous import with callback) success\n");
+
+	printf("Test 2 (asynchronous export with completion queue)...\n");
+	for (size_t i = 0; i < TEST_REQ_COUNT; ++i) {
+		r = tr31_export_async(
+			engine,
+			&ctxs[0],
+			&kbpk,
+			0,
+			key_blocks[i],
+			sizeof(key_blocks[i]),
+			NULL,
+			NULL,
+			&reqs[i]
+		);
+		if (r) {
+			fprintf(stderr, "tr31_export_async() error %d\n", r);
+			r = 1;
+			goto exit;
+		}
+	}
+	completed_count = 0;
+	while (completed_count < TEST_REQ_COUNT) {
+		size_t count;
+
+		count = tr31_engine_poll(engine, completed, sizeof(completed) / sizeof(completed[0]));
+		for (size_t i = 0; i < count; ++i) {
+			if (completed[i]->result) {
+				fprintf(stderr, "Request %zu error %d: %s\n", (size_t)(completed[i] - reqs), completed[i]->result, tr31_get_error_string(completed[i]->result));
+				r = 1;
+				goto exit;
+			}
+		}
+		completed_count += count;
+	}
+	for (size_t i = 0; i < TEST_REQ_COUNT; ++i) {
+		tr31_release(&ctxs[i]);
+		r = tr31_import(key_blocks[i], strlen(key_blocks[i]), &kbpk, 0, &ctxs[i]);
+		reqs[i].result = r;
+		r = verify_import(i, 0);
+		if (r) {
+			goto exit;
+		}
+	}
+	printf("Test 2 (asynchronous export with completion queue) success\n");
+
+	printf("Test 3 (engine capacity)...\n");
+	for (size_t i = 0; i < TEST_REQ_COUNT; ++i) {
+		tr31_release(&ctxs[i]);
+	}
+	tr31_engine_destroy(engine);
+	engine = tr31_engine_create(2, 3); // rounded up to 4
+	if (!engine) {
+		fprintf(stderr, "tr31_engine_create() failed\n");
+		r = 1;
+		goto exit;
+	}
+	submitted = 0;
+	completed_count = 0;
+	while (completed_count < TEST_REQ_COUNT) {
+		while (submitted < TEST_REQ_COUNT) {
+			r = tr31_import_async(
+				engine,
+				test_key_block,
+				strlen(test_key_block),
+				&kbpk,
+				0,
+				&ctxs[submitted],
+				NULL,
+				NULL,
+				&reqs[submitted]
+			);
+			if (r == TR31_ENGINE_BUSY) {
+				break;
+			}
+			if (r) {
+				fprintf(stderr, "tr31_import_async() error %d\n", r);
+				r = 1;
+				goto exit;
+			}
+			++submitted;
+		}
+		if (submitted - completed_count > 4) {
+			fprintf(stderr, "Engine capacity exceeded\n");
+			r = 1;
+			goto exit;
+		}
+		completed_count += tr31_engine_poll(engine, completed, sizeof(completed) / sizeof(completed[0]));
+	}
+	for (size_t i = 0; i < TEST_REQ_COUNT; ++i) {
+		r = verify_import(i, 0);
+		if (r) {
+			goto exit;
+		}
+	}
+	printf("Test 3 (engine capacity) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_engine_destroy(engine);
+	for (size_t i = 0; i < TEST_REQ_COUNT; ++i) {
+		tr31_release(&ctxs[i]);
+	}
+	tr31_key_release(&kbpk);
+
+	return r;
+}
@@ -0,0 +1,321 @@
+/**
+ * @file tr31_keyring_stress_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const uint8_t test1_kbpk[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+static const char test1_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const uint8_t test1_key_verify[] = { 0xBF, 0x82, 0xDA, 0xC6, 0xA3, 0x3D, 0xF9, 0x2C, 0xE6, 0x6E, 0x15, 0xB7, 0x0E, 0x5D, 0xCE, 0xB6 };
+
+// example data generated using a Thales payShield 10k HSM
+static const uint8_t test2_kbpk[] = { 0xEF, 0xE0, 0x85, 0x3B, 0x25, 0x6B, 0x58, 0x3D, 0x86, 0x8F, 0x25, 0x1C, 0xE9, 0x9E, 0xA1, 0xD9 };
+static const char test2_key_block[] = "B0080K0TN00N00001C414014375212C24995E405B5EE052CB92B67F455EA2680F6751088F9F1C228";
+static const uint8_t test2_key_verify[] = { 0x5D, 0xB5, 0x0B, 0x45, 0x4F, 0x83, 0x89, 0xAD, 0xCE, 0x57, 0x3B, 0xE5, 0x08, 0x61, 0xF2, 0xBF };
+
+// TR-31:2018, A.7.4
+static const uint8_t test3_kbpk[] = {
+	0x88, 0xE1, 0xAB, 0x2A, 0x2E, 0x3D, 0xD3, 0x8C, 0x1F, 0xA0, 0x39, 0xA5, 0x36, 0x50, 0x0C, 0xC8,
+	0xA8, 0x7A, 0xB9, 0xD6, 0x2D, 0xC9, 0x2C, 0x01, 0x05, 0x8F, 0xA7, 0x9F, 0x44, 0x65, 0x7D, 0xE6,
+};
+static const char test3_key_block[] = "D0112P0AE00E0000B82679114F470F540165EDFBF7E250FCEA43F810D215F8D207E2E417C07156A27E8E31DA05F7425509593D03A457DC34";
+static const uint8_t test3_key_verify[] = { 0x3F, 0x41, 0x9E, 0x1C, 0xB7, 0x07, 0x94, 0x42, 0xAA, 0x37, 0x47, 0x4C, 0x2E, 0xFB, 0xF8, 0xB8 };
+
+struct test_vector_t {
+	unsigned int kbpk_algorithm;
+	const uint8_t* kbpk;
+	size_t kbpk_len;
+	const char* key_block;
+	const uint8_t* key_verify;
+	size_t key_verify_len;
+};
+
+static const struct test_vector_t test_vectors[] = {
+	{ TR31_KEY_ALGORITHM_TDES, test1_kbpk, sizeof(test1_kbpk), test1_key_block, test1_key_verify, sizeof(test1_key_verify) },
+	{ TR31_KEY_ALGORITHM_TDES, test2_kbpk, sizeof(test2_kbpk), test2_key_block, test2_key_verify, sizeof(test2_key_verify) },
+	{ TR31_KEY_ALGORITHM_AES, test3_kbpk, sizeof(test3_kbpk), test3_key_block, test3_key_verify, sizeof(test3_key_verify) },
+};
+#define TEST_VECTOR_COUNT (sizeof(test_vectors) / sizeof(test_vectors[0]))
+
+#define TEST_IMPORTER_COUNT (4)
+#define TEST_FILLER_COUNT (8)
+#define TEST_ROTATION_COUNT (400)
+
+struct test_state_t {
+	struct tr31_keyring_t* keyring;
+	atomic_bool done;
+	atomic_size_t import_count;
+	atomic_size_t error_count;
+};
+
+static int test_key_init(
+	unsigned int algorithm,
+	const uint8_t* data,
+	size_t data_len,
+	struct tr31_key_t* kbpk
+)
+{
+	int r;
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		algorithm,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		data,
+		data_len,
+		kbpk
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+
+	return 0;
+}
+
+static void test_filler_data(unsigned int seed, uint8_t* data, size_t data_len)
+{
+	for (size_t i = 0; i < data_len; ++i) {
+		data[i] = seed * 31 + i * 7 + 0x5A;
+	}
+}
+
+static void* test_importer(void* arg)
+{
+	struct test_state_t* state = arg;
+	struct tr31_ctx_t tr31;
+	unsigned int i = 0;
+
+	memset(&tr31, 0, sizeof(tr31));
+	do {
+		const struct test_vector_t* vector = &test_vectors[i % TEST_VECTOR_COUNT];
+		int r;
+
+		// alternate between single threaded and parallel trials
+		r = tr31_keyring_import(
+			state->keyring,
+			vector->key_block,
+			strlen(vector->key_block),
+			0,
+			1 + (i & 1),
+			&tr31,
+			NULL
+		);
+		if (r ||
+			tr31.key.length != vector->key_verify_len ||
+			memcmp(tr31.key.data, vector->key_verify, vector->key_verify_len) != 0
+		) {
+			fprintf(stderr, "tr31_keyring_import() failed during rotation; r=%d\n", r);
+			atomic_fetch_add(&state->error_count, 1);
+		}
+		tr31_release(&tr31);
+		atomic_fetch_add(&state->import_count, 1);
+		++i;
+	} while (!atomic_load(&state->done));
+
+	return NULL;
+}
+
+static int test_rotate(struct test_state_t* state, size_t* vector_ids, size_t* filler_ids)
+{
+	int r;
+	struct tr31_key_t kbpk;
+	uint8_t data[32];
+	size_t temp_id;
+
+	for (unsigned int round = 0; round < TEST_ROTATION_COUNT; ++round) {
+		// replace KBPK required by importers with a new copy
+		const struct test_vector_t* vector = &test_vectors[round % TEST_VECTOR_COUNT];
+		size_t* vector_id = &vector_ids[round % TEST_VECTOR_COUNT];
+
+		r = test_key_init(vector->kbpk_algorithm, vector->kbpk, vector->kbpk_len, &kbpk);
+		if (r) {
+			return r;
+		}
+		r = tr31_keyring_rotate(state->keyring, *vector_id, &kbpk, vector_id);
+		tr31_key_release(&kbpk);
+		if (r) {
+			fprintf(stderr, "tr31_keyring_rotate() error %d: %s\n", r, tr31_get_error_string(r));
+			return 1;
+		}
+
+		// replace unrelated KBPK with a new KBPK
+		test_filler_data(TEST_FILLER_COUNT + round, data, sizeof(data));
+		r = test_key_init(
+			round & 1 ? TR31_KEY_ALGORITHM_AES : TR31_KEY_ALGORITHM_TDES,
+			data,
+			round & 1 ? 32 : 16,
+			&kbpk
+		);
+		if (r) {
+			return r;
+		}
+		r = tr31_keyring_rotate(
+			state->keyring,
+			filler_ids[round % TEST_FILLER_COUNT],
+			&kbpk,
+			&filler_ids[round % TEST_FILLER_COUNT]
+		);
+		if (r) {
+			tr31_key_release(&kbpk);
+			fprintf(stderr, "tr31_keyring_rotate() error %d: %s\n", r, tr31_get_error_string(r));
+			return 1;
+		}
+
+		// add and remove temporary KBPK
+		r = tr31_keyring_add(state->keyring, &kbpk, &temp_id);
+		tr31_key_release(&kbpk);
+		if (r) {
+			fprintf(stderr, "tr31_keyring_add() error %d: %s\n", r, tr31_get_error_string(r));
+			return 1;
+		}
+		r = tr31_keyring_remove(state->keyring, temp_id);
+		if (r) {
+			fprintf(stderr, "tr31_keyring_remove() failed; r=%d\n", r);
+			return 1;
+		}
+
+		if ((round & 0xF) == 0) {
+			tr31_keyring_reclaim(state->keyring);
+		}
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int r;
+	struct test_state_t state;
+	struct tr31_key_t kbpk;
+	uint8_t data[32];
+	size_t vector_ids[TEST_VECTOR_COUNT];
+	size_t filler_ids[TEST_FILLER_COUNT];
+	pthread_t threads[TEST_IMPORTER_COUNT];
+	unsigned int threads_started = 0;
+	size_t import_count;
+
+	state.keyring = tr31_keyring_create();
+	if (!state.keyring) {
+		fprintf(stderr, "tr31_keyring_create() failed\n");
+		return 1;
+	}
+	atomic_init(&state.done, false);
+	atomic_init(&state.import_count, 0);
+	atomic_init(&state.error_count, 0);
+
+	// populate keyring with KBPKs required by importers and unrelated KBPKs
+	for (size_t i = 0; i < TEST_VECTOR_COUNT; ++i) {
+		r = test_key_init(test_vectors[i].kbpk_algorithm, test_vectors[i].kbpk, test_vectors[i].kbpk_len, &kbpk);
+		if (r) {
+			goto exit;
+		}
+		r = tr31_keyring_add(state.keyring, &kbpk, &vector_ids[i]);
+		tr31_key_release(&kbpk);
+		if (r) {
+			fprintf(stderr, "tr31_keyring_add() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+	}
+	for (unsigned int i = 0; i < TEST_FILLER_COUNT; ++i) {
+		test_filler_data(i, data, sizeof(data));
+		r = test_key_init(i & 1 ? TR31_KEY_ALGORITHM_AES : TR31_KEY_ALGORITHM_TDES, data, i & 1 ? 32 : 16, &kbpk);
+		if (r) {
+			goto exit;
+		}
+		r = tr31_keyring_add(state.keyring, &kbpk, &filler_ids[i]);
+		tr31_key_release(&kbpk);
+		if (r) {
+			fprintf(stderr, "tr31_keyring_add() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+	}
+
+	printf("Test 1 (concurrent imports during KBPK rotation)...\n");
+	for (unsigned int i = 0; i < TEST_IMPORTER_COUNT; ++i) {
+		if (pthread_create(&threads[i], NULL, test_importer, &state)) {
+			fprintf(stderr, "pthread_create() failed\n");
+			r = 1;
+			goto exit;
+		}
+		++threads_started;
+	}
+
+	// ensure that all importers are running before rotation starts
+	while (atomic_load(&state.import_count) < TEST_IMPORTER_COUNT) {
+		sched_yield();
+	}
+
+	r = test_rotate(&state, vector_ids, filler_ids);
+	if (r) {
+		goto exit;
+	}
+	import_count = atomic_load(&state.import_count);
+
+	atomic_store(&state.done, true);
+	for (unsigned int i = 0; i < threads_started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	threads_started = 0;
+
+	if (atomic_load(&state.error_count)) {
+		fprintf(stderr, "%zu of %zu imports failed\n",
+			atomic_load(&state.error_count),
+			atomic_load(&state.import_count)
+		);
+		r = 1;
+		goto exit;
+	}
+	printf("%zu imports during %u rotations\n", import_count, TEST_ROTATION_COUNT);
+
+	// no imports are in progress and all replaced snapshots can be reclaimed
+	if (tr31_keyring_reclaim(state.keyring) != 0) {
+		fprintf(stderr, "tr31_keyring_reclaim() did not reclaim all snapshots\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 1 (concurrent imports during KBPK rotation) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	atomic_store(&state.done, true);
+	for (unsigned int i = 0; i < threads_started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	tr31_keyring_destroy(state.keyring);
+	return r;
+}
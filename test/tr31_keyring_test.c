@@ -0,0 +1,345 @@
+/**
+ * @file tr31_keyring_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const uint8_t test1_kbpk[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+static const char test1_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const uint8_t test1_key_verify[] = { 0xBF, 0x82, 0xDA, 0xC6, 0xA3, 0x3D, 0xF9, 0x2C, 0xE6, 0x6E, 0x15, 0xB7, 0x0E, 0x5D, 0xCE, 0xB6 };
+
+// example data generated using a Thales payShield 10k HSM
+static const uint8_t test2_kbpk[] = { 0xEF, 0xE0, 0x85, 0x3B, 0x25, 0x6B, 0x58, 0x3D, 0x86, 0x8F, 0x25, 0x1C, 0xE9, 0x9E, 0xA1, 0xD9 };
+static const char test2_key_block[] = "B0080K0TN00N00001C414014375212C24995E405B5EE052CB92B67F455EA2680F6751088F9F1C228";
+static const uint8_t test2_key_verify[] = { 0x5D, 0xB5, 0x0B, 0x45, 0x4F, 0x83, 0x89, 0xAD, 0xCE, 0x57, 0x3B, 0xE5, 0x08, 0x61, 0xF2, 0xBF };
+
+// TR-31:2018, A.7.4
+static const uint8_t test3_kbpk[] = {
+	0x88, 0xE1, 0xAB, 0x2A, 0x2E, 0x3D, 0xD3, 0x8C, 0x1F, 0xA0, 0x39, 0xA5, 0x36, 0x50, 0x0C, 0xC8,
+	0xA8, 0x7A, 0xB9, 0xD6, 0x2D, 0xC9, 0x2C, 0x01, 0x05, 0x8F, 0xA7, 0x9F, 0x44, 0x65, 0x7D, 0xE6,
+};
+static const char test3_key_block[] = "D0112P0AE00E0000B82679114F470F540165EDFBF7E250FCEA43F810D215F8D207E2E417C07156A27E8E31DA05F7425509593D03A457DC34";
+static const uint8_t test3_key_verify[] = { 0x3F, 0x41, 0x9E, 0x1C, 0xB7, 0x07, 0x94, 0x42, 0xAA, 0x37, 0x47, 0x4C, 0x2E, 0xFB, 0xF8, 0xB8 };
+
+// number of unrelated KBPKs per algorithm
+#define TEST_FILLER_COUNT (40)
+
+static int keyring_add(
+	struct tr31_keyring_t* keyring,
+	unsigned int algorithm,
+	const uint8_t* data,
+	size_t data_len,
+	size_t* kbpk_id
+)
+{
+	int r;
+	struct tr31_key_t kbpk;
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		algorithm,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		data,
+		data_len,
+		&kbpk
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+
+	r = tr31_keyring_add(keyring, &kbpk, kbpk_id);
+	tr31_key_release(&kbpk);
+	if (r) {
+		fprintf(stderr, "tr31_keyring_add() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int keyring_add_fillers(struct tr31_keyring_t* keyring, uint8_t seed)
+{
+	int r;
+	uint8_t data[32];
+
+	for (unsigned int i = 0; i < TEST_FILLER_COUNT; ++i) {
+		for (size_t j = 0; j < sizeof(data); ++j) {
+			data[j] = seed + i * 31 + j * 7;
+		}
+
+		r = keyring_add(keyring, TR31_KEY_ALGORITHM_TDES, data, 16, NULL);
+		if (r) {
+			return r;
+		}
+		r = keyring_add(keyring, TR31_KEY_ALGORITHM_AES, data, 32, NULL);
+		if (r) {
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+static int keyring_import(
+	struct tr31_keyring_t* keyring,
+	const char* key_block,
+	unsigned int thread_count,
+	size_t kbpk_id_verify,
+	const uint8_t* key_verify,
+	size_t key_verify_len
+)
+{
+	int r;
+	struct tr31_ctx_t tr31;
+	size_t kbpk_id = SIZE_MAX;
+
+	memset(&tr31, 0, sizeof(tr31));
+	r = tr31_keyring_import(keyring, key_block, strlen(key_block), 0, thread_count, &tr31, &kbpk_id);
+	if (r) {
+		fprintf(stderr, "tr31_keyring_import() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	if (kbpk_id != kbpk_id_verify) {
+		fprintf(stderr, "Incorrect KBPK identifier %zu; expected %zu\n", kbpk_id, kbpk_id_verify);
+		r = 1;
+		goto exit;
+	}
+	if (tr31.key.length != key_verify_len ||
+		memcmp(tr31.key.data, key_verify, key_verify_len) != 0
+	) {
+		fprintf(stderr, "Incorrect key data\n");
+		r = 1;
+		goto exit;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_release(&tr31);
+	return r;
+}
+
+int main(void)
+{
+	int r;
+	struct tr31_keyring_t* keyring;
+	size_t test1_kbpk_id;
+	size_t test2_kbpk_id;
+	size_t test3_kbpk_id;
+	struct tr31_stats_t before;
+	struct tr31_stats_t after;
+	struct tr31_ctx_t tr31;
+	char tampered[256];
+	struct tr31_key_t kbpk;
+	size_t old_kbpk_id;
+
+	memset(&tr31, 0, sizeof(tr31));
+	keyring = tr31_keyring_create();
+	if (!keyring) {
+		fprintf(stderr, "tr31_keyring_create() failed\n");
+		return 1;
+	}
+
+	printf("Test 1 (empty keyring)...\n");
+	r = tr31_keyring_import(keyring, test1_key_block, strlen(test1_key_block), 0, 1, &tr31, NULL);
+	tr31_release(&tr31);
+	if (r != TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED) {
+		fprintf(stderr, "tr31_keyring_import() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 1 (empty keyring) success\n");
+
+	// populate keyring with KBPKs of interest between unrelated KBPKs
+	r = keyring_add_fillers(keyring, 0x11);
+	if (r) {
+		goto exit;
+	}
+	r = keyring_add(keyring, TR31_KEY_ALGORITHM_TDES, test1_kbpk, sizeof(test1_kbpk), &test1_kbpk_id);
+	if (r) {
+		goto exit;
+	}
+	r = keyring_add_fillers(keyring, 0x22);
+	if (r) {
+		goto exit;
+	}
+	r = keyring_add(keyring, TR31_KEY_ALGORITHM_TDES, test2_kbpk, sizeof(test2_kbpk), &test2_kbpk_id);
+	if (r) {
+		goto exit;
+	}
+	r = keyring_add(keyring, TR31_KEY_ALGORITHM_AES, test3_kbpk, sizeof(test3_kbpk), &test3_kbpk_id);
+	if (r) {
+		goto exit;
+	}
+	r = keyring_add_fillers(keyring, 0x33);
+	if (r) {
+		goto exit;
+	}
+	if (test1_kbpk_id != TEST_FILLER_COUNT * 2 ||
+		test2_kbpk_id != TEST_FILLER_COUNT * 4 + 1 ||
+		test3_kbpk_id != TEST_FILLER_COUNT * 4 + 2
+	) {
+		fprintf(stderr, "Incorrect KBPK identifier\n");
+		r = 1;
+		goto exit;
+	}
+
+	printf("Test 2 (KBPK selection using optional block KP)...\n");
+	r = tr31_stats_snapshot(&before);
+	if (r) {
+		fprintf(stderr, "tr31_stats_snapshot() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	r = keyring_import(keyring, test1_key_block, 1, test1_kbpk_id, test1_key_verify, sizeof(test1_key_verify));
+	if (r) {
+		goto exit;
+	}
+	r = tr31_stats_snapshot(&after);
+	if (r) {
+		fprintf(stderr, "tr31_stats_snapshot() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	// only the selected KBPK is used and the key block is decrypted and
+	// verified exactly once
+	if (after.kbpk_derive_count != before.kbpk_derive_count ||
+		after.kbpk_derive_cached_count != before.kbpk_derive_cached_count + 1
+	) {
+		fprintf(stderr, "Incorrect KBPK derivation statistics; derived=%llu; cached=%llu\n",
+			(unsigned long long)(after.kbpk_derive_count - before.kbpk_derive_count),
+			(unsigned long long)(after.kbpk_derive_cached_count - before.kbpk_derive_cached_count)
+		);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 2 (KBPK selection using optional block KP) success\n");
+
+	printf("Test 3 (KBPK trial for format version B without optional block KP)...\n");
+	r = keyring_import(keyring, test2_key_block, 4, test2_kbpk_id, test2_key_verify, sizeof(test2_key_verify));
+	if (r) {
+		goto exit;
+	}
+	printf("Test 3 (KBPK trial for format version B without optional block KP) success\n");
+
+	printf("Test 4 (KBPK trial for format version D without optional block KP)...\n");
+	r = keyring_import(keyring, test3_key_block, 4, test3_kbpk_id, test3_key_verify, sizeof(test3_key_verify));
+	if (r) {
+		goto exit;
+	}
+	r = keyring_import(keyring, test3_key_block, 1, test3_kbpk_id, test3_key_verify, sizeof(test3_key_verify));
+	if (r) {
+		goto exit;
+	}
+	printf("Test 4 (KBPK trial for format version D without optional block KP) success\n");
+
+	printf("Test 5 (no KBPK verifies key block)...\n");
+	// tamper with key version field in key block header
+	memcpy(tampered, test2_key_block, sizeof(test2_key_block));
+	tampered[9] = tampered[9] == '0' ? '1' : '0';
+	r = tr31_keyring_import(keyring, tampered, strlen(tampered), 0, 4, &tr31, NULL);
+	tr31_release(&tr31);
+	if (r != TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED) {
+		fprintf(stderr, "tr31_keyring_import() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 5 (no KBPK verifies key block) success\n");
+
+	printf("Test 6 (KBPK removal and rotation)...\n");
+	r = tr31_keyring_remove(keyring, test2_kbpk_id);
+	if (r) {
+		fprintf(stderr, "tr31_keyring_remove() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_keyring_import(keyring, test2_key_block, strlen(test2_key_block), 0, 4, &tr31, NULL);
+	tr31_release(&tr31);
+	if (r != TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED) {
+		fprintf(stderr, "tr31_keyring_import() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_keyring_remove(keyring, test2_kbpk_id);
+	if (r >= 0) {
+		fprintf(stderr, "tr31_keyring_remove() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		test1_kbpk,
+		sizeof(test1_kbpk),
+		&kbpk
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	old_kbpk_id = test1_kbpk_id;
+	r = tr31_keyring_rotate(keyring, old_kbpk_id, &kbpk, &test1_kbpk_id);
+	tr31_key_release(&kbpk);
+	if (r) {
+		fprintf(stderr, "tr31_keyring_rotate() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	if (test1_kbpk_id != TEST_FILLER_COUNT * 6 + 3) {
+		fprintf(stderr, "Incorrect KBPK identifier %zu\n", test1_kbpk_id);
+		r = 1;
+		goto exit;
+	}
+	r = keyring_import(keyring, test1_key_block, 1, test1_kbpk_id, test1_key_verify, sizeof(test1_key_verify));
+	if (r) {
+		goto exit;
+	}
+	// no imports are in progress and all replaced snapshots can be reclaimed
+	if (tr31_keyring_reclaim(keyring) != 0) {
+		fprintf(stderr, "tr31_keyring_reclaim() did not reclaim all snapshots\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 6 (KBPK removal and rotation) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_keyring_destroy(keyring);
+	return r;
+}
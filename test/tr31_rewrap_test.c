@@ -0,0 +1,313 @@
+/**
+ * @file tr31_rewrap_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const char test_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const uint8_t test_kbpk_old_data[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+static const uint8_t test_kbpk_new_data[] = {
+	0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+	0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+};
+static const uint8_t test_key_data[] = { 0xBF, 0x82, 0xDA, 0xC6, 0xA3, 0x3D, 0xF9, 0x2C, 0xE6, 0x6E, 0x15, 0xB7, 0x0E, 0x5D, 0xCE, 0xB6 };
+static const char test_ksn[] = "FFFF00A0200001E00000";
+
+static void print_buf(const char* buf_name, const void* buf, size_t length)
+{
+	const uint8_t* ptr = buf;
+	printf("%s: ", buf_name);
+	for (size_t i = 0; i < length; i++) {
+		printf("%02X", ptr[i]);
+	}
+	printf("\n");
+}
+
+static int verify_rewrapped_key_block(const char* key_block, const struct tr31_key_t* kbpk)
+{
+	int r;
+	struct tr31_ctx_t tr31;
+	struct tr31_opt_ctx_t* opt_ctx;
+	struct tr31_opt_blk_kcv_data_t kcv_data;
+
+	r = tr31_import(key_block, strlen(key_block), kbpk, 0, &tr31);
+	if (r) {
+		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+
+	if (tr31.version != TR31_VERSION_D ||
+		tr31.key.usage != TR31_KEY_USAGE_DUKPT_IK ||
+		tr31.key.algorithm != TR31_KEY_ALGORITHM_TDES ||
+		tr31.key.mode_of_use != TR31_KEY_MODE_OF_USE_DERIVE ||
+		tr31.key.exportability != TR31_KEY_EXPORT_NONE
+	) {
+		fprintf(stderr, "Re-wrapped key block attributes are incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	if (tr31.key.length != sizeof(test_key_data) ||
+		memcmp(tr31.key.data, test_key_data, sizeof(test_key_data)) != 0
+	) {
+		fprintf(stderr, "Re-wrapped key data is incorrect\n");
+		print_buf("key", tr31.key.data, tr31.key.length);
+		r = 1;
+		goto exit;
+	}
+
+	// optional block KS must be retained
+	opt_ctx = tr31_opt_block_find(&tr31, TR31_OPT_BLOCK_KS);
+	if (!opt_ctx ||
+		opt_ctx->data_length != strlen(test_ksn) ||
+		memcmp(opt_ctx->data, test_ksn, strlen(test_ksn)) != 0
+	) {
+		fprintf(stderr, "Re-wrapped optional block KS is incorrect\n");
+		r = 1;
+		goto exit;
+	}
+
+	// optional block KP must match the new KBPK
+	opt_ctx = tr31_opt_block_find(&tr31, TR31_OPT_BLOCK_KP);
+	if (!opt_ctx) {
+		fprintf(stderr, "Re-wrapped optional block KP is missing\n");
+		r = 1;
+		goto exit;
+	}
+	r = tr31_opt_block_decode_kcv(opt_ctx, &kcv_data);
+	if (r) {
+		fprintf(stderr, "tr31_opt_block_decode_kcv() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	if (kcv_data.kcv_algorithm != kbpk->kcv_algorithm ||
+		kcv_data.kcv_len != kbpk->kcv_len ||
+		memcmp(kcv_data.kcv, kbpk->kcv, kbpk->kcv_len) != 0
+	) {
+		fprintf(stderr, "Re-wrapped optional block KP is incorrect\n");
+		print_buf("KP", kcv_data.kcv, kcv_data.kcv_len);
+		r = 1;
+		goto exit;
+	}
+
+	// success
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_release(&tr31);
+	return r;
+}
+
+int main(void)
+{
+	int r;
+	struct tr31_key_t kbpk_old;
+	struct tr31_key_t kbpk_new;
+	char key_block[1024];
+	struct tr31_rewrap_item_t items[64];
+	char key_blocks[64][1024];
+
+	// populate key block protection keys
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		test_kbpk_old_data,
+		sizeof(test_kbpk_old_data),
+		&kbpk_old
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_AES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		test_kbpk_new_data,
+		sizeof(test_kbpk_new_data),
+		&kbpk_new
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+
+	// KCV of new KBPK is used to verify optional block KP
+	r = tr31_key_get_kcv(&kbpk_new);
+	if (r) {
+		fprintf(stderr, "tr31_key_get_kcv() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+
+	printf("Test 1 (re-wrap format version B to D)...\n");
+	r = tr31_rewrap(
+		test_key_block,
+		strlen(test_key_block),
+		&kbpk_old,
+		&kbpk_new,
+		TR31_VERSION_D,
+		0,
+		0,
+		key_block,
+		sizeof(key_block)
+	);
+	if (r) {
+		fprintf(stderr, "tr31_rewrap() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = verify_rewrapped_key_block(key_block, &kbpk_new);
+	if (r) {
+		goto exit;
+	}
+	printf("Test 1 (re-wrap format version B to D): %s\n", key_block);
+	printf("Test 1 (re-wrap format version B to D) success\n");
+
+	printf("Test 2 (re-wrap error handling)...\n");
+	r = tr31_rewrap(
+		test_key_block,
+		strlen(test_key_block),
+		&kbpk_new,
+		&kbpk_new,
+		0,
+		0,
+		0,
+		key_block,
+		sizeof(key_block)
+	);
+	if (r != TR31_ERROR_UNSUPPORTED_KBPK_ALGORITHM) {
+		fprintf(stderr, "tr31_rewrap() unexpected result %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_rewrap(
+		test_key_block,
+		strlen(test_key_block) - 1,
+		&kbpk_old,
+		&kbpk_new,
+		TR31_VERSION_D,
+		0,
+		0,
+		key_block,
+		sizeof(key_block)
+	);
+	if (r != TR31_ERROR_INVALID_LENGTH_FIELD) {
+		fprintf(stderr, "tr31_rewrap() unexpected result %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	printf("Test 2 (re-wrap error handling) success\n");
+
+	printf("Test 3 (batch re-wrap)...\n");
+	for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); ++i) {
+		items[i].key_block = test_key_block;
+		items[i].key_block_len = strlen(test_key_block);
+		items[i].new_key_block = key_blocks[i];
+		items[i].new_key_block_buf_len = sizeof(key_blocks[i]);
+		items[i].result = -1;
+	}
+	// corrupt the authenticator of one item
+	items[17].key_block = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E6";
+	r = tr31_rewrap_batch(
+		items,
+		sizeof(items) / sizeof(items[0]),
+		&kbpk_old,
+		&kbpk_new,
+		TR31_VERSION_D,
+		0,
+		0,
+		4
+	);
+	if (r != TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED) {
+		fprintf(stderr, "tr31_rewrap_batch() unexpected result %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); ++i) {
+		if (i == 17) {
+			if (items[i].result != TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED) {
+				fprintf(stderr, "Batch item %zu unexpected result %d: %s\n", i, items[i].result, tr31_get_error_string(items[i].result));
+				r = 1;
+				goto exit;
+			}
+			continue;
+		}
+
+		if (items[i].result) {
+			fprintf(stderr, "Batch item %zu error %d: %s\n", i, items[i].result, tr31_get_error_string(items[i].result));
+			r = 1;
+			goto exit;
+		}
+		r = verify_rewrapped_key_block(items[i].new_key_block, &kbpk_new);
+		if (r) {
+			fprintf(stderr, "Batch item %zu verification failed\n", i);
+			goto exit;
+		}
+	}
+	printf("Test 3 (batch re-wrap) success\n");
+
+	printf("Test 4 (batch re-wrap using calling thread)...\n");
+	r = tr31_rewrap_batch(
+		items,
+		16,
+		&kbpk_old,
+		&kbpk_new,
+		TR31_VERSION_D,
+		0,
+		0,
+		0
+	);
+	if (r) {
+		fprintf(stderr, "tr31_rewrap_batch() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	for (size_t i = 0; i < 16; ++i) {
+		r = verify_rewrapped_key_block(items[i].new_key_block, &kbpk_new);
+		if (r) {
+			fprintf(stderr, "Batch item %zu verification failed\n", i);
+			goto exit;
+		}
+	}
+	printf("Test 4 (batch re-wrap using calling thread) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_key_release(&kbpk_old);
+	tr31_key_release(&kbpk_new);
+
+	return r;
+}
@@ -0,0 +1,291 @@
+/**
+ * @file tr31_rng_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const char test_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const uint8_t test_kbpk_data[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+static const uint8_t test_kbpk_aes_data[] = {
+	0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+	0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+};
+
+static int test_rng_fixed(void* ctx, void* buf, size_t len)
+{
+	size_t* count = ctx;
+	memset(buf, 0x5A, len);
+	*count += len;
+	return 0;
+}
+
+static int test_rng_xorshift(void* ctx, void* buf, size_t len)
+{
+	uint64_t* state = ctx;
+	uint8_t* ptr = buf;
+
+	// deterministic xorshift64 to allow reproducible statistics
+	for (size_t i = 0; i < len; ++i) {
+		*state ^= *state << 13;
+		*state ^= *state >> 7;
+		*state ^= *state << 17;
+		ptr[i] = *state >> 56;
+	}
+	return 0;
+}
+
+static int test_rng_fail(void* ctx, void* buf, size_t len)
+{
+	(void)ctx;
+	(void)buf;
+	(void)len;
+	return -1;
+}
+
+int main(void)
+{
+	int r;
+	struct tr31_key_t kbpk;
+	struct tr31_key_t kbpk_aes = { 0 };
+	struct tr31_ctx_t tr31;
+	struct tr31_ctx_t tr31_d = { 0 };
+	size_t rng_count = 0;
+	char key_block1[1024];
+	char key_block2[1024];
+	struct tr31_rewrap_item_t items[64];
+	char key_blocks[64][1024];
+	uint64_t xorshift_state = 0x0123456789ABCDEF;
+	size_t pb_counts[62];
+	size_t pb_total;
+	double chi_square;
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		test_kbpk_data,
+		sizeof(test_kbpk_data),
+		&kbpk
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+
+	r = tr31_import(test_key_block, strlen(test_key_block), &kbpk, 0, &tr31);
+	if (r) {
+		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+		tr31_key_release(&kbpk);
+		return 1;
+	}
+
+	printf("Test 1 (custom random number generator)...\n");
+	tr31_set_rng(&test_rng_fixed, &rng_count);
+	r = tr31_export(&tr31, &kbpk, 0, key_block1, sizeof(key_block1));
+	if (r) {
+		fprintf(stderr, "tr31_export() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_export(&tr31, &kbpk, 0, key_block2, sizeof(key_block2));
+	if (r) {
+		fprintf(stderr, "tr31_export() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	if (!rng_count) {
+		fprintf(stderr, "Custom random number generator not used\n");
+		r = 1;
+		goto exit;
+	}
+	if (strcmp(key_block1, key_block2) != 0) {
+		fprintf(stderr, "Key blocks differ despite fixed random number generator\n");
+		fprintf(stderr, "%s\n%s\n", key_block1, key_block2);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 1 (custom random number generator) success\n");
+
+	printf("Test 2 (random number generator failure)...\n");
+	tr31_set_rng(&test_rng_fail, NULL);
+	r = tr31_export(&tr31, &kbpk, 0, key_block1, sizeof(key_block1));
+	if (r >= 0) {
+		fprintf(stderr, "tr31_export() unexpected result %d\n", r);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 2 (random number generator failure) success\n");
+
+	printf("Test 3 (default random number generator)...\n");
+	tr31_set_rng(NULL, NULL);
+	for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); ++i) {
+		items[i].key_block = test_key_block;
+		items[i].key_block_len = strlen(test_key_block);
+		items[i].new_key_block = key_blocks[i];
+		items[i].new_key_block_buf_len = sizeof(key_blocks[i]);
+		items[i].result = -1;
+	}
+	r = tr31_rewrap_batch(
+		items,
+		sizeof(items) / sizeof(items[0]),
+		&kbpk,
+		&kbpk,
+		0,
+		0,
+		0,
+		4
+	);
+	if (r) {
+		fprintf(stderr, "tr31_rewrap_batch() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	// every key block must be unique, also across threads
+	for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); ++i) {
+		for (size_t j = i + 1; j < sizeof(items) / sizeof(items[0]); ++j) {
+			if (strcmp(key_blocks[i], key_blocks[j]) == 0) {
+				fprintf(stderr, "Key blocks %zu and %zu are identical\n", i, j);
+				r = 1;
+				goto exit;
+			}
+		}
+	}
+	printf("Test 3 (default random number generator) success\n");
+
+	printf("Test 4 (optional block PB character distribution)...\n");
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_AES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		test_kbpk_aes_data,
+		sizeof(test_kbpk_aes_data),
+		&kbpk_aes
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	// format version D with an empty KP optional block, to be computed for
+	// the AES KBPK by tr31_export(), results in optional block PB with 8
+	// characters
+	r = tr31_init(TR31_VERSION_D, &tr31.key, &tr31_d);
+	if (r) {
+		fprintf(stderr, "tr31_init() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	for (size_t i = 0; i < tr31.opt_blocks_count; ++i) {
+		const struct tr31_opt_ctx_t* opt_ctx = &tr31.opt_blocks[i];
+
+		if (opt_ctx->id == TR31_OPT_BLOCK_KP) {
+			r = tr31_opt_block_add_KP(&tr31_d);
+		} else {
+			r = tr31_opt_block_add(&tr31_d, opt_ctx->id, opt_ctx->data, opt_ctx->data_length);
+		}
+		if (r) {
+			fprintf(stderr, "tr31_opt_block_add() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+	}
+	tr31_set_rng(&test_rng_xorshift, &xorshift_state);
+	memset(pb_counts, 0, sizeof(pb_counts));
+	pb_total = 0;
+	for (size_t i = 0; i < 20000; ++i) {
+		struct tr31_ctx_t tr31_pb;
+		struct tr31_opt_ctx_t* opt_ctx;
+
+		r = tr31_export(&tr31_d, &kbpk_aes, 0, key_block1, sizeof(key_block1));
+		if (r) {
+			fprintf(stderr, "tr31_export() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		r = tr31_import(key_block1, strlen(key_block1), NULL, 0, &tr31_pb);
+		if (r) {
+			fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		opt_ctx = tr31_opt_block_find(&tr31_pb, TR31_OPT_BLOCK_PB);
+		if (!opt_ctx || opt_ctx->data_length != 8) {
+			fprintf(stderr, "Optional block PB not found or has unexpected length\n");
+			tr31_release(&tr31_pb);
+			r = 1;
+			goto exit;
+		}
+		for (size_t j = 0; j < opt_ctx->data_length; ++j) {
+			const char c = ((const char*)opt_ctx->data)[j];
+			if (c >= '0' && c <= '9') {
+				++pb_counts[c - '0'];
+			} else if (c >= 'A' && c <= 'Z') {
+				++pb_counts[c - 'A' + 10];
+			} else if (c >= 'a' && c <= 'z') {
+				++pb_counts[c - 'a' + 36];
+			} else {
+				fprintf(stderr, "Invalid optional block PB character 0x%02X\n", (unsigned int)c);
+				tr31_release(&tr31_pb);
+				r = 1;
+				goto exit;
+			}
+			++pb_total;
+		}
+		tr31_release(&tr31_pb);
+	}
+	// chi-square goodness of fit for uniform distribution of 62 characters
+	// critical value for 61 degrees of freedom at p = 0.001 is 100.9
+	chi_square = 0;
+	for (size_t i = 0; i < sizeof(pb_counts) / sizeof(pb_counts[0]); ++i) {
+		double expected = (double)pb_total / 62;
+		double diff = pb_counts[i] - expected;
+		chi_square += (diff * diff) / expected;
+	}
+	printf("Optional block PB characters: %zu; chi-square: %.1f\n", pb_total, chi_square);
+	if (pb_total < 50000 || chi_square > 100.9) {
+		fprintf(stderr, "Optional block PB character distribution is not uniform\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 4 (optional block PB character distribution) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_set_rng(NULL, NULL);
+	tr31_release(&tr31_d);
+	tr31_release(&tr31);
+	tr31_key_release(&kbpk);
+	tr31_key_release(&kbpk_aes);
+
+	return r;
+}
@@ -0,0 +1,293 @@
+/**
+ * @file tr31_serialize_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+#include "tr31_serialize.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const uint8_t test1_kbpk_data[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+static const char test1_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const char test1_json_verify[] =
+	"{\"version\":\"B\",\"length\":128,\"key_usage\":\"B1\",\"algorithm\":\"T\",\"mode_of_use\":\"X\",\"key_version\":null,\"exportability\":\"N\",\"key_context\":\"0\","
+	"\"opt_blocks\":["
+		"{\"id\":\"KS\",\"data\":\"FFFF00A0200001E00000\",\"decoded\":{\"iksn\":\"FFFF00A0200001E00000\"}},"
+		"{\"id\":\"KC\",\"data\":\"000169E3\",\"decoded\":{\"kcv_algorithm\":0,\"kcv\":\"0169E3\"}},"
+		"{\"id\":\"KP\",\"data\":\"00ECAD62\",\"decoded\":{\"kcv_algorithm\":0,\"kcv\":\"ECAD62\"}}"
+	"],"
+	"\"key_length\":16,\"kcv\":\"0169E3\"}";
+
+// minimal CBOR well-formedness check for definite length items
+static const uint8_t* cbor_skip(const uint8_t* ptr, const uint8_t* end)
+{
+	uint8_t major;
+	uint8_t info;
+	uint64_t value = 0;
+	size_t arg_len;
+
+	if (!ptr || ptr >= end) {
+		return NULL;
+	}
+	major = *ptr >> 5;
+	info = *ptr & 0x1F;
+	++ptr;
+
+	if (info < 24) {
+		value = info;
+		arg_len = 0;
+	} else if (info <= 27) {
+		arg_len = 1 << (info - 24);
+	} else {
+		// reserved or indefinite length
+		return NULL;
+	}
+	if ((size_t)(end - ptr) < arg_len) {
+		return NULL;
+	}
+	for (size_t i = 0; i < arg_len; ++i) {
+		value = (value << 8) | *ptr++;
+	}
+
+	switch (major) {
+		case 0: // unsigned integer
+		case 1: // negative integer
+			return ptr;
+
+		case 2: // byte string
+		case 3: // text string
+			if ((uint64_t)(end - ptr) < value) {
+				return NULL;
+			}
+			return ptr + value;
+
+		case 4: // array
+			for (uint64_t i = 0; i < value; ++i) {
+				ptr = cbor_skip(ptr, end);
+			}
+			return ptr;
+
+		case 5: // map
+			for (uint64_t i = 0; i < value * 2; ++i) {
+				ptr = cbor_skip(ptr, end);
+			}
+			return ptr;
+
+		case 7: // simple values
+			return info < 24 ? ptr : NULL;
+
+		default:
+			return NULL;
+	}
+}
+
+int main(void)
+{
+	int r;
+	struct tr31_key_t kbpk;
+	struct tr31_key_t key;
+	struct tr31_ctx_t tr31;
+	char json[1024];
+	uint8_t cbor[1024];
+	size_t out_len;
+	size_t json_len;
+
+	memset(&tr31, 0, sizeof(tr31));
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		test1_kbpk_data,
+		sizeof(test1_kbpk_data),
+		&kbpk
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+
+	printf("Test 1 (JSON serialization of imported key block)...\n");
+	r = tr31_import(test1_key_block, strlen(test1_key_block), &kbpk, TR31_IMPORT_COMPUTE_KCV, &tr31);
+	if (r) {
+		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_ctx_to_json(&tr31, 0, NULL, 0, &json_len);
+	if (r) {
+		fprintf(stderr, "tr31_ctx_to_json() length query failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	if (json_len != strlen(test1_json_verify)) {
+		fprintf(stderr, "tr31_ctx_to_json() length query is incorrect; json_len=%zu\n", json_len);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_ctx_to_json(&tr31, 0, json, sizeof(json), &out_len);
+	if (r) {
+		fprintf(stderr, "tr31_ctx_to_json() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	if (out_len != json_len || strcmp(json, test1_json_verify) != 0) {
+		fprintf(stderr, "JSON output is incorrect:\n%s\n", json);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_ctx_to_json(&tr31, TR31_SERIALIZE_FLAG_INCLUDE_KEY, json, sizeof(json), &out_len);
+	if (r) {
+		fprintf(stderr, "tr31_ctx_to_json() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	if (out_len != json_len + 41 || !strstr(json, ",\"key_length\":16,\"key\":\"") || !strstr(json, "\",\"kcv\":\"0169E3\"}")) {
+		fprintf(stderr, "JSON output with key is incorrect:\n%s\n", json);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_ctx_to_json(&tr31, 0, json, json_len, &out_len);
+	if (r <= 0 || json[0] || out_len != json_len) {
+		fprintf(stderr, "tr31_ctx_to_json() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 1 (JSON serialization of imported key block) success\n");
+
+	printf("Test 2 (CBOR serialization of imported key block)...\n");
+	r = tr31_ctx_to_cbor(&tr31, 0, NULL, 0, &out_len);
+	if (r) {
+		fprintf(stderr, "tr31_ctx_to_cbor() length query failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_ctx_to_cbor(&tr31, 0, cbor, sizeof(cbor), &json_len);
+	if (r) {
+		fprintf(stderr, "tr31_ctx_to_cbor() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	if (json_len != out_len ||
+		cbor[0] != 0xAB || // map with 11 members
+		memcmp(cbor + 1, "\x67" "version" "\x61" "B" "\x66" "length" "\x18\x80", 19) != 0 ||
+		cbor_skip(cbor, cbor + out_len) != cbor + out_len
+	) {
+		fprintf(stderr, "CBOR output is incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	r = tr31_ctx_to_cbor(&tr31, 0, cbor, out_len - 1, &json_len);
+	if (r <= 0 || json_len != out_len) {
+		fprintf(stderr, "tr31_ctx_to_cbor() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	tr31_release(&tr31);
+	printf("Test 2 (CBOR serialization of imported key block) success\n");
+
+	printf("Test 3 (serialization of decoded optional blocks)...\n");
+	r = tr31_key_init(
+		TR31_KEY_USAGE_BDK,
+		TR31_KEY_ALGORITHM_AES,
+		TR31_KEY_MODE_OF_USE_DERIVE,
+		"12",
+		TR31_KEY_EXPORT_TRUSTED,
+		TR31_KEY_CONTEXT_NONE,
+		NULL,
+		0,
+		&key
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_init(TR31_VERSION_D, &key, &tr31);
+	tr31_key_release(&key);
+	if (r) {
+		fprintf(stderr, "tr31_init() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_opt_block_add_DA(&tr31, "B0TXNP0TEN", 10);
+	if (r) {
+		fprintf(stderr, "tr31_opt_block_add_DA() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_opt_block_add_TC(&tr31, "20240102030405Z");
+	if (r) {
+		fprintf(stderr, "tr31_opt_block_add_TC() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_opt_block_add_WP(&tr31, 2);
+	if (r) {
+		fprintf(stderr, "tr31_opt_block_add_WP() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_ctx_to_json(&tr31, TR31_SERIALIZE_FLAG_INCLUDE_KEY, json, sizeof(json), &out_len);
+	if (r) {
+		fprintf(stderr, "tr31_ctx_to_json() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	if (!strstr(json, "\"version\":\"D\",") ||
+		!strstr(json, "\"key_version\":\"12\",") ||
+		!strstr(json, "\"decoded\":{\"version\":1,\"attributes\":[{\"key_usage\":\"B0\",\"algorithm\":\"T\",\"mode_of_use\":\"X\",\"exportability\":\"N\"},{\"key_usage\":\"P0\",\"algorithm\":\"T\",\"mode_of_use\":\"E\",\"exportability\":\"N\"}]}") ||
+		!strstr(json, "\"decoded\":{\"seconds\":1704164645,\"centiseconds\":0}") ||
+		!strstr(json, "\"decoded\":{\"version\":0,\"wrapping_pedigree\":2}") ||
+		strstr(json, "\"key\"") ||
+		json[out_len - 1] != '}' || json[out_len - 2] != ']'
+	) {
+		fprintf(stderr, "JSON output is incorrect:\n%s\n", json);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_ctx_to_cbor(&tr31, 0, cbor, sizeof(cbor), &out_len);
+	if (r) {
+		fprintf(stderr, "tr31_ctx_to_cbor() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	if (cbor[0] != 0xA9 || // map with 9 members
+		cbor_skip(cbor, cbor + out_len) != cbor + out_len
+	) {
+		fprintf(stderr, "CBOR output is incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 3 (serialization of decoded optional blocks) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_key_release(&kbpk);
+	tr31_release(&tr31);
+	return r;
+}
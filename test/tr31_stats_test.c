@@ -0,0 +1,149 @@
+/**
+ * @file tr31_stats_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+#include "tr31_strings.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const uint8_t test_kbpk_data[] = { 0xAB, 0x2E, 0x09, 0xDB, 0x3E, 0xF0, 0xBA, 0x71, 0xE0, 0xCE, 0x6C, 0xD7, 0x55, 0xC2, 0x3A, 0x3B };
+static const char test_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const char test_key_block_bad_mac[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E6";
+
+int main(void)
+{
+	int r;
+	struct tr31_key_t kbpk;
+	struct tr31_ctx_t tr31;
+	struct tr31_stats_t before;
+	struct tr31_stats_t after;
+	char key_block[256];
+	char str[4096];
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		TR31_KEY_ALGORITHM_TDES,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		test_kbpk_data,
+		sizeof(test_kbpk_data),
+		&kbpk
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+
+	printf("Test 1 (import and export counters)...\n");
+	r = tr31_stats_snapshot(&before);
+	if (r) {
+		fprintf(stderr, "tr31_stats_snapshot() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_import(test_key_block, strlen(test_key_block), &kbpk, 0, &tr31);
+	if (r) {
+		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_export(&tr31, &kbpk, 0, key_block, sizeof(key_block));
+	tr31_release(&tr31);
+	if (r) {
+		fprintf(stderr, "tr31_export() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31_import(test_key_block_bad_mac, strlen(test_key_block_bad_mac), &kbpk, 0, &tr31);
+	if (r != TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED) {
+		fprintf(stderr, "tr31_import() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_stats_snapshot(&after);
+	if (r) {
+		fprintf(stderr, "tr31_stats_snapshot() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	if (after.import_count[1] - before.import_count[1] != 1 ||
+		after.import_bytes - before.import_bytes != strlen(test_key_block) ||
+		after.import_failed_count - before.import_failed_count != 1 ||
+		after.export_count[1] - before.export_count[1] != 1 ||
+		after.export_bytes - before.export_bytes != strlen(key_block) ||
+		after.export_failed_count != before.export_failed_count ||
+		after.error_count[TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED] - before.error_count[TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED] != 1 ||
+		after.kbpk_derive_count - before.kbpk_derive_count != 3 ||
+		after.alloc_count <= before.alloc_count ||
+		after.alloc_bytes <= before.alloc_bytes
+	) {
+		fprintf(stderr, "Counters are incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	for (size_t i = 0; i < TR31_STATS_VERSION_COUNT; ++i) {
+		if (i != 1 && (after.import_count[i] != before.import_count[i] || after.export_count[i] != before.export_count[i])) {
+			fprintf(stderr, "Counters of other format versions are incorrect\n");
+			r = 1;
+			goto exit;
+		}
+	}
+	printf("Test 1 (import and export counters) success\n");
+
+	printf("Test 2 (Prometheus text format)...\n");
+	r = tr31_stats_get_prometheus_string(&after, str, sizeof(str));
+	if (r) {
+		fprintf(stderr, "tr31_stats_get_prometheus_string() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	snprintf(key_block, sizeof(key_block), "tr31_imports_total{version=\"B\"} %llu\n", (unsigned long long)after.import_count[1]);
+	if (!strstr(str, "# HELP tr31_imports_total ") ||
+		!strstr(str, "# TYPE tr31_imports_total counter\n") ||
+		!strstr(str, key_block) ||
+		!strstr(str, "tr31_errors_total{error=\"key_block_verification_failed\"} 1\n") ||
+		!strstr(str, "tr31_kbpk_derivations_total{source=\"cached\"} 0\n") ||
+		!strstr(str, "# TYPE tr31_allocation_failures_total counter\n")
+	) {
+		fprintf(stderr, "Prometheus text is incorrect:\n%s", str);
+		r = 1;
+		goto exit;
+	}
+	r = tr31_stats_get_prometheus_string(&after, str, 100);
+	if (r <= 0 || str[0]) {
+		fprintf(stderr, "tr31_stats_get_prometheus_string() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 2 (Prometheus text format) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_key_release(&kbpk);
+	return r;
+}
@@ -0,0 +1,256 @@
+/**
+ * @file tr31_tool_migrate_test.c
+ * @brief Test interrupted and resumed key block migration using tr31-tool
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const char test_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const char test_kbpk_old[] = "AB2E09DB3EF0BA71E0CE6CD755C23A3B";
+static const char test_kbpk_new[] = "1D22BF32387C600AD97F9B97A51311AC";
+static const char test_kbpk_other[] = "4141414141414141414141414141414141414141414141414141414141414141";
+
+#define TEST_LINE_COUNT (3 * 4096) // several bulk processing batches
+#define TEST_OUTPUT_LIMIT (1000000) // output file size limit that interrupts migration after the first batch
+
+static int write_input(const char* path)
+{
+	FILE* file;
+
+	file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "fopen() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	for (size_t i = 0; i < TEST_LINE_COUNT; ++i) {
+		fprintf(file, "%s\n", test_key_block);
+	}
+	if (fclose(file)) {
+		fprintf(stderr, "fclose() failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int run_migrate(
+	const char* tool,
+	const char* input_path,
+	const char* output_path,
+	const char* kbpk_new,
+	rlim_t output_limit
+)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "fork() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (pid == 0) {
+		if (output_limit) {
+			// interrupt migration by failing output writes beyond the limit
+			struct rlimit limit = { output_limit, output_limit };
+			signal(SIGXFSZ, SIG_IGN);
+			setrlimit(RLIMIT_FSIZE, &limit);
+		}
+		execl(tool, tool,
+			"--migrate", input_path, output_path,
+			"--kbpk-old", test_kbpk_old,
+			"--kbpk-new", kbpk_new,
+			"--jobs", "2",
+			(char*)NULL
+		);
+		fprintf(stderr, "execl() failed: %s\n", strerror(errno));
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) != pid) {
+		fprintf(stderr, "waitpid() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (!WIFEXITED(status)) {
+		fprintf(stderr, "tr31-tool did not exit\n");
+		return -1;
+	}
+
+	return WEXITSTATUS(status);
+}
+
+static long long file_size(const char* path)
+{
+	struct stat st;
+
+	if (stat(path, &st)) {
+		return -1;
+	}
+	return st.st_size;
+}
+
+static long long count_lines(const char* path)
+{
+	FILE* file;
+	int c;
+	int prev = '\n';
+	long long count = 0;
+
+	file = fopen(path, "rb");
+	if (!file) {
+		return -1;
+	}
+	while ((c = fgetc(file)) != EOF) {
+		if (c == '\n') {
+			if (prev == '\n') {
+				// empty lines indicate failed key blocks
+				fclose(file);
+				return -1;
+			}
+			++count;
+		}
+		prev = c;
+	}
+	fclose(file);
+
+	return count;
+}
+
+int main(int argc, char** argv)
+{
+	int r;
+	char dir_template[] = "/tmp/tr31_tool_migrate_testXXXXXX";
+	char* dir = NULL;
+	char input_path[256];
+	char other_input_path[256];
+	char output_path[256];
+	char journal_path[sizeof(output_path) + 8];
+	long long output_size;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <tr31-tool>\n", argv[0]);
+		return 1;
+	}
+
+	dir = mkdtemp(dir_template);
+	if (!dir) {
+		fprintf(stderr, "mkdtemp() failed: %s\n", strerror(errno));
+		return 1;
+	}
+	snprintf(input_path, sizeof(input_path), "%s/input.txt", dir);
+	snprintf(other_input_path, sizeof(other_input_path), "%s/other.txt", dir);
+	snprintf(output_path, sizeof(output_path), "%s/output.txt", dir);
+	snprintf(journal_path, sizeof(journal_path), "%s.journal", output_path);
+
+	// other input has the same size and content but is a different file
+	if (write_input(input_path) || write_input(other_input_path)) {
+		r = 1;
+		goto exit;
+	}
+
+	printf("Test 1 (interrupted migration)...\n");
+	r = run_migrate(argv[1], input_path, output_path, test_kbpk_new, TEST_OUTPUT_LIMIT);
+	if (r == 0) {
+		fprintf(stderr, "Migration was not interrupted\n");
+		r = 1;
+		goto exit;
+	}
+	if (file_size(journal_path) <= 0) {
+		fprintf(stderr, "Journal was not kept\n");
+		r = 1;
+		goto exit;
+	}
+	output_size = file_size(output_path);
+	if (output_size <= 0) {
+		fprintf(stderr, "Output was not written\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 1 (interrupted migration) success\n");
+
+	printf("Test 2 (resume using different input)...\n");
+	r = run_migrate(argv[1], other_input_path, output_path, test_kbpk_new, 0);
+	if (r == 0) {
+		fprintf(stderr, "Migration was resumed using different input\n");
+		r = 1;
+		goto exit;
+	}
+	if (file_size(journal_path) <= 0 || file_size(output_path) != output_size) {
+		fprintf(stderr, "Journal or output was modified\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 2 (resume using different input) success\n");
+
+	printf("Test 3 (resume using different KBPK)...\n");
+	r = run_migrate(argv[1], input_path, output_path, test_kbpk_other, 0);
+	if (r == 0) {
+		fprintf(stderr, "Migration was resumed using different KBPK\n");
+		r = 1;
+		goto exit;
+	}
+	if (file_size(journal_path) <= 0 || file_size(output_path) != output_size) {
+		fprintf(stderr, "Journal or output was modified\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 3 (resume using different KBPK) success\n");
+
+	printf("Test 4 (resume)...\n");
+	r = run_migrate(argv[1], input_path, output_path, test_kbpk_new, 0);
+	if (r != 0) {
+		fprintf(stderr, "Migration was not resumed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	if (file_size(journal_path) >= 0) {
+		fprintf(stderr, "Journal was not removed\n");
+		r = 1;
+		goto exit;
+	}
+	if (count_lines(output_path) != TEST_LINE_COUNT) {
+		fprintf(stderr, "Output is incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 4 (resume) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	unlink(input_path);
+	unlink(other_input_path);
+	unlink(output_path);
+	unlink(journal_path);
+	rmdir(dir);
+
+	return r;
+}
@@ -0,0 +1,326 @@
+/**
+ * @file tr31_trace_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_MAX_EVENTS (32)
+
+// stage reported by the trace hook
+struct test_trace_event_t {
+	enum tr31_trace_stage_t stage;
+	uint64_t start_ns;
+	uint64_t end_ns;
+};
+
+// trace events recorded by the trace hook
+struct test_trace_t {
+	size_t count;
+	struct test_trace_event_t events[TEST_MAX_EVENTS];
+};
+
+// key block corpus entry
+struct test_corpus_t {
+	const char* name;
+	unsigned int kbpk_algorithm;
+	const uint8_t* kbpk;
+	size_t kbpk_len;
+	const char* key_block;
+};
+
+// example data generated using a Thales payShield 10k HSM
+static const uint8_t test1_kbpk[] = { 0xEF, 0xE0, 0x85, 0x3B, 0x25, 0x6B, 0x58, 0x3D, 0x86, 0x8F, 0x25, 0x1C, 0xE9, 0x9E, 0xA1, 0xD9 };
+static const char test1_tr31_format_a[] = "A0072K0TN00N0000F40D5672C6D0EC86F860BA88D44D00F0CA9A8CE8CD2F640287A9A9EB";
+static const char test1_tr31_format_b[] = "B0080K0TN00N00001C414014375212C24995E405B5EE052CB92B67F455EA2680F6751088F9F1C228";
+static const char test1_tr31_format_c[] = "C0072K0TN00N0000C9B875FF7A5316BF221C09ED52080DE0B45632A4EA9CE87699CB565E";
+
+// example data generated using a Thales payShield 10k HSM
+static const uint8_t test7_kbpk[] = {
+	0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+	0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+};
+static const char test7_tr31_ascii[] = "D0112B0TN00N000037DB9B046B7B0048785690759580ABC3B9842AB4BB7717B49E92528E575785D8123559376A2553B27BE94F054F4E971C";
+
+// ISO 20038:2017, B.2
+static const uint8_t test9_kbpk[] = {
+	0x32, 0x35, 0x36, 0x2D, 0x62, 0x69, 0x74, 0x20, 0x41, 0x45, 0x53, 0x20, 0x77, 0x72, 0x61, 0x70,
+	0x70, 0x69, 0x6E, 0x67, 0x20, 0x28, 0x49, 0x53, 0x4F, 0x20, 0x32, 0x30, 0x30, 0x33, 0x38, 0x29,
+};
+static const char test9_tr31_ascii[] = "E0084B0TV16N0000B2AE5E26BBA7F246E84D5EA24167E208A6B66EF2E27E55A52DB52F0AEACB94C57547";
+
+#define TEST_KBPK(name) name, sizeof(name)
+
+static const struct test_corpus_t test_corpus[] = {
+	{ "format version A", TR31_KEY_ALGORITHM_TDES, TEST_KBPK(test1_kbpk), test1_tr31_format_a },
+	{ "format version B", TR31_KEY_ALGORITHM_TDES, TEST_KBPK(test1_kbpk), test1_tr31_format_b },
+	{ "format version C", TR31_KEY_ALGORITHM_TDES, TEST_KBPK(test1_kbpk), test1_tr31_format_c },
+	{ "format version D", TR31_KEY_ALGORITHM_AES, TEST_KBPK(test7_kbpk), test7_tr31_ascii },
+	{ "format version E", TR31_KEY_ALGORITHM_AES, TEST_KBPK(test9_kbpk), test9_tr31_ascii },
+};
+
+// stages expected for each operation, excluding the outer stage
+static const enum tr31_trace_stage_t test_import_stages[] = {
+	TR31_TRACE_STAGE_PARSE,
+	TR31_TRACE_STAGE_KBPK_DERIVE,
+	TR31_TRACE_STAGE_DECRYPT,
+	TR31_TRACE_STAGE_MAC_VERIFY,
+	TR31_TRACE_STAGE_KCV,
+};
+static const enum tr31_trace_stage_t test_import_no_kcv_stages[] = {
+	TR31_TRACE_STAGE_PARSE,
+	TR31_TRACE_STAGE_KBPK_DERIVE,
+	TR31_TRACE_STAGE_DECRYPT,
+	TR31_TRACE_STAGE_MAC_VERIFY,
+};
+static const enum tr31_trace_stage_t test_import_no_kbpk_stages[] = {
+	TR31_TRACE_STAGE_PARSE,
+};
+static const enum tr31_trace_stage_t test_export_stages[] = {
+	TR31_TRACE_STAGE_ENCODE,
+	TR31_TRACE_STAGE_KBPK_DERIVE,
+	TR31_TRACE_STAGE_ENCRYPT,
+	TR31_TRACE_STAGE_MAC_GENERATE,
+};
+
+static struct test_trace_t test_trace;
+
+static void test_trace_hook(void* ctx, enum tr31_trace_stage_t stage, uint64_t start_ns, uint64_t end_ns)
+{
+	struct test_trace_t* trace = ctx;
+
+	if (trace->count >= TEST_MAX_EVENTS) {
+		// record overflow as an invalid event
+		trace->events[TEST_MAX_EVENTS - 1].stage = TR31_TRACE_STAGE_COUNT;
+		return;
+	}
+	trace->events[trace->count].stage = stage;
+	trace->events[trace->count].start_ns = start_ns;
+	trace->events[trace->count].end_ns = end_ns;
+	trace->count++;
+}
+
+static int test_check_trace(
+	const char* name,
+	const struct test_trace_t* trace,
+	enum tr31_trace_stage_t outer_stage,
+	const enum tr31_trace_stage_t* stages,
+	size_t stages_count
+)
+{
+	const struct test_trace_event_t* outer;
+
+	if (!trace->count) {
+		fprintf(stderr, "%s: no stages reported\n", name);
+		return 1;
+	}
+
+	// outer stage is reported last because it completes last
+	outer = &trace->events[trace->count - 1];
+	if (outer->stage != outer_stage) {
+		fprintf(stderr, "%s: last stage is %d; expected %d\n", name, outer->stage, outer_stage);
+		return 1;
+	}
+
+	// all other stages must be nested within the outer stage
+	for (size_t i = 0; i < trace->count; ++i) {
+		const struct test_trace_event_t* event = &trace->events[i];
+
+		if (event->stage >= TR31_TRACE_STAGE_COUNT) {
+			fprintf(stderr, "%s: invalid stage %d\n", name, event->stage);
+			return 1;
+		}
+		if (event->start_ns > event->end_ns) {
+			fprintf(stderr, "%s: stage %d ends before it starts\n", name, event->stage);
+			return 1;
+		}
+		if (event->start_ns < outer->start_ns || event->end_ns > outer->end_ns) {
+			fprintf(stderr, "%s: stage %d is not nested within stage %d\n", name, event->stage, outer_stage);
+			return 1;
+		}
+		if (i != trace->count - 1 && event->stage == outer_stage) {
+			fprintf(stderr, "%s: stage %d reported more than once\n", name, outer_stage);
+			return 1;
+		}
+	}
+
+	// each expected stage must be reported exactly once
+	for (size_t i = 0; i < stages_count; ++i) {
+		size_t count = 0;
+
+		for (size_t j = 0; j < trace->count; ++j) {
+			if (trace->events[j].stage == stages[i]) {
+				++count;
+			}
+		}
+		if (count != 1) {
+			fprintf(stderr, "%s: stage %d reported %zu times; expected once\n", name, stages[i], count);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int r;
+	struct tr31_key_t kbpk;
+	struct tr31_ctx_t tr31;
+	char key_block[1024];
+	bool tr31_valid = false;
+
+	r = tr31_set_trace_hook(&test_trace_hook, &test_trace);
+	if (r) {
+		// tracing was not enabled when the library was built
+		printf("Tracing not available; skipping tests\n");
+		return 0;
+	}
+
+	for (size_t i = 0; i < sizeof(test_corpus) / sizeof(test_corpus[0]); ++i) {
+		const struct test_corpus_t* entry = &test_corpus[i];
+
+		printf("Test %zu (%s)...\n", i + 1, entry->name);
+
+		// populate key block protection key without tracing KCV computation
+		memset(&kbpk, 0, sizeof(kbpk));
+		kbpk.usage = TR31_KEY_USAGE_KEK;
+		kbpk.algorithm = entry->kbpk_algorithm;
+		kbpk.mode_of_use = TR31_KEY_MODE_OF_USE_ENC_DEC;
+		kbpk.length = entry->kbpk_len;
+		kbpk.data = (void*)entry->kbpk;
+
+		// import without key block protection key
+		memset(&test_trace, 0, sizeof(test_trace));
+		r = tr31_import(entry->key_block, strlen(entry->key_block), NULL, 0, &tr31);
+		if (r) {
+			fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		tr31_release(&tr31);
+		r = test_check_trace(
+			entry->name,
+			&test_trace,
+			TR31_TRACE_STAGE_IMPORT,
+			test_import_no_kbpk_stages,
+			sizeof(test_import_no_kbpk_stages) / sizeof(test_import_no_kbpk_stages[0])
+		);
+		if (r) {
+			goto exit;
+		}
+
+		// import with key block protection key and without KCV computation
+		memset(&test_trace, 0, sizeof(test_trace));
+		r = tr31_import(entry->key_block, strlen(entry->key_block), &kbpk, 0, &tr31);
+		if (r) {
+			fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		tr31_release(&tr31);
+		r = test_check_trace(
+			entry->name,
+			&test_trace,
+			TR31_TRACE_STAGE_IMPORT,
+			test_import_no_kcv_stages,
+			sizeof(test_import_no_kcv_stages) / sizeof(test_import_no_kcv_stages[0])
+		);
+		if (r) {
+			goto exit;
+		}
+
+		// import with key block protection key and KCV computation
+		memset(&test_trace, 0, sizeof(test_trace));
+		r = tr31_import(entry->key_block, strlen(entry->key_block), &kbpk, TR31_IMPORT_COMPUTE_KCV, &tr31);
+		if (r) {
+			fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		tr31_valid = true;
+		r = test_check_trace(
+			entry->name,
+			&test_trace,
+			TR31_TRACE_STAGE_IMPORT,
+			test_import_stages,
+			sizeof(test_import_stages) / sizeof(test_import_stages[0])
+		);
+		if (r) {
+			goto exit;
+		}
+
+		// export
+		memset(&test_trace, 0, sizeof(test_trace));
+		r = tr31_export(&tr31, &kbpk, 0, key_block, sizeof(key_block));
+		if (r) {
+			fprintf(stderr, "tr31_export() error %d: %s\n", r, tr31_get_error_string(r));
+			r = 1;
+			goto exit;
+		}
+		r = test_check_trace(
+			entry->name,
+			&test_trace,
+			TR31_TRACE_STAGE_EXPORT,
+			test_export_stages,
+			sizeof(test_export_stages) / sizeof(test_export_stages[0])
+		);
+		if (r) {
+			goto exit;
+		}
+
+		tr31_release(&tr31);
+		tr31_valid = false;
+		printf("Test %zu (%s) success\n", i + 1, entry->name);
+	}
+
+	// no stages may be reported after the trace hook is removed
+	printf("Test %zu (trace hook removed)...\n", sizeof(test_corpus) / sizeof(test_corpus[0]) + 1);
+	tr31_set_trace_hook(NULL, NULL);
+	memset(&test_trace, 0, sizeof(test_trace));
+	r = tr31_import(test1_tr31_format_b, strlen(test1_tr31_format_b), NULL, 0, &tr31);
+	if (r) {
+		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	tr31_release(&tr31);
+	if (test_trace.count) {
+		fprintf(stderr, "%zu stages reported after trace hook was removed\n", test_trace.count);
+		r = 1;
+		goto exit;
+	}
+	printf("Test %zu (trace hook removed) success\n", sizeof(test_corpus) / sizeof(test_corpus[0]) + 1);
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	if (tr31_valid) {
+		tr31_release(&tr31);
+	}
+	tr31_set_trace_hook(NULL, NULL);
+	return r;
+}
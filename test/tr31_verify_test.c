@@ -0,0 +1,204 @@
+/**
+ * @file tr31_verify_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// example data generated using a Thales payShield 10k HSM
+static const uint8_t test1_kbpk[] = { 0xEF, 0xE0, 0x85, 0x3B, 0x25, 0x6B, 0x58, 0x3D, 0x86, 0x8F, 0x25, 0x1C, 0xE9, 0x9E, 0xA1, 0xD9 };
+static const char test1_tr31_format_a[] = "A0072K0TN00N0000F40D5672C6D0EC86F860BA88D44D00F0CA9A8CE8CD2F640287A9A9EB";
+static const char test1_tr31_format_b[] = "B0080K0TN00N00001C414014375212C24995E405B5EE052CB92B67F455EA2680F6751088F9F1C228";
+static const char test1_tr31_format_c[] = "C0072K0TN00N0000C9B875FF7A5316BF221C09ED52080DE0B45632A4EA9CE87699CB565E";
+
+// TR-31:2018, A.7.4
+static const uint8_t test2_kbpk[] = {
+	0x88, 0xE1, 0xAB, 0x2A, 0x2E, 0x3D, 0xD3, 0x8C, 0x1F, 0xA0, 0x39, 0xA5, 0x36, 0x50, 0x0C, 0xC8,
+	0xA8, 0x7A, 0xB9, 0xD6, 0x2D, 0xC9, 0x2C, 0x01, 0x05, 0x8F, 0xA7, 0x9F, 0x44, 0x65, 0x7D, 0xE6,
+};
+static const char test2_tr31_format_d[] = "D0112P0AE00E0000B82679114F470F540165EDFBF7E250FCEA43F810D215F8D207E2E417C07156A27E8E31DA05F7425509593D03A457DC34";
+
+// ISO 20038:2017, B.2
+static const uint8_t test3_kbpk[] = {
+	0x32, 0x35, 0x36, 0x2D, 0x62, 0x69, 0x74, 0x20, 0x41, 0x45, 0x53, 0x20, 0x77, 0x72, 0x61, 0x70,
+	0x70, 0x69, 0x6E, 0x67, 0x20, 0x28, 0x49, 0x53, 0x4F, 0x20, 0x32, 0x30, 0x30, 0x33, 0x38, 0x29,
+};
+static const char test3_tr31_format_e[] = "E0084B0TV16N0000B2AE5E26BBA7F246E84D5EA24167E208A6B66EF2E27E55A52DB52F0AEACB94C57547";
+
+static size_t alloc_count = 0;
+
+static void* test_malloc(void* ctx, size_t size)
+{
+	(void)ctx;
+	++alloc_count;
+	return malloc(size);
+}
+
+static void* test_realloc(void* ctx, void* ptr, size_t size)
+{
+	(void)ctx;
+	++alloc_count;
+	return realloc(ptr, size);
+}
+
+static void test_free(void* ctx, void* ptr)
+{
+	(void)ctx;
+	free(ptr);
+}
+
+static int test_verify(
+	const char* name,
+	const char* key_block,
+	unsigned int kbpk_algorithm,
+	const uint8_t* kbpk_data,
+	size_t kbpk_len
+)
+{
+	int r;
+	struct tr31_key_t kbpk;
+	struct tr31_ctx_t tr31_ctx;
+	size_t import_alloc_count;
+	size_t verify_alloc_count;
+	char tampered[256];
+	size_t key_block_len = strlen(key_block);
+
+	printf("Test %s...\n", name);
+
+	r = tr31_key_init(
+		TR31_KEY_USAGE_TR31_KBPK,
+		kbpk_algorithm,
+		TR31_KEY_MODE_OF_USE_ENC_DEC,
+		"00",
+		TR31_KEY_EXPORT_NONE,
+		TR31_KEY_CONTEXT_NONE,
+		kbpk_data,
+		kbpk_len,
+		&kbpk
+	);
+	if (r) {
+		fprintf(stderr, "tr31_key_init() error %d: %s\n", r, tr31_get_error_string(r));
+		return 1;
+	}
+
+	// count allocations by key block import, for comparison
+	memset(&tr31_ctx, 0, sizeof(tr31_ctx));
+	alloc_count = 0;
+	r = tr31_import(key_block, key_block_len, &kbpk, 0, &tr31_ctx);
+	tr31_release(&tr31_ctx);
+	import_alloc_count = alloc_count;
+	if (r) {
+		fprintf(stderr, "tr31_import() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+
+	// verification must not extract the key data
+	alloc_count = 0;
+	r = tr31_verify(key_block, key_block_len, &kbpk, 0);
+	verify_alloc_count = alloc_count;
+	if (r) {
+		fprintf(stderr, "tr31_verify() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	if (verify_alloc_count >= import_alloc_count) {
+		fprintf(stderr, "tr31_verify() allocations not fewer than tr31_import(); verify=%zu; import=%zu\n",
+			verify_alloc_count,
+			import_alloc_count
+		);
+		r = 1;
+		goto exit;
+	}
+
+	// tamper with key version field in key block header; tampering with the
+	// authenticator may instead result in an invalid key length because the
+	// authenticator is used as the IV for some format versions
+	memcpy(tampered, key_block, key_block_len);
+	tampered[9] = tampered[9] == '0' ? '1' : '0';
+	r = tr31_verify(tampered, key_block_len, &kbpk, 0);
+	if (r != TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED) {
+		fprintf(stderr, "tr31_verify() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+
+	printf("Test %s success\n", name);
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_key_release(&kbpk);
+	return r;
+}
+
+int main(void)
+{
+	int r;
+	struct tr31_allocator_t allocator = {
+		.malloc_func = &test_malloc,
+		.realloc_func = &test_realloc,
+		.free_func = &test_free,
+		.ctx = NULL,
+	};
+
+	tr31_set_allocator(&allocator);
+
+	r = test_verify("1 (format version A)", test1_tr31_format_a, TR31_KEY_ALGORITHM_TDES, test1_kbpk, sizeof(test1_kbpk));
+	if (r) {
+		goto exit;
+	}
+	r = test_verify("2 (format version B)", test1_tr31_format_b, TR31_KEY_ALGORITHM_TDES, test1_kbpk, sizeof(test1_kbpk));
+	if (r) {
+		goto exit;
+	}
+	r = test_verify("3 (format version C)", test1_tr31_format_c, TR31_KEY_ALGORITHM_TDES, test1_kbpk, sizeof(test1_kbpk));
+	if (r) {
+		goto exit;
+	}
+	r = test_verify("4 (format version D)", test2_tr31_format_d, TR31_KEY_ALGORITHM_AES, test2_kbpk, sizeof(test2_kbpk));
+	if (r) {
+		goto exit;
+	}
+	r = test_verify("5 (format version E)", test3_tr31_format_e, TR31_KEY_ALGORITHM_AES, test3_kbpk, sizeof(test3_kbpk));
+	if (r) {
+		goto exit;
+	}
+
+	printf("Test 6 (missing key block protection key)...\n");
+	r = tr31_verify(test1_tr31_format_b, strlen(test1_tr31_format_b), NULL, 0);
+	if (r >= 0) {
+		fprintf(stderr, "tr31_verify() did not fail as expected; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 6 (missing key block protection key) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	tr31_set_allocator(NULL);
+	return r;
+}
@@ -0,0 +1,281 @@
+/**
+ * @file tr31d_shm_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+#include "tr31d.h"
+#include "tr31d-shm.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const char test_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const char test_kbpk_file_data[] =
+	"AB2E09DB3EF0BA71E0CE6CD755C23A3B\n"
+	"4141414141414141414141414141414141414141414141414141414141414141\n";
+static const uint8_t test_key_data[] = { 0xBF, 0x82, 0xDA, 0xC6, 0xA3, 0x3D, 0xF9, 0x2C, 0xE6, 0x6E, 0x15, 0xB7, 0x0E, 0x5D, 0xCE, 0xB6 };
+static const char test_export_header[] = "D0000P0AE00E0000";
+
+static int test_shm_contains(const struct tr31d_shm_t* shm, const void* data, size_t len)
+{
+	const uint8_t* ptr = (const uint8_t*)shm->hdr;
+
+	for (size_t i = 0; i + len <= shm->size; ++i) {
+		if (memcmp(ptr + i, data, len) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	int r;
+	char dir_template[] = "/tmp/tr31d_shm_testXXXXXX";
+	char* dir = NULL;
+	char kbpk_file_path[256];
+	char socket_path[256];
+	FILE* file;
+	pid_t pid = -1;
+	struct tr31d_shm_client_t client = { .fd = -1 };
+	struct tr31_ctx_t tr31;
+	char key_block[256];
+	unsigned int submitted;
+	unsigned int completed;
+	int status;
+	struct stat st;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <tr31d>\n", argv[0]);
+		return 1;
+	}
+
+	dir = mkdtemp(dir_template);
+	if (!dir) {
+		fprintf(stderr, "mkdtemp() failed: %s\n", strerror(errno));
+		return 1;
+	}
+	snprintf(kbpk_file_path, sizeof(kbpk_file_path), "%s/kbpk.txt", dir);
+	snprintf(socket_path, sizeof(socket_path), "%s/tr31d.sock", dir);
+
+	file = fopen(kbpk_file_path, "wb");
+	if (!file) {
+		fprintf(stderr, "fopen() failed: %s\n", strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	fwrite(test_kbpk_file_data, 1, sizeof(test_kbpk_file_data) - 1, file);
+	fclose(file);
+
+	printf("Test 1 (attach shared memory rings)...\n");
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "fork() failed: %s\n", strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	if (pid == 0) {
+		execl(argv[1], argv[1], "--socket", socket_path, "--kbpk-file", kbpk_file_path, "--threads", "1", (char*)NULL);
+		fprintf(stderr, "execl() failed: %s\n", strerror(errno));
+		_exit(127);
+	}
+
+	// retry until the daemon is listening
+	for (unsigned int i = 0; i < 500; ++i) {
+		struct timespec delay = { 0, 10000000 }; // 10ms
+
+		r = tr31d_shm_client_open(socket_path, 8, &client);
+		if (r == 0) {
+			break;
+		}
+		nanosleep(&delay, NULL);
+	}
+	if (r) {
+		fprintf(stderr, "tr31d_shm_client_open() failed; r=%d\n", r);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 1 (attach shared memory rings) success\n");
+
+	printf("Test 2 (import and export)...\n");
+	r = tr31d_shm_import(&client, 0, test_key_block, strlen(test_key_block), 0, &tr31);
+	if (r) {
+		fprintf(stderr, "tr31d_shm_import() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	if (tr31.key.usage != TR31_KEY_USAGE_DUKPT_IK ||
+		tr31.key.length != sizeof(test_key_data) ||
+		memcmp(tr31.key.data, test_key_data, sizeof(test_key_data)) != 0 ||
+		tr31.opt_blocks_count != 3
+	) {
+		fprintf(stderr, "Imported key is incorrect\n");
+		tr31_release(&tr31);
+		r = 1;
+		goto exit;
+	}
+	tr31_release(&tr31);
+
+	r = tr31d_shm_export(
+		&client,
+		1,
+		test_export_header,
+		strlen(test_export_header),
+		test_key_data,
+		sizeof(test_key_data),
+		0,
+		key_block,
+		sizeof(key_block)
+	);
+	if (r) {
+		fprintf(stderr, "tr31d_shm_export() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	r = tr31d_shm_import(&client, 1, key_block, strlen(key_block), 0, &tr31);
+	if (r) {
+		fprintf(stderr, "tr31d_shm_import() error %d: %s\n", r, tr31_get_error_string(r));
+		r = 1;
+		goto exit;
+	}
+	if (tr31.key.length != sizeof(test_key_data) ||
+		memcmp(tr31.key.data, test_key_data, sizeof(test_key_data)) != 0
+	) {
+		fprintf(stderr, "Exported key is incorrect\n");
+		tr31_release(&tr31);
+		r = 1;
+		goto exit;
+	}
+	tr31_release(&tr31);
+
+	// cleartext keys must not remain in shared memory
+	if (test_shm_contains(&client.shm, test_key_data, sizeof(test_key_data))) {
+		fprintf(stderr, "Cleartext key remains in shared memory\n");
+		r = 1;
+		goto exit;
+	}
+
+	// incorrect KBPK
+	r = tr31d_shm_import(&client, 1, test_key_block, strlen(test_key_block), 0, &tr31);
+	if (r != TR31D_ERROR_INVALID_REQUEST) {
+		fprintf(stderr, "tr31d_shm_import() unexpected result %d\n", r);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 2 (import and export) success\n");
+
+	printf("Test 3 (pipelined requests across ring wrap-around)...\n");
+	submitted = 0;
+	completed = 0;
+	while (completed < 1000) {
+		const struct tr31d_shm_cqe_t* cqe;
+		struct tr31d_shm_sqe_t* sqe;
+
+		// fill all available submission queue entries before submitting
+		while (submitted < 1000 && (sqe = tr31d_shm_client_get_sqe(&client))) {
+			sqe->id = submitted;
+			sqe->op = TR31D_OP_IMPORT;
+			sqe->kbpk_index = 0;
+			sqe->import_flags = 0;
+			sqe->payload_len = strlen(test_key_block);
+			memcpy(sqe->payload, test_key_block, sqe->payload_len);
+			// corrupt every tenth key block
+			if (submitted % 10 == 9) {
+				sqe->payload[sqe->payload_len - 1] ^= 1;
+			}
+			++submitted;
+		}
+		tr31d_shm_client_submit(&client);
+
+		r = tr31d_shm_client_wait_cqe(&client, &cqe);
+		if (r) {
+			fprintf(stderr, "tr31d_shm_client_wait_cqe() failed; r=%d\n", r);
+			r = 1;
+			goto exit;
+		}
+		if (cqe->id != completed) {
+			fprintf(stderr, "Unexpected completion %u; expected %u\n", cqe->id, completed);
+			r = 1;
+			goto exit;
+		}
+		if (completed % 10 == 9) {
+			r = cqe->result != TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED;
+		} else {
+			r = cqe->result != 0 ||
+				cqe->payload_len != 4 + sizeof(test_key_data) ||
+				memcmp(cqe->payload + 4, test_key_data, sizeof(test_key_data)) != 0;
+		}
+		if (r) {
+			fprintf(stderr, "Completion %u is incorrect; result=%d\n", cqe->id, cqe->result);
+			r = 1;
+			goto exit;
+		}
+		tr31d_shm_client_cqe_seen(&client);
+		++completed;
+	}
+	printf("Test 3 (pipelined requests across ring wrap-around) success\n");
+
+	printf("Test 4 (detach and stop daemon)...\n");
+	tr31d_shm_client_close(&client);
+	kill(pid, SIGTERM);
+	if (waitpid(pid, &status, 0) != pid) {
+		fprintf(stderr, "waitpid() failed: %s\n", strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	pid = -1;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Daemon did not exit cleanly\n");
+		r = 1;
+		goto exit;
+	}
+	if (stat(socket_path, &st) == 0) {
+		fprintf(stderr, "Daemon did not remove socket\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 4 (detach and stop daemon) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	tr31d_shm_client_close(&client);
+	if (pid > 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+	unlink(socket_path);
+	unlink(kbpk_file_path);
+	rmdir(dir);
+
+	return r;
+}
@@ -0,0 +1,502 @@
+/**
+ * @file tr31d_test.c
+ *
+ * Copyright 2024 Leon Lynch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "tr31.h"
+#include "tr31d.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// TR-31:2018, A.7.3.2 with optional blocks KS, KC and KP
+static const char test_key_block[] = "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E5";
+static const char test_kbpk_file_data[] =
+	"AB2E09DB3EF0BA71E0CE6CD755C23A3B\n"
+	"4141414141414141414141414141414141414141414141414141414141414141\n";
+static const uint8_t test_key_data[] = { 0xBF, 0x82, 0xDA, 0xC6, 0xA3, 0x3D, 0xF9, 0x2C, 0xE6, 0x6E, 0x15, 0xB7, 0x0E, 0x5D, 0xCE, 0xB6 };
+static const uint8_t test_kcv[] = { 0x01, 0x69, 0xE3 };
+static const char test_export_header[] = "D0000P0AE00E0000";
+
+#define TEST_STALL_REQ_COUNT (100000) // upper bound of requests sent by client that does not read responses
+#define TEST_TIMEOUT_S (10)
+
+struct test_resp_t {
+	uint32_t id;
+	int32_t result;
+	size_t payload_len;
+	uint8_t payload[TR31D_MAX_PAYLOAD_LEN];
+};
+
+static int send_request(
+	int fd,
+	uint32_t id,
+	uint8_t op,
+	uint8_t version,
+	uint8_t kbpk_index,
+	uint8_t kbpk_new_index,
+	const void* payload,
+	size_t payload_len
+)
+{
+	uint8_t buf[TR31D_REQ_HEADER_LEN + 256];
+	uint32_t value;
+
+	if (payload_len > sizeof(buf) - TR31D_REQ_HEADER_LEN) {
+		return -1;
+	}
+
+	value = htonl(TR31D_REQ_HEADER_LEN - 4 + payload_len);
+	memcpy(buf, &value, sizeof(value));
+	value = htonl(id);
+	memcpy(buf + 4, &value, sizeof(value));
+	buf[8] = op;
+	buf[9] = version;
+	buf[10] = kbpk_index;
+	buf[11] = kbpk_new_index;
+	memset(buf + 12, 0, 4); // no import or export flags
+	if (payload_len) {
+		memcpy(buf + TR31D_REQ_HEADER_LEN, payload, payload_len);
+	}
+
+	if (write(fd, buf, TR31D_REQ_HEADER_LEN + payload_len) != (ssize_t)(TR31D_REQ_HEADER_LEN + payload_len)) {
+		return -1;
+	}
+	return 0;
+}
+
+static int read_full(int fd, void* buf, size_t len)
+{
+	uint8_t* ptr = buf;
+
+	while (len) {
+		ssize_t r = read(fd, ptr, len);
+		if (r <= 0) {
+			return -1;
+		}
+		ptr += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static int read_response(int fd, struct test_resp_t* resp)
+{
+	uint8_t hdr[TR31D_RESP_HEADER_LEN];
+	uint32_t value;
+
+	if (read_full(fd, hdr, sizeof(hdr))) {
+		return -1;
+	}
+	memcpy(&value, hdr, sizeof(value));
+	value = ntohl(value);
+	if (value < TR31D_RESP_HEADER_LEN - 4 || value - (TR31D_RESP_HEADER_LEN - 4) > TR31D_MAX_PAYLOAD_LEN) {
+		return -1;
+	}
+	resp->payload_len = value - (TR31D_RESP_HEADER_LEN - 4);
+	memcpy(&value, hdr + 4, sizeof(value));
+	resp->id = ntohl(value);
+	memcpy(&value, hdr + 8, sizeof(value));
+	resp->result = (int32_t)ntohl(value);
+
+	return read_full(fd, resp->payload, resp->payload_len);
+}
+
+static int connect_daemon(const char* socket_path)
+{
+	int fd;
+	struct sockaddr_un addr;
+	struct timeval timeout = { .tv_sec = TEST_TIMEOUT_S };
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	// daemon must respond in time instead of hanging the test
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	return fd;
+}
+
+int main(int argc, char** argv)
+{
+	int r;
+	char dir_template[] = "/tmp/tr31d_testXXXXXX";
+	char* dir = NULL;
+	char kbpk_file_path[256];
+	char socket_path[256];
+	FILE* file;
+	pid_t pid = -1;
+	int fd = -1;
+	int fd_other = -1;
+	int stall_fd = -1;
+	struct sockaddr_un addr;
+	uint8_t export_payload[64];
+	size_t export_payload_len;
+	struct test_resp_t resp;
+	unsigned int resp_mask = 0;
+	char exported_key_block[256] = { 0 };
+	char rewrapped_key_block[256] = { 0 };
+	int status;
+	struct stat st;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <tr31d>\n", argv[0]);
+		return 1;
+	}
+
+	dir = mkdtemp(dir_template);
+	if (!dir) {
+		fprintf(stderr, "mkdtemp() failed: %s\n", strerror(errno));
+		return 1;
+	}
+	snprintf(kbpk_file_path, sizeof(kbpk_file_path), "%s/kbpk.txt", dir);
+	snprintf(socket_path, sizeof(socket_path), "%s/tr31d.sock", dir);
+
+	file = fopen(kbpk_file_path, "wb");
+	if (!file) {
+		fprintf(stderr, "fopen() failed: %s\n", strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	fwrite(test_kbpk_file_data, 1, sizeof(test_kbpk_file_data) - 1, file);
+	fclose(file);
+
+	printf("Test 1 (start daemon)...\n");
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "fork() failed: %s\n", strerror(errno));
+		r = 1;
+		goto exit;
+	}
+	if (pid == 0) {
+		execl(argv[1], argv[1], "--socket", socket_path, "--kbpk-file", kbpk_file_path, "--threads", "2", "--write-timeout", "500", (char*)NULL);
+		fprintf(stderr, "execl() failed: %s\n", strerror(errno));
+		_exit(127);
+	}
+
+	// connect and retry until the daemon is listening
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path is too long\n");
+		r = 1;
+		goto exit;
+	}
+	memcpy(addr.sun_path, socket_path, strlen(socket_path) + 1);
+	for (unsigned int i = 0; i < 500; ++i) {
+		struct timespec delay = { 0, 10000000 }; // 10ms
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) {
+			fprintf(stderr, "socket() failed: %s\n", strerror(errno));
+			r = 1;
+			goto exit;
+		}
+		if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+		nanosleep(&delay, NULL);
+	}
+	if (fd < 0) {
+		fprintf(stderr, "Failed to connect to daemon\n");
+		r = 1;
+		goto exit;
+	}
+	if (stat(socket_path, &st) || (st.st_mode & 0077)) {
+		fprintf(stderr, "Socket is accessible by other users\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 1 (start daemon) success\n");
+
+	printf("Test 2 (pipelined requests)...\n");
+	export_payload[0] = 0;
+	export_payload[1] = strlen(test_export_header);
+	memcpy(export_payload + 2, test_export_header, strlen(test_export_header));
+	memcpy(export_payload + 2 + strlen(test_export_header), test_key_data, sizeof(test_key_data));
+	export_payload_len = 2 + strlen(test_export_header) + sizeof(test_key_data);
+	r = send_request(fd, 1, TR31D_OP_IMPORT, 0, 0, 0, test_key_block, strlen(test_key_block));
+	r |= send_request(fd, 2, TR31D_OP_IMPORT, 0, 0, 0, "B0128B1TX00N0300KS18FFFF00A0200001E00000KC0C000169E3KP0C00ECAD626F9F1A826814AA066D86C8C18BD0E14033E1EBEC75BEDF586E6E325F3AA8C0E6", strlen(test_key_block));
+	r |= send_request(fd, 3, TR31D_OP_EXPORT, 0, 1, 0, export_payload, export_payload_len);
+	r |= send_request(fd, 4, TR31D_OP_REWRAP, TR31_VERSION_D, 0, 1, test_key_block, strlen(test_key_block));
+	r |= send_request(fd, 5, TR31D_OP_IMPORT, 0, 7, 0, test_key_block, strlen(test_key_block));
+	r |= send_request(fd, 6, 0xFF, 0, 0, 0, NULL, 0);
+	if (r) {
+		fprintf(stderr, "Failed to send requests\n");
+		r = 1;
+		goto exit;
+	}
+	for (unsigned int i = 0; i < 6; ++i) {
+		r = read_response(fd, &resp);
+		if (r) {
+			fprintf(stderr, "Failed to read response\n");
+			r = 1;
+			goto exit;
+		}
+		if (resp.id < 1 || resp.id > 6 || (resp_mask & (1 << resp.id))) {
+			fprintf(stderr, "Unexpected response ID %u\n", resp.id);
+			r = 1;
+			goto exit;
+		}
+		resp_mask |= 1 << resp.id;
+
+		switch (resp.id) {
+			case 1:
+				if (resp.result != 0 ||
+					resp.payload_len != 1 + sizeof(test_kcv) + sizeof(test_key_data) ||
+					resp.payload[0] != sizeof(test_kcv) ||
+					memcmp(resp.payload + 1, test_kcv, sizeof(test_kcv)) != 0 ||
+					memcmp(resp.payload + 1 + sizeof(test_kcv), test_key_data, sizeof(test_key_data)) != 0
+				) {
+					fprintf(stderr, "Import response is incorrect; result=%d\n", resp.result);
+					r = 1;
+					goto exit;
+				}
+				break;
+
+			case 2:
+				if (resp.result != TR31_ERROR_KEY_BLOCK_VERIFICATION_FAILED || resp.payload_len) {
+					fprintf(stderr, "Corrupt import response is incorrect; result=%d\n", resp.result);
+					r = 1;
+					goto exit;
+				}
+				break;
+
+			case 3:
+				if (resp.result != 0 || !resp.payload_len || resp.payload_len >= sizeof(exported_key_block)) {
+					fprintf(stderr, "Export response is incorrect; result=%d\n", resp.result);
+					r = 1;
+					goto exit;
+				}
+				memcpy(exported_key_block, resp.payload, resp.payload_len);
+				break;
+
+			case 4:
+				if (resp.result != 0 || !resp.payload_len || resp.payload_len >= sizeof(rewrapped_key_block)) {
+					fprintf(stderr, "Re-wrap response is incorrect; result=%d\n", resp.result);
+					r = 1;
+					goto exit;
+				}
+				memcpy(rewrapped_key_block, resp.payload, resp.payload_len);
+				break;
+
+			case 5:
+			case 6:
+				if (resp.result != TR31D_ERROR_INVALID_REQUEST || resp.payload_len) {
+					fprintf(stderr, "Invalid request response is incorrect; result=%d\n", resp.result);
+					r = 1;
+					goto exit;
+				}
+				break;
+		}
+	}
+	printf("Test 2 (pipelined requests) success\n");
+
+	printf("Test 3 (round trip using daemon)...\n");
+	if (exported_key_block[0] != 'D' || rewrapped_key_block[0] != 'D') {
+		fprintf(stderr, "Key block format version is incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	r = send_request(fd, 7, TR31D_OP_IMPORT, 0, 1, 0, exported_key_block, strlen(exported_key_block));
+	r |= read_response(fd, &resp);
+	if (r || resp.id != 7 || resp.result != 0 ||
+		resp.payload_len < sizeof(test_key_data) ||
+		memcmp(resp.payload + resp.payload_len - sizeof(test_key_data), test_key_data, sizeof(test_key_data)) != 0
+	) {
+		fprintf(stderr, "Import of exported key block failed; result=%d\n", resp.result);
+		r = 1;
+		goto exit;
+	}
+	r = send_request(fd, 8, TR31D_OP_IMPORT, 0, 1, 0, rewrapped_key_block, strlen(rewrapped_key_block));
+	r |= read_response(fd, &resp);
+	if (r || resp.id != 8 || resp.result != 0 ||
+		resp.payload_len < sizeof(test_key_data) ||
+		memcmp(resp.payload + resp.payload_len - sizeof(test_key_data), test_key_data, sizeof(test_key_data)) != 0
+	) {
+		fprintf(stderr, "Import of re-wrapped key block failed; result=%d\n", resp.result);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 3 (round trip using daemon) success\n");
+
+	printf("Test 4 (statistics)...\n");
+	r = send_request(fd, 9, TR31D_OP_STATS, 0, 0, 0, NULL, 0);
+	r |= read_response(fd, &resp);
+	if (r || resp.id != 9 || resp.result != 0 || !resp.payload_len) {
+		fprintf(stderr, "Statistics request failed; result=%d\n", resp.result);
+		r = 1;
+		goto exit;
+	}
+	resp.payload[resp.payload_len < sizeof(resp.payload) ? resp.payload_len : sizeof(resp.payload) - 1] = 0;
+	printf("%s", (const char*)resp.payload);
+	if (!strstr((const char*)resp.payload, "import") ||
+		!strstr((const char*)resp.payload, "rewrap")
+	) {
+		fprintf(stderr, "Statistics are incorrect\n");
+		r = 1;
+		goto exit;
+	}
+	r = send_request(fd, 10, TR31D_OP_METRICS, 0, 0, 0, NULL, 0);
+	r |= read_response(fd, &resp);
+	if (r || resp.id != 10 || resp.result != 0 || !resp.payload_len) {
+		fprintf(stderr, "Metrics request failed; result=%d\n", resp.result);
+		r = 1;
+		goto exit;
+	}
+	resp.payload[resp.payload_len < sizeof(resp.payload) ? resp.payload_len : sizeof(resp.payload) - 1] = 0;
+	if (!strstr((const char*)resp.payload, "# TYPE tr31_imports_total counter\n") ||
+		!strstr((const char*)resp.payload, "tr31_imports_total{version=\"B\"} 2\n") ||
+		!strstr((const char*)resp.payload, "tr31_imports_total{version=\"D\"} 2\n") ||
+		!strstr((const char*)resp.payload, "tr31_exports_total{version=\"D\"} 2\n") ||
+		!strstr((const char*)resp.payload, "tr31_errors_total{error=\"key_block_verification_failed\"} 1\n")
+	) {
+		fprintf(stderr, "Metrics are incorrect:\n%s", (const char*)resp.payload);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 4 (statistics) success\n");
+
+	printf("Test 5 (client that does not read responses)...\n");
+	stall_fd = connect_daemon(socket_path);
+	if (stall_fd < 0) {
+		fprintf(stderr, "Failed to connect to daemon\n");
+		r = 1;
+		goto exit;
+	}
+	// pipeline metrics requests, which have large responses, until the
+	// socket is full or the daemon closes the connection
+	for (unsigned int i = 0; i < TEST_STALL_REQ_COUNT; ++i) {
+		uint8_t hdr[TR31D_REQ_HEADER_LEN] = { 0 };
+		uint32_t value;
+
+		value = htonl(TR31D_REQ_HEADER_LEN - 4);
+		memcpy(hdr, &value, sizeof(value));
+		value = htonl(100 + i);
+		memcpy(hdr + 4, &value, sizeof(value));
+		hdr[8] = TR31D_OP_METRICS;
+		if (send(stall_fd, hdr, sizeof(hdr), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(hdr)) {
+			break;
+		}
+	}
+	// other clients must still be served
+	fd_other = connect_daemon(socket_path);
+	if (fd_other < 0) {
+		fprintf(stderr, "Failed to connect to daemon\n");
+		r = 1;
+		goto exit;
+	}
+	r = send_request(fd_other, 11, TR31D_OP_IMPORT, 0, 0, 0, test_key_block, strlen(test_key_block));
+	r |= read_response(fd_other, &resp);
+	if (r || resp.id != 11 || resp.result != 0 ||
+		resp.payload_len < sizeof(test_key_data) ||
+		memcmp(resp.payload + resp.payload_len - sizeof(test_key_data), test_key_data, sizeof(test_key_data)) != 0
+	) {
+		fprintf(stderr, "Import failed while other client is stalled; result=%d\n", resp.result);
+		r = 1;
+		goto exit;
+	}
+	printf("Test 5 (client that does not read responses) success\n");
+
+	printf("Test 6 (stop daemon)...\n");
+	close(fd);
+	fd = -1;
+	close(fd_other);
+	fd_other = -1;
+	// stalled client remains connected and must not prevent shutdown
+	kill(pid, SIGTERM);
+	for (unsigned int i = 0; i < TEST_TIMEOUT_S * 100; ++i) {
+		struct timespec delay = { 0, 10000000 }; // 10ms
+		pid_t wait_pid;
+
+		wait_pid = waitpid(pid, &status, WNOHANG);
+		if (wait_pid == pid) {
+			pid = -1;
+			break;
+		}
+		if (wait_pid < 0) {
+			fprintf(stderr, "waitpid() failed: %s\n", strerror(errno));
+			r = 1;
+			goto exit;
+		}
+		nanosleep(&delay, NULL);
+	}
+	if (pid > 0) {
+		fprintf(stderr, "Daemon did not exit\n");
+		r = 1;
+		goto exit;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Daemon did not exit cleanly\n");
+		r = 1;
+		goto exit;
+	}
+	if (stat(socket_path, &st) == 0) {
+		fprintf(stderr, "Daemon did not remove socket\n");
+		r = 1;
+		goto exit;
+	}
+	printf("Test 6 (stop daemon) success\n");
+
+	printf("All tests passed.\n");
+	r = 0;
+	goto exit;
+
+exit:
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (fd_other >= 0) {
+		close(fd_other);
+	}
+	if (stall_fd >= 0) {
+		close(stall_fd);
+	}
+	if (pid > 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+	unlink(socket_path);
+	unlink(kbpk_file_path);
+	rmdir(dir);
+
+	return r;
+}